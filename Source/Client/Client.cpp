@@ -12,10 +12,27 @@
  * under the License.
  */
 
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+
 #include <SDL_events.h>
 
 #include <Core/CommandLine.h>
 #include <Core/Debug.h>
+#include <Core/Encoding.h>
+#include <Core/IO/Codec/Pack.h>
+#include <Core/IO/Codec/Zip.h>
+#include <Core/IO/FileWatcher.h>
+#include <Core/IO/MappedFile.h>
+#include <Core/IO/VirtualFileSystem.h>
+#include <Core/LogSink.h>
+#include <Core/Profiler.h>
+#include <Core/StringUtils.h>
+#include <Core/System.h>
 #include <Render/System.h>
 
 #include "Client.h"
@@ -48,12 +65,134 @@ namespace {
                 }
                 clientParams.dataDir = param;
                 return true;
+            } else if (option == OSSTR("verify-archives")) {
+                clientParams.verifyArchives = true;
+                return true;
+            } else if (option == OSSTR("hot-reload")) {
+                clientParams.hotReload = true;
+                return true;
+            } else if (option == OSSTR("async-log")) {
+                // Optional parameter: --async-log=drop or --async-log=block
+                clientParams.asyncLog = true;
+                if (!parser.HasParam()) {
+                    return true;
+                }
+                OsStringView param = parser.GetParam();
+                if (param == OSSTR("drop")) {
+                    clientParams.asyncLoggerParams.overflowPolicy = LogOverflowPolicy::Drop;
+                } else if (param == OSSTR("block")) {
+                    clientParams.asyncLoggerParams.overflowPolicy = LogOverflowPolicy::Block;
+                } else {
+                    FATAL("Invalid parameter for --async-log: {}", param);
+                }
+                return true;
+            } else if (option == OSSTR("log-level")) {
+                auto param = parser.GetParam();
+                std::string error;
+                if (!param) {
+                    FATAL("Missing parameter for --log-level");
+                } else if (!Debug::SetLogLevels(param, Out{error})) {
+                    FATAL("Invalid parameter for --log-level: {}", error);
+                }
+                return true;
+            } else if (option == OSSTR("deferred-log")) {
+                clientParams.deferredLog = true;
+                return true;
+            } else if (option == OSSTR("log-json")) {
+                auto param = parser.GetParam();
+                if (!param) {
+                    FATAL("Missing parameter for --log-json");
+                }
+                clientParams.jsonLogPath = param;
+                return true;
+            } else if (option == OSSTR("log-binary")) {
+                auto param = parser.GetParam();
+                if (!param) {
+                    FATAL("Missing parameter for --log-binary");
+                }
+                clientParams.binaryLogPath = param;
+                return true;
+            } else if (option == OSSTR("profile")) {
+                // Chrome trace event format if the file name ends with .json, or else binary
+                auto param = parser.GetParam();
+                if (!param) {
+                    FATAL("Missing parameter for --profile");
+                }
+                clientParams.profilePath = param;
+                return true;
+            } else if (option == OSSTR("flight-recorder")) {
+                auto param = parser.GetParam();
+                if (!param) {
+                    FATAL("Missing parameter for --flight-recorder");
+                }
+                clientParams.flightRecorderPath = param;
+                return true;
+            } else if (option == OSSTR("frame-stats")) {
+                clientParams.frameStats = true;
+                return true;
+            } else if (option == OSSTR("benchmark")) {
+                auto param = parser.GetParam();
+                if (!param) {
+                    FATAL("Missing parameter for --benchmark");
+                } else if (!ParseInteger(param, Out{clientParams.benchmarkFrames}) || !clientParams.benchmarkFrames) {
+                    FATAL("Invalid parameter for --benchmark: {}", param);
+                }
+                return true;
+            } else if (option == OSSTR("benchmark-output")) {
+                auto param = parser.GetParam();
+                if (!param) {
+                    FATAL("Missing parameter for --benchmark-output");
+                }
+                clientParams.benchmarkOutputPath = param;
+                return true;
+            } else if (option == OSSTR("headless")) {
+                clientParams.headless = true;
+                return true;
             } else {
                 FATAL("Invalid option: --{}", option);
             }
         }
     };
 
+    // Log files are rotated so that a long session can't fill the disk.
+    constexpr uint64_t LogFileMaxSize = 64 << 20;
+    constexpr uint32_t LogFileMaxCount = 4;
+
+    // Opens a log file and adds it as a sink with its own thread, so that encoding and writing it
+    // doesn't slow down the threads that log.
+    void AddLogFileSink(std::unique_ptr<LogFileSink> sink, const OsString& path)
+    {
+        LogFileParams params;
+        std::string error;
+
+        params.path = path;
+        params.maxFileSize = LogFileMaxSize;
+        params.maxFileCount = LogFileMaxCount;
+
+        if (!sink->Open(params, Out{error})) {
+            LOG_WARNING("Can't open log file {}: {}", path, error);
+            return;
+        }
+
+        auto threadedSink = std::make_unique<ThreadedLogSink>(std::move(sink));
+        if (!threadedSink->Start(Out{error})) {
+            LOG_WARNING("Can't start log sink thread: {}", error);
+        }
+
+        Debug::AddLogSink(std::move(threadedSink));
+    }
+
+    // The character type comes from the suffix, which is always a literal, so 'str' can be any
+    // string or view of the same type.
+    template<typename CharT, typename StringT>
+    bool EndsWith(const StringT& str, const CharT* suffix)
+    {
+        std::basic_string_view<CharT> view{str};
+        std::basic_string_view<CharT> suffixView{suffix};
+
+        return view.size() >= suffixView.size() && view.substr(view.size() - suffixView.size()) == suffixView;
+    }
+
 } // namespace
 
 ClientParams ClientParams::FromCommandLine(int argc, const oschar_t* const* argv)
@@ -73,39 +212,272 @@ Client::~Client()
 {
 }
 
-void Client::Initialize(const ClientParams&)
+void Client::Initialize(const ClientParams& params)
 {
-    m_renderWindow = std::make_unique<RenderWindow>();
+    OsString flightRecorderPath = params.flightRecorderPath;
+    std::error_code error;
+
+    if (!params.profilePath.empty()) {
+        m_profilePath = params.profilePath;
+        Profiler::Start();
+    }
+
+    m_logFrameStats = params.frameStats;
+    m_benchmarkFrames = params.benchmarkFrames;
+    m_benchmarkOutputPath = params.benchmarkOutputPath;
+
+    PROFILE_SCOPE("Client::Initialize");
+
+    if (flightRecorderPath.empty() && System::GetCacheDirectory(Out{flightRecorderPath})) {
+        std::filesystem::create_directories(flightRecorderPath, error);
+        flightRecorderPath += OSSTR("/FlightRecorder.log");
+    }
+    Debug::SetFlightRecorderPath(std::move(flightRecorderPath));
+
+    if (!params.jsonLogPath.empty()) {
+        AddLogFileSink(std::make_unique<JsonLogFileSink>(), params.jsonLogPath);
+    }
+    if (!params.binaryLogPath.empty()) {
+        AddLogFileSink(std::make_unique<BinaryLogFileSink>(), params.binaryLogPath);
+    }
+
+    if (params.asyncLog) {
+        std::string error;
+        if (!Debug::StartAsyncLogger(params.asyncLoggerParams, Out{error})) {
+            LOG_WARNING("Can't start logger thread: {}", error);
+        }
+    }
+
+    if (params.deferredLog) {
+        std::string error;
+        if (!Debug::StartDeferredLogger(params.deferredLoggerParams, Out{error})) {
+            LOG_WARNING("Can't start deferred logger thread: {}", error);
+        }
+    }
+
+    MountDataSources(params);
+
+    // Benchmarks run as fast as possible, and there's nothing to look at yet anyway.
+    RenderWindowParams windowParams;
+    windowParams.vsync = !params.benchmarkFrames;
+    windowParams.hidden = params.benchmarkFrames || params.headless;
+    windowParams.headless = params.headless;
+    m_renderWindow = std::make_unique<RenderWindow>(windowParams);
     m_renderSystem = std::make_unique<RenderSystem>(*this);
 }
 
 void Client::Run()
 {
-    while (!IsQuitting()) {
-        HandleSdlEvents();
+    using Clock = std::chrono::steady_clock;
+
+    for (uint64_t frame = 0; !IsQuitting(); ++frame) {
+        if (m_benchmarkFrames && frame == m_benchmarkFrames) {
+            Quit();
+            break;
+        }
+
+        PROFILE_SCOPE("Frame");
+
+        Clock::time_point frameStart = Clock::now();
+        {
+            PROFILE_SCOPE("HandleSdlEvents");
+            HandleSdlEvents();
+        }
         if (IsQuitting()) {
             break;
         }
+        Clock::time_point eventsEnd = Clock::now();
+
+        if (m_fileWatcher) {
+            PROFILE_SCOPE("RefreshChangedFiles");
+            RefreshChangedFiles();
+        }
 
-        m_renderWindow->SwapBuffers();
+        Clock::time_point swapStart = Clock::now();
+        {
+            PROFILE_SCOPE("SwapBuffers");
+            m_renderWindow->SwapBuffers();
+        }
+        Clock::time_point frameEnd = Clock::now();
+
+        FrameTimings timings;
+        timings.total = std::chrono::duration_cast<std::chrono::nanoseconds>(frameEnd - frameStart);
+        timings.events = std::chrono::duration_cast<std::chrono::nanoseconds>(eventsEnd - frameStart);
+        timings.swap = std::chrono::duration_cast<std::chrono::nanoseconds>(frameEnd - swapStart);
+        m_frameStats.RecordFrame(frame, timings);
     }
 }
 
 void Client::ShutDown()
 {
+    if (m_logFrameStats) {
+        m_frameStats.LogSummary();
+    }
+    if (m_benchmarkFrames) {
+        WriteBenchmarkResults();
+    }
+
+    if (!m_profilePath.empty()) {
+        std::string error;
+        bool isWritten;
+
+        Profiler::Stop();
+        if (EndsWith(m_profilePath, OSSTR(".json"))) {
+            isWritten = Profiler::WriteChromeTrace(m_profilePath.c_str(), Out{error});
+        } else {
+            isWritten = Profiler::WriteBinaryTrace(m_profilePath.c_str(), Out{error});
+        }
+
+        if (!isWritten) {
+            LOG_WARNING("Can't write profile to {}: {}", m_profilePath, error);
+        }
+    }
+
     m_renderSystem.reset();
     m_renderWindow.reset();
+    m_fileWatcher.reset();
+    m_fileSystem = nullptr;
+    m_looseFiles = nullptr;
+    m_dataSource.reset();
+    Debug::StopDeferredLogger();
+    Debug::StopAsyncLogger();
+    Debug::RemoveLogSinks();
 }
 
 void* Client::GetService(const std::type_info& type)
 {
-    if (type == typeid(GlLoader)) {
+    if (type == typeid(DataSource)) {
+        return static_cast<DataSource*>(m_dataSource.get());
+    } else if (type == typeid(GlLoader)) {
         return static_cast<GlLoader*>(m_renderWindow.get());
     } else {
         return nullptr;
     }
 }
 
+void Client::MountDataSources(const ClientParams& params)
+{
+    PROFILE_SCOPE("Client::MountDataSources");
+
+    const OsString& dataDir = params.dataDir;
+    auto vfs = std::make_unique<VirtualFileSystem>();
+    auto looseFiles = std::make_unique<MappedFileSource>(dataDir);
+    std::vector<OsString> archiveNames;
+    ZipOpenParams zipParams;
+    std::string listError;
+    IoError error;
+
+    // Archives in the data directory are layered in name order, so "Assets.abpk" can be patched
+    // by e.g. "Assets.1.zip". Loose files override all archives. An archive that can't be read,
+    // e.g. a patch left half-downloaded, is skipped so that the rest of the data is still usable.
+    auto addArchive = [&](OsStringView name, System::FileType type) {
+        if (type == System::FileType::Regular && (EndsWith(name, OSSTR(".abpk")) || EndsWith(name, OSSTR(".zip")))) {
+            archiveNames.emplace_back(name);
+        }
+    };
+
+    if (!System::ListDirectory(dataDir.empty() ? OSSTR(".") : dataDir.c_str(), addArchive, Out{listError})) {
+        FATAL("Can't read data directory: {}", listError);
+    }
+
+    std::sort(archiveNames.begin(), archiveNames.end());
+
+    if (System::GetCacheDirectory(Out{zipParams.indexCacheDir})) {
+        zipParams.indexCacheDir += OSSTR("/ZipIndex");
+    }
+    zipParams.verify = params.verifyArchives;
+
+    for (size_t i = 0; i < archiveNames.size(); ++i) {
+        const OsString& name = archiveNames[i];
+        std::unique_ptr<DataSource> archive;
+        OsString path;
+
+#ifdef _WIN32
+        looseFiles->ResolvePath(Encoding::WideToSystem(name), Out{path}, Out{error});
+#else
+        looseFiles->ResolvePath(name, Out{path}, Out{error});
+#endif
+
+        if (EndsWith(name, OSSTR(".abpk"))) {
+            auto pack = std::make_unique<PackArchiveReader>();
+            if (pack->Open(path.c_str(), Out{error})) {
+                archive = std::move(pack);
+            }
+        } else {
+            auto zip = std::make_unique<ZipArchiveReader>();
+            if (zip->Open(path.c_str(), zipParams, Out{error})) {
+                archive = std::move(zip);
+            }
+        }
+
+        if (!archive || !vfs->Mount(std::move(archive), {}, int(i), Out{error})) {
+            LOG_WARNING("Can't mount {}, skipping it: {}", name, error);
+            continue;
+        }
+
+        LOG_INFO("Mounted {}", name);
+    }
+
+    m_looseFiles = looseFiles.get();
+    if (!vfs->Mount(std::move(looseFiles), {}, int(archiveNames.size()), Out{error})) {
+        FATAL("Can't mount data directory: {}", error);
+    }
+
+    m_fileSystem = vfs.get();
+    m_dataSource = std::move(vfs);
+
+    if (params.hotReload) {
+        m_fileWatcher = CreateFileWatcher(dataDir, Out{error});
+        if (!m_fileWatcher) {
+            LOG_WARNING("Can't watch data directory for changes: {}", error);
+        }
+    }
+}
+
+void Client::WriteBenchmarkResults()
+{
+    std::string results = m_frameStats.FormatJson();
+
+    results.push_back('\n');
+
+    if (m_benchmarkOutputPath.empty()) {
+        fwrite(results.data(), 1, results.size(), stdout);
+        fflush(stdout);
+        return;
+    }
+
+    std::ofstream output{std::filesystem::path{m_benchmarkOutputPath}, std::ios::binary | std::ios::trunc};
+    output.write(results.data(), std::streamsize(results.size()));
+
+    if (!output.flush()) {
+        LOG_ERROR("Can't write benchmark results to {}", m_benchmarkOutputPath);
+    }
+}
+
+void Client::RefreshChangedFiles()
+{
+    std::vector<FileChange> changes;
+
+    // Changes are applied between frames, so nothing is reading from the file system meanwhile.
+    if (!m_fileWatcher->Poll(Out{changes})) {
+        LOG_RATE_LIMITED(Warning, 1000, "Some changes to the data directory may have been missed");
+    }
+
+    for (const FileChange& change : changes) {
+        if (change.name.find('/') == std::string::npos
+            && (EndsWith(change.name, ".abpk") || EndsWith(change.name, ".zip")))
+        {
+            LOG_WARNING("Archive {} changed; restart to mount it again", change.name);
+        } else if (!m_fileSystem->RefreshEntry(*m_looseFiles, change.name, !change.isRemoved)) {
+            continue;
+        } else if (change.isRemoved) {
+            LOG_DEBUG("Removed {}", change.name);
+        } else {
+            LOG_DEBUG("Reloaded {}", change.name);
+        }
+    }
+}
+
 void Client::HandleSdlEvents()
 {
     SDL_Event event;
@@ -17,19 +17,39 @@
 
 #include <memory>
 
+#include <Core/Debug.h>
 #include <Core/ServiceProvider.h>
 
+#include "FrameStats.h"
+
 union SDL_Event;
 struct SDL_WindowEvent;
 
 namespace ArenaBuilder {
 
+    class DataSource;
+    class FileWatcher;
     class RenderSystem;
     class RenderWindow;
+    class VirtualFileSystem;
 
     // Used when initializing a Client.
     struct ClientParams {
         OsString dataDir;
+        bool verifyArchives = false; // Ignore cached archive indices
+        bool hotReload = false; // Pick up changes to loose files in the data directory while running
+        bool asyncLog = false; // Write log messages from a background thread
+        AsyncLoggerParams asyncLoggerParams;
+        bool deferredLog = false; // Format deferred log messages on a background thread
+        DeferredLoggerParams deferredLoggerParams;
+        OsString jsonLogPath; // Also write log messages to this file as JSON lines
+        OsString binaryLogPath; // Also write log messages to this file in the compact binary format
+        OsString profilePath; // Record profiling zones and write them here at shutdown
+        OsString flightRecorderPath; // Where recent log messages are dumped on a crash; defaults to the cache directory
+        bool frameStats = false; // Log a summary of frame times at shutdown
+        uint64_t benchmarkFrames = 0; // Run this many frames without vsync, then write frame times as JSON
+        OsString benchmarkOutputPath; // Where benchmark results are written; defaults to stdout
+        bool headless = false; // Render offscreen with Mesa's software renderer
 
         static ClientParams FromCommandLine(int argc, const oschar_t* const* argv);
     };
@@ -42,6 +62,7 @@ namespace ArenaBuilder {
         Client(Client&&) = delete;
         ~Client();
 
+        DataSource* GetDataSource() { return m_dataSource.get(); }
         RenderWindow* GetRenderWindow() { return m_renderWindow.get(); }
         RenderSystem* GetRenderSystem() { return m_renderSystem.get(); }
 
@@ -59,11 +80,23 @@ namespace ArenaBuilder {
         void* GetService(const std::type_info& type) override;
 
     private:
+        std::unique_ptr<DataSource> m_dataSource;
+        VirtualFileSystem* m_fileSystem = nullptr; // Same object as m_dataSource
+        DataSource* m_looseFiles = nullptr; // Owned by m_fileSystem
+        std::unique_ptr<FileWatcher> m_fileWatcher;
         std::unique_ptr<RenderWindow> m_renderWindow;
         std::unique_ptr<RenderSystem> m_renderSystem;
 
         bool m_quitRequested = false;
-
+        OsString m_profilePath;
+        FrameStats m_frameStats;
+        bool m_logFrameStats = false;
+        uint64_t m_benchmarkFrames = 0;
+        OsString m_benchmarkOutputPath;
+
+        void MountDataSources(const ClientParams& params);
+        void WriteBenchmarkResults();
+        void RefreshChangedFiles();
         void HandleSdlEvents();
         void HandleSdlEvent(const SDL_Event& event);
         void HandleSdlWindowEvent(const SDL_WindowEvent& event);
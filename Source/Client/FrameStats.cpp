@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <iterator>
+
+#include <fmt/format.h>
+
+#include <Core/Debug.h>
+#include <Core/LogSink.h>
+
+#include "FrameStats.h"
+
+using namespace ArenaBuilder;
+
+namespace {
+
+    int GetHighestBit(uint64_t value)
+    {
+#if defined(__GNUC__)
+        return 63 - __builtin_clzll(value);
+#else
+        int bit = 0;
+        while (value >>= 1) {
+            ++bit;
+        }
+        return bit;
+#endif
+    }
+
+    double ToMilliseconds(std::chrono::nanoseconds duration)
+    {
+        return double(duration.count()) / 1e6;
+    }
+
+    // Percentiles in milliseconds, for reports.
+    struct Percentiles {
+        double p50;
+        double p95;
+        double p99;
+        double max;
+    };
+
+    Percentiles GetPercentiles(const DurationHistogram& histogram)
+    {
+        return Percentiles{
+            ToMilliseconds(histogram.GetPercentile(50)),
+            ToMilliseconds(histogram.GetPercentile(95)),
+            ToMilliseconds(histogram.GetPercentile(99)),
+            ToMilliseconds(histogram.GetMax()),
+        };
+    }
+
+    void AppendJsonPercentiles(std::string& out, const char* name, const DurationHistogram& histogram)
+    {
+        Percentiles percentiles = GetPercentiles(histogram);
+
+        fmt::format_to(std::back_inserter(out), R"("{}":{{"p50":{:.3f},"p95":{:.3f},"p99":{:.3f},"max":{:.3f}}})",
+                       name, percentiles.p50, percentiles.p95, percentiles.p99, percentiles.max);
+    }
+
+} // namespace
+
+void DurationHistogram::Record(std::chrono::nanoseconds duration)
+{
+    uint64_t value = uint64_t(std::max<int64_t>(duration.count(), 0));
+
+    ++m_counts[GetBucketIndex(value)];
+    ++m_count;
+    m_max = std::max(m_max, value);
+}
+
+void DurationHistogram::Reset()
+{
+    memset(m_counts, 0, sizeof(m_counts));
+    m_count = 0;
+    m_max = 0;
+}
+
+std::chrono::nanoseconds DurationHistogram::GetPercentile(double percentile) const
+{
+    if (!m_count) {
+        return std::chrono::nanoseconds{0};
+    }
+
+    // Rank of the value we're looking for, counting from 1.
+    double rank = ceil(std::clamp(percentile, 0.0, 100.0) / 100.0 * double(m_count));
+    uint64_t targetCount = std::max<uint64_t>(uint64_t(rank), 1);
+    uint64_t count = 0;
+
+    for (size_t i = 0; i < BucketCount; ++i) {
+        count += m_counts[i];
+        if (count >= targetCount) {
+            return std::chrono::nanoseconds{int64_t(std::min(GetBucketUpperBound(i), m_max))};
+        }
+    }
+
+    return std::chrono::nanoseconds{int64_t(m_max)};
+}
+
+// Values below SubBucketCount get a bucket each. Above that, a value whose highest bit is N goes in
+// one of SubBucketCount buckets determined by the SubBucketBits bits below bit N.
+size_t DurationHistogram::GetBucketIndex(uint64_t value)
+{
+    if (value < SubBucketCount) {
+        return size_t(value);
+    }
+
+    int shift = GetHighestBit(value) - SubBucketBits;
+    return size_t(uint64_t(shift + 1) * SubBucketCount + (value >> shift) - SubBucketCount);
+}
+
+uint64_t DurationHistogram::GetBucketUpperBound(size_t index)
+{
+    if (index < SubBucketCount) {
+        return index;
+    }
+
+    int shift = int(index / SubBucketCount) - 1;
+    uint64_t lowerBound = (SubBucketCount + index % SubBucketCount) << shift;
+    return lowerBound + ((uint64_t(1) << shift) - 1);
+}
+
+//--------------------------------------------------------------------------------------------------
+
+void FrameStats::RecordFrame(uint64_t frame, const FrameTimings& timings)
+{
+    auto now = std::chrono::steady_clock::now();
+
+    if (!m_window.total.GetCount()) {
+        m_windowStart = now;
+    }
+
+    m_window.Record(timings);
+    m_session.Record(timings);
+    m_sessionTime += timings.total;
+
+    if (timings.total > m_spikeThreshold) {
+        RecordSpike(frame, timings);
+    }
+
+    if (now - m_windowStart >= ReportInterval) {
+        LogReport();
+    }
+}
+
+void FrameStats::LogSummary() const
+{
+    Percentiles total = GetPercentiles(m_session.total);
+    Percentiles cpu = GetPercentiles(m_session.cpu);
+    Percentiles events = GetPercentiles(m_session.events);
+    Percentiles swap = GetPercentiles(m_session.swap);
+
+    LOG_INFO("Frame time over {} frames: p50 {:.2f} ms, p95 {:.2f} ms, p99 {:.2f} ms, max {:.2f} ms",
+             m_session.total.GetCount(), total.p50, total.p95, total.p99, total.max);
+    LOG_INFO("CPU time: p50 {:.2f} ms, p95 {:.2f} ms, p99 {:.2f} ms, max {:.2f} ms",
+             cpu.p50, cpu.p95, cpu.p99, cpu.max);
+    LOG_INFO("Event handling time: p50 {:.2f} ms, p95 {:.2f} ms, p99 {:.2f} ms, max {:.2f} ms",
+             events.p50, events.p95, events.p99, events.max);
+    LOG_INFO("Swap time: p50 {:.2f} ms, p95 {:.2f} ms, p99 {:.2f} ms, max {:.2f} ms",
+             swap.p50, swap.p95, swap.p99, swap.max);
+
+    if (m_spikes.empty()) {
+        return;
+    }
+
+    LOG_INFO("{} frame spikes; the longest were:", m_spikeCount);
+
+    for (const Spike& spike : m_spikes) {
+        // Time of day in UTC, matching the log files.
+        int64_t milliseconds = spike.timestamp / 1000000 % 86400000;
+
+        LOG_INFO("  Frame {} at {:02}:{:02}:{:02}.{:03}: {:.2f} ms (CPU {:.2f} ms, events {:.2f} ms, swap {:.2f} ms)",
+                 spike.frame, milliseconds / 3600000, milliseconds / 60000 % 60, milliseconds / 1000 % 60,
+                 milliseconds % 1000, ToMilliseconds(spike.timings.total),
+                 ToMilliseconds(spike.timings.GetCpuTime()), ToMilliseconds(spike.timings.events),
+                 ToMilliseconds(spike.timings.swap));
+    }
+}
+
+std::string FrameStats::FormatJson() const
+{
+    double seconds = std::chrono::duration<double>(m_sessionTime).count();
+    uint64_t frameCount = m_session.total.GetCount();
+    std::string out;
+
+    fmt::format_to(std::back_inserter(out), R"({{"frames":{},"seconds":{:.3f},"fps":{:.1f},)", frameCount, seconds,
+                   seconds > 0 ? double(frameCount) / seconds : 0.0);
+    AppendJsonPercentiles(out, "frameTime", m_session.total);
+    out.push_back(',');
+    AppendJsonPercentiles(out, "cpuTime", m_session.cpu);
+    out.push_back(',');
+    AppendJsonPercentiles(out, "eventTime", m_session.events);
+    out.push_back(',');
+    AppendJsonPercentiles(out, "swapTime", m_session.swap);
+    out.push_back('}');
+    return out;
+}
+
+void FrameStats::Histograms::Record(const FrameTimings& timings)
+{
+    total.Record(timings.total);
+    cpu.Record(timings.GetCpuTime());
+    events.Record(timings.events);
+    swap.Record(timings.swap);
+}
+
+void FrameStats::Histograms::Reset()
+{
+    total.Reset();
+    cpu.Reset();
+    events.Reset();
+    swap.Reset();
+}
+
+void FrameStats::RecordSpike(uint64_t frame, const FrameTimings& timings)
+{
+    auto isLonger = [](const Spike& a, const Spike& b) { return a.timings.total > b.timings.total; };
+    Spike spike{LogRecord::GetCurrentTimestamp(), frame, timings};
+
+    ++m_windowSpikeCount;
+    ++m_spikeCount;
+
+    TRACE_EVENT("FrameSpike", frame);
+    LOG_RATE_LIMITED(Info, 1000, "Frame {} took {:.2f} ms (CPU {:.2f} ms, events {:.2f} ms, swap {:.2f} ms)",
+                     frame, ToMilliseconds(timings.total), ToMilliseconds(timings.GetCpuTime()),
+                     ToMilliseconds(timings.events), ToMilliseconds(timings.swap));
+
+    if (m_spikes.size() < MaxSpikeCount || isLonger(spike, m_spikes.back())) {
+        m_spikes.insert(std::upper_bound(m_spikes.begin(), m_spikes.end(), spike, isLonger), spike);
+        if (m_spikes.size() > MaxSpikeCount) {
+            m_spikes.pop_back();
+        }
+    }
+}
+
+void FrameStats::LogReport()
+{
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - m_windowStart;
+    Percentiles total = GetPercentiles(m_window.total);
+    Percentiles cpu = GetPercentiles(m_window.cpu);
+    Percentiles events = GetPercentiles(m_window.events);
+    Percentiles swap = GetPercentiles(m_window.swap);
+
+    LOG_INFO("Frame time over {} frames in {:.1f} s: p50 {:.2f} ms, p95 {:.2f} ms, p99 {:.2f} ms, max {:.2f} ms, {} spikes",
+             m_window.total.GetCount(), elapsed.count(), total.p50, total.p95, total.p99, total.max,
+             m_windowSpikeCount);
+    LOG_INFO("CPU time: p50 {:.2f} ms, p95 {:.2f} ms, p99 {:.2f} ms, max {:.2f} ms",
+             cpu.p50, cpu.p95, cpu.p99, cpu.max);
+    LOG_INFO("Event handling time: p50 {:.2f} ms, p95 {:.2f} ms, p99 {:.2f} ms, max {:.2f} ms",
+             events.p50, events.p95, events.p99, events.max);
+    LOG_INFO("Swap time: p50 {:.2f} ms, p95 {:.2f} ms, p99 {:.2f} ms, max {:.2f} ms",
+             swap.p50, swap.p95, swap.p99, swap.max);
+
+    // Spikes are judged against recent frames, since e.g. resizing the window or moving it to
+    // another display can change the frame rate.
+    m_spikeThreshold = m_window.total.GetPercentile(50) * SpikeFactor;
+    m_windowSpikeCount = 0;
+    m_window.Reset();
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef ARENABUILDER_CLIENT_FRAMESTATS_H_INCLUDED
+#define ARENABUILDER_CLIENT_FRAMESTATS_H_INCLUDED
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <Core/Types.h>
+
+namespace ArenaBuilder {
+
+    // Histogram of durations in the style of HdrHistogram. Each power of two is split into
+    // SubBucketCount linear buckets, so percentiles are within about 3% of the recorded durations,
+    // with no configuration and a fixed size. Recording is a few instructions and never allocates.
+    class DurationHistogram {
+    public:
+        static constexpr int SubBucketBits = 5;
+        static constexpr uint64_t SubBucketCount = uint64_t(1) << SubBucketBits;
+        static constexpr size_t BucketCount = (64 - SubBucketBits + 1) * SubBucketCount;
+
+        void Record(std::chrono::nanoseconds duration);
+        void Reset();
+
+        uint64_t GetCount() const { return m_count; }
+        std::chrono::nanoseconds GetMax() const { return std::chrono::nanoseconds{m_max}; }
+
+        // Gets the duration which the given percentage of recorded durations don't exceed, rounded
+        // up to the end of its bucket. Returns zero if nothing has been recorded.
+        std::chrono::nanoseconds GetPercentile(double percentile) const;
+
+    private:
+        uint64_t m_counts[BucketCount] = {};
+        uint64_t m_count = 0;
+        uint64_t m_max = 0;
+
+        static size_t GetBucketIndex(uint64_t value);
+        static uint64_t GetBucketUpperBound(size_t index);
+    };
+
+    // Durations measured over one iteration of the client's main loop.
+    struct FrameTimings {
+        std::chrono::nanoseconds total{0};
+        std::chrono::nanoseconds events{0}; // Handling SDL events
+        std::chrono::nanoseconds swap{0}; // Blocked in RenderWindow::SwapBuffers(), e.g. waiting for vsync
+
+        // Time not spent blocked on the swap.
+        std::chrono::nanoseconds GetCpuTime() const { return total - swap; }
+    };
+
+    // Collects frame timings into histograms. A report of the frames since the last one is logged
+    // at info level every ReportInterval, so it's there in release builds, and LogSummary() reports
+    // the whole session. Frames which take much longer than usual are logged as spikes, at most
+    // once a second, along with when they happened, so they can be matched up with other log
+    // messages and the flight recorder.
+    class FrameStats {
+    public:
+        static constexpr std::chrono::seconds ReportInterval{10};
+        static constexpr size_t MaxSpikeCount = 16; // Only the longest spikes are kept for the summary
+
+        // A frame is a spike if it takes this many times the median frame time of the last report,
+        // or InitialSpikeThreshold before the first report.
+        static constexpr int SpikeFactor = 2;
+        static constexpr std::chrono::milliseconds InitialSpikeThreshold{100};
+
+        FrameStats() = default;
+        FrameStats(const FrameStats&) = delete;
+        FrameStats(FrameStats&&) = delete;
+
+        void RecordFrame(uint64_t frame, const FrameTimings& timings);
+        void LogSummary() const;
+
+        // Formats the whole session as a JSON object, for comparing benchmark runs, e.g.:
+        //
+        //   {"frames":1000,"seconds":2.417,"fps":413.7,
+        //    "frameTime":{"p50":2.31,"p95":3.02,"p99":4.87,"max":9.16},
+        //    "cpuTime":{...},"eventTime":{...},"swapTime":{...}}
+        //
+        // Percentiles are in milliseconds.
+        std::string FormatJson() const;
+
+        FrameStats& operator=(const FrameStats&) = delete;
+        FrameStats& operator=(FrameStats&&) = delete;
+
+    private:
+        struct Histograms {
+            DurationHistogram total;
+            DurationHistogram cpu;
+            DurationHistogram events;
+            DurationHistogram swap;
+
+            void Record(const FrameTimings& timings);
+            void Reset();
+        };
+
+        struct Spike {
+            int64_t timestamp; // Nanoseconds since the Unix epoch, like log records
+            uint64_t frame;
+            FrameTimings timings;
+        };
+
+        Histograms m_window; // Since the last report
+        Histograms m_session; // Every frame
+        std::chrono::nanoseconds m_sessionTime{0}; // Sum of all frame times
+        std::chrono::steady_clock::time_point m_windowStart;
+        uint64_t m_windowSpikeCount = 0;
+        uint64_t m_spikeCount = 0;
+        std::chrono::nanoseconds m_spikeThreshold = InitialSpikeThreshold;
+        std::vector<Spike> m_spikes; // Sorted from longest to shortest
+
+        void RecordSpike(uint64_t frame, const FrameTimings& timings);
+        void LogReport();
+    };
+
+} // namespace ArenaBuilder
+
+#endif // ARENABUILDER_CLIENT_FRAMESTATS_H_INCLUDED
@@ -12,6 +12,8 @@
  * under the License.
  */
 
+#include <SDL_hints.h>
+#include <SDL_stdinc.h>
 #include <SDL_video.h>
 
 #include <Core/Debug.h>
@@ -28,10 +30,17 @@ namespace {
 
 } // namespace
 
-RenderWindow::RenderWindow()
+RenderWindow::RenderWindow(const RenderWindowParams& params)
     : m_sdlWindow{nullptr, &SDL_DestroyWindow}
     , m_glContext{nullptr, &SDL_GL_DeleteContext}
 {
+    // The offscreen driver renders into EGL pbuffers. LIBGL_ALWAYS_SOFTWARE makes Mesa use
+    // llvmpipe even if there is a GPU, so that results are comparable between hosts.
+    if (params.headless) {
+        SDL_SetHint(SDL_HINT_VIDEODRIVER, "offscreen");
+        SDL_setenv("LIBGL_ALWAYS_SOFTWARE", "1", 1);
+    }
+
     SDL_GL_ResetAttributes();
     SDL_GL_SetAttribute(SDL_GL_BUFFER_SIZE, 24);
     SDL_GL_SetAttribute(SDL_GL_RED_SIZE, 8);
@@ -51,7 +60,8 @@ RenderWindow::RenderWindow()
         SDL_WINDOWPOS_UNDEFINED,
         DefaultWindowSize.x,
         DefaultWindowSize.y,
-        SDL_WINDOW_ALLOW_HIGHDPI | SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE | SDL_WINDOW_SHOWN));
+        SDL_WINDOW_ALLOW_HIGHDPI | SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE
+            | (params.hidden ? SDL_WINDOW_HIDDEN : SDL_WINDOW_SHOWN)));
 
     if (!m_sdlWindow) {
         FATAL("Can't create SDL window: {}", SDL_GetError());
@@ -62,8 +72,11 @@ RenderWindow::RenderWindow()
         FATAL("Can't create OpenGL context: {}", SDL_GetError());
     }
 
-    // Enable vsync. Eventually we'll make this configurable.
-    if (!SDL_GL_SetSwapInterval(-1)) {
+    if (!params.vsync) {
+        if (SDL_GL_SetSwapInterval(0)) {
+            LOG_WARNING("Can't disable vsync: {}", SDL_GetError());
+        }
+    } else if (!SDL_GL_SetSwapInterval(-1)) {
         LOG_DEBUG("Enabled adaptive vsync");
     } else if (!SDL_GL_SetSwapInterval(1)) {
         LOG_DEBUG("Enabled vsync");
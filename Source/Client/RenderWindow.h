@@ -24,12 +24,22 @@ struct SDL_Window;
 
 namespace ArenaBuilder {
 
+    struct RenderWindowParams {
+        bool vsync = true;
+        bool hidden = false;
+
+        // Use SDL's offscreen video driver and Mesa's software renderer, so that no display or GPU
+        // is needed. Must be set for the first window, since SDL picks a video driver only once.
+        bool headless = false;
+    };
+
     // SDL window wrapper.
     class RenderWindow : public GlLoader {
     public:
-        RenderWindow();
+        RenderWindow() = delete;
         RenderWindow(const RenderWindow&) = delete;
         RenderWindow(RenderWindow&&) = delete;
+        explicit RenderWindow(const RenderWindowParams& params);
         ~RenderWindow();
 
         Vec2i GetClientSize() const;
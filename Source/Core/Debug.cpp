@@ -12,46 +12,101 @@
  * under the License.
  */
 
+#include <ctype.h>
 #include <stdio.h>
 #ifdef _WIN32
 # include <windows.h>
 #endif
 
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <memory>
+#include <vector>
+
 #include <Core/Debug.h>
+#include <Core/LogSink.h>
 #include <Core/Mutex.h>
 #include <Core/System.h>
-
-// ANSI escape sequences for decorating log messages. These are supported on Windows and on most
-// Unix terminal emulators.
-#define ANSI_RESET "\x1B[0m"
-#define ANSI_BOLD "\x1B[1m"
-#define ANSI_BLACK "\x1B[30m"
-#define ANSI_RED "\x1B[31m"
-#define ANSI_GREEN "\x1B[32m"
-#define ANSI_YELLOW "\x1B[33m"
-#define ANSI_BLUE "\x1B[34m"
-#define ANSI_MAGENTA "\x1B[35m"
-#define ANSI_CYAN "\x1B[36m"
-#define ANSI_WHITE "\x1B[37m"
+#include <Core/Thread.h>
 
 using namespace ArenaBuilder;
 
 namespace {
 
+    class DeferredLogBuffer;
+
     struct LoggerState {
-        RecursiveMutex mutex;
-        bool locked = false; // Flag to prevent interrupting a message with another message
+        RecursiveMutex mutex; // Held while writing to the sinks
+        std::vector<std::unique_ptr<LogSink>> sinks; // The console sink comes first
         OsString fatalErrorMessage; // Fatal errors must be written all at once to prevent interruptions
+
+        // Every thread's deferred log buffer, including those of threads that have exited but
+        // whose buffers haven't been drained yet. Locked after 'mutex' when both are needed.
+        RecursiveMutex deferredBuffersMutex;
+        std::vector<std::shared_ptr<DeferredLogBuffer>> deferredBuffers;
+    };
+
+    // Messages are formatted into a per-thread buffer so that the mutex is only held for a single
+    // write. Buffers that grew for an unusually long message are shrunk again afterwards.
+    constexpr size_t MaxRetainedBufferSize = 65536;
+
+    struct ThreadLogState {
+        OsString buffer;
+        LogLevel level = LogLevel::Info;
+        uint64_t threadId = Thread::GetCurrentId();
+        bool isInMessage = false; // Prevents interrupting a message with another message
     };
 
     LoggerState* s_loggerState = nullptr;
-    LogLevel s_maxLogLevel =
+    thread_local ThreadLogState t_logState;
+    constexpr LogLevel DefaultLogLevel =
 #ifdef NDEBUG
         LogLevel::Warning;
 #else
         LogLevel::Debug;
 #endif
 
+    constexpr LogLevel VerboseLogLevel =
+#ifdef NDEBUG
+        LogLevel::Info;
+#else
+        LogLevel::Trace;
+#endif
+
+    constexpr const char* LogLevelNames[] = {"fatal", "error", "warning", "info", "debug", "trace"};
+    constexpr const char* LogChannelNames[] = {"general", "io", "render", "client", "tools"};
+
+    static_assert(std::size(LogChannelNames) == size_t(LogChannel::Count));
+
+    bool EqualsIgnoreCase(std::string_view a, std::string_view b)
+    {
+        if (a.size() != b.size()) {
+            return false;
+        }
+
+        for (size_t i = 0; i < a.size(); ++i) {
+            if (tolower(static_cast<unsigned char>(a[i])) != tolower(static_cast<unsigned char>(b[i]))) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    template<size_t N>
+    bool FindName(const char* const (&names)[N], std::string_view name, Out<size_t> outIndex)
+    {
+        for (size_t i = 0; i < N; ++i) {
+            if (EqualsIgnoreCase(names[i], name)) {
+                *outIndex = i;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
     // The __FILE__ token may evaluate to a longer path than we want for log messages. This returns
     // the path relative to the game's source directory.
     const char* GetShortSourceFileName(const char* path)
@@ -80,35 +135,522 @@ namespace {
         return path;
     }
 
-    void WriteLogMessageSuffix(const char* sourceFileName, int sourceLine)
+    // Writes a record to every sink. The caller must hold the logger mutex.
+    void WriteToSinks(const LogRecord& record)
     {
-        if (sourceFileName) {
-            sourceFileName = GetShortSourceFileName(sourceFileName);
-#ifdef _WIN32
-            // We can't simply use fwprintf for all of this, because some implementations of Windows
-            // CRT have the types reversed for %s and %S.
-            fputws(L" " ANSI_BOLD ANSI_BLACK "(", stderr);
-            fputs(sourceFileName, stderr);
-            fwprintf(stderr, L":%d)", sourceLine);
-#else
-            fprintf(stderr, " " ANSI_BOLD ANSI_BLACK "(%s:%d)", sourceFileName, sourceLine);
-#endif
+        for (const auto& sink : s_loggerState->sinks) {
+            sink->Write(record);
         }
+    }
 
-#ifdef _WIN32
-        fputws(L"" ANSI_RESET "\r\n", stderr);
-#else
-        fputs(ANSI_RESET "\n", stderr);
-#endif
-        fflush(stderr);
+    // Lets the sinks flush after writing records. The caller must hold the logger mutex.
+    void EndSinkBatch()
+    {
+        for (const auto& sink : s_loggerState->sinks) {
+            sink->EndBatch();
+        }
+    }
+
+    // Writes a single record to the sinks while holding the mutex.
+    void WriteLogRecord(const LogRecord& record)
+    {
+        ScopedLock lock{s_loggerState->mutex};
+
+        WriteToSinks(record);
+        EndSinkBatch();
+    }
+
+    // Reports messages that were lost because a buffer was full. The caller must hold the logger
+    // mutex. Doesn't end the batch.
+    void WriteDroppedMessageNotice(size_t droppedCount)
+    {
+        OsString notice = fmt::format(OsStringView{OSSTR("{} log messages were dropped")}, droppedCount);
+        LogRecord record;
+
+        record.timestamp = LogRecord::GetCurrentTimestamp();
+        record.threadId = t_logState.threadId;
+        record.level = LogLevel::Warning;
+        record.message = notice;
+        WriteToSinks(record);
+    }
+
+    // Bounded multi-producer ring of formatted messages, drained by a single logger thread. Each
+    // slot has a sequence number which tells producers and the consumer whose turn it is, so
+    // pushing only takes one compare-and-swap. Messages are swapped in and out of the slots, so
+    // once the slots' strings have grown, nothing allocates.
+    class AsyncLogQueue {
+    public:
+        AsyncLogQueue() = delete;
+        AsyncLogQueue(const AsyncLogQueue&) = delete;
+        AsyncLogQueue(AsyncLogQueue&&) = delete;
+        explicit AsyncLogQueue(const AsyncLoggerParams& params);
+        ~AsyncLogQueue();
+
+        bool Start(Out<std::string> outError);
+        void Stop();
+
+        // Copies the record and swaps its message into the ring. The message is left with some
+        // other string's contents.
+        void Push(const LogRecord& record, OsString& message);
+
+        // Writes all messages in the ring to the sinks. The caller must hold the logger mutex,
+        // which is what keeps this single-consumer.
+        void Drain();
+
+        AsyncLogQueue& operator=(const AsyncLogQueue&) = delete;
+        AsyncLogQueue& operator=(AsyncLogQueue&&) = delete;
+
+    private:
+        struct Slot {
+            std::atomic<size_t> sequence;
+            LogRecord record; // The message is only set while draining
+            OsString message;
+        };
+
+        std::unique_ptr<Slot[]> m_slots;
+        size_t m_mask;
+        LogOverflowPolicy m_overflowPolicy;
+        alignas(64) std::atomic<size_t> m_pushPosition{0};
+        alignas(64) size_t m_popPosition = 0; // Only accessed with the logger mutex held
+        std::atomic<size_t> m_droppedCount{0};
+        std::atomic<uint32_t> m_blockedCount{0};
+        std::atomic<bool> m_isStopping{false};
+        std::atomic<bool> m_isWakeupPending{false}; // m_pending was released and not yet acquired
+        Semaphore m_pending; // Released when a push finds no wakeup pending
+        Semaphore m_space; // Released for blocked producers after draining
+        Thread m_thread;
+
+        bool TryPush(const LogRecord& record, OsString& message);
+        void Wake();
+        void Run();
+    };
+
+    AsyncLogQueue::AsyncLogQueue(const AsyncLoggerParams& params)
+        : m_overflowPolicy{params.overflowPolicy}
+    {
+        size_t capacity = 2;
+
+        while (capacity < params.capacity) {
+            capacity *= 2;
+        }
+
+        m_slots = std::make_unique<Slot[]>(capacity);
+        m_mask = capacity - 1;
+
+        for (size_t i = 0; i < capacity; ++i) {
+            m_slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    AsyncLogQueue::~AsyncLogQueue()
+    {
+        Stop();
+    }
+
+    bool AsyncLogQueue::Start(Out<std::string> outError)
+    {
+        return m_thread.Start([this] { Run(); }, outError);
+    }
+
+    void AsyncLogQueue::Stop()
+    {
+        if (!m_thread.IsJoinable()) {
+            return;
+        }
+
+        m_isStopping.store(true, std::memory_order_release);
+        m_pending.Release();
+        m_thread.Join();
+
+        ScopedLock lock{s_loggerState->mutex};
+        Drain();
+    }
+
+    void AsyncLogQueue::Push(const LogRecord& record, OsString& message)
+    {
+        if (TryPush(record, message)) {
+            Wake();
+            return;
+        } else if (m_overflowPolicy == LogOverflowPolicy::Drop) {
+            m_droppedCount.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        // The logger thread only releases m_space when it sees a blocked producer, so there's a
+        // window where a wakeup can be missed. The timeout covers it.
+        m_blockedCount.fetch_add(1, std::memory_order_seq_cst);
+        while (!TryPush(record, message)) {
+            m_space.TryAcquire(10);
+        }
+        m_blockedCount.fetch_sub(1, std::memory_order_relaxed);
+        Wake();
+    }
+
+    bool AsyncLogQueue::TryPush(const LogRecord& record, OsString& message)
+    {
+        size_t position = m_pushPosition.load(std::memory_order_relaxed);
+        Slot* slot;
+
+        while (true) {
+            slot = &m_slots[position & m_mask];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            auto difference = ptrdiff_t(sequence - position);
+
+            if (difference == 0) {
+                if (m_pushPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (difference < 0) {
+                return false; // Full
+            } else {
+                position = m_pushPosition.load(std::memory_order_relaxed);
+            }
+        }
+
+        slot->record = record;
+        slot->message.swap(message);
+        slot->sequence.store(position + 1, std::memory_order_release);
+        return true;
     }
 
+    void AsyncLogQueue::Drain()
+    {
+        size_t droppedCount = m_droppedCount.exchange(0, std::memory_order_relaxed);
+        uint32_t blockedCount;
+
+        while (true) {
+            Slot& slot = m_slots[m_popPosition & m_mask];
+
+            if (slot.sequence.load(std::memory_order_acquire) != m_popPosition + 1) {
+                break;
+            }
+
+            slot.record.message = slot.message;
+            WriteToSinks(slot.record);
+            slot.message.clear();
+            slot.sequence.store(m_popPosition + m_mask + 1, std::memory_order_release);
+            ++m_popPosition;
+        }
+
+        if (droppedCount) {
+            WriteDroppedMessageNotice(droppedCount);
+        }
+
+        EndSinkBatch();
+
+        blockedCount = m_blockedCount.load(std::memory_order_seq_cst);
+        if (blockedCount) {
+            m_space.Release(blockedCount);
+        }
+    }
+
+    // Only the first push after the logger thread wakes up releases the semaphore, so a burst of
+    // messages costs one wakeup instead of one empty pass per message.
+    void AsyncLogQueue::Wake()
+    {
+        if (!m_isWakeupPending.exchange(true, std::memory_order_acq_rel)) {
+            m_pending.Release();
+        }
+    }
+
+    void AsyncLogQueue::Run()
+    {
+        while (!m_isStopping.load(std::memory_order_acquire)) {
+            m_pending.Acquire();
+
+            // Cleared before draining, so a message pushed after this point either gets drained
+            // now or releases the semaphore again. The exchange synchronizes with the pusher's.
+            m_isWakeupPending.exchange(false, std::memory_order_acq_rel);
+
+            ScopedLock lock{s_loggerState->mutex};
+            Drain();
+        }
+    }
+
+    // The logger threads' objects are only destroyed by StopAsyncLogger() and StopDeferredLogger(),
+    // not at exit. Otherwise exiting after a fatal error would wait for a logger thread which may be
+    // waiting for the mutex that the fatal error holds.
+    std::atomic<AsyncLogQueue*> s_asyncLogQueue{nullptr};
+
+    // Header of a record in a DeferredLogBuffer, followed by the arguments. A null format function
+    // marks padding up to the end of the ring, in which case only that field is present.
+    struct DeferredLogRecord {
+        Debug::Internal::DeferredFormatFunction format;
+        const Debug::Internal::DeferredLogSite* site;
+        const oschar_t* fmt;
+        int64_t timestamp; // Steady clock, as in the flight recorder
+        uint32_t fmtSize;
+        uint32_t size; // Including the header and alignment
+    };
+
+    // Single-producer, single-consumer ring of deferred log records for one thread. Positions are
+    // byte counts that only grow, so the ring is empty when they're equal. Records are 8-byte
+    // aligned and never wrap around the end of the ring.
+    class DeferredLogBuffer {
+    public:
+        static constexpr size_t RecordAlignment = 8;
+
+        DeferredLogBuffer() = delete;
+        DeferredLogBuffer(const DeferredLogBuffer&) = delete;
+        DeferredLogBuffer(DeferredLogBuffer&&) = delete;
+        DeferredLogBuffer(uint64_t threadId, size_t capacity);
+
+        // Producer side. Reserve() returns null if the record doesn't fit. Commit() returns true if
+        // the ring is more than half full, in which case the logger thread should be woken.
+        uint8_t* Reserve(size_t size);
+        bool Commit();
+        void Abandon() { m_isAbandoned.store(true, std::memory_order_release); }
+
+        // Consumer side. The caller must hold the logger mutex. clockOffset converts the records'
+        // timestamps to the system clock. Returns false if the buffer's thread has exited, in which
+        // case the buffer is empty afterwards and can be dropped.
+        bool Drain(OsString& scratch, int64_t clockOffset);
+
+        DeferredLogBuffer& operator=(const DeferredLogBuffer&) = delete;
+        DeferredLogBuffer& operator=(DeferredLogBuffer&&) = delete;
+
+    private:
+        std::unique_ptr<uint8_t[]> m_data;
+        size_t m_capacity;
+        uint64_t m_threadId;
+        alignas(64) std::atomic<size_t> m_writePosition{0};
+        size_t m_reservedPosition = 0; // Producer only
+        size_t m_cachedReadPosition = 0; // Producer only
+        alignas(64) std::atomic<size_t> m_readPosition{0};
+        std::atomic<size_t> m_droppedCount{0};
+        std::atomic<bool> m_isAbandoned{false};
+    };
+
+    DeferredLogBuffer::DeferredLogBuffer(uint64_t threadId, size_t capacity)
+        : m_data{std::make_unique<uint8_t[]>(capacity)}
+        , m_capacity{capacity}
+        , m_threadId{threadId}
+    {
+    }
+
+    uint8_t* DeferredLogBuffer::Reserve(size_t size)
+    {
+        size_t position = m_writePosition.load(std::memory_order_relaxed);
+        size_t offset = position & (m_capacity - 1);
+        size_t padding = offset + size > m_capacity ? m_capacity - offset : 0;
+
+        if (position + padding + size - m_cachedReadPosition > m_capacity) {
+            m_cachedReadPosition = m_readPosition.load(std::memory_order_acquire);
+
+            if (size > m_capacity || position + padding + size - m_cachedReadPosition > m_capacity) {
+                m_droppedCount.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+        }
+
+        if (padding) {
+            Debug::Internal::DeferredFormatFunction noFormat = nullptr;
+            memcpy(&m_data[offset], &noFormat, sizeof(noFormat));
+            offset = 0;
+        }
+
+        m_reservedPosition = position + padding + size;
+        return &m_data[offset];
+    }
+
+    bool DeferredLogBuffer::Commit()
+    {
+        m_writePosition.store(m_reservedPosition, std::memory_order_release);
+
+        if (m_reservedPosition - m_cachedReadPosition <= m_capacity / 2) {
+            return false;
+        }
+
+        // The cached position may be stale, so only wake the logger thread if it's really behind.
+        m_cachedReadPosition = m_readPosition.load(std::memory_order_acquire);
+        return m_reservedPosition - m_cachedReadPosition > m_capacity / 2;
+    }
+
+    bool DeferredLogBuffer::Drain(OsString& scratch, int64_t clockOffset)
+    {
+        // Check before draining so that nothing can be added after the last drain.
+        bool isAbandoned = m_isAbandoned.load(std::memory_order_acquire);
+        size_t position = m_readPosition.load(std::memory_order_relaxed);
+        size_t end = m_writePosition.load(std::memory_order_acquire);
+        size_t droppedCount;
+
+        while (position != end) {
+            size_t offset = position & (m_capacity - 1);
+            auto record = reinterpret_cast<const DeferredLogRecord*>(&m_data[offset]);
+
+            if (!record->format) {
+                position += m_capacity - offset;
+                continue;
+            }
+
+            const Debug::Internal::DeferredLogSite& site = *record->site;
+            LogRecord logRecord;
+
+            scratch.clear();
+            record->format(scratch, OsStringView{record->fmt, record->fmtSize},
+                           reinterpret_cast<const uint8_t*>(record) + sizeof(DeferredLogRecord));
+
+            logRecord.timestamp = record->timestamp + clockOffset;
+            logRecord.threadId = m_threadId;
+            logRecord.level = site.level;
+            logRecord.sourceFileName = GetShortSourceFileName(site.sourceFileName);
+            logRecord.sourceLine = site.sourceLine;
+            logRecord.message = scratch;
+            WriteToSinks(logRecord);
+            position += record->size;
+        }
+
+        m_readPosition.store(position, std::memory_order_release);
+
+        droppedCount = m_droppedCount.exchange(0, std::memory_order_relaxed);
+        if (droppedCount) {
+            WriteDroppedMessageNotice(droppedCount);
+        }
+
+        return !isAbandoned;
+    }
+
+    // Owns the calling thread's deferred log buffer and marks it abandoned when the thread exits.
+    struct DeferredLogThreadState {
+        std::shared_ptr<DeferredLogBuffer> buffer;
+
+        ~DeferredLogThreadState()
+        {
+            if (buffer) {
+                buffer->Abandon();
+            }
+        }
+    };
+
+    thread_local DeferredLogThreadState t_deferredLogState;
+
+    // Formats every thread's deferred messages. The caller must hold the logger mutex. Doesn't end
+    // the batch.
+    void DrainDeferredLogBuffers()
+    {
+        static OsString scratch;
+        int64_t clockOffset = LogRecord::GetCurrentTimestamp() - Debug::Internal::GetSteadyTimestamp();
+        ScopedLock lock{s_loggerState->deferredBuffersMutex};
+        auto& buffers = s_loggerState->deferredBuffers;
+
+        for (size_t i = 0; i < buffers.size();) {
+            if (buffers[i]->Drain(scratch, clockOffset)) {
+                ++i;
+            } else {
+                buffers[i] = std::move(buffers.back());
+                buffers.pop_back();
+            }
+        }
+    }
+
+    // Thread which periodically drains the deferred log buffers. Producers only signal it when
+    // their ring passes half full, so most deferred messages cost no system calls.
+    class DeferredLogger {
+    public:
+        static constexpr uint32_t DrainIntervalMilliseconds = 10;
+
+        DeferredLogger() = delete;
+        DeferredLogger(const DeferredLogger&) = delete;
+        DeferredLogger(DeferredLogger&&) = delete;
+        explicit DeferredLogger(const DeferredLoggerParams& params);
+        ~DeferredLogger();
+
+        size_t GetBufferCapacity() const { return m_bufferCapacity; }
+
+        bool Start(Out<std::string> outError);
+        void Stop();
+
+        // Drains before the interval is up. Like AsyncLogQueue::Wake(), only the first call after
+        // the thread wakes up releases the semaphore.
+        void Wake();
+
+        DeferredLogger& operator=(const DeferredLogger&) = delete;
+        DeferredLogger& operator=(DeferredLogger&&) = delete;
+
+    private:
+        size_t m_bufferCapacity;
+        std::atomic<bool> m_isStopping{false};
+        std::atomic<bool> m_isWakeupPending{false}; // m_pending was released and not yet acquired
+        Semaphore m_pending; // Released by Stop() and when a ring passes half full
+        Thread m_thread;
+
+        void Run();
+    };
+
+    DeferredLogger::DeferredLogger(const DeferredLoggerParams& params)
+    {
+        size_t capacity = 256;
+
+        while (capacity < params.capacity) {
+            capacity *= 2;
+        }
+
+        m_bufferCapacity = capacity;
+    }
+
+    DeferredLogger::~DeferredLogger()
+    {
+        Stop();
+    }
+
+    bool DeferredLogger::Start(Out<std::string> outError)
+    {
+        return m_thread.Start([this] { Run(); }, outError);
+    }
+
+    void DeferredLogger::Stop()
+    {
+        if (!m_thread.IsJoinable()) {
+            return;
+        }
+
+        m_isStopping.store(true, std::memory_order_release);
+        m_pending.Release();
+        m_thread.Join();
+
+        ScopedLock lock{s_loggerState->mutex};
+        DrainDeferredLogBuffers();
+        EndSinkBatch();
+    }
+
+    void DeferredLogger::Wake()
+    {
+        if (!m_isWakeupPending.exchange(true, std::memory_order_acq_rel)) {
+            m_pending.Release();
+        }
+    }
+
+    void DeferredLogger::Run()
+    {
+        while (!m_isStopping.load(std::memory_order_acquire)) {
+            m_pending.TryAcquire(DrainIntervalMilliseconds);
+            m_isWakeupPending.exchange(false, std::memory_order_acq_rel);
+
+            ScopedLock lock{s_loggerState->mutex};
+            DrainDeferredLogBuffers();
+            EndSinkBatch();
+        }
+    }
+
+    std::atomic<DeferredLogger*> s_deferredLogger{nullptr};
+
 } // namespace
 
+std::atomic<LogLevel> Debug::Internal::channelLogLevels[size_t(LogChannel::Count)] = {
+    DefaultLogLevel,
+    DefaultLogLevel,
+    DefaultLogLevel,
+    DefaultLogLevel,
+    DefaultLogLevel,
+};
+
 void Debug::InitLogger()
 {
     static LoggerState globalLoggerState;
     s_loggerState = &globalLoggerState;
+    s_loggerState->sinks.push_back(std::make_unique<ConsoleLogSink>());
+
+    System::SetCrashHandler(&DumpFlightRecorder);
 
 #ifdef _WIN32
 
@@ -133,79 +675,225 @@ void Debug::InitLogger()
 
 void Debug::EnableVerboseLogMessages()
 {
-#ifdef NDEBUG
-    s_maxLogLevel = LogLevel::Info;
+    for (auto& level : Internal::channelLogLevels) {
+        level.store(VerboseLogLevel, std::memory_order_relaxed);
+    }
+}
+
+LogLevel Debug::GetLogLevel(LogChannel channel)
+{
+    return Internal::channelLogLevels[size_t(channel)].load(std::memory_order_relaxed);
+}
+
+void Debug::SetLogLevel(LogChannel channel, LogLevel level)
+{
+    Internal::channelLogLevels[size_t(channel)].store(level, std::memory_order_relaxed);
+}
+
+const char* Debug::GetLogLevelName(LogLevel level)
+{
+    return size_t(level) < std::size(LogLevelNames) ? LogLevelNames[size_t(level)] : "unknown";
+}
+
+bool Debug::SetLogLevels(OsStringView spec, Out<std::string> outError)
+{
+#ifdef _WIN32
+    std::string specString = Encoding::WideToSystem(spec);
+    std::string_view remaining = specString;
 #else
-    s_maxLogLevel = LogLevel::Trace;
+    std::string_view remaining = spec;
 #endif
+    LogLevel levels[size_t(LogChannel::Count)];
+
+    // Parse everything before changing any levels.
+    for (size_t i = 0; i < size_t(LogChannel::Count); ++i) {
+        levels[i] = GetLogLevel(LogChannel(i));
+    }
+
+    while (!remaining.empty()) {
+        size_t end = remaining.find(',');
+        std::string_view item = remaining.substr(0, end);
+        size_t separator = item.find('=');
+        std::string_view levelName = separator == std::string_view::npos ? item : item.substr(separator + 1);
+        size_t channelIndex = 0;
+        size_t levelIndex = 0;
+
+        remaining = end == std::string_view::npos ? std::string_view{} : remaining.substr(end + 1);
+
+        if (!FindName(LogLevelNames, levelName, Out{levelIndex})) {
+            *outError = fmt::format("Invalid log level: '{}'", levelName);
+            return false;
+        } else if (separator == std::string_view::npos) {
+            std::fill(std::begin(levels), std::end(levels), LogLevel(levelIndex));
+        } else if (!FindName(LogChannelNames, item.substr(0, separator), Out{channelIndex})) {
+            *outError = fmt::format("Invalid log channel: '{}'", item.substr(0, separator));
+            return false;
+        } else {
+            levels[channelIndex] = LogLevel(levelIndex);
+        }
+    }
+
+    for (size_t i = 0; i < size_t(LogChannel::Count); ++i) {
+        SetLogLevel(LogChannel(i), levels[i]);
+    }
+
+    return true;
 }
 
-bool Debug::Internal::BeginLogMessage(LogLevel level)
+void Debug::AddLogSink(std::unique_ptr<LogSink> sink)
 {
-    const oschar_t* prefix;
+    ScopedLock lock{s_loggerState->mutex};
+    s_loggerState->sinks.push_back(std::move(sink));
+}
 
-    if (int(level) > int(s_maxLogLevel)) {
-        return false;
-    }
+void Debug::RemoveLogSinks()
+{
+    std::vector<std::unique_ptr<LogSink>> sinks;
 
-    switch (level) {
-    case LogLevel::Error:
-        prefix = OSSTR(ANSI_BOLD ANSI_RED "Error: " ANSI_RESET);
-        break;
-    case LogLevel::Warning:
-        prefix = OSSTR(ANSI_BOLD ANSI_YELLOW "Warning: " ANSI_RESET);
-        break;
-    case LogLevel::Info:
-        prefix = OSSTR(ANSI_BOLD ANSI_BLUE "Info: " ANSI_RESET);
-        break;
-    case LogLevel::Debug:
-        prefix = OSSTR(ANSI_BOLD ANSI_MAGENTA "Debug: " ANSI_RESET);
-        break;
-    case LogLevel::Trace:
-        prefix = OSSTR(ANSI_BOLD ANSI_CYAN "Trace: " ANSI_BLACK);
-        break;
-    default:
-        return false;
+    {
+        ScopedLock lock{s_loggerState->mutex};
+        auto& allSinks = s_loggerState->sinks;
+
+        std::move(allSinks.begin() + 1, allSinks.end(), std::back_inserter(sinks));
+        allSinks.resize(1);
     }
 
-    if (!s_loggerState->mutex.TryLock()) {
-        return false;
-    } else if (s_loggerState->locked) {
-        s_loggerState->mutex.Unlock();
+    // Destroy them without the mutex, since they may wait for their threads.
+    sinks.clear();
+}
+
+bool Debug::StartAsyncLogger(const AsyncLoggerParams& params, Out<std::string> outError)
+{
+    auto queue = std::make_unique<AsyncLogQueue>(params);
+
+    ASSERT(!s_asyncLogQueue.load(std::memory_order_relaxed));
+
+    if (!queue->Start(outError)) {
         return false;
     }
 
-    s_loggerState->locked = true;
+    s_asyncLogQueue.store(queue.release(), std::memory_order_release);
+    return true;
+}
+
+void Debug::StopAsyncLogger()
+{
+    delete s_asyncLogQueue.exchange(nullptr, std::memory_order_acq_rel);
+}
 
-#ifdef _WIN32
-    fputws(prefix, stderr);
-#else
-    fputs(prefix, stderr);
-#endif
+bool Debug::StartDeferredLogger(const DeferredLoggerParams& params, Out<std::string> outError)
+{
+    auto logger = std::make_unique<DeferredLogger>(params);
 
+    ASSERT(!s_deferredLogger.load(std::memory_order_relaxed));
+
+    if (!logger->Start(outError)) {
+        return false;
+    }
+
+    s_deferredLogger.store(logger.release(), std::memory_order_release);
     return true;
 }
 
-void Debug::Internal::PutLogMessageChar(oschar_t ch)
+void Debug::StopDeferredLogger()
 {
-#ifdef _WIN32
-    fputwc(ch, stderr);
-#else
-    fputc(ch, stderr);
-#endif
+    delete s_deferredLogger.exchange(nullptr, std::memory_order_acq_rel);
+}
+
+OsString* Debug::Internal::BeginLogMessage(LogLevel level)
+{
+    ThreadLogState& state = t_logState;
+
+    // Fatal errors have their own path.
+    if (level <= LogLevel::Fatal || level > LogLevel::Trace || state.isInMessage) {
+        return nullptr;
+    }
+
+    state.isInMessage = true;
+    state.level = level;
+    state.buffer.clear();
+    return &state.buffer;
 }
 
 void Debug::Internal::EndLogMessage(const char* sourceFileName, int sourceLine)
 {
-    WriteLogMessageSuffix(sourceFileName, sourceLine);
-    s_loggerState->locked = false;
-    s_loggerState->mutex.Unlock();
+    ThreadLogState& state = t_logState;
+    LogRecord record;
+
+    record.timestamp = LogRecord::GetCurrentTimestamp();
+    record.threadId = state.threadId;
+    record.level = state.level;
+    record.sourceFileName = GetShortSourceFileName(sourceFileName);
+    record.sourceLine = sourceLine;
+    record.message = state.buffer;
+
+    RecordLogMessage(record.level, record.sourceFileName, sourceLine, state.buffer);
+
+    if (AsyncLogQueue* queue = s_asyncLogQueue.load(std::memory_order_acquire)) {
+        queue->Push(record, state.buffer);
+    } else {
+        WriteLogRecord(record);
+    }
+
+    if (state.buffer.capacity() > MaxRetainedBufferSize) {
+        state.buffer.clear();
+        state.buffer.shrink_to_fit();
+    }
+
+    state.isInMessage = false;
+}
+
+bool Debug::Internal::IsDeferredLoggerRunning()
+{
+    return s_deferredLogger.load(std::memory_order_acquire) != nullptr;
+}
+
+uint8_t* Debug::Internal::BeginDeferredRecord(DeferredFormatFunction format, const DeferredLogSite& site,
+                                              OsStringView fmt, size_t argSize)
+{
+    constexpr size_t alignment = DeferredLogBuffer::RecordAlignment;
+    size_t size = (sizeof(DeferredLogRecord) + argSize + alignment - 1) & ~(alignment - 1);
+    DeferredLogThreadState& state = t_deferredLogState;
+    int64_t timestamp = GetSteadyTimestamp();
+    uint8_t* data;
+
+    RecordUnformattedLogMessage(site.level, site.sourceFileName, site.sourceLine, fmt.data(), timestamp);
+
+    if (!state.buffer) {
+        // A thread keeps its ring if the logger is restarted.
+        size_t capacity = s_deferredLogger.load(std::memory_order_acquire)->GetBufferCapacity();
+        state.buffer = std::make_shared<DeferredLogBuffer>(t_logState.threadId, capacity);
+
+        ScopedLock lock{s_loggerState->deferredBuffersMutex};
+        s_loggerState->deferredBuffers.push_back(state.buffer);
+    }
+
+    data = state.buffer->Reserve(size);
+    if (!data) {
+        return nullptr;
+    }
+
+    auto record = reinterpret_cast<DeferredLogRecord*>(data);
+    record->format = format;
+    record->site = &site;
+    record->fmt = fmt.data();
+    record->timestamp = timestamp;
+    record->fmtSize = uint32_t(fmt.size());
+    record->size = uint32_t(size);
+    return data + sizeof(DeferredLogRecord);
+}
+
+void Debug::Internal::EndDeferredRecord()
+{
+    if (t_deferredLogState.buffer->Commit()) {
+        s_deferredLogger.load(std::memory_order_acquire)->Wake();
+    }
 }
 
 void Debug::Internal::BeginFatalError()
 {
     s_loggerState->mutex.Lock();
-    s_loggerState->locked = true;
+    t_logState.isInMessage = true;
     s_loggerState->fatalErrorMessage.clear(); // In case we're interrupting another fatal error message
 }
 
@@ -216,19 +904,36 @@ void Debug::Internal::PutFatalErrorChar(oschar_t ch)
 
 void Debug::Internal::EndFatalErrorAndExit(const char* sourceFileName, int sourceLine)
 {
-#ifdef _WIN32
-    // We can't simply use fwprintf for all of this, because some implementations of Windows CRT
-    // have the types reversed for %s and %S.
-    fputws(L"" ANSI_BOLD ANSI_RED "Fatal error: " ANSI_RESET ANSI_BOLD, stderr);
-    fputws(s_loggerState->fatalErrorMessage.c_str(), stderr);
-#else
-    fprintf(stderr, ANSI_BOLD ANSI_RED "Fatal error: " ANSI_RESET ANSI_BOLD "%s", s_loggerState->fatalErrorMessage.c_str());
-#endif
+    LogRecord record;
+
+    // The mutex is held since BeginFatalError(), so the logger threads can't be draining at the
+    // same time.
+    if (AsyncLogQueue* queue = s_asyncLogQueue.load(std::memory_order_acquire)) {
+        queue->Drain();
+    }
+    if (s_deferredLogger.load(std::memory_order_acquire)) {
+        DrainDeferredLogBuffers();
+    }
+
+    sourceFileName = GetShortSourceFileName(sourceFileName);
+
+    record.timestamp = LogRecord::GetCurrentTimestamp();
+    record.threadId = t_logState.threadId;
+    record.level = LogLevel::Fatal;
+    record.sourceFileName = sourceFileName;
+    record.sourceLine = sourceLine;
+    record.message = s_loggerState->fatalErrorMessage;
+    WriteToSinks(record);
+
+    // Sinks with threads of their own may have records pending, and won't get a chance later.
+    for (const auto& sink : s_loggerState->sinks) {
+        sink->Flush();
+    }
 
-    WriteLogMessageSuffix(sourceFileName, sourceLine);
+    RecordLogMessage(LogLevel::Fatal, sourceFileName, sourceLine, s_loggerState->fatalErrorMessage);
+    DumpFlightRecorder("Fatal error");
 
     if (sourceFileName) {
-        sourceFileName = GetShortSourceFileName(sourceFileName);
         fmt::format_to(FatalErrorIterator{}, OsStringView{OSSTR(" ({}:{})")}, Forward(sourceFileName), sourceLine);
     }
 
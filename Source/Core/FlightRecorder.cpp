@@ -0,0 +1,425 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <string.h>
+#ifdef _WIN32
+# include <stdio.h>
+#else
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+#include <Core/Debug.h>
+
+using namespace ArenaBuilder;
+
+namespace {
+
+    enum class FlightRecordKind : uint8_t {
+        Message,
+        UnformattedMessage, // Filtered out or deferred, so only the format string is known
+        Event,
+    };
+
+    // Fixed-size record, so that recording never allocates and dumping needs no parsing. Message
+    // text is truncated to fit.
+    struct FlightRecord {
+        static constexpr size_t TextCapacity = 200;
+
+        int64_t timestamp; // Nanoseconds on the steady clock
+        const char* sourceFileName;
+        const oschar_t* format;
+        const char* tag;
+        uint64_t value;
+        int32_t sourceLine;
+        FlightRecordKind kind;
+        LogLevel level;
+        uint16_t textSize;
+        char text[TextCapacity];
+    };
+
+    // Ring of one thread's most recent records. Only that thread writes to it, and the dump reads it
+    // without any synchronization, since by then the process is going down anyway. When a thread
+    // exits, its ring is kept for the dump until another thread claims it.
+    struct FlightRecorderRing {
+        static constexpr uint32_t Capacity = 256;
+
+        std::atomic<bool> isInUse{true};
+        std::atomic<uint32_t> recordCount{0}; // Total, so the newest is at (recordCount - 1) % Capacity
+        FlightRecord records[Capacity];
+    };
+
+    // Rings are only added, never removed, so the dump can walk them without locking.
+    constexpr size_t MaxRingCount = 128;
+
+    std::atomic<FlightRecorderRing*> s_rings[MaxRingCount];
+    std::atomic<size_t> s_ringCount{0};
+    OsString s_dumpPath;
+    std::atomic<bool> s_isDumping{false};
+    const int64_t s_startTime = Debug::Internal::GetSteadyTimestamp();
+
+    // Releases the calling thread's ring when the thread exits.
+    struct FlightRecorderThreadState {
+        FlightRecorderRing* ring = nullptr;
+        bool isExhausted = false; // Every ring is taken
+
+        ~FlightRecorderThreadState()
+        {
+            if (ring) {
+                ring->isInUse.store(false, std::memory_order_release);
+            }
+        }
+    };
+
+    thread_local FlightRecorderThreadState t_flightRecorderState;
+
+    FlightRecorderRing* ClaimRing()
+    {
+        size_t ringCount = std::min(s_ringCount.load(std::memory_order_acquire), MaxRingCount);
+        size_t index;
+
+        // Reuse a ring from a thread that has exited, if any.
+        for (size_t i = 0; i < ringCount; ++i) {
+            FlightRecorderRing* existing = s_rings[i].load(std::memory_order_acquire);
+            bool isInUse = false;
+
+            if (existing && existing->isInUse.compare_exchange_strong(isInUse, true, std::memory_order_acquire)) {
+                return existing;
+            }
+        }
+
+        index = s_ringCount.fetch_add(1, std::memory_order_acq_rel);
+        if (index >= MaxRingCount) {
+            return nullptr;
+        }
+
+        FlightRecorderRing* ring = new FlightRecorderRing;
+        s_rings[index].store(ring, std::memory_order_release);
+        return ring;
+    }
+
+    FlightRecord* BeginRecord(FlightRecordKind kind, int64_t timestamp)
+    {
+        FlightRecorderThreadState& state = t_flightRecorderState;
+
+        if (!state.ring) {
+            if (state.isExhausted) {
+                return nullptr;
+            }
+
+            state.ring = ClaimRing();
+            if (!state.ring) {
+                state.isExhausted = true;
+                return nullptr;
+            }
+        }
+
+        uint32_t count = state.ring->recordCount.load(std::memory_order_relaxed);
+        FlightRecord& record = state.ring->records[count % FlightRecorderRing::Capacity];
+
+        record.timestamp = timestamp;
+        record.kind = kind;
+        return &record;
+    }
+
+    void EndRecord()
+    {
+        FlightRecorderRing* ring = t_flightRecorderState.ring;
+        ring->recordCount.store(ring->recordCount.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Copies text into a record, replacing anything that isn't ASCII on Windows, where the text is
+    // wide. Only used for diagnostics, so that's good enough.
+    void CopyRecordText(FlightRecord& record, OsStringView text)
+    {
+        size_t size = std::min(text.size(), FlightRecord::TextCapacity);
+
+#ifdef _WIN32
+        for (size_t i = 0; i < size; ++i) {
+            record.text[i] = uint32_t(text[i]) < 0x80 ? char(text[i]) : '?';
+        }
+#else
+        memcpy(record.text, text.data(), size);
+#endif
+
+        record.textSize = uint16_t(size);
+    }
+
+    //----------------------------------------------------------------------------------------------
+    // Dumping. Everything below must be async-signal-safe: no allocation, no locks and no stdio on
+    // Unix.
+
+    class DumpWriter {
+    public:
+        DumpWriter() = delete;
+        DumpWriter(const DumpWriter&) = delete;
+        DumpWriter(DumpWriter&&) = delete;
+
+        explicit DumpWriter(const oschar_t* path)
+        {
+#ifdef _WIN32
+            m_file = _wfopen(path, L"wb");
+#else
+            m_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#endif
+        }
+
+        ~DumpWriter()
+        {
+            Flush();
+#ifdef _WIN32
+            if (m_file) {
+                fclose(m_file);
+            }
+#else
+            if (m_fd >= 0) {
+                close(m_fd);
+            }
+#endif
+        }
+
+        bool IsOpen() const
+        {
+#ifdef _WIN32
+            return m_file != nullptr;
+#else
+            return m_fd >= 0;
+#endif
+        }
+
+        void Write(const char* data, size_t size)
+        {
+            while (size) {
+                size_t chunkSize = std::min(size, sizeof(m_buffer) - m_size);
+
+                memcpy(&m_buffer[m_size], data, chunkSize);
+                m_size += chunkSize;
+                data += chunkSize;
+                size -= chunkSize;
+
+                if (m_size == sizeof(m_buffer)) {
+                    Flush();
+                }
+            }
+        }
+
+        void Write(std::string_view str) { Write(str.data(), str.size()); }
+
+#ifdef _WIN32
+        void Write(OsStringView str)
+        {
+            for (oschar_t ch : str) {
+                char narrow = uint32_t(ch) < 0x80 ? char(ch) : '?';
+                Write(&narrow, 1);
+            }
+        }
+#endif
+
+        void WriteNumber(uint64_t value, size_t minDigits = 1)
+        {
+            char digits[20];
+            size_t count = 0;
+
+            do {
+                digits[sizeof(digits) - ++count] = char('0' + value % 10);
+                value /= 10;
+            } while (value || count < minDigits);
+
+            Write(&digits[sizeof(digits) - count], count);
+        }
+
+        void Flush()
+        {
+#ifdef _WIN32
+            if (m_file) {
+                fwrite(m_buffer, 1, m_size, m_file);
+            }
+#else
+            for (size_t offset = 0; m_fd >= 0 && offset < m_size;) {
+                ssize_t written = write(m_fd, &m_buffer[offset], m_size - offset);
+                if (written <= 0) {
+                    break;
+                }
+                offset += size_t(written);
+            }
+#endif
+            m_size = 0;
+        }
+
+        DumpWriter& operator=(const DumpWriter&) = delete;
+        DumpWriter& operator=(DumpWriter&&) = delete;
+
+    private:
+#ifdef _WIN32
+        FILE* m_file = nullptr;
+#else
+        int m_fd = -1;
+#endif
+        char m_buffer[4096];
+        size_t m_size = 0;
+    };
+
+    const char* GetLevelName(LogLevel level)
+    {
+        switch (level) {
+        case LogLevel::Fatal: return "Fatal";
+        case LogLevel::Error: return "Error";
+        case LogLevel::Warning: return "Warning";
+        case LogLevel::Info: return "Info";
+        case LogLevel::Debug: return "Debug";
+        case LogLevel::Trace: return "Trace";
+        default: return "?";
+        }
+    }
+
+    void DumpRecord(DumpWriter& writer, const FlightRecord& record)
+    {
+        int64_t time = record.timestamp - s_startTime;
+
+        // "[seconds.microseconds] "
+        writer.Write("[");
+        writer.WriteNumber(uint64_t(std::max<int64_t>(time, 0)) / 1000000000);
+        writer.Write(".");
+        writer.WriteNumber(uint64_t(std::max<int64_t>(time, 0)) / 1000 % 1000000, 6);
+        writer.Write("] ");
+
+        switch (record.kind) {
+        case FlightRecordKind::Message:
+            writer.Write(GetLevelName(record.level));
+            writer.Write(": ");
+            writer.Write(record.text, record.textSize);
+            break;
+
+        case FlightRecordKind::UnformattedMessage:
+            writer.Write(GetLevelName(record.level));
+            writer.Write(" (unformatted): ");
+            writer.Write(OsStringView{record.format});
+            break;
+
+        case FlightRecordKind::Event:
+            writer.Write("Event: ");
+            writer.Write(record.tag);
+            writer.Write(" = ");
+            writer.WriteNumber(record.value);
+            break;
+        }
+
+        if (record.sourceFileName && record.kind != FlightRecordKind::Event) {
+            writer.Write(" (");
+            writer.Write(record.sourceFileName);
+            writer.Write(":");
+            writer.WriteNumber(uint64_t(std::max(record.sourceLine, 0)));
+            writer.Write(")");
+        }
+
+        writer.Write("\n");
+    }
+
+} // namespace
+
+void Debug::SetFlightRecorderPath(OsString path)
+{
+    s_dumpPath = std::move(path);
+}
+
+void Debug::DumpFlightRecorder(const char* reason)
+{
+    size_t ringCount = std::min(s_ringCount.load(std::memory_order_acquire), MaxRingCount);
+
+    // A crash while dumping, or a fatal error followed by a crash, only dumps once.
+    if (s_dumpPath.empty() || s_isDumping.exchange(true)) {
+        return;
+    }
+
+    DumpWriter writer{s_dumpPath.c_str()};
+    if (!writer.IsOpen()) {
+        return;
+    }
+
+    writer.Write("ArenaBuilder flight recorder: ");
+    writer.Write(reason);
+    writer.Write("\n");
+
+    for (size_t i = 0; i < ringCount; ++i) {
+        const FlightRecorderRing* ring = s_rings[i].load(std::memory_order_acquire);
+        if (!ring) {
+            continue;
+        }
+
+        uint32_t count = ring->recordCount.load(std::memory_order_acquire);
+        uint32_t first = count > FlightRecorderRing::Capacity ? count - FlightRecorderRing::Capacity : 0;
+
+        writer.Write("\n--- Thread ");
+        writer.WriteNumber(i);
+        writer.Write(ring->isInUse.load(std::memory_order_relaxed) ? " ---\n" : " (exited) ---\n");
+
+        for (uint32_t j = first; j != count; ++j) {
+            DumpRecord(writer, ring->records[j % FlightRecorderRing::Capacity]);
+        }
+    }
+}
+
+int64_t Debug::Internal::GetSteadyTimestamp()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Debug::Internal::RecordLogMessage(LogLevel level, const char* sourceFileName, int sourceLine, OsStringView text)
+{
+    FlightRecord* record = BeginRecord(FlightRecordKind::Message, GetSteadyTimestamp());
+
+    if (record) {
+        record->level = level;
+        record->sourceFileName = sourceFileName;
+        record->sourceLine = sourceLine;
+        CopyRecordText(*record, text);
+        EndRecord();
+    }
+}
+
+void Debug::Internal::RecordUnformattedLogMessage(LogLevel level, const char* sourceFileName, int sourceLine,
+                                                  const oschar_t* fmt)
+{
+    RecordUnformattedLogMessage(level, sourceFileName, sourceLine, fmt, GetSteadyTimestamp());
+}
+
+void Debug::Internal::RecordUnformattedLogMessage(LogLevel level, const char* sourceFileName, int sourceLine,
+                                                  const oschar_t* fmt, int64_t timestamp)
+{
+    FlightRecord* record = BeginRecord(FlightRecordKind::UnformattedMessage, timestamp);
+
+    if (record) {
+        record->level = level;
+        record->sourceFileName = sourceFileName;
+        record->sourceLine = sourceLine;
+        record->format = fmt;
+        EndRecord();
+    }
+}
+
+void Debug::Internal::RecordTraceEvent(const char* tag, uint64_t value)
+{
+    FlightRecord* record = BeginRecord(FlightRecordKind::Event, GetSteadyTimestamp());
+
+    if (record) {
+        record->tag = tag;
+        record->value = value;
+        EndRecord();
+    }
+}
@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <algorithm>
+
+#include <Core/IO/Async.h>
+#include <Core/IO/MappedFile.h>
+#include <Core/Debug.h>
+
+using namespace ArenaBuilder;
+
+namespace {
+
+    // Reads an entire stream, using a view if the stream has one so that nothing is copied.
+    void ReadEntireStream(DataSource& source, Out<AsyncReadResult> outResult)
+    {
+        AsyncReadResult& result = *outResult;
+        std::shared_ptr<Stream> stream = source.OpenStream(result.name, Out{result.error});
+        ByteView view;
+
+        if (!stream) {
+            if (!result.error.HasError()) {
+                result.error = "Can't open stream";
+            }
+            return;
+        } else if (stream->TryGetView(Out{view})) {
+            result.data = view;
+            result.owner = std::move(stream);
+            return;
+        }
+
+        auto buffer = std::make_shared<std::vector<uint8_t>>();
+
+        if (stream->ReadAll(Out{*buffer}, Out{result.error})) {
+            result.data = {buffer->data(), buffer->size()};
+            result.owner = std::move(buffer);
+        }
+    }
+
+} // namespace
+
+void AsyncDataSource::SubmitRead(std::string name, AsyncReadCallback callback)
+{
+    std::vector<AsyncReadRequest> requests;
+
+    requests.push_back({std::move(name), std::move(callback)});
+    SubmitReads(std::move(requests));
+}
+
+//--------------------------------------------------------------------------------------------------
+
+ThreadedAsyncDataSource::ThreadedAsyncDataSource(DataSource& source, size_t threadCount)
+    : m_source{&source}
+{
+    StartThreads(threadCount);
+}
+
+ThreadedAsyncDataSource::ThreadedAsyncDataSource(std::unique_ptr<DataSource> source, size_t threadCount)
+    : m_source{source.get()}
+    , m_ownedSource{std::move(source)}
+{
+    ASSERT(m_source != nullptr);
+    StartThreads(threadCount);
+}
+
+ThreadedAsyncDataSource::~ThreadedAsyncDataSource()
+{
+    {
+        ScopedLock lock{m_mutex};
+        m_isStopping = true;
+        m_requests.clear();
+    }
+
+    m_requestSemaphore.Release(uint32_t(m_threads.size()));
+    m_threads.clear();
+}
+
+void ThreadedAsyncDataSource::SubmitReads(std::vector<AsyncReadRequest> requests)
+{
+    if (requests.empty()) {
+        return;
+    }
+
+    {
+        ScopedLock lock{m_mutex};
+        for (AsyncReadRequest& request : requests) {
+            m_requests.push_back(std::move(request));
+        }
+    }
+
+    m_pendingCount += requests.size();
+    m_requestSemaphore.Release(uint32_t(requests.size()));
+}
+
+size_t ThreadedAsyncDataSource::PollCompletions()
+{
+    std::vector<Completion> completions;
+
+    {
+        ScopedLock lock{m_mutex};
+        completions.swap(m_completions);
+    }
+
+    // Callbacks run without the lock held, so they're free to submit more reads.
+    for (Completion& completion : completions) {
+        if (completion.callback) {
+            completion.callback(completion.result);
+        }
+        --m_pendingCount;
+    }
+
+    return completions.size();
+}
+
+void ThreadedAsyncDataSource::WaitForAll()
+{
+    while (m_pendingCount) {
+        if (!PollCompletions()) {
+            m_completionSemaphore.Acquire();
+        }
+    }
+}
+
+void ThreadedAsyncDataSource::StartThreads(size_t threadCount)
+{
+    std::string error;
+
+    threadCount = std::max<size_t>(threadCount, 1);
+    m_threads.reserve(threadCount);
+
+    for (size_t i = 0; i < threadCount; ++i) {
+        auto thread = std::make_unique<Thread>();
+
+        if (!thread->Start([this]() { RunWorker(); }, Out{error})) {
+            FATAL("Can't start I/O worker thread: {}", error);
+        }
+
+        m_threads.push_back(std::move(thread));
+    }
+}
+
+void ThreadedAsyncDataSource::RunWorker()
+{
+    while (true) {
+        Completion completion;
+
+        m_requestSemaphore.Acquire();
+
+        {
+            ScopedLock lock{m_mutex};
+
+            if (m_isStopping) {
+                return;
+            } else if (m_requests.empty()) {
+                continue;
+            }
+
+            completion.result.name = std::move(m_requests.front().name);
+            completion.callback = std::move(m_requests.front().callback);
+            m_requests.pop_front();
+        }
+
+        ReadEntireStream(*m_source, Out{completion.result});
+
+        {
+            ScopedLock lock{m_mutex};
+            m_completions.push_back(std::move(completion));
+        }
+
+        m_completionSemaphore.Release();
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+
+std::unique_ptr<AsyncDataSource> ArenaBuilder::CreateAsyncFileSource(OsString rootDir, size_t threadCount)
+{
+#ifdef __linux__
+    IoError error;
+
+    if (auto source = Internal::CreateUringFileSource(rootDir, Out{error})) {
+        LOG_DEBUG("Using io_uring for asynchronous file reads");
+        return source;
+    }
+
+    LOG_DEBUG("Can't use io_uring for asynchronous file reads: {}", error);
+#endif
+
+    return std::make_unique<ThreadedAsyncDataSource>(std::make_unique<MappedFileSource>(std::move(rootDir)),
+                                                     threadCount);
+}
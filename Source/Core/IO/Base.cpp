@@ -12,6 +12,9 @@
  * under the License.
  */
 
+#include <algorithm>
+#include <limits>
+
 #include <Core/IO/Base.h>
 #include <Core/Debug.h>
 
@@ -27,7 +30,7 @@ Stream::~Stream()
 {
 }
 
-size_t Stream::Read(void* buffer, size_t size, Out<std::string> outError)
+size_t Stream::Read(void* buffer, size_t size, Out<IoError> outError)
 {
     char* position = reinterpret_cast<char*>(buffer);
     size_t bytesRemaining = size;
@@ -58,18 +61,133 @@ size_t Stream::Read(void* buffer, size_t size, Out<std::string> outError)
     return totalBytesRead;
 }
 
-size_t Stream::ReadExact(void* buffer, size_t size, Out<std::string> outError)
+size_t Stream::ReadExact(void* buffer, size_t size, Out<IoError> outError)
 {
     size_t result = Read(buffer, size, outError);
 
-    if (result < size && outError->empty()) {
-        *outError = "Unexpected end of stream";
+    if (result < size && !outError->HasError()) {
+        *outError = IoError{IoErrorCode::EndOfStream, "Unexpected end of stream"};
     }
 
     return result;
 }
 
-size_t Stream::Write(const void* buffer, size_t size, Out<std::string> outError)
+size_t Stream::ReadV(const ByteSpan* spans, size_t count, Out<IoError> outError)
+{
+    size_t spanIndex = 0;
+    size_t spanOffset = 0;
+    size_t totalBytesRead = 0;
+    size_t result;
+
+    if (!count) {
+        return 0;
+    } else if (ErrorIfClosed(outError)) {
+        return 0;
+    }
+
+    ASSERT(spans != nullptr);
+
+    for (;;) {
+        while (spanIndex < count && spanOffset == spans[spanIndex].size) {
+            ++spanIndex;
+            spanOffset = 0;
+        }
+
+        if (spanIndex == count) {
+            break;
+        }
+
+        // A partially filled span can't be passed to DoReadV() without copying the span array, so
+        // finish it with DoRead() first.
+        if (spanOffset) {
+            result = DoRead(spans[spanIndex].data + spanOffset, spans[spanIndex].size - spanOffset, outError);
+        } else {
+            result = DoReadV(&spans[spanIndex], count - spanIndex, outError);
+        }
+
+        if (!result) {
+            SetEof();
+            break;
+        }
+
+        totalBytesRead += result;
+
+        while (result) {
+            size_t spanBytes = std::min(result, spans[spanIndex].size - spanOffset);
+            spanOffset += spanBytes;
+            result -= spanBytes;
+
+            if (spanOffset == spans[spanIndex].size) {
+                ++spanIndex;
+                spanOffset = 0;
+            }
+        }
+    }
+
+    return totalBytesRead;
+}
+
+bool Stream::ReadAll(Out<std::vector<uint8_t>> outData, Out<IoError> outError)
+{
+    std::vector<uint8_t>& data = *outData;
+    uint8_t probe[4096];
+    uint64_t size;
+    size_t result;
+
+    data.clear();
+
+    if (ErrorIfClosed(outError)) {
+        return false;
+    }
+
+    // Read the expected size in one go. Non-seekable streams report a position of zero, so this
+    // may be an overestimate if some of the stream was already read.
+    if (GetSize(Out{size}) && size > Tell()) {
+        size -= Tell();
+        if (size > std::numeric_limits<size_t>::max()) {
+            *outError = "Stream is too large";
+            return false;
+        }
+
+        data.resize(size_t(size));
+        data.resize(Read(data.data(), data.size(), outError));
+
+        if (outError->HasError()) {
+            return false;
+        } else if (data.size() < size) {
+            return true;
+        }
+    }
+
+    // Check for the end through a small buffer first so that a stream of the expected size
+    // doesn't end up with twice the capacity it needs.
+    result = Read(probe, sizeof(probe), outError);
+    data.insert(data.end(), probe, probe + result);
+
+    if (outError->HasError()) {
+        return false;
+    } else if (result < sizeof(probe)) {
+        return true;
+    }
+
+    // The size is unknown or wrong, so grow the output geometrically.
+    for (;;) {
+        size_t oldSize = data.size();
+        size_t readSize = std::max(oldSize, sizeof(probe));
+
+        data.resize(oldSize + readSize);
+        result = Read(&data[oldSize], readSize, outError);
+        data.resize(oldSize + result);
+
+        if (outError->HasError()) {
+            return false;
+        } else if (result < readSize) {
+            return true;
+        }
+    }
+}
+
+size_t Stream::Write(const void* buffer, size_t size, Out<IoError> outError)
 {
     const char* position = reinterpret_cast<const char*>(buffer);
     size_t bytesRemaining = size;
@@ -87,8 +205,8 @@ size_t Stream::Write(const void* buffer, size_t size, Out<std::string> outError)
     while (totalBytesWritten < size) {
         result = DoWrite(position, bytesRemaining, outError);
         if (!result) {
-            if (outError->empty()) {
-                *outError = "Unexpected end of stream";
+            if (!outError->HasError()) {
+                *outError = IoError{IoErrorCode::EndOfStream, "Unexpected end of stream"};
             }
             break;
         }
@@ -102,23 +220,123 @@ size_t Stream::Write(const void* buffer, size_t size, Out<std::string> outError)
     return totalBytesWritten;
 }
 
-size_t Stream::DoRead(void*, size_t, Out<std::string> outError)
+bool Stream::TryGetView(Out<ByteView>) const
+{
+    return false;
+}
+
+bool Stream::IsSeekable() const
+{
+    return false;
+}
+
+bool Stream::GetSize(Out<uint64_t>) const
+{
+    return false;
+}
+
+uint64_t Stream::Tell() const
 {
-    *outError = "Stream is not readable";
     return 0;
 }
 
-size_t Stream::DoWrite(const void*, size_t, Out<std::string> outError)
+bool Stream::Seek(int64_t offset, SeekOrigin origin, Out<IoError> outError)
 {
-    *outError = "Stream is not writable";
+    uint64_t base = 0;
+    uint64_t size;
+    uint64_t position;
+    bool hasSize;
+
+    if (ErrorIfClosed(outError)) {
+        return false;
+    } else if (!IsSeekable()) {
+        *outError = IoError{IoErrorCode::NotSupported, "Stream is not seekable"};
+        return false;
+    }
+
+    hasSize = GetSize(Out{size});
+
+    switch (origin) {
+    case SeekOrigin::Begin:
+        break;
+    case SeekOrigin::Current:
+        base = Tell();
+        break;
+    case SeekOrigin::End:
+        if (!hasSize) {
+            *outError = IoError{IoErrorCode::NotSupported, "Stream size is unknown"};
+            return false;
+        }
+        base = size;
+        break;
+    }
+
+    // Avoid negating INT64_MIN.
+    if (offset < 0) {
+        uint64_t distance = uint64_t(-(offset + 1)) + 1;
+        if (distance > base) {
+            *outError = IoError{IoErrorCode::InvalidArgument, "Seek position is before the start of the stream"};
+            return false;
+        }
+        position = base - distance;
+    } else {
+        position = base + uint64_t(offset);
+        if (position < base || (hasSize && position > size)) {
+            *outError = IoError{IoErrorCode::InvalidArgument, "Seek position is past the end of the stream"};
+            return false;
+        }
+    }
+
+    if (!DoSeek(position, outError)) {
+        return false;
+    }
+
+    ClearEof();
+    return true;
+}
+
+size_t Stream::DoRead(void*, size_t, Out<IoError> outError)
+{
+    *outError = IoError{IoErrorCode::NotSupported, "Stream is not readable"};
+    return 0;
+}
+
+size_t Stream::DoReadV(const ByteSpan* spans, size_t, Out<IoError> outError)
+{
+    return DoRead(spans[0].data, spans[0].size, outError);
+}
+
+size_t Stream::DoWrite(const void*, size_t, Out<IoError> outError)
+{
+    *outError = IoError{IoErrorCode::NotSupported, "Stream is not writable"};
     return 0;
 }
 
-bool Stream::ErrorIfClosed(Out<std::string> outError) const
+bool Stream::DoSeek(uint64_t, Out<IoError> outError)
+{
+    *outError = IoError{IoErrorCode::NotSupported, "Stream is not seekable"};
+    return false;
+}
+
+bool Stream::ErrorIfClosed(Out<IoError> outError) const
 {
     if (!IsOpen()) {
-        *outError = "Stream is closed";
+        *outError = IoError{IoErrorCode::Closed, "Stream is closed"};
         return true;
     }
     return false;
 }
+
+//--------------------------------------------------------------------------------------------------
+
+bool DataSource::EnumerateEntries(const EntryCallback&, Out<IoError> outError)
+{
+    *outError = "Data source can't list its entries";
+    return false;
+}
+
+std::unique_ptr<Stream> DataSource::OpenEntryStream(uint64_t, Out<IoError> outError)
+{
+    *outError = "Data source can't open entries by ID";
+    return nullptr;
+}
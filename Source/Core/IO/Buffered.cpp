@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <algorithm>
+
+#include <Core/IO/Buffered.h>
+#include <Core/Debug.h>
+
+using namespace ArenaBuilder;
+
+BufferedStream::BufferedStream(Stream& source, size_t bufferSize)
+    : m_source{&source}
+    , m_buffer{new uint8_t[bufferSize]}
+    , m_capacity{bufferSize}
+{
+    ASSERT(bufferSize > 0);
+}
+
+BufferedStream::BufferedStream(std::unique_ptr<Stream> source, size_t bufferSize)
+    : m_source{source.get()}
+    , m_ownedSource{std::move(source)}
+    , m_buffer{new uint8_t[bufferSize]}
+    , m_capacity{bufferSize}
+{
+    ASSERT(m_source != nullptr);
+    ASSERT(bufferSize > 0);
+}
+
+BufferedStream::~BufferedStream()
+{
+}
+
+void BufferedStream::Close()
+{
+    m_source->Close();
+    m_position = 0;
+    m_end = 0;
+}
+
+size_t BufferedStream::Peek(void* buffer, size_t size, Out<IoError> outError)
+{
+    size = std::min(size, m_capacity);
+    Fill(size, outError);
+    size = std::min(size, GetBufferedSize());
+
+    if (size) {
+        std::memcpy(buffer, &m_buffer[m_position], size);
+    }
+
+    return size;
+}
+
+size_t BufferedStream::Skip(size_t size, Out<IoError> outError)
+{
+    size_t totalBytesSkipped = std::min(size, GetBufferedSize());
+    size_t result;
+
+    m_position += totalBytesSkipped;
+
+    while (totalBytesSkipped < size) {
+        if (!Fill(1, outError)) {
+            break;
+        } else if (!GetBufferedSize()) {
+            SetEof();
+            break;
+        }
+
+        result = std::min(size - totalBytesSkipped, GetBufferedSize());
+        m_position += result;
+        totalBytesSkipped += result;
+    }
+
+    return totalBytesSkipped;
+}
+
+bool BufferedStream::ReadLine(Out<std::string> outLine, Out<IoError> outError)
+{
+    const uint8_t* start;
+    const void* newline;
+    bool gotAnyData = false;
+
+    outLine->clear();
+
+    while (true) {
+        if (!Fill(1, outError)) {
+            return false;
+        } else if (!GetBufferedSize()) {
+            // Reached the end of the stream. A final line without a terminator still counts.
+            SetEof();
+            if (!gotAnyData) {
+                return false;
+            }
+            break;
+        }
+
+        start = &m_buffer[m_position];
+        newline = std::memchr(start, '\n', GetBufferedSize());
+        gotAnyData = true;
+
+        if (newline) {
+            size_t length = size_t(static_cast<const uint8_t*>(newline) - start);
+            outLine->append(reinterpret_cast<const char*>(start), length);
+            m_position += length + 1;
+            break;
+        }
+
+        outLine->append(reinterpret_cast<const char*>(start), GetBufferedSize());
+        m_position = m_end;
+    }
+
+    if (!outLine->empty() && outLine->back() == '\r') {
+        outLine->pop_back();
+    }
+
+    return true;
+}
+
+size_t BufferedStream::DoRead(void* buffer, size_t size, Out<IoError> outError)
+{
+    if (!GetBufferedSize()) {
+        // Large reads bypass the buffer entirely rather than being copied through it. Already
+        // consumed bytes are dropped so that the buffer always ends at the source's position.
+        if (size >= m_capacity) {
+            m_position = m_end = 0;
+            return m_source->Read(buffer, size, outError);
+        } else if (!Fill(1, outError)) {
+            return 0;
+        }
+    }
+
+    size = std::min(size, GetBufferedSize());
+    ConsumeBuffered(buffer, size);
+    return size;
+}
+
+bool BufferedStream::DoSeek(uint64_t position, Out<IoError> outError)
+{
+    uint64_t sourcePosition = m_source->Tell();
+    uint64_t bufferStart = sourcePosition - m_end;
+
+    // The buffer holds the bytes just before the source's position, so seeks that land inside it
+    // don't need to touch the source.
+    if (position >= bufferStart && position <= sourcePosition) {
+        m_position = size_t(position - bufferStart);
+        return true;
+    }
+
+    m_position = m_end = 0;
+    return m_source->Seek(int64_t(position), SeekOrigin::Begin, outError);
+}
+
+bool BufferedStream::Fill(size_t minSize, Out<IoError> outError)
+{
+    ASSERT(minSize <= m_capacity);
+
+    if (GetBufferedSize() >= minSize) {
+        return true;
+    }
+
+    if (m_position) {
+        std::memmove(&m_buffer[0], &m_buffer[m_position], GetBufferedSize());
+        m_end -= m_position;
+        m_position = 0;
+    }
+
+    // Stream::Read() keeps reading until the buffer is full, so a short read means either the end
+    // of the stream or an error.
+    m_end += m_source->Read(&m_buffer[m_end], m_capacity - m_end, outError);
+    return !outError->HasError();
+}
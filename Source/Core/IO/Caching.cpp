@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+#include <Core/IO/Caching.h>
+#include <Core/IO/Memory.h>
+#include <Core/Debug.h>
+#include <Core/Mutex.h>
+
+using namespace ArenaBuilder;
+
+namespace {
+
+    struct CacheItem {
+        std::string name;
+        uint64_t nameHash;
+        std::shared_ptr<const std::vector<uint8_t>> data;
+    };
+
+    // Reads the rest of a stream into a new blob. Returns null if an error occurs.
+    std::shared_ptr<std::vector<uint8_t>> ReadBlob(Stream& stream, Out<IoError> outError)
+    {
+        auto blob = std::make_shared<std::vector<uint8_t>>();
+
+        if (!stream.ReadAll(Out{*blob}, outError)) {
+            return nullptr;
+        }
+
+        return blob;
+    }
+
+    std::unique_ptr<Stream> CreateBlobStream(std::shared_ptr<const std::vector<uint8_t>> blob)
+    {
+        ByteView view{blob->data(), blob->size()};
+        return std::make_unique<MemoryInputStream>(view, std::move(blob));
+    }
+
+} // namespace
+
+struct CachingDataSource::Shard {
+    using ItemList = std::list<CacheItem>;
+
+    RecursiveMutex mutex; // Guards everything below
+    ItemList items; // Most recently used first
+    std::unordered_multimap<uint64_t, ItemList::iterator> index; // Keyed by name hash
+    size_t byteCount = 0;
+    size_t byteBudget = 0;
+    uint64_t hitCount = 0;
+    uint64_t missCount = 0;
+    uint64_t bypassCount = 0;
+    uint64_t evictionCount = 0;
+
+    ItemList::iterator Find(const HashedName& name)
+    {
+        auto range = index.equal_range(name.hash);
+
+        for (auto iter = range.first; iter != range.second; ++iter) {
+            if (iter->second->name == name.name) {
+                return iter->second;
+            }
+        }
+
+        return items.end();
+    }
+
+    void Remove(ItemList::iterator item)
+    {
+        auto range = index.equal_range(item->nameHash);
+
+        for (auto iter = range.first; iter != range.second; ++iter) {
+            if (iter->second == item) {
+                index.erase(iter);
+                break;
+            }
+        }
+
+        byteCount -= item->data->size();
+        items.erase(item);
+    }
+};
+
+CachingDataSource::CachingDataSource(DataSource& source, size_t byteBudget, size_t shardCount)
+    : m_source{&source}
+    , m_byteBudget{byteBudget}
+{
+    Initialize(shardCount);
+}
+
+CachingDataSource::CachingDataSource(std::unique_ptr<DataSource> source, size_t byteBudget, size_t shardCount)
+    : m_source{source.get()}
+    , m_ownedSource{std::move(source)}
+    , m_byteBudget{byteBudget}
+{
+    ASSERT(m_source != nullptr);
+    Initialize(shardCount);
+}
+
+CachingDataSource::~CachingDataSource()
+{
+}
+
+std::unique_ptr<Stream> CachingDataSource::OpenStream(std::string_view name, Out<IoError> outError)
+{
+    return OpenStream(HashedName{name}, outError);
+}
+
+std::unique_ptr<Stream> CachingDataSource::OpenStream(const HashedName& name, Out<IoError> outError)
+{
+    Shard& shard = GetShard(name.hash);
+    std::unique_ptr<Stream> stream;
+    std::shared_ptr<const std::vector<uint8_t>> blob;
+    ByteView view;
+    uint64_t size;
+
+    {
+        ScopedLock lock{shard.mutex};
+        auto item = shard.Find(name);
+
+        if (item != shard.items.end()) {
+            shard.items.splice(shard.items.begin(), shard.items, item);
+            ++shard.hitCount;
+            return CreateBlobStream(item->data);
+        }
+    }
+
+    // Read without holding the lock. If another thread misses on the same name at the same time,
+    // both read it and the first to finish keeps its copy in the cache.
+    stream = m_source->OpenStream(name.name, outError);
+    if (!stream) {
+        return nullptr;
+    } else if (stream->TryGetView(Out{view}) || (stream->GetSize(Out{size}) && size > shard.byteBudget)) {
+        ScopedLock lock{shard.mutex};
+        ++shard.bypassCount;
+        return stream;
+    }
+
+    blob = ReadBlob(*stream, outError);
+    if (!blob) {
+        return nullptr;
+    }
+
+    ScopedLock lock{shard.mutex};
+
+    if (blob->size() > shard.byteBudget) {
+        ++shard.bypassCount;
+        return CreateBlobStream(std::move(blob));
+    }
+
+    ++shard.missCount;
+    LOG_TRACE_DEFERRED("Cache miss for name hash {:016x}, {} bytes", name.hash, blob->size());
+
+    if (shard.Find(name) == shard.items.end()) {
+        shard.items.push_front({std::string{name.name}, name.hash, blob});
+        shard.index.emplace(name.hash, shard.items.begin());
+        shard.byteCount += blob->size();
+
+        while (shard.byteCount > shard.byteBudget) {
+            shard.Remove(std::prev(shard.items.end()));
+            ++shard.evictionCount;
+        }
+    }
+
+    return CreateBlobStream(std::move(blob));
+}
+
+bool CachingDataSource::EnumerateEntries(const EntryCallback& callback, Out<IoError> outError)
+{
+    return m_source->EnumerateEntries([&callback](std::string_view name, uint64_t) { callback(name, NoEntryId); },
+                                      outError);
+}
+
+void CachingDataSource::Invalidate(std::string_view name)
+{
+    HashedName hashedName{name};
+    Shard& shard = GetShard(hashedName.hash);
+    ScopedLock lock{shard.mutex};
+    auto item = shard.Find(hashedName);
+
+    if (item != shard.items.end()) {
+        shard.Remove(item);
+    }
+}
+
+void CachingDataSource::Clear()
+{
+    for (size_t i = 0; i < m_shardCount; ++i) {
+        Shard& shard = m_shards[i];
+        ScopedLock lock{shard.mutex};
+
+        shard.items.clear();
+        shard.index.clear();
+        shard.byteCount = 0;
+    }
+}
+
+DataCacheStats CachingDataSource::GetStats() const
+{
+    DataCacheStats stats;
+
+    stats.byteBudget = m_byteBudget;
+
+    for (size_t i = 0; i < m_shardCount; ++i) {
+        Shard& shard = m_shards[i];
+        ScopedLock lock{shard.mutex};
+
+        stats.hitCount += shard.hitCount;
+        stats.missCount += shard.missCount;
+        stats.bypassCount += shard.bypassCount;
+        stats.evictionCount += shard.evictionCount;
+        stats.entryCount += shard.items.size();
+        stats.byteCount += shard.byteCount;
+    }
+
+    return stats;
+}
+
+void CachingDataSource::LogStats() const
+{
+    DataCacheStats stats = GetStats();
+
+    LOG_INFO("Data cache: {} hits, {} misses, {} bypassed, {} evicted; {} entries using {}/{} bytes",
+             stats.hitCount, stats.missCount, stats.bypassCount, stats.evictionCount, stats.entryCount,
+             stats.byteCount, stats.byteBudget);
+}
+
+void CachingDataSource::Initialize(size_t shardCount)
+{
+    ASSERT(shardCount > 0);
+
+    m_shardCount = shardCount;
+    m_shards.reset(new Shard[shardCount]);
+
+    for (size_t i = 0; i < shardCount; ++i) {
+        m_shards[i].byteBudget = m_byteBudget / shardCount;
+    }
+}
+
+CachingDataSource::Shard& CachingDataSource::GetShard(uint64_t nameHash) const
+{
+    // The low bits of the hash are used by the shard's index, so pick the shard with the high bits.
+    return m_shards[size_t((nameHash >> 32) % m_shardCount)];
+}
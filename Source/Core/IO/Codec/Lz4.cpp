@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <algorithm>
+
+#include <lz4frame.h>
+
+#include <Core/IO/Codec/Lz4.h>
+#include <Core/Debug.h>
+
+using namespace ArenaBuilder;
+
+namespace {
+
+    constexpr size_t BlockSize = 65536;
+
+    LZ4F_preferences_t GetPreferences(int level)
+    {
+        LZ4F_preferences_t preferences = {};
+
+        preferences.frameInfo.blockSizeID = LZ4F_max64KB;
+        preferences.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+        preferences.compressionLevel = level;
+        return preferences;
+    }
+
+} // namespace
+
+Lz4InputStream::Lz4InputStream(Stream& source)
+    : m_source{&source}
+{
+    Init();
+}
+
+Lz4InputStream::Lz4InputStream(std::unique_ptr<Stream> source)
+    : m_source{source.get()}
+    , m_ownedSource{std::move(source)}
+{
+    ASSERT(m_source != nullptr);
+    Init();
+}
+
+Lz4InputStream::~Lz4InputStream()
+{
+    LZ4F_freeDecompressionContext(m_context);
+}
+
+void Lz4InputStream::Close()
+{
+    if (m_context) {
+        LZ4F_freeDecompressionContext(m_context);
+        m_context = nullptr;
+    }
+
+    m_source->Close();
+    m_buffer.reset();
+    m_position = m_end = 0;
+}
+
+size_t Lz4InputStream::DoRead(void* buffer, size_t size, Out<IoError> outError)
+{
+    size_t totalBytesRead = 0;
+    size_t inputSize;
+    size_t outputSize;
+    size_t result;
+
+    // Loop until some output is produced, since a frame or block header alone may consume all
+    // buffered input without producing anything.
+    while (!totalBytesRead) {
+        if (m_position == m_end) {
+            m_position = 0;
+            m_end = m_source->Read(m_buffer.get(), BufferSize, outError);
+
+            if (!m_end) {
+                if (!outError->HasError() && !m_isFrameComplete) {
+                    *outError = IoError{IoErrorCode::InvalidData, "Truncated LZ4 stream"};
+                }
+                return 0;
+            }
+        }
+
+        inputSize = m_end - m_position;
+        outputSize = size;
+        result = LZ4F_decompress(m_context, buffer, &outputSize, &m_buffer[m_position], &inputSize, nullptr);
+
+        if (LZ4F_isError(result)) {
+            *outError = LZ4F_getErrorName(result);
+            return 0;
+        }
+
+        m_position += inputSize;
+        totalBytesRead = outputSize;
+        m_isFrameComplete = result == 0;
+    }
+
+    return totalBytesRead;
+}
+
+void Lz4InputStream::Init()
+{
+    if (LZ4F_isError(LZ4F_createDecompressionContext(&m_context, LZ4F_VERSION))) {
+        FATAL("Can't create LZ4 decompression context");
+    }
+
+    m_buffer.reset(new uint8_t[BufferSize]);
+}
+
+//--------------------------------------------------------------------------------------------------
+
+Lz4OutputStream::Lz4OutputStream(Stream& target, int level)
+    : m_target{&target}
+    , m_level{level}
+{
+    Init();
+}
+
+Lz4OutputStream::Lz4OutputStream(std::unique_ptr<Stream> target, int level)
+    : m_target{target.get()}
+    , m_ownedTarget{std::move(target)}
+    , m_level{level}
+{
+    ASSERT(m_target != nullptr);
+    Init();
+}
+
+Lz4OutputStream::~Lz4OutputStream()
+{
+    LZ4F_freeCompressionContext(m_context);
+}
+
+void Lz4OutputStream::Close()
+{
+    if (m_context) {
+        LZ4F_freeCompressionContext(m_context);
+        m_context = nullptr;
+    }
+
+    m_target->Close();
+    m_buffer.reset();
+    m_isFrameStarted = false;
+}
+
+bool Lz4OutputStream::Finish(Out<IoError> outError)
+{
+    size_t result;
+
+    if (!IsOpen()) {
+        *outError = IoError{IoErrorCode::Closed, "Stream is closed"};
+        return false;
+    } else if (!BeginFrame(outError)) {
+        return false;
+    }
+
+    result = LZ4F_compressEnd(m_context, m_buffer.get(), m_capacity, nullptr);
+    m_isFrameStarted = false;
+
+    if (LZ4F_isError(result)) {
+        *outError = LZ4F_getErrorName(result);
+        return false;
+    }
+
+    return m_target->Write(m_buffer.get(), result, outError) == result;
+}
+
+size_t Lz4OutputStream::DoWrite(const void* buffer, size_t size, Out<IoError> outError)
+{
+    const uint8_t* input = static_cast<const uint8_t*>(buffer);
+    size_t totalBytesWritten = 0;
+    size_t inputSize;
+    size_t result;
+
+    if (!BeginFrame(outError)) {
+        return 0;
+    }
+
+    // The output buffer is sized for one block of input, so larger writes are split.
+    while (totalBytesWritten < size) {
+        inputSize = std::min(size - totalBytesWritten, BlockSize);
+        result = LZ4F_compressUpdate(m_context, m_buffer.get(), m_capacity, input + totalBytesWritten, inputSize,
+                                     nullptr);
+
+        if (LZ4F_isError(result)) {
+            *outError = LZ4F_getErrorName(result);
+            return 0;
+        } else if (result && m_target->Write(m_buffer.get(), result, outError) < result) {
+            return 0;
+        }
+
+        totalBytesWritten += inputSize;
+    }
+
+    return totalBytesWritten;
+}
+
+void Lz4OutputStream::Init()
+{
+    LZ4F_preferences_t preferences = GetPreferences(m_level);
+
+    if (LZ4F_isError(LZ4F_createCompressionContext(&m_context, LZ4F_VERSION))) {
+        FATAL("Can't create LZ4 compression context");
+    }
+
+    m_capacity = std::max(LZ4F_compressBound(BlockSize, &preferences), size_t(LZ4F_HEADER_SIZE_MAX));
+    m_buffer.reset(new uint8_t[m_capacity]);
+}
+
+bool Lz4OutputStream::BeginFrame(Out<IoError> outError)
+{
+    LZ4F_preferences_t preferences = GetPreferences(m_level);
+    size_t result;
+
+    if (m_isFrameStarted) {
+        return true;
+    }
+
+    result = LZ4F_compressBegin(m_context, m_buffer.get(), m_capacity, &preferences);
+    if (LZ4F_isError(result)) {
+        *outError = LZ4F_getErrorName(result);
+        return false;
+    } else if (m_target->Write(m_buffer.get(), result, outError) < result) {
+        return false;
+    }
+
+    m_isFrameStarted = true;
+    return true;
+}
@@ -0,0 +1,447 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include <zstd.h>
+
+#include <Core/IO/Codec/Pack.h>
+#include <Core/IO/MappedFile.h>
+#include <Core/IO/Memory.h>
+#include <Core/Debug.h>
+#include <Core/Profiler.h>
+
+using namespace std::literals::string_literals;
+using namespace ArenaBuilder;
+
+namespace {
+
+    // Largest chunk size accepted from a pack file. Anything larger is assumed to be corrupt
+    // rather than risk huge allocations.
+    constexpr uint32_t MaxChunkSize = uint32_t(1) << 26;
+
+    // Returns true if [offset, offset + count * recordSize) lies within a file of the given size.
+    bool IsRangeInFile(uint64_t offset, uint64_t count, uint64_t recordSize, uint64_t fileSize)
+    {
+        return offset <= fileSize && count <= (fileSize - offset) / recordSize;
+    }
+
+    // Decompresses the chunks of a compressed entry. Each chunk is decompressed into the caller's
+    // buffer if it fits, or into an internal buffer otherwise.
+    class PackInputStream final : public Stream {
+    public:
+        PackInputStream() = delete;
+        PackInputStream(const PackInputStream&) = delete;
+        PackInputStream(PackInputStream&&) = delete;
+        explicit PackInputStream(std::shared_ptr<MappedFile> mapping, ByteView data, const uint8_t* chunkRecords,
+                                 uint64_t size, uint32_t chunkSize);
+        ~PackInputStream();
+
+        void Close() override;
+        bool IsOpen() const override { return m_mapping != nullptr; }
+        bool IsSeekable() const override { return true; }
+        bool GetSize(Out<uint64_t> outSize) const override;
+        uint64_t Tell() const override { return m_position - (m_bufferEnd - m_bufferPosition); }
+
+        PackInputStream& operator=(const PackInputStream&) = delete;
+        PackInputStream& operator=(PackInputStream&&) = delete;
+
+    protected:
+        size_t DoRead(void* buffer, size_t size, Out<IoError> outError) override;
+        bool DoSeek(uint64_t position, Out<IoError> outError) override;
+
+    private:
+        std::shared_ptr<MappedFile> m_mapping;
+        ByteView m_data;
+        const uint8_t* m_chunkRecords; // First chunk record of this entry
+        uint64_t m_size;
+        uint64_t m_position = 0; // End of the buffered chunk, if any
+        uint32_t m_chunkSize;
+        ZSTD_DCtx* m_context = nullptr;
+        std::unique_ptr<uint8_t[]> m_buffer;
+        size_t m_bufferPosition = 0;
+        size_t m_bufferEnd = 0;
+
+        bool DecodeChunk(uint64_t chunkIndex, uint8_t* output, size_t outputSize, Out<IoError> outError);
+    };
+
+    PackInputStream::PackInputStream(std::shared_ptr<MappedFile> mapping, ByteView data, const uint8_t* chunkRecords,
+                                     uint64_t size, uint32_t chunkSize)
+        : m_mapping{std::move(mapping)}, m_data{data}, m_chunkRecords{chunkRecords}, m_size{size},
+          m_chunkSize{chunkSize}
+    {
+    }
+
+    PackInputStream::~PackInputStream()
+    {
+        Close();
+    }
+
+    void PackInputStream::Close()
+    {
+        if (m_context) {
+            ZSTD_freeDCtx(m_context);
+            m_context = nullptr;
+        }
+
+        m_buffer.reset();
+        m_bufferPosition = m_bufferEnd = 0;
+        m_mapping.reset();
+        m_data = {};
+    }
+
+    bool PackInputStream::GetSize(Out<uint64_t> outSize) const
+    {
+        *outSize = m_size;
+        return IsOpen();
+    }
+
+    size_t PackInputStream::DoRead(void* buffer, size_t size, Out<IoError> outError)
+    {
+        uint64_t chunkIndex;
+        uint64_t chunkStart;
+        size_t chunkOutputSize;
+        size_t skipSize;
+
+        if (m_bufferPosition < m_bufferEnd) {
+            size = std::min(size, m_bufferEnd - m_bufferPosition);
+            std::memcpy(buffer, &m_buffer[m_bufferPosition], size);
+            m_bufferPosition += size;
+            return size;
+        } else if (m_position >= m_size) {
+            return 0;
+        }
+
+        // After a seek, the position may be in the middle of a chunk.
+        chunkIndex = m_position / m_chunkSize;
+        chunkStart = chunkIndex * m_chunkSize;
+        chunkOutputSize = size_t(std::min<uint64_t>(m_chunkSize, m_size - chunkStart));
+        skipSize = size_t(m_position - chunkStart);
+
+        // The buffered chunk has been used up. Forget it before the fast path below moves the
+        // position past it, or seeks would take it for the chunk ending at the new position.
+        m_bufferPosition = m_bufferEnd = 0;
+
+        // Skip the extra copy when the caller wants the whole chunk anyway.
+        if (!skipSize && size >= chunkOutputSize) {
+            if (!DecodeChunk(chunkIndex, static_cast<uint8_t*>(buffer), chunkOutputSize, outError)) {
+                return 0;
+            }
+            m_position += chunkOutputSize;
+            return chunkOutputSize;
+        }
+
+        if (!m_buffer) {
+            m_buffer.reset(new uint8_t[m_chunkSize]);
+        }
+
+        if (!DecodeChunk(chunkIndex, m_buffer.get(), chunkOutputSize, outError)) {
+            return 0;
+        }
+
+        size = std::min(size, chunkOutputSize - skipSize);
+        std::memcpy(buffer, &m_buffer[skipSize], size);
+        m_position = chunkStart + chunkOutputSize;
+        m_bufferPosition = skipSize + size;
+        m_bufferEnd = chunkOutputSize;
+        return size;
+    }
+
+    bool PackInputStream::DoSeek(uint64_t position, Out<IoError>)
+    {
+        uint64_t bufferStart = m_position - m_bufferEnd;
+
+        // Seeks within the decoded chunk don't need to decode it again.
+        if (m_bufferEnd && position >= bufferStart && position < m_position) {
+            m_bufferPosition = size_t(position - bufferStart);
+        } else {
+            m_position = position;
+            m_bufferPosition = m_bufferEnd = 0;
+        }
+
+        return true;
+    }
+
+    bool PackInputStream::DecodeChunk(uint64_t chunkIndex, uint8_t* output, size_t outputSize,
+                                      Out<IoError> outError)
+    {
+        auto chunk = PackFormat::LoadChunkRecord(m_chunkRecords + chunkIndex * PackFormat::ChunkRecordSize);
+        size_t result;
+
+        if (!IsRangeInFile(chunk.offset, chunk.storedSize, 1, m_data.size)) {
+            *outError = "Chunk is out of range";
+            return false;
+        }
+
+        const uint8_t* input = m_data.data + chunk.offset;
+
+        if (!(chunk.flags & PackFormat::ChunkFlagCompressed)) {
+            if (chunk.storedSize != outputSize) {
+                *outError = "Stored chunk has the wrong size";
+                return false;
+            }
+            std::memcpy(output, input, outputSize);
+            return true;
+        }
+
+        if (!m_context) {
+            m_context = ZSTD_createDCtx();
+            if (!m_context) {
+                *outError = "ZSTD_createDCtx failed";
+                return false;
+            }
+        }
+
+        result = ZSTD_decompressDCtx(m_context, output, outputSize, input, chunk.storedSize);
+        if (ZSTD_isError(result)) {
+            *outError = IoError{"ZSTD_decompressDCtx", ZSTD_getErrorName(result)};
+            return false;
+        } else if (result != outputSize) {
+            *outError = "Compressed chunk has the wrong size";
+            return false;
+        }
+
+        return true;
+    }
+
+} // namespace
+
+PackArchiveReader::PackArchiveReader(const oschar_t* path, Out<IoError> outError)
+{
+    Open(path, outError);
+}
+
+PackArchiveReader::~PackArchiveReader()
+{
+    Close();
+}
+
+bool PackArchiveReader::Open(const oschar_t* path, Out<IoError> outError)
+{
+    PROFILE_SCOPE("PackArchiveReader::Open");
+
+    Close();
+
+    auto mapping = std::make_shared<MappedFile>();
+    if (!mapping->Open(path, outError)) {
+        return false;
+    }
+
+    m_data = mapping->GetView();
+    if (m_data.size < PackFormat::HeaderSize || !PackFormat::LoadHeader(m_data.data, Out{m_header})) {
+        *outError = "Not an ArenaBuilder pack file";
+        Close();
+        return false;
+    } else if (!ValidateHeader(outError)) {
+        Close();
+        return false;
+    }
+
+    m_mapping = std::move(mapping);
+    return true;
+}
+
+void PackArchiveReader::Close()
+{
+    m_mapping.reset();
+    m_data = {};
+    m_header = {};
+}
+
+bool PackArchiveReader::GetEntry(uint32_t index, Out<PackEntryInfo> outEntry, Out<IoError> outError) const
+{
+    PackFormat::Entry entry;
+
+    if (!LoadEntry(index, Out{entry}, outError)) {
+        return false;
+    }
+
+    PackEntryInfo& info = *outEntry;
+    info.name = {reinterpret_cast<const char*>(m_data.data + m_header.namesOffset + entry.nameOffset), entry.nameSize};
+    info.nameHash = entry.nameHash;
+    info.index = index;
+    info.size = entry.size;
+    info.storedSize = entry.storedSize;
+    info.method = entry.method;
+    return true;
+}
+
+bool PackArchiveReader::FindEntry(std::string_view name, Out<PackEntryInfo> outEntry) const
+{
+    return FindEntry(HashedName{name}, outEntry);
+}
+
+bool PackArchiveReader::FindEntry(const HashedName& name, Out<PackEntryInfo> outEntry) const
+{
+    uint32_t bucket;
+    uint32_t slot;
+    IoError error;
+
+    if (!m_header.entryCount) {
+        return false;
+    }
+
+    bucket = PackFormat::GetBucket(name.hash, m_header.bucketCount);
+    slot = PackFormat::GetSlot(name.hash,
+                               LoadLittleEndian<uint32_t>(m_data.data + m_header.bucketsOffset
+                                                          + bucket * PackFormat::BucketSize),
+                               m_header.entryCount);
+
+    if (!GetEntry(slot, outEntry, Out{error})) {
+        LOG_WARNING("Malformed pack entry {}: {}", slot, error);
+        return false;
+    }
+
+    return outEntry->nameHash == name.hash && outEntry->name == name.name;
+}
+
+std::unique_ptr<Stream> PackArchiveReader::OpenStream(std::string_view name, Out<IoError> outError)
+{
+    return OpenStream(HashedName{name}, outError);
+}
+
+std::unique_ptr<Stream> PackArchiveReader::OpenStream(const HashedName& name, Out<IoError> outError)
+{
+    PackEntryInfo info;
+
+    if (!m_mapping) {
+        *outError = IoError{IoErrorCode::Closed, "Archive is closed"};
+        return nullptr;
+    } else if (!FindEntry(name, Out{info})) {
+        *outError = IoError{IoErrorCode::NotFound, "File not found"};
+        return nullptr;
+    }
+
+    return OpenEntryStream(info.index, outError);
+}
+
+bool PackArchiveReader::EnumerateEntries(const EntryCallback& callback, Out<IoError> outError)
+{
+    PackEntryInfo info;
+
+    if (!m_mapping) {
+        *outError = IoError{IoErrorCode::Closed, "Archive is closed"};
+        return false;
+    }
+
+    for (uint32_t i = 0; i < m_header.entryCount; ++i) {
+        if (!GetEntry(i, Out{info}, outError)) {
+            return false;
+        }
+        callback(info.name, i);
+    }
+
+    return true;
+}
+
+std::unique_ptr<Stream> PackArchiveReader::OpenEntryStream(uint64_t index, Out<IoError> outError)
+{
+    PackFormat::Entry entry;
+
+    if (!m_mapping) {
+        *outError = IoError{IoErrorCode::Closed, "Archive is closed"};
+        return nullptr;
+    } else if (index >= m_header.entryCount) {
+        *outError = IoError{IoErrorCode::NotFound, "File not found"};
+        return nullptr;
+    } else if (!LoadEntry(uint32_t(index), Out{entry}, outError)) {
+        return nullptr;
+    }
+
+    return CreateEntryStream(entry);
+}
+
+bool PackArchiveReader::ValidateHeader(Out<IoError> outError) const
+{
+    const PackFormat::Header& header = m_header;
+    uint64_t fileSize = m_data.size;
+
+    if (header.fileSize != fileSize) {
+        *outError = "Pack file is truncated or has trailing data";
+        return false;
+    } else if (header.entryCount && !header.bucketCount) {
+        *outError = "Pack file has no hash buckets";
+        return false;
+    } else if (header.chunkCount && (!header.chunkSize || header.chunkSize > MaxChunkSize)) {
+        *outError = "Pack file has an invalid chunk size";
+        return false;
+    } else if (!IsRangeInFile(header.bucketsOffset, header.bucketCount, PackFormat::BucketSize, fileSize)
+               || !IsRangeInFile(header.entriesOffset, header.entryCount, PackFormat::EntrySize, fileSize)
+               || !IsRangeInFile(header.chunksOffset, header.chunkCount, PackFormat::ChunkRecordSize, fileSize)
+               || !IsRangeInFile(header.namesOffset, header.namesSize, 1, fileSize)
+               || header.payloadOffset > fileSize)
+    {
+        *outError = "Pack file table is out of range";
+        return false;
+    }
+
+    return true;
+}
+
+bool PackArchiveReader::LoadEntry(uint32_t index, Out<PackFormat::Entry> outEntry, Out<IoError> outError) const
+{
+    PackFormat::Entry& entry = *outEntry;
+    uint64_t chunkCount;
+
+    if (index >= m_header.entryCount) {
+        *outError = IoError{IoErrorCode::NotFound, "File not found"};
+        return false;
+    }
+
+    entry = PackFormat::LoadEntry(m_data.data + m_header.entriesOffset + uint64_t(index) * PackFormat::EntrySize);
+
+    if (!IsRangeInFile(entry.nameOffset, entry.nameSize, 1, m_header.namesSize)) {
+        *outError = "Entry name is out of range";
+        return false;
+    }
+
+    switch (entry.method) {
+    case PackFormat::Method::Stored:
+        if (entry.storedSize != entry.size || !IsRangeInFile(entry.dataOffset, entry.size, 1, m_data.size)) {
+            *outError = "Entry data is out of range";
+            return false;
+        }
+        return true;
+
+    case PackFormat::Method::Zstd:
+        if (!m_header.chunkSize) {
+            *outError = "Entry has no chunks";
+            return false;
+        }
+        chunkCount = entry.size / m_header.chunkSize + (entry.size % m_header.chunkSize != 0);
+        if (!IsRangeInFile(entry.firstChunk, chunkCount, 1, m_header.chunkCount)) {
+            *outError = "Entry chunks are out of range";
+            return false;
+        }
+        return true;
+
+    default:
+        *outError = IoError{IoErrorCode::NotSupported, "Unsupported compression method", std::to_string(uint16_t(entry.method))};
+        return false;
+    }
+}
+
+std::unique_ptr<Stream> PackArchiveReader::CreateEntryStream(const PackFormat::Entry& entry)
+{
+    if (entry.method == PackFormat::Method::Stored) {
+        ByteView view{m_data.data + entry.dataOffset, size_t(entry.size)};
+        return std::make_unique<MemoryInputStream>(view, m_mapping);
+    }
+
+    const uint8_t* chunkRecords = m_data.data + m_header.chunksOffset
+                                  + uint64_t(entry.firstChunk) * PackFormat::ChunkRecordSize;
+    return std::make_unique<PackInputStream>(m_mapping, m_data, chunkRecords, entry.size, m_header.chunkSize);
+}
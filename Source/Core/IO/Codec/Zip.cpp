@@ -12,21 +12,513 @@
  * under the License.
  */
 
-#include <errno.h>
-#include <stdio.h>
-#include <string.h>
-
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <limits>
+#include <vector>
 
+#define ZLIB_CONST
 #include <zip.h>
+#include <zlib.h>
 
 #include <Core/IO/Codec/Zip.h>
+#include <Core/IO/MappedFile.h>
+#include <Core/IO/Memory.h>
+#include <Core/ByteOrder.h>
 #include <Core/Debug.h>
+#include <Core/Profiler.h>
 
 using namespace std::literals::string_literals;
 using namespace ArenaBuilder;
 
-ZipArchiveReader::ZipArchiveReader(const oschar_t* path, Out<std::string> outError)
+namespace fs = std::filesystem;
+
+namespace {
+
+    // Record layouts from the zip application note (APPNOTE.TXT).
+    constexpr uint32_t LocalHeaderSignature = 0x04034B50;
+    constexpr uint32_t CentralDirEntrySignature = 0x02014B50;
+    constexpr uint32_t EndOfCentralDirSignature = 0x06054B50;
+    constexpr uint32_t Zip64EndOfCentralDirSignature = 0x06064B50;
+    constexpr uint32_t Zip64EndOfCentralDirLocatorSignature = 0x07064B50;
+    constexpr uint16_t Zip64ExtraFieldId = 0x0001;
+    constexpr uint16_t GeneralFlagEncrypted = 0x0001;
+
+    constexpr size_t LocalHeaderSize = 30;
+    constexpr size_t CentralDirEntrySize = 46;
+    constexpr size_t EndOfCentralDirSize = 22;
+    constexpr size_t Zip64EndOfCentralDirSize = 56;
+    constexpr size_t Zip64EndOfCentralDirLocatorSize = 20;
+    constexpr size_t MaxCommentLength = 0xFFFF;
+
+    // zlib counts bytes with 32-bit integers, so large buffers are processed in chunks.
+    constexpr size_t MaxZlibChunkSize = size_t(1) << 30;
+
+    // Minimum distance between inflate checkpoints, in bytes of uncompressed output. Each
+    // checkpoint holds a copy of the 32 KiB deflate window.
+    constexpr uint64_t InflateCheckpointSpacing = uint64_t(1) << 20;
+    constexpr uInt InflateWindowSize = 32768;
+
+    // Size of the scratch buffer used to decompress and discard data when seeking forward.
+    constexpr size_t SkipBufferSize = 16384;
+
+    // Entry table cache layout. All integers are little-endian.
+    //
+    //   Header: magic, version (u32), archive size (u64), archive modification time (u64),
+    //           central directory hash (u64), entry count (u64), path length in bytes (u32), path
+    //   Each entry: name length (u32), name, index (u64), size (u64), compressed size (u64),
+    //               CRC (u32), method (u16), flags (u8), data offset (u64)
+    //   Trailer: FNV-1a hash of everything before it (u64)
+    //
+    // The path is the archive's absolute path in the native encoding, which guards against
+    // collisions between cache file names.
+    constexpr char IndexCacheMagic[4] = {'A', 'B', 'Z', 'I'};
+    constexpr uint32_t IndexCacheVersion = 1;
+    constexpr uint8_t IndexCacheFlagEncrypted = 0x01;
+    constexpr uint8_t IndexCacheFlagHasDataOffset = 0x02;
+    constexpr size_t IndexCacheMinEntrySize = 43;
+
+    template<typename T>
+    void AppendLittleEndian(std::string& buffer, T value)
+    {
+        char bytes[sizeof(T)];
+
+        StoreLittleEndian(bytes, value);
+        buffer.append(bytes, sizeof(T));
+    }
+
+    // Bounds-checked reader for cache files. Once a read goes out of bounds, every later read
+    // returns zero and IsValid() returns false, so callers only need to check at the end.
+    class IndexCacheReader {
+    public:
+        explicit IndexCacheReader(ByteView data)
+            : m_data{data}
+        {
+        }
+
+        bool IsValid() const { return m_isValid; }
+        size_t GetPosition() const { return m_position; }
+
+        template<typename T>
+        T Read()
+        {
+            const uint8_t* bytes = ReadBytes(sizeof(T));
+            return bytes ? LoadLittleEndian<T>(bytes) : T{};
+        }
+
+        const uint8_t* ReadBytes(size_t size)
+        {
+            if (!m_isValid || size > m_data.size - m_position) {
+                m_isValid = false;
+                return nullptr;
+            }
+
+            m_position += size;
+            return m_data.data + m_position - size;
+        }
+
+    private:
+        ByteView m_data;
+        size_t m_position = 0;
+        bool m_isValid = true;
+    };
+
+    std::string_view GetPathBytes(const OsString& path)
+    {
+        return {reinterpret_cast<const char*>(path.data()), path.size() * sizeof(oschar_t)};
+    }
+
+    // Names the cache file after a hash of the archive's absolute path.
+    OsString GetIndexCachePath(const OsString& cacheDir, const OsString& archivePath)
+    {
+        std::string fileName = fmt::format("{:016x}.zipindex", HashFnv1a64(GetPathBytes(archivePath)));
+        OsString path = cacheDir;
+
+        if (!path.empty() && path.back() != '/' && path.back() != '\\') {
+            path.push_back('/');
+        }
+
+        // The file name is ASCII, so it can be widened one character at a time.
+        for (char ch : fileName) {
+            path.push_back(oschar_t(ch));
+        }
+
+        return path;
+    }
+
+    struct CentralDirectoryInfo {
+        uint64_t entryCount = 0;
+        uint64_t offset = 0;
+        uint64_t size = 0;
+    };
+
+    // Finds the central directory from the end-of-central-directory record, which is at the end of
+    // the archive, followed only by a comment of up to 64 KiB.
+    bool FindCentralDirectory(ByteView archive, Out<CentralDirectoryInfo> outInfo, Out<IoError> outError)
+    {
+        const uint8_t* record = nullptr;
+        size_t searchStart;
+        CentralDirectoryInfo& info = *outInfo;
+
+        if (archive.size < EndOfCentralDirSize) {
+            *outError = "Archive is too small";
+            return false;
+        }
+
+        searchStart = archive.size - EndOfCentralDirSize;
+        for (size_t offset = searchStart + 1; offset-- > 0 && searchStart - offset <= MaxCommentLength;) {
+            if (LoadLittleEndian<uint32_t>(archive.data + offset) == EndOfCentralDirSignature) {
+                record = archive.data + offset;
+                break;
+            }
+        }
+
+        if (!record) {
+            *outError = "Missing end of central directory record";
+            return false;
+        }
+
+        info.entryCount = LoadLittleEndian<uint16_t>(record + 10);
+        info.size = LoadLittleEndian<uint32_t>(record + 12);
+        info.offset = LoadLittleEndian<uint32_t>(record + 16);
+
+        // ZIP64 archives store saturated values in the regular record, and the real values in a
+        // separate record found through the locator preceding the regular record.
+        if (size_t(record - archive.data) >= Zip64EndOfCentralDirLocatorSize) {
+            const uint8_t* locator = record - Zip64EndOfCentralDirLocatorSize;
+
+            if (LoadLittleEndian<uint32_t>(locator) == Zip64EndOfCentralDirLocatorSignature) {
+                uint64_t zip64Offset = LoadLittleEndian<uint64_t>(locator + 8);
+                const uint8_t* zip64Record;
+
+                if (archive.size < Zip64EndOfCentralDirSize || zip64Offset > archive.size - Zip64EndOfCentralDirSize) {
+                    *outError = "Invalid ZIP64 end of central directory offset";
+                    return false;
+                }
+
+                zip64Record = archive.data + zip64Offset;
+                if (LoadLittleEndian<uint32_t>(zip64Record) != Zip64EndOfCentralDirSignature) {
+                    *outError = "Invalid ZIP64 end of central directory record";
+                    return false;
+                }
+
+                info.entryCount = LoadLittleEndian<uint64_t>(zip64Record + 32);
+                info.size = LoadLittleEndian<uint64_t>(zip64Record + 40);
+                info.offset = LoadLittleEndian<uint64_t>(zip64Record + 48);
+            }
+        }
+
+        if (info.offset > archive.size || info.size > archive.size - info.offset) {
+            *outError = "Central directory is out of bounds";
+            return false;
+        }
+
+        return true;
+    }
+
+    // Replaces saturated 32-bit sizes and offsets with their 64-bit values from the ZIP64 extra
+    // field, if present. The 64-bit values appear only for fields which are saturated.
+    void ApplyZip64ExtraField(ByteView extra, Out<uint64_t> inOutSize, Out<uint64_t> inOutCompressedSize,
+                              Out<uint64_t> inOutLocalHeaderOffset)
+    {
+        const uint8_t* position = extra.data;
+        const uint8_t* end = extra.data + extra.size;
+
+        while (end - position >= 4) {
+            uint16_t id = LoadLittleEndian<uint16_t>(position);
+            uint16_t size = LoadLittleEndian<uint16_t>(position + 2);
+            const uint8_t* field = position + 4;
+            const uint8_t* fieldEnd = field + size;
+
+            if (end - field < size) {
+                return;
+            }
+
+            position = fieldEnd;
+            if (id != Zip64ExtraFieldId) {
+                continue;
+            }
+
+            for (Out<uint64_t> value : {inOutSize, inOutCompressedSize, inOutLocalHeaderOffset}) {
+                if (*value != 0xFFFFFFFF) {
+                    continue;
+                } else if (fieldEnd - field < 8) {
+                    return;
+                }
+                *value = LoadLittleEndian<uint64_t>(field);
+                field += 8;
+            }
+            return;
+        }
+    }
+
+    // Closes a libzip file handle, logging any error since there's nobody to report it to.
+    void CloseZipFile(struct ::zip_file* zipFile)
+    {
+        zip_error_t zipError;
+
+        if (int errorCode = zip_fclose(zipFile)) {
+            zip_error_init_with_code(&zipError, errorCode);
+            Finally _freeZipError{[&zipError]() { zip_error_fini(&zipError); }};
+            LOG_ERROR("zip_fclose: {}", zip_error_strerror(&zipError));
+        }
+    }
+
+    // Inflate state at a deflate block boundary, from which decompression can be resumed. This is
+    // the same technique as zlib's zran.c example.
+    struct InflateCheckpoint {
+        uint64_t inputPosition = 0; // Compressed bytes consumed
+        uint64_t outputPosition = 0;
+        int bitCount = 0; // Unused bits in the last consumed byte
+        std::unique_ptr<uint8_t[]> window;
+        uInt windowSize = 0;
+    };
+
+} // namespace
+
+// State for reading an entry straight out of the archive mapping.
+struct ZipInputStream::DirectState {
+    std::shared_ptr<MappedFile> mapping; // Keeps the input alive
+    const uint8_t* input = nullptr;
+    uint64_t inputSize = 0;
+    uint64_t inputPosition = 0;
+    uint64_t outputSize = 0;
+    uint64_t outputPosition = 0;
+    uint32_t expectedCrc = 0;
+    uint32_t crc = 0;
+    uint64_t crcPosition = 0; // The CRC covers output up to here
+    bool isCrcChecked = false;
+    uint16_t method = 0;
+    z_stream zstream{};
+    bool isZStreamInit = false;
+
+    // Checkpoints are only recorded once the stream has been seeked, so sequential readers don't
+    // pay for them. They are sorted by output position.
+    std::vector<InflateCheckpoint> checkpoints;
+    bool isIndexing = false;
+    std::unique_ptr<uint8_t[]> skipBuffer;
+
+    ~DirectState()
+    {
+        if (isZStreamInit) {
+            inflateEnd(&zstream);
+        }
+    }
+
+    size_t Read(void* buffer, size_t size, Out<IoError> outError);
+    bool Seek(uint64_t position, Out<IoError> outError);
+
+private:
+    size_t Inflate(uint8_t* buffer, size_t size, Out<IoError> outError);
+    void UpdateCrc(const uint8_t* data, size_t size);
+    uint64_t GetNextCheckpointPosition() const;
+    void AddCheckpoint(uint64_t position);
+    bool RestoreCheckpoint(const InflateCheckpoint* checkpoint, Out<IoError> outError);
+    bool SkipTo(uint64_t position, Out<IoError> outError);
+};
+
+size_t ZipInputStream::DirectState::Read(void* buffer, size_t size, Out<IoError> outError)
+{
+    size_t result;
+
+    size = size_t(std::min<uint64_t>(size, outputSize - outputPosition));
+    if (!size) {
+        return 0;
+    }
+
+    if (method == ZIP_CM_STORE) {
+        std::memcpy(buffer, input + outputPosition, size);
+        result = size;
+    } else {
+        result = Inflate(static_cast<uint8_t*>(buffer), size, outError);
+        if (!result) {
+            return 0;
+        }
+    }
+
+    UpdateCrc(static_cast<const uint8_t*>(buffer), result);
+    outputPosition += result;
+
+    // The CRC can only be checked if every byte has been read at some point.
+    if (crcPosition == outputSize && !isCrcChecked) {
+        isCrcChecked = true;
+        if (crc != expectedCrc) {
+            *outError = IoError{IoErrorCode::InvalidData, "CRC mismatch"};
+            return 0;
+        }
+    }
+
+    return result;
+}
+
+bool ZipInputStream::DirectState::Seek(uint64_t position, Out<IoError> outError)
+{
+    if (method == ZIP_CM_STORE) {
+        outputPosition = position;
+        return true;
+    }
+
+    isIndexing = true;
+
+    // Resume from the last checkpoint at or before the target if that's closer than the current
+    // position.
+    auto iter = std::upper_bound(checkpoints.begin(), checkpoints.end(), position,
+                                 [](uint64_t position, const InflateCheckpoint& checkpoint) {
+                                     return position < checkpoint.outputPosition;
+                                 });
+    const InflateCheckpoint* checkpoint = iter != checkpoints.begin() ? &*(iter - 1) : nullptr;
+
+    if (position < outputPosition || (checkpoint && checkpoint->outputPosition > outputPosition)) {
+        if (!RestoreCheckpoint(checkpoint, outError)) {
+            return false;
+        }
+    }
+
+    return SkipTo(position, outError);
+}
+
+size_t ZipInputStream::DirectState::Inflate(uint8_t* buffer, size_t size, Out<IoError> outError)
+{
+    bool isLookingForCheckpoint;
+    int zresult;
+
+    size = std::min<size_t>(size, MaxZlibChunkSize);
+    zstream.next_out = buffer;
+    zstream.avail_out = uInt(size);
+
+    // Keep inflating until at least some output is produced.
+    while (zstream.avail_out == size) {
+        if (!zstream.avail_in) {
+            uint64_t inputRemaining = inputSize - inputPosition;
+
+            if (!inputRemaining) {
+                *outError = IoError{IoErrorCode::EndOfStream, "Unexpected end of compressed data"};
+                return 0;
+            }
+
+            zstream.next_in = input + inputPosition;
+            zstream.avail_in = uInt(std::min<uint64_t>(inputRemaining, MaxZlibChunkSize));
+            inputPosition += zstream.avail_in;
+        }
+
+        // Z_BLOCK stops at the end of each deflate block, which is where checkpoints can be taken.
+        isLookingForCheckpoint = isIndexing && outputPosition + size >= GetNextCheckpointPosition();
+
+        zresult = inflate(&zstream, isLookingForCheckpoint ? Z_BLOCK : Z_NO_FLUSH);
+        if (zresult == Z_STREAM_END) {
+            break;
+        } else if (zresult != Z_OK) {
+            *outError = IoError{"inflate", zstream.msg ? zstream.msg : "Invalid compressed data"};
+            return 0;
+        }
+
+        // Bit 7 of data_type is set at a block boundary, and bit 6 is set in the final block.
+        if (isLookingForCheckpoint && (zstream.data_type & 128) && !(zstream.data_type & 64)) {
+            AddCheckpoint(outputPosition + (size - zstream.avail_out));
+        }
+    }
+
+    if (zstream.avail_out == size) {
+        *outError = "Compressed data is shorter than expected";
+        return 0;
+    }
+
+    return size - zstream.avail_out;
+}
+
+void ZipInputStream::DirectState::UpdateCrc(const uint8_t* data, size_t size)
+{
+    if (outputPosition <= crcPosition && crcPosition < outputPosition + size) {
+        size_t offset = size_t(crcPosition - outputPosition);
+        crc = uint32_t(crc32_z(crc, data + offset, size - offset));
+        crcPosition = outputPosition + size;
+    }
+}
+
+uint64_t ZipInputStream::DirectState::GetNextCheckpointPosition() const
+{
+    return (checkpoints.empty() ? 0 : checkpoints.back().outputPosition) + InflateCheckpointSpacing;
+}
+
+void ZipInputStream::DirectState::AddCheckpoint(uint64_t position)
+{
+    InflateCheckpoint checkpoint;
+
+    if (position < GetNextCheckpointPosition()) {
+        return;
+    }
+
+    checkpoint.inputPosition = inputPosition - zstream.avail_in;
+    checkpoint.outputPosition = position;
+    checkpoint.bitCount = zstream.data_type & 7;
+    checkpoint.window.reset(new uint8_t[InflateWindowSize]);
+    checkpoint.windowSize = InflateWindowSize;
+
+    if (inflateGetDictionary(&zstream, checkpoint.window.get(), &checkpoint.windowSize) != Z_OK) {
+        return;
+    }
+
+    checkpoints.push_back(std::move(checkpoint));
+}
+
+bool ZipInputStream::DirectState::RestoreCheckpoint(const InflateCheckpoint* checkpoint, Out<IoError> outError)
+{
+    if (inflateReset(&zstream) != Z_OK) {
+        *outError = IoError{"inflateReset", zstream.msg ? zstream.msg : "Failed"};
+        return false;
+    }
+
+    zstream.next_in = nullptr;
+    zstream.avail_in = 0;
+
+    // A null checkpoint means the start of the entry.
+    if (!checkpoint) {
+        inputPosition = 0;
+        outputPosition = 0;
+        return true;
+    }
+
+    // The checkpoint's block may start partway through a byte.
+    if (checkpoint->bitCount) {
+        int bits = input[checkpoint->inputPosition - 1] >> (8 - checkpoint->bitCount);
+        if (inflatePrime(&zstream, checkpoint->bitCount, bits) != Z_OK) {
+            *outError = IoError{"inflatePrime", zstream.msg ? zstream.msg : "Failed"};
+            return false;
+        }
+    }
+
+    if (inflateSetDictionary(&zstream, checkpoint->window.get(), checkpoint->windowSize) != Z_OK) {
+        *outError = IoError{"inflateSetDictionary", zstream.msg ? zstream.msg : "Failed"};
+        return false;
+    }
+
+    inputPosition = checkpoint->inputPosition;
+    outputPosition = checkpoint->outputPosition;
+    return true;
+}
+
+bool ZipInputStream::DirectState::SkipTo(uint64_t position, Out<IoError> outError)
+{
+    if (!skipBuffer && outputPosition < position) {
+        skipBuffer.reset(new uint8_t[SkipBufferSize]);
+    }
+
+    while (outputPosition < position) {
+        if (!Read(skipBuffer.get(), size_t(std::min<uint64_t>(SkipBufferSize, position - outputPosition)), outError)) {
+            if (!outError->HasError()) {
+                *outError = IoError{IoErrorCode::EndOfStream, "Unexpected end of compressed data"};
+            }
+            return false;
+        }
+    }
+
+    return true;
+}
+
+ZipArchiveReader::ZipArchiveReader(const oschar_t* path, Out<IoError> outError)
 {
     Open(path, outError);
 }
@@ -36,45 +528,100 @@ ZipArchiveReader::~ZipArchiveReader()
     Close();
 }
 
-bool ZipArchiveReader::Open(const oschar_t* path, Out<std::string> outError)
+bool ZipArchiveReader::Open(const oschar_t* path, const ZipOpenParams& params, Out<IoError> outError)
 {
-    FILE* file;
+    PROFILE_SCOPE("ZipArchiveReader::Open");
+
     zip_error_t zipError;
     zip_source_t* zipSource;
+    ByteView archiveView;
+    OsString archivePath;
+    OsString cachePath;
+    uint64_t directoryHash = 0;
+    bool isCached = false;
 
     Close();
 
-    // Open the stdio file stream that libzip will use.
-#ifdef _WIN32
-    file = _wfopen(path, L"rb");
-#else
-    file = fopen(path, "rb");
-#endif
-    if (!file) {
-        *outError = strerror(errno);
+    // Map the whole archive. libzip reads from the mapping instead of a stdio stream, and stored
+    // entries can be handed out as views into it.
+    m_mapping = std::make_shared<MappedFile>();
+    if (!m_mapping->Open(path, outError)) {
+        m_mapping.reset();
         return false;
     }
 
+    archiveView = m_mapping->GetView();
+
+    // The cache is keyed on the central directory hash in addition to the file's size and
+    // modification time, so an archive rewritten within the same second is still detected. If the
+    // central directory can't be found, libzip will fail below anyway.
+    if (!params.indexCacheDir.empty()) {
+        CentralDirectoryInfo directory;
+        IoError directoryError;
+        std::error_code pathError;
+
+        archivePath = fs::absolute(fs::path{path}, pathError).native();
+        if (!pathError && FindCentralDirectory(archiveView, Out{directory}, Out{directoryError})) {
+            std::string_view directoryBytes{reinterpret_cast<const char*>(archiveView.data + directory.offset),
+                                            size_t(directory.size)};
+
+            directoryHash = HashFnv1a64(directoryBytes);
+            cachePath = GetIndexCachePath(params.indexCacheDir, archivePath);
+            isCached = !params.verify && LoadIndexCache(cachePath, archivePath, directoryHash);
+        }
+    }
+
     // Initialize the zip error container.
     zip_error_init(&zipError);
     Finally _freeZipError{[&zipError]() { zip_error_fini(&zipError); }};
 
-    // Create a zip source from the file stream.
-    zipSource = zip_source_filep_create(file, 0, ZIP_LENGTH_TO_END, &zipError);
+    // Create a zip source from the mapping.
+    zipSource = zip_source_buffer_create(archiveView.data, archiveView.size, 0, &zipError);
     if (!zipSource) {
-        *outError = "zip_source_filep_create: "s + zip_error_strerror(&zipError);
-        fclose(file);
+        *outError = IoError{"zip_source_buffer_create", zip_error_strerror(&zipError)};
+        Close();
         return false;
     }
 
     // Load the zip archive from the source.
-    m_zip = zip_open_from_source(zipSource, ZIP_RDONLY | ZIP_CHECKCONS, &zipError);
+    m_zip = zip_open_from_source(zipSource, ZIP_RDONLY | (isCached ? 0 : ZIP_CHECKCONS), &zipError);
     if (!m_zip) {
-        *outError = "zip_open_from_source: "s + zip_error_strerror(&zipError);
+        *outError = IoError{"zip_open_from_source", zip_error_strerror(&zipError)};
         zip_source_free(zipSource);
+        Close();
         return false;
     }
 
+    // Entry indices are passed to libzip, so the cached table must at least agree on the count.
+    if (isCached && zip_get_num_entries(m_zip, 0) != zip_int64_t(m_entries.size())) {
+        LOG_WARNING("Cached zip index doesn't match libzip; reloading");
+        isCached = false;
+    }
+
+    if (isCached) {
+        LOG_DEBUG_DEFERRED("Loaded {} zip entries from cache", m_entries.size());
+    } else {
+        if (!LoadEntries(outError)) {
+            Close();
+            return false;
+        }
+
+        // libzip doesn't expose where each entry's data starts, so we find that ourselves. If the
+        // central directory can't be interpreted, every entry falls back to libzip.
+        IoError locationError;
+        if (!LoadEntryLocations(Out{locationError})) {
+            LOG_WARNING("Can't locate zip entry data; stored entries will be copied: {}", locationError);
+            for (ZipEntryInfo& entry : m_entries) {
+                entry.hasDataOffset = false;
+            }
+        }
+
+        if (!cachePath.empty()) {
+            SaveIndexCache(cachePath, archivePath, directoryHash);
+        }
+    }
+
+    BuildNameTable();
     return true;
 }
 
@@ -86,15 +633,94 @@ void ZipArchiveReader::Close()
         }
         m_zip = nullptr;
     }
+
+    m_entries.clear();
+    m_nameTable.clear();
+    m_mapping.reset();
+}
+
+const ZipEntryInfo* ZipArchiveReader::FindEntry(const HashedName& name) const
+{
+    size_t mask = m_nameTable.size() - 1;
+
+    if (m_nameTable.empty()) {
+        return nullptr;
+    }
+
+    for (size_t slot = size_t(name.hash) & mask;; slot = (slot + 1) & mask) {
+        uint32_t value = m_nameTable[slot];
+
+        if (!value) {
+            return nullptr;
+        }
+
+        const ZipEntryInfo& entry = m_entries[value - 1];
+        if (entry.nameHash == name.hash && entry.name == name.name) {
+            return &entry;
+        }
+    }
+}
+
+std::unique_ptr<Stream> ZipArchiveReader::OpenStream(std::string_view name, Out<IoError> outError)
+{
+    return OpenStream(HashedName{name}, outError);
+}
+
+std::unique_ptr<Stream> ZipArchiveReader::OpenStream(const HashedName& name, Out<IoError> outError)
+{
+    const ZipEntryInfo* entry;
+
+    if (!m_zip) {
+        *outError = IoError{IoErrorCode::Closed, "Archive is closed"};
+        return nullptr;
+    }
+
+    entry = FindEntry(name);
+    if (!entry) {
+        *outError = IoError{IoErrorCode::NotFound, "File not found"};
+        return nullptr;
+    }
+
+    return OpenEntryStream(entry->index, outError);
+}
+
+bool ZipArchiveReader::EnumerateEntries(const EntryCallback& callback, Out<IoError> outError)
+{
+    if (!m_zip) {
+        *outError = IoError{IoErrorCode::Closed, "Archive is closed"};
+        return false;
+    }
+
+    for (const ZipEntryInfo& entry : m_entries) {
+        if (!entry.name.empty() && entry.name.back() != '/') {
+            callback(entry.name, entry.index);
+        }
+    }
+
+    return true;
 }
 
-std::unique_ptr<Stream> ZipArchiveReader::OpenStream(std::string_view name, Out<std::string> outError)
+std::unique_ptr<Stream> ZipArchiveReader::OpenEntryStream(uint64_t index, Out<IoError> outError)
 {
-    auto stream = std::make_unique<ZipInputStream>(*this, std::string{name}.c_str(), outError);
+    std::unique_ptr<Stream> stream;
 
+    if (!m_zip) {
+        *outError = IoError{IoErrorCode::Closed, "Archive is closed"};
+        return nullptr;
+    } else if (index >= m_entries.size()) {
+        *outError = IoError{IoErrorCode::NotFound, "File not found"};
+        return nullptr;
+    }
+
+    stream = OpenMappedStream(m_entries[size_t(index)]);
+    if (stream) {
+        return stream;
+    }
+
+    stream = std::make_unique<ZipInputStream>(*this, index, outError);
     if (!stream->IsOpen()) {
-        if (outError->empty()) {
-            *outError = "File not found";
+        if (!outError->HasError()) {
+            *outError = IoError{IoErrorCode::NotFound, "File not found"};
         }
         stream.reset();
     }
@@ -102,30 +728,391 @@ std::unique_ptr<Stream> ZipArchiveReader::OpenStream(std::string_view name, Out<
     return stream;
 }
 
+bool ZipArchiveReader::LoadEntries(Out<IoError> outError)
+{
+    PROFILE_SCOPE("ZipArchiveReader::LoadEntries");
+
+    zip_int64_t entryCount = zip_get_num_entries(m_zip, 0);
+    zip_stat_t stat;
+
+    if (entryCount < 0) {
+        *outError = IoError{"zip_get_num_entries", zip_strerror(m_zip)};
+        return false;
+    } else if (uint64_t(entryCount) >= std::numeric_limits<uint32_t>::max()) {
+        *outError = "Too many entries in archive";
+        return false;
+    }
+
+    m_entries.resize(size_t(entryCount));
+
+    for (size_t i = 0; i < m_entries.size(); ++i) {
+        ZipEntryInfo& entry = m_entries[i];
+
+        if (zip_stat_index(m_zip, i, 0, &stat)) {
+            *outError = IoError{"zip_stat_index", zip_strerror(m_zip)};
+            return false;
+        }
+
+        entry.name = stat.name ? stat.name : "";
+        entry.nameHash = HashFnv1a64(entry.name);
+        entry.index = i;
+        entry.size = stat.size;
+        entry.compressedSize = stat.comp_size;
+        entry.crc = stat.crc;
+        entry.method = stat.comp_method;
+        entry.isEncrypted = stat.encryption_method != ZIP_EM_NONE;
+
+        // Found later by LoadEntryLocations(). The entry may hold an offset from a rejected cache.
+        entry.hasDataOffset = false;
+        entry.dataOffset = 0;
+    }
+
+    return true;
+}
+
+bool ZipArchiveReader::LoadEntryLocations(Out<IoError> outError)
+{
+    PROFILE_SCOPE("ZipArchiveReader::LoadEntryLocations");
+
+    ByteView archive = m_mapping->GetView();
+    CentralDirectoryInfo directory;
+    const uint8_t* position;
+    const uint8_t* end;
+
+    if (!FindCentralDirectory(archive, Out{directory}, outError)) {
+        return false;
+    } else if (directory.entryCount != m_entries.size()) {
+        *outError = "Central directory entry count doesn't match libzip";
+        return false;
+    }
+
+    position = archive.data + directory.offset;
+    end = position + directory.size;
+
+    for (ZipEntryInfo& entry : m_entries) {
+        uint64_t size, compressedSize, localHeaderOffset;
+        uint16_t flags, nameLength, extraLength, commentLength;
+        const uint8_t* extra;
+
+        if (size_t(end - position) < CentralDirEntrySize
+            || LoadLittleEndian<uint32_t>(position) != CentralDirEntrySignature)
+        {
+            *outError = "Invalid central directory entry";
+            return false;
+        }
+
+        flags = LoadLittleEndian<uint16_t>(position + 8);
+        compressedSize = LoadLittleEndian<uint32_t>(position + 20);
+        size = LoadLittleEndian<uint32_t>(position + 24);
+        nameLength = LoadLittleEndian<uint16_t>(position + 28);
+        extraLength = LoadLittleEndian<uint16_t>(position + 30);
+        commentLength = LoadLittleEndian<uint16_t>(position + 32);
+        localHeaderOffset = LoadLittleEndian<uint32_t>(position + 42);
+
+        if (size_t(end - position) < CentralDirEntrySize + nameLength + extraLength + commentLength) {
+            *outError = "Truncated central directory entry";
+            return false;
+        }
+
+        extra = position + CentralDirEntrySize + nameLength;
+        ApplyZip64ExtraField({extra, extraLength}, Out{size}, Out{compressedSize}, Out{localHeaderOffset});
+        position += CentralDirEntrySize + nameLength + extraLength + commentLength;
+
+        if (size != entry.size || compressedSize != entry.compressedSize) {
+            *outError = "Central directory entry doesn't match libzip";
+            return false;
+        }
+
+        // The data starts after the local header, whose extra field may differ from the one in the
+        // central directory. Entries with unexpected local headers are left to libzip.
+        if ((flags & GeneralFlagEncrypted)
+            || archive.size < LocalHeaderSize
+            || localHeaderOffset > archive.size - LocalHeaderSize
+            || LoadLittleEndian<uint32_t>(archive.data + localHeaderOffset) != LocalHeaderSignature)
+        {
+            continue;
+        }
+
+        const uint8_t* localHeader = archive.data + localHeaderOffset;
+
+        entry.dataOffset = localHeaderOffset + LocalHeaderSize
+                           + LoadLittleEndian<uint16_t>(localHeader + 26)
+                           + LoadLittleEndian<uint16_t>(localHeader + 28);
+        entry.hasDataOffset = entry.dataOffset <= archive.size
+                              && entry.compressedSize <= archive.size - entry.dataOffset;
+    }
+
+    return true;
+}
+
+bool ZipArchiveReader::LoadIndexCache(const OsString& cachePath, const OsString& archivePath, uint64_t directoryHash)
+{
+    PROFILE_SCOPE("ZipArchiveReader::LoadIndexCache");
+
+    MappedFile cacheFile;
+    IoError error;
+    ByteView data;
+    uint64_t entryCount;
+    std::string_view pathBytes = GetPathBytes(archivePath);
+
+    // A missing cache file is the normal cold start case, so errors are deliberately ignored.
+    if (!cacheFile.Open(cachePath.c_str(), Out{error})) {
+        return false;
+    }
+
+    data = cacheFile.GetView();
+    if (data.size < sizeof(uint64_t)
+        || LoadLittleEndian<uint64_t>(data.data + data.size - sizeof(uint64_t))
+               != HashFnv1a64({reinterpret_cast<const char*>(data.data), data.size - sizeof(uint64_t)}))
+    {
+        return false;
+    }
+
+    IndexCacheReader reader{{data.data, data.size - sizeof(uint64_t)}};
+    const uint8_t* magic = reader.ReadBytes(sizeof(IndexCacheMagic));
+
+    if (!magic || std::memcmp(magic, IndexCacheMagic, sizeof(IndexCacheMagic))
+        || reader.Read<uint32_t>() != IndexCacheVersion
+        || reader.Read<uint64_t>() != m_mapping->GetView().size
+        || reader.Read<uint64_t>() != m_mapping->GetModificationTime()
+        || reader.Read<uint64_t>() != directoryHash)
+    {
+        return false;
+    }
+
+    entryCount = reader.Read<uint64_t>();
+    uint32_t pathLength = reader.Read<uint32_t>();
+    const uint8_t* path = reader.ReadBytes(pathLength);
+
+    // Checking the count against the file size bounds the allocation below for corrupt files.
+    if (!path || pathLength != pathBytes.size() || std::memcmp(path, pathBytes.data(), pathLength)
+        || entryCount >= std::numeric_limits<uint32_t>::max() || entryCount > data.size / IndexCacheMinEntrySize)
+    {
+        return false;
+    }
+
+    m_entries.resize(size_t(entryCount));
+
+    for (size_t i = 0; i < m_entries.size(); ++i) {
+        ZipEntryInfo& entry = m_entries[i];
+        uint32_t nameLength = reader.Read<uint32_t>();
+        const uint8_t* name = reader.ReadBytes(nameLength);
+        uint8_t flags;
+
+        entry.name.assign(name ? reinterpret_cast<const char*>(name) : "", name ? nameLength : 0);
+        entry.nameHash = HashFnv1a64(entry.name);
+        entry.index = reader.Read<uint64_t>();
+        entry.size = reader.Read<uint64_t>();
+        entry.compressedSize = reader.Read<uint64_t>();
+        entry.crc = reader.Read<uint32_t>();
+        entry.method = reader.Read<uint16_t>();
+        flags = reader.Read<uint8_t>();
+        entry.isEncrypted = (flags & IndexCacheFlagEncrypted) != 0;
+        entry.hasDataOffset = (flags & IndexCacheFlagHasDataOffset) != 0;
+        entry.dataOffset = reader.Read<uint64_t>();
+
+        // Indices are passed to libzip and offsets are used to build views into the mapping, so
+        // never trust them blindly.
+        if (entry.index != i
+            || (entry.hasDataOffset
+                && (entry.dataOffset > m_mapping->GetView().size
+                    || entry.compressedSize > m_mapping->GetView().size - entry.dataOffset)))
+        {
+            m_entries.clear();
+            return false;
+        }
+    }
+
+    if (!reader.IsValid() || reader.GetPosition() != data.size - sizeof(uint64_t)) {
+        m_entries.clear();
+        return false;
+    }
+
+    return true;
+}
+
+void ZipArchiveReader::SaveIndexCache(const OsString& cachePath, const OsString& archivePath,
+                                      uint64_t directoryHash) const
+{
+    PROFILE_SCOPE("ZipArchiveReader::SaveIndexCache");
+
+    std::string_view pathBytes = GetPathBytes(archivePath);
+    fs::path tempPath = fs::path{cachePath}.concat(".tmp");
+    std::error_code error;
+    std::string buffer;
+
+    buffer.append(IndexCacheMagic, sizeof(IndexCacheMagic));
+    AppendLittleEndian(buffer, IndexCacheVersion);
+    AppendLittleEndian(buffer, uint64_t(m_mapping->GetView().size));
+    AppendLittleEndian(buffer, m_mapping->GetModificationTime());
+    AppendLittleEndian(buffer, directoryHash);
+    AppendLittleEndian(buffer, uint64_t(m_entries.size()));
+    AppendLittleEndian(buffer, uint32_t(pathBytes.size()));
+    buffer.append(pathBytes);
+
+    for (const ZipEntryInfo& entry : m_entries) {
+        AppendLittleEndian(buffer, uint32_t(entry.name.size()));
+        buffer.append(entry.name);
+        AppendLittleEndian(buffer, entry.index);
+        AppendLittleEndian(buffer, entry.size);
+        AppendLittleEndian(buffer, entry.compressedSize);
+        AppendLittleEndian(buffer, entry.crc);
+        AppendLittleEndian(buffer, entry.method);
+        AppendLittleEndian(buffer, uint8_t((entry.isEncrypted ? IndexCacheFlagEncrypted : 0)
+                                           | (entry.hasDataOffset ? IndexCacheFlagHasDataOffset : 0)));
+        AppendLittleEndian(buffer, entry.dataOffset);
+    }
+
+    AppendLittleEndian(buffer, HashFnv1a64(buffer));
+
+    // The cache is only an optimization, so failing to write it is a warning. Writing to a
+    // temporary file first means a concurrent run never sees a partial cache.
+    fs::create_directories(fs::path{cachePath}.parent_path(), error);
+
+    {
+        std::ofstream output{tempPath, std::ios::binary | std::ios::trunc};
+        output.write(buffer.data(), std::streamsize(buffer.size()));
+        if (!output.flush()) {
+            LOG_WARNING("Can't write zip index cache {}", tempPath.native());
+            output.close();
+            fs::remove(tempPath, error);
+            return;
+        }
+    }
+
+    fs::rename(tempPath, cachePath, error);
+    if (error) {
+        LOG_WARNING("Can't write zip index cache {}: {}", cachePath, error.message());
+        fs::remove(tempPath, error);
+    }
+}
+
+void ZipArchiveReader::BuildNameTable()
+{
+    PROFILE_SCOPE("ZipArchiveReader::BuildNameTable");
+
+    size_t tableSize = 16;
+    size_t mask;
+
+    // Keep the load factor at or below one half so probe sequences stay short.
+    while (tableSize < m_entries.size() * 2) {
+        tableSize *= 2;
+    }
+
+    m_nameTable.assign(tableSize, 0);
+    mask = tableSize - 1;
+
+    for (const ZipEntryInfo& entry : m_entries) {
+        if (FindEntry(HashedName{entry.name, entry.nameHash})) {
+            continue;
+        }
+
+        size_t slot = size_t(entry.nameHash) & mask;
+        while (m_nameTable[slot]) {
+            slot = (slot + 1) & mask;
+        }
+        m_nameTable[slot] = uint32_t(entry.index + 1);
+    }
+}
+
+std::unique_ptr<Stream> ZipArchiveReader::OpenMappedStream(const ZipEntryInfo& entry)
+{
+    if (!entry.hasDataOffset || entry.method != ZIP_CM_STORE || entry.isEncrypted
+        || entry.compressedSize != entry.size)
+    {
+        return nullptr;
+    }
+
+    ByteView view{m_mapping->GetView().data + entry.dataOffset, size_t(entry.size)};
+    return std::make_unique<MemoryInputStream>(view, m_mapping);
+}
+
 //--------------------------------------------------------------------------------------------------
 
-ZipInputStream::ZipInputStream(ZipArchiveReader& archive, const char* name, Out<std::string> outError)
+ZipInputStream::ZipInputStream(ZipArchiveReader& archive, const char* name, Out<IoError> outError)
 {
     Open(archive, name, outError);
 }
 
+ZipInputStream::ZipInputStream(ZipArchiveReader& archive, uint64_t index, Out<IoError> outError)
+{
+    Open(archive, index, outError);
+}
+
 ZipInputStream::~ZipInputStream()
 {
     Close();
 }
 
-bool ZipInputStream::Open(ZipArchiveReader& archive, const char* name, Out<std::string> outError)
+bool ZipInputStream::Open(ZipArchiveReader& archive, const char* name, Out<IoError> outError)
 {
     Close();
 
     if (!archive.IsOpen()) {
-        *outError = "Archive is closed";
+        *outError = IoError{IoErrorCode::Closed, "Archive is closed"};
+        return false;
+    }
+
+    const ZipEntryInfo* entry = archive.FindEntry(name);
+    if (!entry) {
+        *outError = IoError{IoErrorCode::NotFound, "File not found"};
+        return false;
+    }
+
+    return Open(archive, entry->index, outError);
+}
+
+bool ZipInputStream::Open(ZipArchiveReader& archive, uint64_t index, Out<IoError> outError)
+{
+    Close();
+
+    if (!archive.IsOpen()) {
+        *outError = IoError{IoErrorCode::Closed, "Archive is closed"};
+        return false;
+    } else if (index >= archive.m_entries.size()) {
+        *outError = IoError{IoErrorCode::NotFound, "File not found"};
         return false;
     }
 
-    m_zipFile = zip_fopen(archive.m_zip, name, 0);
+    const ZipEntryInfo& entry = archive.m_entries[size_t(index)];
+    m_archive = &archive;
+    m_index = index;
+    m_size = entry.size;
+
+    // Decode directly from the mapping whenever possible. This needs no locking, since the mapping
+    // is read-only and all decoder state belongs to this stream.
+    if (entry.hasDataOffset && !entry.isEncrypted
+        && (entry.method == ZIP_CM_DEFLATE || (entry.method == ZIP_CM_STORE && entry.size == entry.compressedSize)))
+    {
+        auto direct = std::make_unique<DirectState>();
+
+        direct->mapping = archive.m_mapping;
+        direct->input = archive.m_mapping->GetView().data + entry.dataOffset;
+        direct->inputSize = entry.compressedSize;
+        direct->outputSize = entry.size;
+        direct->expectedCrc = entry.crc;
+        direct->method = entry.method;
+
+        if (entry.method == ZIP_CM_DEFLATE) {
+            // Negative window bits select raw deflate data without a zlib header.
+            if (inflateInit2(&direct->zstream, -MAX_WBITS) != Z_OK) {
+                *outError = IoError{"inflateInit2", direct->zstream.msg ? direct->zstream.msg : "Failed"};
+                m_archive = nullptr;
+                return false;
+            }
+            direct->isZStreamInit = true;
+        }
+
+        m_direct = std::move(direct);
+        return true;
+    }
+
+    ScopedLock lock{archive.m_zipMutex};
+
+    m_zipFile = zip_fopen_index(archive.m_zip, index, 0);
     if (!m_zipFile) {
-        *outError = "zip_fopen: "s + zip_strerror(archive.m_zip);
+        *outError = IoError{"zip_fopen_index", zip_strerror(archive.m_zip)};
+        m_archive = nullptr;
         return false;
     }
 
@@ -134,31 +1121,109 @@ bool ZipInputStream::Open(ZipArchiveReader& archive, const char* name, Out<std::
 
 void ZipInputStream::Close()
 {
-    zip_error_t zipError;
+    m_direct.reset();
 
     if (m_zipFile) {
-        if (int errorCode = zip_fclose(m_zipFile)) {
-            zip_error_init_with_code(&zipError, errorCode);
-            Finally _freeZipError{[&zipError]() { zip_error_fini(&zipError); }};
-            LOG_ERROR("zip_fclose: {}", zip_error_strerror(&zipError));
-        }
+        ScopedLock lock{m_archive->m_zipMutex};
+        CloseZipFile(m_zipFile);
         m_zipFile = nullptr;
     }
+
+    m_archive = nullptr;
+    m_index = 0;
+    m_size = 0;
+    m_zipFilePosition = 0;
+}
+
+bool ZipInputStream::GetSize(Out<uint64_t> outSize) const
+{
+    *outSize = m_size;
+    return IsOpen();
+}
+
+uint64_t ZipInputStream::Tell() const
+{
+    return m_direct ? m_direct->outputPosition : m_zipFilePosition;
 }
 
-size_t ZipInputStream::DoRead(void* buffer, size_t size, Out<std::string> outError)
+size_t ZipInputStream::DoRead(void* buffer, size_t size, Out<IoError> outError)
 {
     zip_int64_t result;
 
+    if (m_direct) {
+        return m_direct->Read(buffer, size, outError);
+    }
+
     if (size > std::numeric_limits<zip_uint64_t>::max()) {
         size = size_t(std::numeric_limits<zip_uint64_t>::max());
     }
 
+    ScopedLock lock{m_archive->m_zipMutex};
+
     result = zip_fread(m_zipFile, buffer, zip_uint64_t(size));
     if (result < 0) {
-        *outError = "zip_fread: "s + zip_file_strerror(m_zipFile);
+        *outError = IoError{"zip_fread", zip_file_strerror(m_zipFile)};
         return 0;
     }
 
+    m_zipFilePosition += uint64_t(result);
     return size_t(result);
 }
+
+bool ZipInputStream::DoSeek(uint64_t position, Out<IoError> outError)
+{
+    if (m_direct) {
+        return m_direct->Seek(position, outError);
+    }
+
+    return SeekZipFile(position, outError);
+}
+
+bool ZipInputStream::SeekZipFile(uint64_t position, Out<IoError> outError)
+{
+    uint8_t buffer[SkipBufferSize];
+    zip_int64_t result;
+
+    ScopedLock lock{m_archive->m_zipMutex};
+
+    if (position == m_zipFilePosition) {
+        return true;
+    }
+
+    // libzip can seek within stored entries, and within compressed entries in some cases.
+    if (zip_file_is_seekable(m_zipFile) > 0) {
+        if (zip_fseek(m_zipFile, zip_int64_t(position), SEEK_SET) < 0) {
+            *outError = IoError{"zip_fseek", zip_file_strerror(m_zipFile)};
+            return false;
+        }
+        m_zipFilePosition = position;
+        return true;
+    }
+
+    // Otherwise, rewind by reopening the entry, then decompress up to the target.
+    if (position < m_zipFilePosition) {
+        struct ::zip_file* zipFile = zip_fopen_index(m_archive->m_zip, m_index, 0);
+        if (!zipFile) {
+            *outError = IoError{"zip_fopen_index", zip_strerror(m_archive->m_zip)};
+            return false;
+        }
+
+        CloseZipFile(m_zipFile);
+        m_zipFile = zipFile;
+        m_zipFilePosition = 0;
+    }
+
+    while (m_zipFilePosition < position) {
+        result = zip_fread(m_zipFile, buffer, std::min<zip_uint64_t>(sizeof(buffer), position - m_zipFilePosition));
+        if (result < 0) {
+            *outError = IoError{"zip_fread", zip_file_strerror(m_zipFile)};
+            return false;
+        } else if (!result) {
+            *outError = IoError{IoErrorCode::EndOfStream, "Unexpected end of stream"};
+            return false;
+        }
+        m_zipFilePosition += uint64_t(result);
+    }
+
+    return true;
+}
@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <zstd.h>
+
+#include <Core/IO/Codec/Zstd.h>
+#include <Core/Debug.h>
+
+using namespace ArenaBuilder;
+
+ZstdInputStream::ZstdInputStream(Stream& source)
+    : m_source{&source}
+{
+    Init();
+}
+
+ZstdInputStream::ZstdInputStream(std::unique_ptr<Stream> source)
+    : m_source{source.get()}
+    , m_ownedSource{std::move(source)}
+{
+    ASSERT(m_source != nullptr);
+    Init();
+}
+
+ZstdInputStream::~ZstdInputStream()
+{
+    ZSTD_freeDCtx(m_context);
+}
+
+void ZstdInputStream::Close()
+{
+    if (m_context) {
+        ZSTD_freeDCtx(m_context);
+        m_context = nullptr;
+    }
+
+    m_source->Close();
+    m_buffer.reset();
+    m_position = m_end = 0;
+}
+
+size_t ZstdInputStream::DoRead(void* buffer, size_t size, Out<IoError> outError)
+{
+    ZSTD_outBuffer output = {buffer, size, 0};
+    size_t result;
+
+    // Loop until some output is produced, since a block header alone may consume all buffered
+    // input without producing anything.
+    while (!output.pos) {
+        if (m_position == m_end) {
+            m_position = 0;
+            m_end = m_source->Read(m_buffer.get(), m_capacity, outError);
+
+            if (!m_end) {
+                if (!outError->HasError() && !m_isFrameComplete) {
+                    *outError = IoError{IoErrorCode::InvalidData, "Truncated zstd stream"};
+                }
+                return 0;
+            }
+        }
+
+        ZSTD_inBuffer input = {m_buffer.get(), m_end, m_position};
+        result = ZSTD_decompressStream(m_context, &output, &input);
+        m_position = input.pos;
+
+        if (ZSTD_isError(result)) {
+            *outError = ZSTD_getErrorName(result);
+            return 0;
+        }
+
+        m_isFrameComplete = result == 0;
+    }
+
+    return output.pos;
+}
+
+void ZstdInputStream::Init()
+{
+    m_context = ZSTD_createDCtx();
+    if (!m_context) {
+        FATAL("Can't create zstd decompression context");
+    }
+
+    ZSTD_DCtx_setParameter(m_context, ZSTD_d_windowLogMax, MaxWindowLog);
+
+    m_capacity = ZSTD_DStreamInSize();
+    m_buffer.reset(new uint8_t[m_capacity]);
+}
+
+//--------------------------------------------------------------------------------------------------
+
+ZstdOutputStream::ZstdOutputStream(Stream& target, int level)
+    : m_target{&target}
+{
+    Init(level);
+}
+
+ZstdOutputStream::ZstdOutputStream(std::unique_ptr<Stream> target, int level)
+    : m_target{target.get()}
+    , m_ownedTarget{std::move(target)}
+{
+    ASSERT(m_target != nullptr);
+    Init(level);
+}
+
+ZstdOutputStream::~ZstdOutputStream()
+{
+    ZSTD_freeCCtx(m_context);
+}
+
+void ZstdOutputStream::Close()
+{
+    if (m_context) {
+        ZSTD_freeCCtx(m_context);
+        m_context = nullptr;
+    }
+
+    m_target->Close();
+    m_buffer.reset();
+}
+
+bool ZstdOutputStream::Finish(Out<IoError> outError)
+{
+    ZSTD_inBuffer input = {nullptr, 0, 0};
+    size_t result;
+
+    if (!IsOpen()) {
+        *outError = IoError{IoErrorCode::Closed, "Stream is closed"};
+        return false;
+    }
+
+    do {
+        ZSTD_outBuffer output = {m_buffer.get(), m_capacity, 0};
+
+        result = ZSTD_compressStream2(m_context, &output, &input, ZSTD_e_end);
+        if (ZSTD_isError(result)) {
+            *outError = ZSTD_getErrorName(result);
+            return false;
+        } else if (output.pos && m_target->Write(m_buffer.get(), output.pos, outError) < output.pos) {
+            return false;
+        }
+    } while (result);
+
+    return true;
+}
+
+size_t ZstdOutputStream::DoWrite(const void* buffer, size_t size, Out<IoError> outError)
+{
+    ZSTD_inBuffer input = {buffer, size, 0};
+    size_t result;
+
+    // Compressed output is flushed whenever the output buffer fills, so memory use stays bounded
+    // no matter how much is written at once.
+    while (input.pos < input.size) {
+        ZSTD_outBuffer output = {m_buffer.get(), m_capacity, 0};
+
+        result = ZSTD_compressStream2(m_context, &output, &input, ZSTD_e_continue);
+        if (ZSTD_isError(result)) {
+            *outError = ZSTD_getErrorName(result);
+            return 0;
+        } else if (output.pos && m_target->Write(m_buffer.get(), output.pos, outError) < output.pos) {
+            return 0;
+        }
+    }
+
+    return size;
+}
+
+void ZstdOutputStream::Init(int level)
+{
+    m_context = ZSTD_createCCtx();
+    if (!m_context) {
+        FATAL("Can't create zstd compression context");
+    }
+
+    ZSTD_CCtx_setParameter(m_context, ZSTD_c_compressionLevel, level);
+    ZSTD_CCtx_setParameter(m_context, ZSTD_c_checksumFlag, 1);
+
+    m_capacity = ZSTD_CStreamOutSize();
+    m_buffer.reset(new uint8_t[m_capacity]);
+}
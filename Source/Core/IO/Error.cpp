@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _WIN32
+# include <string.h>
+#endif
+
+#include <Core/IO/Error.h>
+#include <Core/System.h>
+
+using namespace ArenaBuilder;
+
+IoError IoError::FromSystemError(const char* message, int errorNumber)
+{
+    IoError error{IoErrorCode::System, message};
+
+    error.m_systemError = errorNumber;
+    return error;
+}
+
+std::string IoError::ToString() const
+{
+    std::string str = m_message;
+    std::string detail;
+
+    if (m_code == IoErrorCode::System) {
+#ifdef _WIN32
+        detail = Win32::GetErrorStringA(uint32_t(m_systemError));
+#else
+        detail = strerror(m_systemError);
+#endif
+    } else {
+        detail = m_detail;
+    }
+
+    if (!str.empty() && !detail.empty()) {
+        str += ": ";
+    }
+
+    return str + detail;
+}
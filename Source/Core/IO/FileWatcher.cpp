@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <Core/IO/FileWatcher.h>
+
+using namespace ArenaBuilder;
+
+FileWatcher::~FileWatcher()
+{
+}
+
+//--------------------------------------------------------------------------------------------------
+
+std::unique_ptr<FileWatcher> ArenaBuilder::CreateFileWatcher([[maybe_unused]] OsString rootDir, Out<IoError> outError)
+{
+#ifdef __linux__
+    return Internal::CreateInotifyFileWatcher(std::move(rootDir), outError);
+#else
+    *outError = IoError{IoErrorCode::NotSupported, "File watching is not supported on this platform"};
+    return nullptr;
+#endif
+}
@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <vector>
+
+#include <Core/IO/MappedFile.h>
+#include <Core/IO/Memory.h>
+#include <Core/System.h>
+#ifdef _WIN32
+# include <Core/Encoding.h>
+#endif
+
+using namespace ArenaBuilder;
+
+namespace {
+
+    // Checks that a data source name is a relative path which stays under the root directory.
+    // Backslashes and colons are rejected as well, since Windows would interpret them.
+    bool IsValidEntryName(std::string_view name)
+    {
+        size_t start = 0;
+        size_t end;
+        std::string_view component;
+
+        while (true) {
+            end = name.find('/', start);
+            component = name.substr(start, end == std::string_view::npos ? end : end - start);
+
+            if (component.empty() || component == "." || component == "..") {
+                return false;
+            } else if (component.find_first_of("\\:") != std::string_view::npos) {
+                return false;
+            } else if (end == std::string_view::npos) {
+                return true;
+            }
+
+            start = end + 1;
+        }
+    }
+
+    // Guards against symbolic link cycles.
+    constexpr int MaxDirectoryDepth = 64;
+
+    bool EnumerateFiles(const OsString& dirPath, const std::string& prefix, int depth,
+                        const DataSource::EntryCallback& callback, Out<IoError> outError)
+    {
+        struct Child {
+            OsString path;
+            std::string name;
+            System::FileType type;
+        };
+
+        std::vector<Child> children;
+        std::string error;
+
+        if (depth > MaxDirectoryDepth) {
+            *outError = "Directories are nested too deeply";
+            return false;
+        }
+
+        // Collect the children first so that only one directory is open at a time.
+        auto addChild = [&](OsStringView name, System::FileType type) {
+            Child child;
+
+            child.path = dirPath;
+            if (!child.path.empty() && child.path.back() != '/' && child.path.back() != '\\') {
+                child.path.push_back('/');
+            }
+            child.path += name;
+#ifdef _WIN32
+            child.name = prefix + Encoding::WideToSystem(name);
+#else
+            child.name = prefix + std::string{name};
+#endif
+            child.type = type;
+
+            if (IsValidEntryName(child.name)) {
+                children.push_back(std::move(child));
+            }
+        };
+
+        if (!System::ListDirectory(dirPath.c_str(), addChild, Out{error})) {
+            *outError = IoError{"Can't list directory", std::move(error)};
+            return false;
+        }
+
+        for (const Child& child : children) {
+            if (child.type == System::FileType::Regular) {
+                callback(child.name, DataSource::NoEntryId);
+            } else if (child.type == System::FileType::Directory
+                       && !EnumerateFiles(child.path, child.name + '/', depth + 1, callback, outError))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+} // namespace
+
+MappedFile::MappedFile(const oschar_t* path, Out<IoError> outError)
+{
+    Open(path, outError);
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+//--------------------------------------------------------------------------------------------------
+
+MappedFileSource::MappedFileSource(OsString rootDir)
+    : m_rootDir{std::move(rootDir)}
+{
+}
+
+MappedFileSource::~MappedFileSource()
+{
+}
+
+std::unique_ptr<Stream> MappedFileSource::OpenStream(std::string_view name, Out<IoError> outError)
+{
+    OsString path;
+    auto mapping = std::make_shared<MappedFile>();
+
+    if (!ResolvePath(name, Out{path}, outError) || !mapping->Open(path.c_str(), outError)) {
+        return nullptr;
+    }
+
+    return std::make_unique<MemoryInputStream>(mapping->GetView(), std::move(mapping));
+}
+
+bool MappedFileSource::EnumerateEntries(const EntryCallback& callback, Out<IoError> outError)
+{
+    // An empty root means names are relative to the working directory, as in ResolvePath().
+    return EnumerateFiles(m_rootDir.empty() ? OsString{OSSTR(".")} : m_rootDir, {}, 0, callback, outError);
+}
+
+bool MappedFileSource::ResolvePath(std::string_view name, Out<OsString> outPath, Out<IoError> outError) const
+{
+    OsString& path = *outPath;
+
+    if (!IsValidEntryName(name)) {
+        *outError = IoError{IoErrorCode::InvalidArgument, "Invalid file name"};
+        return false;
+    }
+
+    path = m_rootDir;
+    if (!path.empty() && path.back() != '/' && path.back() != '\\') {
+        path.push_back('/');
+    }
+
+#ifdef _WIN32
+    path += Encoding::SystemToWide(name);
+#else
+    path += name;
+#endif
+
+    return true;
+}
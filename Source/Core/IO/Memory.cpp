@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include <Core/IO/Memory.h>
+
+using namespace ArenaBuilder;
+
+MemoryInputStream::MemoryInputStream(ByteView view, std::shared_ptr<const void> owner)
+{
+    Open(view, std::move(owner));
+}
+
+MemoryInputStream::~MemoryInputStream()
+{
+}
+
+void MemoryInputStream::Open(ByteView view, std::shared_ptr<const void> owner)
+{
+    m_view = view;
+    m_owner = std::move(owner);
+    m_position = 0;
+    m_isOpen = true;
+    ClearEof();
+}
+
+void MemoryInputStream::Close()
+{
+    m_view = {};
+    m_owner.reset();
+    m_position = 0;
+    m_isOpen = false;
+}
+
+bool MemoryInputStream::TryGetView(Out<ByteView> outView) const
+{
+    if (!m_isOpen) {
+        return false;
+    }
+
+    *outView = m_view;
+    return true;
+}
+
+bool MemoryInputStream::GetSize(Out<uint64_t> outSize) const
+{
+    if (!m_isOpen) {
+        return false;
+    }
+
+    *outSize = m_view.size;
+    return true;
+}
+
+size_t MemoryInputStream::DoRead(void* buffer, size_t size, Out<IoError>)
+{
+    size = std::min(size, m_view.size - m_position);
+
+    if (size) {
+        std::memcpy(buffer, m_view.data + m_position, size);
+        m_position += size;
+    }
+
+    return size;
+}
+
+size_t MemoryInputStream::DoReadV(const ByteSpan* spans, size_t count, Out<IoError>)
+{
+    size_t startPosition = m_position;
+    size_t size;
+
+    for (size_t i = 0; i < count && m_position < m_view.size; ++i) {
+        size = std::min(spans[i].size, m_view.size - m_position);
+
+        if (size) {
+            std::memcpy(spans[i].data, m_view.data + m_position, size);
+            m_position += size;
+        }
+    }
+
+    return m_position - startPosition;
+}
+
+bool MemoryInputStream::DoSeek(uint64_t position, Out<IoError>)
+{
+    m_position = size_t(position);
+    return true;
+}
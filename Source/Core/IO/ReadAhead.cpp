@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include <Core/IO/ReadAhead.h>
+#include <Core/Debug.h>
+
+using namespace ArenaBuilder;
+
+ReadAheadStream::ReadAheadStream(Stream& source, size_t chunkSize, size_t chunkCount)
+    : m_source{&source}
+    , m_chunkSize{chunkSize}
+{
+    Init(chunkCount);
+}
+
+ReadAheadStream::ReadAheadStream(std::unique_ptr<Stream> source, size_t chunkSize, size_t chunkCount)
+    : m_source{source.get()}
+    , m_ownedSource{std::move(source)}
+    , m_chunkSize{chunkSize}
+{
+    ASSERT(m_source != nullptr);
+    Init(chunkCount);
+}
+
+ReadAheadStream::~ReadAheadStream()
+{
+    StopWorker();
+}
+
+void ReadAheadStream::Close()
+{
+    StopWorker();
+    m_source->Close();
+    m_chunks.clear();
+    m_isOpen = false;
+}
+
+bool ReadAheadStream::GetSize(Out<uint64_t> outSize) const
+{
+    if (!m_hasSize) {
+        return false;
+    }
+
+    *outSize = m_size;
+    return true;
+}
+
+size_t ReadAheadStream::DoRead(void* buffer, size_t size, Out<IoError> outError)
+{
+    size_t result;
+
+    if (m_isFinished) {
+        *outError = m_error;
+        return 0;
+    } else if (!m_hasReadChunk) {
+        m_filledChunks->Acquire();
+        m_hasReadChunk = true;
+    }
+
+    Chunk& chunk = m_chunks[m_readIndex];
+
+    result = std::min(size, chunk.size - m_readOffset);
+    if (result) {
+        std::memcpy(buffer, &chunk.data[m_readOffset], result);
+        m_readOffset += result;
+        m_position += result;
+    }
+
+    if (m_readOffset < chunk.size) {
+        return result;
+    } else if (chunk.isLast) {
+        // The worker has exited, so the last chunk is never released back to it.
+        m_isFinished = true;
+        m_error = std::move(chunk.error);
+        if (!result) {
+            *outError = m_error;
+        }
+    } else {
+        m_readIndex = (m_readIndex + 1) % m_chunks.size();
+        m_readOffset = 0;
+        m_hasReadChunk = false;
+        m_freeChunks->Release();
+    }
+
+    return result;
+}
+
+bool ReadAheadStream::DoSeek(uint64_t position, Out<IoError> outError)
+{
+    bool result;
+
+    StopWorker();
+    result = m_source->Seek(int64_t(position), SeekOrigin::Begin, outError);
+
+    // Even if the seek failed, restart from wherever the underlying stream is now.
+    m_position = result ? position : m_source->Tell();
+    StartWorker();
+    return result;
+}
+
+void ReadAheadStream::Init(size_t chunkCount)
+{
+    ASSERT(m_chunkSize > 0);
+    ASSERT(chunkCount > 0);
+
+    m_isSeekable = m_source->IsSeekable();
+    m_hasSize = m_source->GetSize(Out{m_size});
+    m_chunks.resize(chunkCount);
+
+    for (Chunk& chunk : m_chunks) {
+        chunk.data.reset(new uint8_t[m_chunkSize]);
+    }
+
+    StartWorker();
+}
+
+void ReadAheadStream::StartWorker()
+{
+    std::string error;
+
+    // Semaphores can't be reset, and the old ones may be left with any count after the worker is
+    // stopped, so start over with new ones.
+    m_freeChunks = std::make_unique<Semaphore>();
+    m_filledChunks = std::make_unique<Semaphore>();
+    m_freeChunks->Release(uint32_t(m_chunks.size()));
+
+    m_readIndex = 0;
+    m_readOffset = 0;
+    m_hasReadChunk = false;
+    m_isFinished = false;
+    m_error.Clear();
+    m_isStopping = false;
+
+    if (!m_thread.Start([this]() { RunWorker(); }, Out{error})) {
+        FATAL("Can't start read-ahead thread: {}", error);
+    }
+}
+
+void ReadAheadStream::StopWorker()
+{
+    if (!m_thread.IsJoinable()) {
+        return;
+    }
+
+    // Wake the worker if it's waiting for a free chunk. It only checks m_isStopping between reads,
+    // so this waits for any read in progress to finish.
+    m_isStopping = true;
+    m_freeChunks->Release();
+    m_thread.Join();
+}
+
+void ReadAheadStream::RunWorker()
+{
+    size_t writeIndex = 0;
+
+    for (;;) {
+        m_freeChunks->Acquire();
+        if (m_isStopping) {
+            return;
+        }
+
+        // Read() only returns less than a full chunk at the end of the stream or on error.
+        Chunk& chunk = m_chunks[writeIndex];
+        chunk.error.Clear();
+        chunk.size = m_source->Read(chunk.data.get(), m_chunkSize, Out{chunk.error});
+        chunk.isLast = chunk.size < m_chunkSize || chunk.error.HasError();
+
+        m_filledChunks->Release();
+
+        if (chunk.isLast) {
+            return;
+        }
+
+        writeIndex = (writeIndex + 1) % m_chunks.size();
+    }
+}
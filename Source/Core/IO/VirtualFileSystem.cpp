@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <limits>
+
+#include <Core/IO/VirtualFileSystem.h>
+#include <Core/Debug.h>
+
+using namespace ArenaBuilder;
+
+VirtualFileSystem::VirtualFileSystem()
+{
+}
+
+VirtualFileSystem::~VirtualFileSystem()
+{
+}
+
+bool VirtualFileSystem::Mount(DataSource& source, std::string_view mountPoint, int priority, Out<IoError> outError)
+{
+    uint32_t layerIndex = uint32_t(m_layers.size());
+    std::vector<std::pair<std::string, uint64_t>> names;
+    std::string prefix{mountPoint};
+
+    if (m_layers.size() >= std::numeric_limits<uint32_t>::max()) {
+        *outError = "Too many layers";
+        return false;
+    } else if (!prefix.empty()) {
+        prefix.push_back('/');
+    }
+
+    // List everything before touching the index so that a failed mount leaves it unchanged.
+    auto addName = [&](std::string_view name, uint64_t entryId) { names.emplace_back(prefix + std::string{name}, entryId); };
+    if (!source.EnumerateEntries(addName, outError)) {
+        return false;
+    } else if (m_entries.size() + names.size() >= std::numeric_limits<uint32_t>::max()) {
+        *outError = "Too many entries";
+        return false;
+    }
+
+    m_layers.push_back({&source, nullptr, std::string{mountPoint}, priority});
+    m_entries.reserve(m_entries.size() + names.size());
+
+    for (auto& [name, entryId] : names) {
+        AddEntry(std::move(name), layerIndex, entryId);
+    }
+
+    LOG_DEBUG("Mounted {} entries at '{}' with priority {}", names.size(), mountPoint, priority);
+    return true;
+}
+
+bool VirtualFileSystem::Mount(std::unique_ptr<DataSource> source, std::string_view mountPoint, int priority,
+                              Out<IoError> outError)
+{
+    ASSERT(source != nullptr);
+
+    if (!Mount(*source, mountPoint, priority, outError)) {
+        return false;
+    }
+
+    m_layers.back().ownedSource = std::move(source);
+    return true;
+}
+
+std::unique_ptr<Stream> VirtualFileSystem::OpenStream(std::string_view name, Out<IoError> outError)
+{
+    return OpenStream(HashedName{name}, outError);
+}
+
+std::unique_ptr<Stream> VirtualFileSystem::OpenStream(const HashedName& name, Out<IoError> outError)
+{
+    const Entry* entry = FindEntry(name);
+
+    if (!entry || entry->layerIndex == NoLayer) {
+        *outError = IoError{IoErrorCode::NotFound, "File not found"};
+        return nullptr;
+    }
+
+    return OpenEntry(*entry, outError);
+}
+
+bool VirtualFileSystem::RefreshEntry(const DataSource& source, std::string_view name, bool exists)
+{
+    bool isVisible = false;
+
+    // The same source may be mounted more than once, i.e. at different mount points.
+    for (uint32_t layerIndex = 0; layerIndex < m_layers.size(); ++layerIndex) {
+        const Layer& layer = m_layers[layerIndex];
+        std::string fullName;
+        Entry* entry;
+
+        if (layer.source != &source) {
+            continue;
+        } else if (!layer.mountPoint.empty()) {
+            fullName = layer.mountPoint + '/';
+        }
+
+        fullName += name;
+        entry = FindEntry(HashedName{fullName});
+
+        if (exists) {
+            if (!entry) {
+                AddEntry(std::move(fullName), layerIndex, NoEntryId);
+                isVisible = true;
+            } else {
+                // A file that was already indexed has changed in place. Opening it again picks up
+                // the new contents, so only the winning layer needs to be reported.
+                AddProvider(*entry, layerIndex, NoEntryId);
+                isVisible = isVisible || entry->layerIndex == layerIndex;
+            }
+        } else if (entry) {
+            isVisible = isVisible || entry->layerIndex == layerIndex;
+            RemoveProvider(*entry, layerIndex);
+        }
+    }
+
+    return isVisible;
+}
+
+bool VirtualFileSystem::EnumerateEntries(const EntryCallback& callback, Out<IoError>)
+{
+    for (size_t i = 0; i < m_entries.size(); ++i) {
+        if (m_entries[i].layerIndex != NoLayer) {
+            callback(m_entries[i].name, i);
+        }
+    }
+
+    return true;
+}
+
+std::unique_ptr<Stream> VirtualFileSystem::OpenEntryStream(uint64_t entryId, Out<IoError> outError)
+{
+    if (entryId >= m_entries.size() || m_entries[size_t(entryId)].layerIndex == NoLayer) {
+        *outError = IoError{IoErrorCode::NotFound, "File not found"};
+        return nullptr;
+    }
+
+    return OpenEntry(m_entries[size_t(entryId)], outError);
+}
+
+bool VirtualFileSystem::Overrides(uint32_t layerIndex, uint32_t otherLayerIndex) const
+{
+    // Layers are in mount order, so a later layer with the same priority wins. Within a single
+    // layer, the first entry with a name wins, as with ZipArchiveReader::FindEntry().
+    return m_layers[layerIndex].priority > m_layers[otherLayerIndex].priority
+           || (m_layers[layerIndex].priority == m_layers[otherLayerIndex].priority && layerIndex > otherLayerIndex);
+}
+
+VirtualFileSystem::Entry* VirtualFileSystem::FindEntry(const HashedName& name)
+{
+    size_t mask = m_nameTable.size() - 1;
+
+    if (m_nameTable.empty()) {
+        return nullptr;
+    }
+
+    for (size_t slot = size_t(name.hash) & mask;; slot = (slot + 1) & mask) {
+        uint32_t value = m_nameTable[slot];
+
+        if (!value) {
+            return nullptr;
+        }
+
+        Entry& entry = m_entries[value - 1];
+        if (entry.nameHash == name.hash && entry.name == name.name) {
+            return &entry;
+        }
+    }
+}
+
+void VirtualFileSystem::AddEntry(std::string name, uint32_t layerIndex, uint64_t entryId)
+{
+    uint64_t nameHash = HashFnv1a64(name);
+    size_t mask;
+
+    if ((m_entries.size() + 1) * 2 > m_nameTable.size()) {
+        GrowNameTable();
+    }
+
+    mask = m_nameTable.size() - 1;
+
+    for (size_t slot = size_t(nameHash) & mask;; slot = (slot + 1) & mask) {
+        uint32_t value = m_nameTable[slot];
+
+        if (!value) {
+            m_entries.push_back({std::move(name), nameHash, layerIndex, entryId});
+            m_nameTable[slot] = uint32_t(m_entries.size());
+            return;
+        }
+
+        Entry& entry = m_entries[value - 1];
+        if (entry.nameHash == nameHash && entry.name == name) {
+            AddProvider(entry, layerIndex, entryId);
+            return;
+        }
+    }
+}
+
+void VirtualFileSystem::AddProvider(Entry& entry, uint32_t layerIndex, uint64_t entryId)
+{
+    if (entry.layerIndex == NoLayer) {
+        entry.layerIndex = layerIndex;
+        entry.entryId = entryId;
+        --m_removedEntryCount;
+        return;
+    } else if (entry.layerIndex == layerIndex) {
+        return;
+    }
+
+    for (uint32_t i = entry.shadows; i; i = m_shadows[i - 1].next) {
+        if (m_shadows[i - 1].layerIndex == layerIndex) {
+            return;
+        }
+    }
+
+    if (Overrides(layerIndex, entry.layerIndex)) {
+        AddShadow(entry, entry.layerIndex, entry.entryId);
+        entry.layerIndex = layerIndex;
+        entry.entryId = entryId;
+    } else {
+        AddShadow(entry, layerIndex, entryId);
+    }
+}
+
+void VirtualFileSystem::RemoveProvider(Entry& entry, uint32_t layerIndex)
+{
+    uint32_t* link = &entry.shadows;
+    uint32_t* bestLink = nullptr;
+
+    // Unlinks a shadow and puts it on the free list.
+    auto unlink = [this](uint32_t* link) {
+        uint32_t index = *link;
+        *link = m_shadows[index - 1].next;
+        m_shadows[index - 1].next = m_freeShadows;
+        m_freeShadows = index;
+    };
+
+    if (entry.layerIndex != layerIndex) {
+        for (; *link; link = &m_shadows[*link - 1].next) {
+            if (m_shadows[*link - 1].layerIndex == layerIndex) {
+                unlink(link);
+                return;
+            }
+        }
+        return;
+    }
+
+    // Promote whichever of the overridden layers would have won if this one was never mounted.
+    for (; *link; link = &m_shadows[*link - 1].next) {
+        if (!bestLink || Overrides(m_shadows[*link - 1].layerIndex, m_shadows[*bestLink - 1].layerIndex)) {
+            bestLink = link;
+        }
+    }
+
+    if (!bestLink) {
+        entry.layerIndex = NoLayer;
+        entry.entryId = NoEntryId;
+        ++m_removedEntryCount;
+        return;
+    }
+
+    entry.layerIndex = m_shadows[*bestLink - 1].layerIndex;
+    entry.entryId = m_shadows[*bestLink - 1].entryId;
+    unlink(bestLink);
+}
+
+void VirtualFileSystem::AddShadow(Entry& entry, uint32_t layerIndex, uint64_t entryId)
+{
+    uint32_t index = m_freeShadows;
+
+    if (index) {
+        m_freeShadows = m_shadows[index - 1].next;
+        m_shadows[index - 1] = {layerIndex, entryId, entry.shadows};
+    } else {
+        m_shadows.push_back({layerIndex, entryId, entry.shadows});
+        index = uint32_t(m_shadows.size());
+    }
+
+    entry.shadows = index;
+}
+
+void VirtualFileSystem::GrowNameTable()
+{
+    size_t tableSize = m_nameTable.empty() ? 64 : m_nameTable.size() * 2;
+    size_t mask = tableSize - 1;
+
+    m_nameTable.assign(tableSize, 0);
+
+    for (size_t i = 0; i < m_entries.size(); ++i) {
+        size_t slot = size_t(m_entries[i].nameHash) & mask;
+
+        while (m_nameTable[slot]) {
+            slot = (slot + 1) & mask;
+        }
+
+        m_nameTable[slot] = uint32_t(i + 1);
+    }
+}
+
+std::unique_ptr<Stream> VirtualFileSystem::OpenEntry(const Entry& entry, Out<IoError> outError)
+{
+    const Layer& layer = m_layers[entry.layerIndex];
+
+    if (entry.entryId != NoEntryId) {
+        return layer.source->OpenEntryStream(entry.entryId, outError);
+    }
+
+    // Sources without entry IDs are opened by their own name for the entry.
+    std::string_view name = entry.name;
+    if (!layer.mountPoint.empty()) {
+        name.remove_prefix(layer.mountPoint.size() + 1);
+    }
+
+    return layer.source->OpenStream(name, outError);
+}
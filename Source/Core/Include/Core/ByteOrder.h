@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef ARENABUILDER_CORE_BYTEORDER_H_INCLUDED
+#define ARENABUILDER_CORE_BYTEORDER_H_INCLUDED
+
+#include <cstring>
+
+#include "Types.h"
+
+namespace ArenaBuilder {
+
+    namespace Internal {
+
+        template<size_t Size> struct UnsignedOfSize;
+        template<> struct UnsignedOfSize<1> { using Type = uint8_t; };
+        template<> struct UnsignedOfSize<2> { using Type = uint16_t; };
+        template<> struct UnsignedOfSize<4> { using Type = uint32_t; };
+        template<> struct UnsignedOfSize<8> { using Type = uint64_t; };
+
+    } // namespace Internal
+
+    // Trait for types that can be loaded and stored with an explicit byte order.
+    template<typename T>
+    constexpr bool IsByteOrderType = std::is_arithmetic_v<T> || std::is_enum_v<T>;
+
+    // Loads a little-endian value from an unaligned address. Compilers reduce the byte loop to a
+    // single load on little-endian targets.
+    template<typename T>
+    inline T LoadLittleEndian(const void* ptr)
+    {
+        static_assert(IsByteOrderType<T>);
+
+        using U = typename Internal::UnsignedOfSize<sizeof(T)>::Type;
+        const uint8_t* bytes = static_cast<const uint8_t*>(ptr);
+        U bits = 0;
+        T value;
+
+        for (size_t i = 0; i < sizeof(T); ++i) {
+            bits = U(bits | U(U(bytes[i]) << (8 * i)));
+        }
+
+        std::memcpy(&value, &bits, sizeof(T));
+        return value;
+    }
+
+    // Stores a little-endian value to an unaligned address.
+    template<typename T>
+    inline void StoreLittleEndian(void* ptr, T value)
+    {
+        static_assert(IsByteOrderType<T>);
+
+        using U = typename Internal::UnsignedOfSize<sizeof(T)>::Type;
+        uint8_t* bytes = static_cast<uint8_t*>(ptr);
+        U bits;
+
+        std::memcpy(&bits, &value, sizeof(T));
+
+        for (size_t i = 0; i < sizeof(T); ++i) {
+            bytes[i] = uint8_t(bits >> (8 * i));
+        }
+    }
+
+} // namespace ArenaBuilder
+
+#endif // ARENABUILDER_CORE_BYTEORDER_H_INCLUDED
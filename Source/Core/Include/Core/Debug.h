@@ -15,39 +15,124 @@
 #ifndef ARENABUILDER_CORE_DEBUG_H_INCLUDED
 #define ARENABUILDER_CORE_DEBUG_H_INCLUDED
 
+#include <atomic>
+#include <chrono>
 #include <iterator>
+#include <limits>
+#include <memory>
+#include <string.h>
+#include <tuple>
+#include <type_traits>
 
 #include <fmt/core.h>
 #include <fmt/xchar.h>
 
 #include "Encoding.h"
 
-// Logging macros
-#ifdef NDEBUG
-# define FATAL(...) do { ::ArenaBuilder::Debug::Internal::LogFatalErrorAndExit(nullptr, 0, OSSTR("") __VA_ARGS__); } while (0)
-# define LOG_ERROR(...) do { ::ArenaBuilder::Debug::Internal::LogMessage(::ArenaBuilder::LogLevel::Error, nullptr, 0, OSSTR("") __VA_ARGS__); } while (0)
-# define LOG_WARNING(...) do { ::ArenaBuilder::Debug::Internal::LogMessage(::ArenaBuilder::LogLevel::Warning, nullptr, 0, OSSTR("") __VA_ARGS__); } while (0)
-# define LOG_INFO(...) do { ::ArenaBuilder::Debug::Internal::LogMessage(::ArenaBuilder::LogLevel::Info, nullptr, 0, OSSTR("") __VA_ARGS__); } while (0)
-# define LOG_DEBUG(...) do { ::ArenaBuilder::Debug::Internal::DiscardMessage(OSSTR("") __VA_ARGS__); } while (0)
-# define LOG_TRACE(...) do { ::ArenaBuilder::Debug::Internal::DiscardMessage(OSSTR("") __VA_ARGS__); } while (0)
-#else
-# define FATAL(...) do { ::ArenaBuilder::Debug::Internal::LogFatalErrorAndExit(__FILE__, __LINE__, OSSTR("") __VA_ARGS__); } while (0)
-# define LOG_ERROR(...) do { ::ArenaBuilder::Debug::Internal::LogMessage(::ArenaBuilder::LogLevel::Error, __FILE__, __LINE__, OSSTR("") __VA_ARGS__); } while (0)
-# define LOG_WARNING(...) do { ::ArenaBuilder::Debug::Internal::LogMessage(::ArenaBuilder::LogLevel::Warning, __FILE__, __LINE__, OSSTR("") __VA_ARGS__); } while (0)
-# define LOG_INFO(...) do { ::ArenaBuilder::Debug::Internal::LogMessage(::ArenaBuilder::LogLevel::Info, __FILE__, __LINE__, OSSTR("") __VA_ARGS__); } while (0)
-# define LOG_DEBUG(...) do { ::ArenaBuilder::Debug::Internal::LogMessage(::ArenaBuilder::LogLevel::Debug, __FILE__, __LINE__, OSSTR("") __VA_ARGS__); } while (0)
-# define LOG_TRACE(...) do { ::ArenaBuilder::Debug::Internal::LogMessage(::ArenaBuilder::LogLevel::Trace, __FILE__, __LINE__, OSSTR("") __VA_ARGS__); } while (0)
+// Channel of the log messages in a source file. Each target sets its own with a compile definition.
+#ifndef ARENABUILDER_LOG_CHANNEL
+# define ARENABUILDER_LOG_CHANNEL General
+#endif
+
+// Most verbose LogLevel that is compiled in. Logging calls above it are removed entirely, even if
+// verbose logging is enabled at run time.
+#ifndef ARENABUILDER_MAX_LOG_LEVEL
+# ifdef NDEBUG
+#  define ARENABUILDER_MAX_LOG_LEVEL Info
+# else
+#  define ARENABUILDER_MAX_LOG_LEVEL Trace
+# endif
+#endif
+
+// Most verbose LogLevel that still goes to the flight recorder when it isn't compiled in. Such calls
+// only record the call site and the unformatted message, without evaluating the format arguments,
+// so a release build's crash dumps still show the debug and trace messages leading up to a crash.
+// Set this to ARENABUILDER_MAX_LOG_LEVEL to strip those calls entirely.
+#ifndef ARENABUILDER_MAX_RECORDED_LOG_LEVEL
+# define ARENABUILDER_MAX_RECORDED_LOG_LEVEL Trace
 #endif
 
-// Assertion macros
 #ifdef NDEBUG
-# define ASSERT(x) do { if (!(x)) ::ArenaBuilder::Debug::Internal::LogFatalErrorAndExit(nullptr, 0, OSSTR("Assertion failed: {}"), #x); } while (0)
+# define ARENABUILDER_LOG_SOURCE nullptr, 0
 #else
-# define ASSERT(x) do { if (!(x)) ::ArenaBuilder::Debug::Internal::LogFatalErrorAndExit(__FILE__, __LINE__, OSSTR("Assertion failed: {}"), #x); } while (0)
+# define ARENABUILDER_LOG_SOURCE __FILE__, __LINE__
 #endif
 
+// Expands to the format string of a logging macro's arguments, without the format arguments.
+#define ARENABUILDER_LOG_FORMAT(...) ARENABUILDER_LOG_FORMAT_(__VA_ARGS__, )
+#define ARENABUILDER_LOG_FORMAT_(fmt, ...) OSSTR("") fmt
+
+// Logs a message if its level is compiled in and enabled for the source file's channel. The format
+// arguments are only evaluated if the message is logged. Otherwise, the unformatted message still
+// goes to the flight recorder, even if its level isn't compiled in (see
+// ARENABUILDER_MAX_RECORDED_LOG_LEVEL).
+#define LOG_MESSAGE(level, ...) do { \
+        if constexpr (::ArenaBuilder::Debug::Internal::IsLogLevelCompiled(::ArenaBuilder::LogLevel::level)) { \
+            if (::ArenaBuilder::Debug::Internal::IsLogEnabled(::ArenaBuilder::LogChannel::ARENABUILDER_LOG_CHANNEL, ::ArenaBuilder::LogLevel::level)) { \
+                ::ArenaBuilder::Debug::Internal::LogMessage(::ArenaBuilder::LogLevel::level, ARENABUILDER_LOG_SOURCE, OSSTR("") __VA_ARGS__); \
+            } else { \
+                ::ArenaBuilder::Debug::Internal::RecordUnformattedLogMessage(::ArenaBuilder::LogLevel::level, ARENABUILDER_LOG_SOURCE, ARENABUILDER_LOG_FORMAT(__VA_ARGS__)); \
+            } \
+        } else if constexpr (::ArenaBuilder::Debug::Internal::IsLogLevelRecorded(::ArenaBuilder::LogLevel::level)) { \
+            ::ArenaBuilder::Debug::Internal::RecordUnformattedLogMessage(::ArenaBuilder::LogLevel::level, ARENABUILDER_LOG_SOURCE, ARENABUILDER_LOG_FORMAT(__VA_ARGS__)); \
+        } \
+    } while (0)
+
+// Like LOG_MESSAGE, but logs at most once per interval from each call site, i.e. for messages that
+// would otherwise be logged every frame.
+#define LOG_RATE_LIMITED(level, intervalMilliseconds, ...) do { \
+        if constexpr (::ArenaBuilder::Debug::Internal::IsLogLevelCompiled(::ArenaBuilder::LogLevel::level)) { \
+            static ::ArenaBuilder::Debug::Internal::LogRateLimiter logRateLimiter_{intervalMilliseconds}; \
+            if (::ArenaBuilder::Debug::Internal::IsLogEnabled(::ArenaBuilder::LogChannel::ARENABUILDER_LOG_CHANNEL, ::ArenaBuilder::LogLevel::level) \
+                && logRateLimiter_.TryAcquire()) \
+            { \
+                ::ArenaBuilder::Debug::Internal::LogMessage(::ArenaBuilder::LogLevel::level, ARENABUILDER_LOG_SOURCE, OSSTR("") __VA_ARGS__); \
+            } else { \
+                ::ArenaBuilder::Debug::Internal::RecordUnformattedLogMessage(::ArenaBuilder::LogLevel::level, ARENABUILDER_LOG_SOURCE, ARENABUILDER_LOG_FORMAT(__VA_ARGS__)); \
+            } \
+        } else if constexpr (::ArenaBuilder::Debug::Internal::IsLogLevelRecorded(::ArenaBuilder::LogLevel::level)) { \
+            ::ArenaBuilder::Debug::Internal::RecordUnformattedLogMessage(::ArenaBuilder::LogLevel::level, ARENABUILDER_LOG_SOURCE, ARENABUILDER_LOG_FORMAT(__VA_ARGS__)); \
+        } \
+    } while (0)
+
+// Like LOG_MESSAGE, but only copies the arguments into a per-thread buffer, and the deferred logger
+// thread formats them later. Arguments must be numbers, enums or const void*, since anything that
+// refers to other memory, e.g. a string or view, may be gone by then. Messages are logged
+// immediately if the deferred logger isn't running. Otherwise, the flight recorder gets the
+// unformatted message.
+#define LOG_DEFERRED(level, ...) do { \
+        if constexpr (::ArenaBuilder::Debug::Internal::IsLogLevelCompiled(::ArenaBuilder::LogLevel::level)) { \
+            static constexpr ::ArenaBuilder::Debug::Internal::DeferredLogSite deferredLogSite_{::ArenaBuilder::LogLevel::level, ARENABUILDER_LOG_SOURCE}; \
+            if (::ArenaBuilder::Debug::Internal::IsLogEnabled(::ArenaBuilder::LogChannel::ARENABUILDER_LOG_CHANNEL, ::ArenaBuilder::LogLevel::level)) { \
+                ::ArenaBuilder::Debug::Internal::LogDeferred(deferredLogSite_, OSSTR("") __VA_ARGS__); \
+            } else { \
+                ::ArenaBuilder::Debug::Internal::RecordUnformattedLogMessage(::ArenaBuilder::LogLevel::level, ARENABUILDER_LOG_SOURCE, ARENABUILDER_LOG_FORMAT(__VA_ARGS__)); \
+            } \
+        } else if constexpr (::ArenaBuilder::Debug::Internal::IsLogLevelRecorded(::ArenaBuilder::LogLevel::level)) { \
+            ::ArenaBuilder::Debug::Internal::RecordUnformattedLogMessage(::ArenaBuilder::LogLevel::level, ARENABUILDER_LOG_SOURCE, ARENABUILDER_LOG_FORMAT(__VA_ARGS__)); \
+        } \
+    } while (0)
+
+// Records a tagged event with a numeric value in the flight recorder only. The tag must be a string
+// literal.
+#define TRACE_EVENT(tag, value) do { ::ArenaBuilder::Debug::Internal::RecordTraceEvent("" tag, uint64_t(value)); } while (0)
+
+#define FATAL(...) do { ::ArenaBuilder::Debug::Internal::LogFatalErrorAndExit(ARENABUILDER_LOG_SOURCE, OSSTR("") __VA_ARGS__); } while (0)
+#define LOG_ERROR(...) LOG_MESSAGE(Error, __VA_ARGS__)
+#define LOG_WARNING(...) LOG_MESSAGE(Warning, __VA_ARGS__)
+#define LOG_INFO(...) LOG_MESSAGE(Info, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_MESSAGE(Debug, __VA_ARGS__)
+#define LOG_TRACE(...) LOG_MESSAGE(Trace, __VA_ARGS__)
+#define LOG_DEBUG_DEFERRED(...) LOG_DEFERRED(Debug, __VA_ARGS__)
+#define LOG_TRACE_DEFERRED(...) LOG_DEFERRED(Trace, __VA_ARGS__)
+
+// Assertion macros
+#define ASSERT(x) do { if (!(x)) ::ArenaBuilder::Debug::Internal::LogFatalErrorAndExit(ARENABUILDER_LOG_SOURCE, OSSTR("Assertion failed: {}"), #x); } while (0)
+
 namespace ArenaBuilder {
 
+    class LogSink;
+
     enum class LogLevel {
         Fatal,
         Error,
@@ -57,19 +142,150 @@ namespace ArenaBuilder {
         Trace,
     };
 
+    // Subsystem that a log message comes from. Each channel's level can be set separately.
+    enum class LogChannel : uint8_t {
+        General,
+        IO,
+        Render,
+        Client,
+        Tools,
+        Count,
+    };
+
+    // What a thread that logs does when the asynchronous logger's ring is full.
+    enum class LogOverflowPolicy {
+        Drop, // Discard the message. The number of dropped messages is logged later.
+        Block, // Wait for the logger thread to make room.
+    };
+
+    struct AsyncLoggerParams {
+        size_t capacity = 4096; // Number of messages, rounded up to a power of two
+        LogOverflowPolicy overflowPolicy = LogOverflowPolicy::Drop;
+    };
+
+    struct DeferredLoggerParams {
+        size_t capacity = 65536; // Bytes per thread, rounded up to a power of two
+    };
+
     namespace Debug {
 
         // Must be called before any messages are logged. Should be called as early as possible,
         // particularly before any threads are spawned.
         void InitLogger();
 
-        // Changes the maximum log level. Level depends on whether build is debug or release.
+        // Changes the maximum log level of every channel. Level depends on whether build is debug or
+        // release.
         void EnableVerboseLogMessages();
 
+        LogLevel GetLogLevel(LogChannel channel);
+        void SetLogLevel(LogChannel channel, LogLevel level);
+
+        // Lowercase name of a level, as accepted by SetLogLevels().
+        const char* GetLogLevelName(LogLevel level);
+
+        // Sets log levels from a comma-separated list of "level" (all channels) or "channel=level",
+        // e.g. "warning,render=debug". Names are case-insensitive.
+        bool SetLogLevels(OsStringView spec, Out<std::string> outError);
+
+        // Adds a destination for log messages, in addition to the console sink that InitLogger()
+        // adds. Sinks are written to from whichever thread writes the message: the logging thread,
+        // or the asynchronous or deferred logger's thread. Wrap a sink in a ThreadedLogSink to give
+        // it a thread of its own.
+        void AddLogSink(std::unique_ptr<LogSink> sink);
+
+        // Flushes and destroys the sinks added with AddLogSink(), e.g. joining their threads. Only
+        // the console sink remains. Should be called after StopAsyncLogger() and
+        // StopDeferredLogger(), so that everything they had pending reaches the sinks.
+        void RemoveLogSinks();
+
+        // The flight recorder keeps each thread's most recent log messages, including those that
+        // are filtered out by their channel's level, and TRACE_EVENTs in a small ring. The rings
+        // are dumped to this file on fatal errors and crashes. Nothing is dumped if the path is
+        // empty. Should be called before any threads are spawned.
+        void SetFlightRecorderPath(OsString path);
+
+        // Writes the flight recorder rings to the file. Safe to call from a signal handler, but the
+        // contents may be inconsistent if other threads are still logging.
+        void DumpFlightRecorder(const char* reason);
+
+        // Moves writing log messages to a background thread. Threads that log still format their
+        // messages, but then only push them into a lock-free ring. Fatal errors are still written
+        // synchronously after everything in the ring. Must not be called while other threads may
+        // be logging.
+        bool StartAsyncLogger(const AsyncLoggerParams& params, Out<std::string> outError);
+
+        // Writes any pending messages and goes back to writing them synchronously. Must not be
+        // called while other threads may be logging.
+        void StopAsyncLogger();
+
+        // Starts the thread which formats messages from LOG_DEBUG_DEFERRED and LOG_TRACE_DEFERRED.
+        // Each thread that logs them gets a ring of the given capacity, and messages that don't fit
+        // are dropped. Must not be called while other threads may be logging.
+        bool StartDeferredLogger(const DeferredLoggerParams& params, Out<std::string> outError);
+
+        // Formats any pending deferred messages and stops the thread. Deferred messages are logged
+        // immediately afterwards. Must not be called while other threads may be logging.
+        void StopDeferredLogger();
+
         namespace Internal {
 
-            bool BeginLogMessage(LogLevel level);
-            void PutLogMessageChar(oschar_t ch);
+            // Maximum level of each channel, indexed by LogChannel.
+            extern std::atomic<LogLevel> channelLogLevels[size_t(LogChannel::Count)];
+
+            constexpr bool IsLogLevelCompiled(LogLevel level)
+            {
+                return int(level) <= int(LogLevel::ARENABUILDER_MAX_LOG_LEVEL);
+            }
+
+            constexpr bool IsLogLevelRecorded(LogLevel level)
+            {
+                return int(level) <= int(LogLevel::ARENABUILDER_MAX_RECORDED_LOG_LEVEL);
+            }
+
+            inline bool IsLogEnabled(LogChannel channel, LogLevel level)
+            {
+                return int(level) <= int(channelLogLevels[size_t(channel)].load(std::memory_order_relaxed));
+            }
+
+            // Per-call-site state for LOG_RATE_LIMITED.
+            class LogRateLimiter {
+            public:
+                constexpr explicit LogRateLimiter(int64_t intervalMilliseconds)
+                    : m_interval{intervalMilliseconds * 1000000}
+                {
+                }
+
+                // Returns true if the interval has passed since the last time this returned true.
+                bool TryAcquire()
+                {
+                    int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now().time_since_epoch()).count();
+                    int64_t next = m_nextTime.load(std::memory_order_relaxed);
+
+                    return now >= next && m_nextTime.compare_exchange_strong(next, now + m_interval, std::memory_order_relaxed);
+                }
+
+            private:
+                std::atomic<int64_t> m_nextTime{std::numeric_limits<int64_t>::min()};
+                int64_t m_interval;
+            };
+
+            // Nanoseconds on the steady clock, which the flight recorder's timestamps use.
+            int64_t GetSteadyTimestamp();
+
+            void RecordLogMessage(LogLevel level, const char* sourceFileName, int sourceLine, OsStringView text);
+            void RecordUnformattedLogMessage(LogLevel level, const char* sourceFileName, int sourceLine,
+                                             const oschar_t* fmt);
+            // Same, with a timestamp that the caller already has, in nanoseconds on the steady clock.
+            void RecordUnformattedLogMessage(LogLevel level, const char* sourceFileName, int sourceLine,
+                                             const oschar_t* fmt, int64_t timestamp);
+            void RecordTraceEvent(const char* tag, uint64_t value);
+
+            // Returns the calling thread's message buffer with the level prefix already written, or
+            // null if the thread is already in the middle of a message. The caller checks the level.
+            OsString* BeginLogMessage(LogLevel level);
+            // Appends the suffix and writes the whole message to stderr at once, or passes it to the
+            // asynchronous logger.
             void EndLogMessage(const char* sourceFileName, int sourceLine);
 
             void BeginFatalError();
@@ -103,31 +319,6 @@ namespace ArenaBuilder {
 
 #endif // defined(_WIN32)
 
-            // Output iterator which calls PutLogMessageChar each time a char is assigned.
-            class LogMessageIterator {
-            public:
-                using difference_type = ptrdiff_t;
-                using iterator_category = std::output_iterator_tag;
-                using pointer = oschar_t*;
-                using reference = oschar_t&;
-                using value_type = oschar_t;
-
-                constexpr LogMessageIterator() = default;
-                constexpr LogMessageIterator(const LogMessageIterator&) = default;
-
-                constexpr LogMessageIterator& operator=(const LogMessageIterator&) = default;
-
-                LogMessageIterator& operator=(oschar_t ch)
-                {
-                    PutLogMessageChar(ch);
-                    return *this;
-                }
-
-                constexpr LogMessageIterator& operator*() { return *this; }
-                constexpr LogMessageIterator& operator++() { return *this; }
-                constexpr LogMessageIterator& operator++(int) { return *this; }
-            };
-
             // Output iterator which calls PutFatalErrorChar each time a char is assigned.
             class FatalErrorIterator {
             public:
@@ -157,8 +348,8 @@ namespace ArenaBuilder {
             void LogMessage(LogLevel level, const char* sourceFileName, int sourceLine,
                             std::basic_string_view<oschar_t> fmt, const Args&...args)
             {
-                if (BeginLogMessage(level)) {
-                    fmt::format_to(LogMessageIterator{}, fmt, Internal::Forward(args)...);
+                if (OsString* buffer = BeginLogMessage(level)) {
+                    fmt::format_to(std::back_inserter(*buffer), fmt, Internal::Forward(args)...);
                     EndLogMessage(sourceFileName, sourceLine);
                 }
             }
@@ -173,9 +364,66 @@ namespace ArenaBuilder {
                 EndFatalErrorAndExit(sourceFileName, sourceLine);
             }
 
+            // Static information about a deferred log call site.
+            struct DeferredLogSite {
+                LogLevel level;
+                const char* sourceFileName;
+                int sourceLine;
+            };
+
+            // Formats a deferred message's body from its recorded arguments.
+            using DeferredFormatFunction = void (*)(OsString& buffer, OsStringView fmt, const uint8_t* args);
+
+            bool IsDeferredLoggerRunning();
+
+            // Reserves a record in the calling thread's deferred log buffer and returns where its
+            // arguments go, or null if the buffer is full. Also records the unformatted message in
+            // the flight recorder, even if it doesn't fit.
+            uint8_t* BeginDeferredRecord(DeferredFormatFunction format, const DeferredLogSite& site,
+                                         OsStringView fmt, size_t argSize);
+            void EndDeferredRecord();
+
+            // Types that LOG_DEFERRED can copy and format later. Anything else may refer to memory
+            // that is gone by the time the deferred logger gets to it, e.g. a string_view or span.
+            template<typename T>
+            constexpr bool IsDeferrableLogArg = std::is_arithmetic_v<T> || std::is_enum_v<T>
+                                                || std::is_same_v<T, const void*>;
+
+            template<typename T>
+            T LoadDeferredArg(const uint8_t*& args)
+            {
+                T value;
+                memcpy(&value, args, sizeof(T));
+                args += sizeof(T);
+                return value;
+            }
+
+            template<typename...Args>
+            void FormatDeferred(OsString& buffer, OsStringView fmt, [[maybe_unused]] const uint8_t* args)
+            {
+                // Braced initialization evaluates the loads in order.
+                std::tuple<Args...> values{LoadDeferredArg<Args>(args)...};
+
+                std::apply([&](const Args&...unpacked) { fmt::format_to(std::back_inserter(buffer), fmt, unpacked...); },
+                           values);
+            }
+
             template<typename...Args>
-            constexpr void DiscardMessage(std::basic_string_view<oschar_t>, const Args&...)
+            void LogDeferred(const DeferredLogSite& site, OsStringView fmt, const Args&...args)
             {
+                static_assert((IsDeferrableLogArg<Args> && ...),
+                              "Deferred log arguments must be numbers, enums or const void*");
+
+                if (!IsDeferredLoggerRunning()) {
+                    LogMessage(site.level, site.sourceFileName, site.sourceLine, fmt, args...);
+                    return;
+                }
+
+                uint8_t* data = BeginDeferredRecord(&FormatDeferred<Args...>, site, fmt, (size_t{0} + ... + sizeof(Args)));
+                if (data) {
+                    ((memcpy(data, &args, sizeof(Args)), data += sizeof(Args)), ...);
+                    EndDeferredRecord();
+                }
             }
 
         } // namespace Internal
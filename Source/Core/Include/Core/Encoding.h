@@ -25,6 +25,7 @@ namespace ArenaBuilder {
     namespace Encoding {
 
         std::wstring SystemToWide(std::string_view inStr);
+        std::string WideToSystem(std::wstring_view inStr);
 
     } // namespace Encoding
 
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef ARENABUILDER_CORE_HASH_H_INCLUDED
+#define ARENABUILDER_CORE_HASH_H_INCLUDED
+
+#include <string_view>
+
+#include "Types.h"
+
+namespace ArenaBuilder {
+
+    // 64-bit FNV-1a hash. Fast for short strings such as file names, but not suitable for anything
+    // where inputs may be chosen to collide.
+    constexpr uint64_t HashFnv1a64(std::string_view str)
+    {
+        uint64_t hash = 0xCBF29CE484222325;
+
+        for (char ch : str) {
+            hash ^= uint8_t(ch);
+            hash *= 0x100000001B3;
+        }
+
+        return hash;
+    }
+
+    // Name paired with its precomputed hash. Callers which look up the same names repeatedly can
+    // keep these around to avoid rehashing.
+    struct HashedName {
+        std::string_view name;
+        uint64_t hash = 0;
+
+        constexpr HashedName() = default;
+
+        constexpr explicit HashedName(std::string_view name)
+            : name{name}, hash{HashFnv1a64(name)}
+        {
+        }
+
+        constexpr HashedName(std::string_view name, uint64_t hash)
+            : name{name}, hash{hash}
+        {
+        }
+    };
+
+} // namespace ArenaBuilder
+
+#endif // ARENABUILDER_CORE_HASH_H_INCLUDED
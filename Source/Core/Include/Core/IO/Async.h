@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef ARENABUILDER_CORE_IO_ASYNC_H_INCLUDED
+#define ARENABUILDER_CORE_IO_ASYNC_H_INCLUDED
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <vector>
+
+#include "../Mutex.h"
+#include "../Thread.h"
+#include "Base.h"
+
+namespace ArenaBuilder {
+
+    // Result of reading an entire named stream asynchronously.
+    struct AsyncReadResult {
+        std::string name;
+        ByteView data;
+        std::shared_ptr<const void> owner; // Keeps data alive
+        IoError error;
+    };
+
+    using AsyncReadCallback = std::function<void(AsyncReadResult& result)>;
+
+    struct AsyncReadRequest {
+        std::string name;
+        AsyncReadCallback callback;
+    };
+
+    // Interface for reading entire named streams without blocking the calling thread. Reads are
+    // submitted in batches, and their callbacks are invoked from PollCompletions() on whichever
+    // thread calls it, so a game loop can keep running while many reads are in flight.
+    class AsyncDataSource {
+    public:
+        virtual ~AsyncDataSource() = 0;
+
+        // Queues a batch of reads. Callbacks are never invoked from within this function, even if
+        // a read fails immediately.
+        virtual void SubmitReads(std::vector<AsyncReadRequest> requests) = 0;
+
+        // Invokes the callbacks of reads which have completed. Never blocks. Returns the number of
+        // callbacks invoked.
+        virtual size_t PollCompletions() = 0;
+
+        // Blocks until every submitted read has completed and its callback has been invoked.
+        virtual void WaitForAll() = 0;
+
+        // Number of submitted reads whose callbacks haven't been invoked yet.
+        virtual size_t GetPendingCount() const = 0;
+
+        void SubmitRead(std::string name, AsyncReadCallback callback);
+
+        AsyncDataSource& operator=(const AsyncDataSource&) = delete;
+        AsyncDataSource& operator=(AsyncDataSource&&) = delete;
+    };
+
+    inline AsyncDataSource::~AsyncDataSource() = default;
+
+    // Portable AsyncDataSource which performs blocking reads from another DataSource on worker
+    // threads. The DataSource must allow concurrent OpenStream() calls and concurrent reads from
+    // separate streams, as ZipArchiveReader and MappedFileSource do. Streams which support
+    // TryGetView() are delivered as views without copying.
+    class ThreadedAsyncDataSource final : public AsyncDataSource {
+    public:
+        ThreadedAsyncDataSource() = delete;
+        ThreadedAsyncDataSource(const ThreadedAsyncDataSource&) = delete;
+        ThreadedAsyncDataSource(ThreadedAsyncDataSource&&) = delete;
+        explicit ThreadedAsyncDataSource(DataSource& source, size_t threadCount);
+        explicit ThreadedAsyncDataSource(std::unique_ptr<DataSource> source, size_t threadCount);
+        ~ThreadedAsyncDataSource(); // Discards any reads which haven't started
+
+        void SubmitReads(std::vector<AsyncReadRequest> requests) override;
+        size_t PollCompletions() override;
+        void WaitForAll() override;
+        size_t GetPendingCount() const override { return m_pendingCount; }
+
+        ThreadedAsyncDataSource& operator=(const ThreadedAsyncDataSource&) = delete;
+        ThreadedAsyncDataSource& operator=(ThreadedAsyncDataSource&&) = delete;
+
+    private:
+        struct Completion {
+            AsyncReadCallback callback;
+            AsyncReadResult result;
+        };
+
+        DataSource* m_source;
+        std::unique_ptr<DataSource> m_ownedSource;
+        std::vector<std::unique_ptr<Thread>> m_threads;
+        RecursiveMutex m_mutex; // Guards m_requests, m_completions and m_isStopping
+        std::deque<AsyncReadRequest> m_requests;
+        std::vector<Completion> m_completions;
+        Semaphore m_requestSemaphore;
+        Semaphore m_completionSemaphore;
+        std::atomic<size_t> m_pendingCount{0};
+        bool m_isStopping = false;
+
+        void StartThreads(size_t threadCount);
+        void RunWorker();
+    };
+
+    // Creates an AsyncDataSource for loose files under a root directory, named as with
+    // MappedFileSource. On Linux this uses io_uring if the kernel supports it. Otherwise it falls
+    // back to a ThreadedAsyncDataSource with the given number of threads.
+    std::unique_ptr<AsyncDataSource> CreateAsyncFileSource(OsString rootDir, size_t threadCount);
+
+    namespace Internal {
+
+#ifdef __linux__
+        std::unique_ptr<AsyncDataSource> CreateUringFileSource(OsString rootDir, Out<IoError> outError);
+#endif
+
+    } // namespace Internal
+
+} // namespace ArenaBuilder
+
+#endif // ARENABUILDER_CORE_IO_ASYNC_H_INCLUDED
@@ -15,12 +15,34 @@
 #ifndef ARENABUILDER_CORE_IO_BASE_H_INCLUDED
 #define ARENABUILDER_CORE_IO_BASE_H_INCLUDED
 
+#include <functional>
 #include <memory>
+#include <vector>
 
 #include "../Types.h"
+#include "Error.h"
 
 namespace ArenaBuilder {
 
+    // Read-only view of a contiguous range of bytes.
+    struct ByteView {
+        const uint8_t* data = nullptr;
+        size_t size = 0;
+    };
+
+    // Writable range of bytes, used as a destination for Stream::ReadV().
+    struct ByteSpan {
+        uint8_t* data = nullptr;
+        size_t size = 0;
+    };
+
+    // Reference point for Stream::Seek().
+    enum class SeekOrigin {
+        Begin,
+        Current,
+        End,
+    };
+
     // Base class for I/O streams.
     class Stream {
     public:
@@ -38,17 +60,47 @@ namespace ArenaBuilder {
         void SetEof(bool eof = true) { m_eof = eof; }
 
         // Reads until 'size' bytes are read, the end of the stream is reached, or an error occurs.
-        size_t Read(void* buffer, size_t size, Out<std::string> outError);
+        size_t Read(void* buffer, size_t size, Out<IoError> outError);
 
         // Reads until 'size' bytes are read or an error occurs. If the end of the stream is reached
         // before 'size' bytes are read, this is treaded as an error and outError is set
         // accordingly.
-        size_t ReadExact(void* buffer, size_t size, Out<std::string> outError);
+        size_t ReadExact(void* buffer, size_t size, Out<IoError> outError);
+
+        // Like Read(), but fills each span in turn as if they were one contiguous buffer, i.e. to
+        // read vertex and index data straight into separate buffers. Empty spans are allowed.
+        // Returns the total number of bytes read.
+        size_t ReadV(const ByteSpan* spans, size_t count, Out<IoError> outError);
+
+        // Reads the rest of the stream into outData, replacing its contents. If the stream knows
+        // its size, the output is allocated once at the right size. Returns false if an error
+        // occurs.
+        bool ReadAll(Out<std::vector<uint8_t>> outData, Out<IoError> outError);
 
         // Writes until 'size' bytes are written or an error occurs. If DoWrite() returns zero but
         // does not set outError, this is treated as an error and outError will be set to a fallback
         // string.
-        size_t Write(const void* buffer, size_t size, Out<std::string> outError);
+        size_t Write(const void* buffer, size_t size, Out<IoError> outError);
+
+        // Gets a view of the entire contents of the stream without copying, if the contents are
+        // already in memory (e.g. memory mapped). The view remains valid until the stream is closed
+        // or destroyed. Returns false if no view is available, in which case the stream must be
+        // read normally. Getting a view does not affect the read position.
+        virtual bool TryGetView(Out<ByteView> outView) const;
+
+        // Returns true if the stream supports Seek() and Tell().
+        virtual bool IsSeekable() const;
+
+        // Gets the total size of the stream in bytes. Returns false if the size isn't known.
+        virtual bool GetSize(Out<uint64_t> outSize) const;
+
+        // Gets the current position of a seekable stream. Returns zero if the stream isn't
+        // seekable.
+        virtual uint64_t Tell() const;
+
+        // Moves the read position of a seekable stream. Seeking before the start or past the end of
+        // the stream is an error. The EOF flag is cleared on success.
+        bool Seek(int64_t offset, SeekOrigin origin, Out<IoError> outError);
 
         Stream& operator=(const Stream&) = delete;
         Stream& operator=(Stream&&) = delete;
@@ -57,25 +109,47 @@ namespace ArenaBuilder {
         // Reads a single pass. Should return the number of bytes read on success (<= size), or 0 if
         // an error occurs or if the end of the stream is reached. This typically corresponds to one
         // syscall, i.e. read().
-        virtual size_t DoRead(void* buffer, size_t size, Out<std::string> outError);
+        virtual size_t DoRead(void* buffer, size_t size, Out<IoError> outError);
+
+        // Reads a single pass into one or more spans, of which the first is never empty. Should
+        // fill the spans in order and return the total number of bytes read, as with DoRead(). The
+        // default implementation only reads into the first span.
+        virtual size_t DoReadV(const ByteSpan* spans, size_t count, Out<IoError> outError);
 
         // Writes a single pass. Should return the number of bytes written on success (<= size), or
-        // 0 if an error occurs. If outError is empty after this returns zero, this is still treated
+        // 0 if an error occurs. If outError isn't set after this returns zero, this is still treated
         // as an error and wrapper functions will set outError accordingly. This function typically
         // corresponds to a signle syscall, i.e. write().
-        virtual size_t DoWrite(const void* buffer, size_t size, Out<std::string> outError);
+        virtual size_t DoWrite(const void* buffer, size_t size, Out<IoError> outError);
+
+        // Moves to an absolute position, which Seek() has already checked against the size of the
+        // stream if known. Should return false and set outError if the seek fails.
+        virtual bool DoSeek(uint64_t position, Out<IoError> outError);
 
     private:
         bool m_eof = false;
 
-        bool ErrorIfClosed(Out<std::string> outError) const;
+        bool ErrorIfClosed(Out<IoError> outError) const;
     };
 
     // Interface for opening named data streams for reading.
     class DataSource {
     public:
+        // Entry ID reported by sources which can only open streams by name.
+        static constexpr uint64_t NoEntryId = ~uint64_t(0);
+
+        using EntryCallback = std::function<void(std::string_view name, uint64_t entryId)>;
+
         virtual ~DataSource() = 0;
-        virtual std::unique_ptr<Stream> OpenStream(std::string_view name, Out<std::string> outError) = 0;
+        virtual std::unique_ptr<Stream> OpenStream(std::string_view name, Out<IoError> outError) = 0;
+
+        // Calls 'callback' with each name that OpenStream() can open, along with an ID that can be
+        // passed to OpenEntryStream() to skip the name lookup, or NoEntryId. Returns false if the
+        // source can't list its names or if an error occurs.
+        virtual bool EnumerateEntries(const EntryCallback& callback, Out<IoError> outError);
+
+        // Opens a stream by an ID from EnumerateEntries().
+        virtual std::unique_ptr<Stream> OpenEntryStream(uint64_t entryId, Out<IoError> outError);
 
         DataSource& operator=(const DataSource&) = delete;
         DataSource& operator=(DataSource&&) = delete;
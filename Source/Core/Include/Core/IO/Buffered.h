@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef ARENABUILDER_CORE_IO_BUFFERED_H_INCLUDED
+#define ARENABUILDER_CORE_IO_BUFFERED_H_INCLUDED
+
+#include <cstring>
+
+#include "../ByteOrder.h"
+#include "Base.h"
+
+namespace ArenaBuilder {
+
+    // Read-only stream adapter which refills an internal buffer from another stream. Small reads
+    // are served from the buffer without calling into the underlying stream.
+    class BufferedStream final : public Stream {
+    public:
+        static constexpr size_t DefaultBufferSize = 16384;
+
+        BufferedStream() = delete;
+        BufferedStream(const BufferedStream&) = delete;
+        BufferedStream(BufferedStream&&) = delete;
+        explicit BufferedStream(Stream& source, size_t bufferSize = DefaultBufferSize);
+        explicit BufferedStream(std::unique_ptr<Stream> source, size_t bufferSize = DefaultBufferSize);
+        ~BufferedStream();
+
+        // Closes the underlying stream and discards any buffered data.
+        void Close() override;
+        bool IsOpen() const override { return m_source && m_source->IsOpen(); }
+
+        // Seekable if the underlying stream is. Seeks within the buffered data don't touch the
+        // underlying stream.
+        bool IsSeekable() const override { return m_source->IsSeekable(); }
+        bool GetSize(Out<uint64_t> outSize) const override { return m_source->GetSize(outSize); }
+        uint64_t Tell() const override { return IsSeekable() ? m_source->Tell() - GetBufferedSize() : 0; }
+
+        // Number of bytes that can be read without refilling the buffer.
+        size_t GetBufferedSize() const { return m_end - m_position; }
+
+        // These hide the Stream functions of the same name so that reads which fit in the buffer
+        // don't go through the virtual DoRead(). Behavior is otherwise identical.
+        size_t Read(void* buffer, size_t size, Out<IoError> outError)
+        {
+            if (size <= GetBufferedSize()) {
+                ConsumeBuffered(buffer, size);
+                return size;
+            }
+            return Stream::Read(buffer, size, outError);
+        }
+
+        size_t ReadExact(void* buffer, size_t size, Out<IoError> outError)
+        {
+            if (size <= GetBufferedSize()) {
+                ConsumeBuffered(buffer, size);
+                return size;
+            }
+            return Stream::ReadExact(buffer, size, outError);
+        }
+
+        // Copies up to 'size' bytes without consuming them. At most the buffer size can be peeked
+        // at once. Returns fewer than 'size' bytes if the end of the stream is reached or if an
+        // error occurs.
+        size_t Peek(void* buffer, size_t size, Out<IoError> outError);
+
+        // Discards up to 'size' bytes. Returns the number of bytes skipped, which is less than
+        // 'size' if the end of the stream is reached or if an error occurs.
+        size_t Skip(size_t size, Out<IoError> outError);
+
+        // Reads up to and including the next '\n'. The line terminator (either "\n" or "\r\n") is
+        // not stored in outLine. Returns false if the stream was already at its end or if an error
+        // occurs.
+        bool ReadLine(Out<std::string> outLine, Out<IoError> outError);
+
+        // Reads a little-endian integer, floating-point or enum value. The end of the stream is
+        // treated as an error, as with ReadExact().
+        template<typename T>
+        bool ReadLittleEndian(Out<T> outValue, Out<IoError> outError)
+        {
+            uint8_t bytes[sizeof(T)];
+
+            if (sizeof(T) <= GetBufferedSize()) {
+                *outValue = LoadLittleEndian<T>(&m_buffer[m_position]);
+                m_position += sizeof(T);
+                return true;
+            } else if (Stream::ReadExact(bytes, sizeof(T), outError) < sizeof(T)) {
+                return false;
+            }
+
+            *outValue = LoadLittleEndian<T>(bytes);
+            return true;
+        }
+
+        BufferedStream& operator=(const BufferedStream&) = delete;
+        BufferedStream& operator=(BufferedStream&&) = delete;
+
+    protected:
+        size_t DoRead(void* buffer, size_t size, Out<IoError> outError) override;
+        bool DoSeek(uint64_t position, Out<IoError> outError) override;
+
+    private:
+        Stream* m_source;
+        std::unique_ptr<Stream> m_ownedSource;
+        std::unique_ptr<uint8_t[]> m_buffer;
+        size_t m_capacity;
+        size_t m_position = 0;
+        size_t m_end = 0;
+
+        void ConsumeBuffered(void* buffer, size_t size)
+        {
+            std::memcpy(buffer, &m_buffer[m_position], size);
+            m_position += size;
+        }
+
+        // Moves any unread bytes to the start of the buffer, then reads from the underlying stream
+        // until the buffer holds at least 'minSize' bytes or the end of the stream is reached.
+        // Returns false if an error occurs.
+        bool Fill(size_t minSize, Out<IoError> outError);
+    };
+
+} // namespace ArenaBuilder
+
+#endif // ARENABUILDER_CORE_IO_BUFFERED_H_INCLUDED
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef ARENABUILDER_CORE_IO_CACHING_H_INCLUDED
+#define ARENABUILDER_CORE_IO_CACHING_H_INCLUDED
+
+#include "../Hash.h"
+#include "Base.h"
+
+namespace ArenaBuilder {
+
+    // Counters reported by CachingDataSource::GetStats().
+    struct DataCacheStats {
+        uint64_t hitCount = 0;
+        uint64_t missCount = 0; // Streams read from the underlying source and cached
+        uint64_t bypassCount = 0; // Streams that were already views or too large to cache
+        uint64_t evictionCount = 0;
+        size_t entryCount = 0;
+        size_t byteCount = 0;
+        size_t byteBudget = 0;
+    };
+
+    // DataSource decorator which keeps the decoded contents of recently opened streams in memory,
+    // so that reopening them returns a view stream instead of decompressing again. The cache is
+    // split into shards by name hash, each with its own lock, LRU list and share of the byte
+    // budget, so concurrent OpenStream() calls rarely contend.
+    //
+    // Streams which already support TryGetView() (loose files and stored archive entries) are
+    // passed through uncached, since they're already backed by the page cache. Streams larger than
+    // a shard's budget are passed through as well. Evicting an entry never invalidates streams that
+    // are still open.
+    class CachingDataSource final : public DataSource {
+    public:
+        static constexpr size_t DefaultShardCount = 16;
+
+        CachingDataSource() = delete;
+        CachingDataSource(const CachingDataSource&) = delete;
+        CachingDataSource(CachingDataSource&&) = delete;
+        explicit CachingDataSource(DataSource& source, size_t byteBudget, size_t shardCount = DefaultShardCount);
+        explicit CachingDataSource(std::unique_ptr<DataSource> source, size_t byteBudget,
+                                   size_t shardCount = DefaultShardCount);
+        ~CachingDataSource();
+
+        std::unique_ptr<Stream> OpenStream(std::string_view name, Out<IoError> outError) override;
+        std::unique_ptr<Stream> OpenStream(const HashedName& name, Out<IoError> outError);
+
+        // Lists the underlying source's names. Entry IDs are always NoEntryId, so that streams are
+        // opened by name through the cache.
+        bool EnumerateEntries(const EntryCallback& callback, Out<IoError> outError) override;
+
+        // Drops a single entry, i.e. after the underlying data has changed.
+        void Invalidate(std::string_view name);
+        void Clear();
+
+        DataCacheStats GetStats() const;
+        void LogStats() const;
+
+        CachingDataSource& operator=(const CachingDataSource&) = delete;
+        CachingDataSource& operator=(CachingDataSource&&) = delete;
+
+    private:
+        struct Shard;
+
+        DataSource* m_source;
+        std::unique_ptr<DataSource> m_ownedSource;
+        std::unique_ptr<Shard[]> m_shards;
+        size_t m_shardCount;
+        size_t m_byteBudget;
+
+        void Initialize(size_t shardCount);
+        Shard& GetShard(uint64_t nameHash) const;
+    };
+
+} // namespace ArenaBuilder
+
+#endif // ARENABUILDER_CORE_IO_CACHING_H_INCLUDED
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef ARENABUILDER_CORE_IO_CODEC_LZ4_H_INCLUDED
+#define ARENABUILDER_CORE_IO_CODEC_LZ4_H_INCLUDED
+
+#include "../Base.h"
+
+struct LZ4F_cctx_s;
+struct LZ4F_dctx_s;
+
+namespace ArenaBuilder {
+
+    // Read-only stream which decompresses LZ4 frames from another stream as it is read. Memory use
+    // is bounded by the input buffer plus the decoder's block buffers, which depend on the block
+    // size in the frame header (at most 4 MiB). Concatenated frames are decoded as a single stream.
+    // Not seekable.
+    class Lz4InputStream final : public Stream {
+    public:
+        static constexpr size_t BufferSize = 65536;
+
+        Lz4InputStream() = delete;
+        Lz4InputStream(const Lz4InputStream&) = delete;
+        Lz4InputStream(Lz4InputStream&&) = delete;
+        explicit Lz4InputStream(Stream& source);
+        explicit Lz4InputStream(std::unique_ptr<Stream> source);
+        ~Lz4InputStream();
+
+        // Closes the underlying stream.
+        void Close() override;
+        bool IsOpen() const override { return m_context && m_source->IsOpen(); }
+
+        Lz4InputStream& operator=(const Lz4InputStream&) = delete;
+        Lz4InputStream& operator=(Lz4InputStream&&) = delete;
+
+    protected:
+        size_t DoRead(void* buffer, size_t size, Out<IoError> outError) override;
+
+    private:
+        Stream* m_source;
+        std::unique_ptr<Stream> m_ownedSource;
+        struct LZ4F_dctx_s* m_context = nullptr;
+        std::unique_ptr<uint8_t[]> m_buffer;
+        size_t m_position = 0;
+        size_t m_end = 0;
+        bool m_isFrameComplete = true;
+
+        void Init();
+    };
+
+    // Write-only stream which compresses data into an LZ4 frame with 64 KiB blocks and writes it to
+    // another stream. Levels below 3 use the fast compressor; higher levels use LZ4HC. Finish()
+    // must be called to write the end of the frame; closing or destroying the stream without
+    // finishing it leaves a truncated frame.
+    class Lz4OutputStream final : public Stream {
+    public:
+        static constexpr int DefaultLevel = 9;
+
+        Lz4OutputStream() = delete;
+        Lz4OutputStream(const Lz4OutputStream&) = delete;
+        Lz4OutputStream(Lz4OutputStream&&) = delete;
+        explicit Lz4OutputStream(Stream& target, int level = DefaultLevel);
+        explicit Lz4OutputStream(std::unique_ptr<Stream> target, int level = DefaultLevel);
+        ~Lz4OutputStream();
+
+        // Closes the underlying stream.
+        void Close() override;
+        bool IsOpen() const override { return m_context && m_target->IsOpen(); }
+
+        // Compresses any pending input, ends the frame and writes everything to the underlying
+        // stream. Further writes start a new frame.
+        bool Finish(Out<IoError> outError);
+
+        Lz4OutputStream& operator=(const Lz4OutputStream&) = delete;
+        Lz4OutputStream& operator=(Lz4OutputStream&&) = delete;
+
+    protected:
+        size_t DoWrite(const void* buffer, size_t size, Out<IoError> outError) override;
+
+    private:
+        Stream* m_target;
+        std::unique_ptr<Stream> m_ownedTarget;
+        struct LZ4F_cctx_s* m_context = nullptr;
+        std::unique_ptr<uint8_t[]> m_buffer;
+        size_t m_capacity = 0;
+        int m_level;
+        bool m_isFrameStarted = false;
+
+        void Init();
+        bool BeginFrame(Out<IoError> outError);
+    };
+
+} // namespace ArenaBuilder
+
+#endif // ARENABUILDER_CORE_IO_CODEC_LZ4_H_INCLUDED
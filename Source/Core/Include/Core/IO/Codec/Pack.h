@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef ARENABUILDER_CORE_IO_CODEC_PACK_H_INCLUDED
+#define ARENABUILDER_CORE_IO_CODEC_PACK_H_INCLUDED
+
+#include "../../Hash.h"
+#include "../Base.h"
+#include "PackFormat.h"
+
+namespace ArenaBuilder {
+
+    class MappedFile;
+
+    // Information about a pack entry. The name points into the archive mapping and is only valid
+    // while the archive is open.
+    struct PackEntryInfo {
+        std::string_view name;
+        uint64_t nameHash = 0;
+        uint32_t index = 0;
+        uint64_t size = 0;
+        uint64_t storedSize = 0;
+        PackFormat::Method method = PackFormat::Method::Stored;
+    };
+
+    // Reads an ArenaBuilder pack file (see PackFormat.h) through a memory mapping. Opening only
+    // validates the header, so it takes constant time regardless of the number of entries; entry
+    // records are validated when they are looked up. Stored entries are opened as views into the
+    // mapping. Compressed entries are decompressed one chunk at a time straight from the mapping.
+    //
+    // Once the archive is open, it is never modified, so OpenStream() may be called from any
+    // number of threads at once. Open() and Close() are not thread-safe.
+    class PackArchiveReader final : public DataSource {
+    public:
+        PackArchiveReader() = default;
+        PackArchiveReader(const PackArchiveReader&) = delete;
+        PackArchiveReader(PackArchiveReader&&) = delete;
+        explicit PackArchiveReader(const oschar_t* path, Out<IoError> outError);
+        ~PackArchiveReader();
+
+        bool Open(const oschar_t* path, Out<IoError> outError);
+        void Close();
+        bool IsOpen() const { return m_mapping != nullptr; }
+
+        uint32_t GetEntryCount() const { return m_header.entryCount; }
+
+        // Gets the entry in the given perfect hash slot. Returns false if the index is out of range
+        // or if the entry record is malformed.
+        bool GetEntry(uint32_t index, Out<PackEntryInfo> outEntry, Out<IoError> outError) const;
+
+        // Looks up an entry by name. Returns false if there is no such entry.
+        bool FindEntry(std::string_view name, Out<PackEntryInfo> outEntry) const;
+        bool FindEntry(const HashedName& name, Out<PackEntryInfo> outEntry) const;
+
+        std::unique_ptr<Stream> OpenStream(std::string_view name, Out<IoError> outError) override;
+        std::unique_ptr<Stream> OpenStream(const HashedName& name, Out<IoError> outError);
+
+        // Entry IDs are perfect hash slots, as used by GetEntry().
+        bool EnumerateEntries(const EntryCallback& callback, Out<IoError> outError) override;
+        std::unique_ptr<Stream> OpenEntryStream(uint64_t index, Out<IoError> outError) override;
+
+        PackArchiveReader& operator=(const PackArchiveReader&) = delete;
+        PackArchiveReader& operator=(PackArchiveReader&&) = delete;
+
+    private:
+        std::shared_ptr<MappedFile> m_mapping;
+        ByteView m_data;
+        PackFormat::Header m_header;
+
+        bool ValidateHeader(Out<IoError> outError) const;
+        bool LoadEntry(uint32_t index, Out<PackFormat::Entry> outEntry, Out<IoError> outError) const;
+        std::unique_ptr<Stream> CreateEntryStream(const PackFormat::Entry& entry);
+    };
+
+} // namespace ArenaBuilder
+
+#endif // ARENABUILDER_CORE_IO_CODEC_PACK_H_INCLUDED
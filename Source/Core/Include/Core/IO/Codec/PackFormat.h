@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef ARENABUILDER_CORE_IO_CODEC_PACKFORMAT_H_INCLUDED
+#define ARENABUILDER_CORE_IO_CODEC_PACKFORMAT_H_INCLUDED
+
+#include "../../ByteOrder.h"
+
+namespace ArenaBuilder {
+
+    // On-disk layout of ArenaBuilder pack files, shared by PackArchiveReader and the ArenaPack
+    // tool. All integers are little-endian. A pack file consists of:
+    //
+    //   - A header at offset zero.
+    //   - The bucket table: one uint32_t displacement per hash bucket.
+    //   - The entry table: one record per entry, indexed by perfect hash slot.
+    //   - The name blob: entry names without terminators.
+    //   - The payload, starting on a page boundary.
+    //   - The chunk table: one record per chunk of each compressed entry.
+    //
+    // Entries are located with a hash-and-displace minimal perfect hash: an entry whose name hash
+    // is 'h' lives in slot GetSlot(h, buckets[GetBucket(h)]). Names must still be compared, since
+    // names that aren't in the pack also map to some slot.
+    namespace PackFormat {
+
+        constexpr uint8_t Magic[4] = {'A', 'B', 'P', 'K'};
+        constexpr uint16_t Version = 1;
+
+        constexpr size_t HeaderSize = 80;
+        constexpr size_t BucketSize = 4;
+        constexpr size_t EntrySize = 48;
+        constexpr size_t ChunkRecordSize = 16;
+
+        // The payload starts on a page boundary, as does the data of every stored entry that is at
+        // least a page long, so their views can be handed to the kernel or GPU without copying.
+        constexpr uint64_t PageSize = 4096;
+        constexpr uint64_t MinAlignment = 16;
+
+        // Uncompressed size of each chunk of a compressed entry, except the last.
+        constexpr uint32_t DefaultChunkSize = 65536;
+
+        enum class Method : uint16_t {
+            Stored = 0,
+            Zstd = 1,
+        };
+
+        // Set if a chunk is compressed. Chunks which don't shrink are stored as-is.
+        constexpr uint32_t ChunkFlagCompressed = 0x1;
+
+        struct Header {
+            uint32_t entryCount = 0;
+            uint32_t bucketCount = 0;
+            uint32_t chunkCount = 0;
+            uint32_t chunkSize = 0;
+            uint64_t fileSize = 0;
+            uint64_t bucketsOffset = 0;
+            uint64_t entriesOffset = 0;
+            uint64_t chunksOffset = 0;
+            uint64_t namesOffset = 0;
+            uint64_t namesSize = 0;
+            uint64_t payloadOffset = 0;
+        };
+
+        struct Entry {
+            uint64_t nameHash = 0; // HashFnv1a64() of the name
+            uint32_t nameOffset = 0; // Relative to the name blob
+            uint32_t nameSize = 0;
+            uint64_t dataOffset = 0; // Absolute; for compressed entries, the first chunk's offset
+            uint64_t size = 0; // Uncompressed
+            uint64_t storedSize = 0;
+            uint32_t firstChunk = 0; // Unused for stored entries
+            Method method = Method::Stored;
+        };
+
+        struct ChunkRecord {
+            uint64_t offset = 0; // Absolute
+            uint32_t storedSize = 0;
+            uint32_t flags = 0;
+        };
+
+        // Finalizer from SplitMix64. Spreads the bits of the name hash so that each displacement
+        // gives an unrelated slot.
+        constexpr uint64_t MixHash(uint64_t value)
+        {
+            value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9;
+            value = (value ^ (value >> 27)) * 0x94D049BB133111EB;
+            return value ^ (value >> 31);
+        }
+
+        constexpr uint32_t GetBucket(uint64_t nameHash, uint32_t bucketCount)
+        {
+            return uint32_t((nameHash >> 32) % bucketCount);
+        }
+
+        constexpr uint32_t GetSlot(uint64_t nameHash, uint32_t displacement, uint32_t entryCount)
+        {
+            return uint32_t(MixHash(nameHash + displacement * 0x9E3779B97F4A7C15) % entryCount);
+        }
+
+        inline bool HasMagic(const uint8_t* data)
+        {
+            return data[0] == Magic[0] && data[1] == Magic[1] && data[2] == Magic[2] && data[3] == Magic[3];
+        }
+
+        // Loads a header without validating anything but the magic number and version.
+        inline bool LoadHeader(const uint8_t* data, Out<Header> outHeader)
+        {
+            Header& header = *outHeader;
+
+            if (!HasMagic(data) || LoadLittleEndian<uint16_t>(data + 4) != Version) {
+                return false;
+            }
+
+            header.entryCount = LoadLittleEndian<uint32_t>(data + 8);
+            header.bucketCount = LoadLittleEndian<uint32_t>(data + 12);
+            header.chunkCount = LoadLittleEndian<uint32_t>(data + 16);
+            header.chunkSize = LoadLittleEndian<uint32_t>(data + 20);
+            header.fileSize = LoadLittleEndian<uint64_t>(data + 24);
+            header.bucketsOffset = LoadLittleEndian<uint64_t>(data + 32);
+            header.entriesOffset = LoadLittleEndian<uint64_t>(data + 40);
+            header.chunksOffset = LoadLittleEndian<uint64_t>(data + 48);
+            header.namesOffset = LoadLittleEndian<uint64_t>(data + 56);
+            header.namesSize = LoadLittleEndian<uint64_t>(data + 64);
+            header.payloadOffset = LoadLittleEndian<uint64_t>(data + 72);
+            return true;
+        }
+
+        inline void StoreHeader(uint8_t* data, const Header& header)
+        {
+            std::memcpy(data, Magic, sizeof(Magic));
+            StoreLittleEndian<uint16_t>(data + 4, Version);
+            StoreLittleEndian<uint16_t>(data + 6, 0);
+            StoreLittleEndian(data + 8, header.entryCount);
+            StoreLittleEndian(data + 12, header.bucketCount);
+            StoreLittleEndian(data + 16, header.chunkCount);
+            StoreLittleEndian(data + 20, header.chunkSize);
+            StoreLittleEndian(data + 24, header.fileSize);
+            StoreLittleEndian(data + 32, header.bucketsOffset);
+            StoreLittleEndian(data + 40, header.entriesOffset);
+            StoreLittleEndian(data + 48, header.chunksOffset);
+            StoreLittleEndian(data + 56, header.namesOffset);
+            StoreLittleEndian(data + 64, header.namesSize);
+            StoreLittleEndian(data + 72, header.payloadOffset);
+        }
+
+        inline Entry LoadEntry(const uint8_t* data)
+        {
+            Entry entry;
+
+            entry.nameHash = LoadLittleEndian<uint64_t>(data);
+            entry.nameOffset = LoadLittleEndian<uint32_t>(data + 8);
+            entry.nameSize = LoadLittleEndian<uint32_t>(data + 12);
+            entry.dataOffset = LoadLittleEndian<uint64_t>(data + 16);
+            entry.size = LoadLittleEndian<uint64_t>(data + 24);
+            entry.storedSize = LoadLittleEndian<uint64_t>(data + 32);
+            entry.firstChunk = LoadLittleEndian<uint32_t>(data + 40);
+            entry.method = LoadLittleEndian<Method>(data + 44);
+            return entry;
+        }
+
+        inline void StoreEntry(uint8_t* data, const Entry& entry)
+        {
+            StoreLittleEndian(data, entry.nameHash);
+            StoreLittleEndian(data + 8, entry.nameOffset);
+            StoreLittleEndian(data + 12, entry.nameSize);
+            StoreLittleEndian(data + 16, entry.dataOffset);
+            StoreLittleEndian(data + 24, entry.size);
+            StoreLittleEndian(data + 32, entry.storedSize);
+            StoreLittleEndian(data + 40, entry.firstChunk);
+            StoreLittleEndian(data + 44, entry.method);
+            StoreLittleEndian<uint16_t>(data + 46, 0);
+        }
+
+        inline ChunkRecord LoadChunkRecord(const uint8_t* data)
+        {
+            ChunkRecord chunk;
+
+            chunk.offset = LoadLittleEndian<uint64_t>(data);
+            chunk.storedSize = LoadLittleEndian<uint32_t>(data + 8);
+            chunk.flags = LoadLittleEndian<uint32_t>(data + 12);
+            return chunk;
+        }
+
+        inline void StoreChunkRecord(uint8_t* data, const ChunkRecord& chunk)
+        {
+            StoreLittleEndian(data, chunk.offset);
+            StoreLittleEndian(data + 8, chunk.storedSize);
+            StoreLittleEndian(data + 12, chunk.flags);
+        }
+
+    } // namespace PackFormat
+
+} // namespace ArenaBuilder
+
+#endif // ARENABUILDER_CORE_IO_CODEC_PACKFORMAT_H_INCLUDED
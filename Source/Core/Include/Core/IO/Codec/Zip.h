@@ -15,6 +15,10 @@
 #ifndef ARENABUILDER_CORE_IO_CODEC_ZIP_H_INCLUDED
 #define ARENABUILDER_CORE_IO_CODEC_ZIP_H_INCLUDED
 
+#include <vector>
+
+#include "../../Hash.h"
+#include "../../Mutex.h"
 #include "../Base.h"
 
 struct zip;
@@ -22,6 +26,42 @@ struct zip_file;
 
 namespace ArenaBuilder {
 
+    class MappedFile;
+
+    // Information about a zip entry, collected once when the archive is opened.
+    struct ZipEntryInfo {
+        std::string name;
+        uint64_t nameHash = 0;
+        uint64_t index = 0;
+        uint64_t size = 0;
+        uint64_t compressedSize = 0;
+        uint32_t crc = 0;
+        uint16_t method = 0;
+        bool isEncrypted = false;
+
+        // Offset of the entry's data within the archive file, if it could be determined.
+        uint64_t dataOffset = 0;
+        bool hasDataOffset = false;
+    };
+
+    struct ZipOpenParams {
+        // Directory where entry tables are cached between runs, or empty to disable the cache. A
+        // cached table is used if the archive's size, modification time and central directory
+        // hash all match, in which case libzip's consistency check is skipped.
+        OsString indexCacheDir;
+
+        // Ignores any cached entry table and runs the consistency check. The cache is rewritten.
+        bool verify = false;
+    };
+
+    // Reads a zip archive through a memory mapping. Entries which are stored without compression
+    // are opened as views into the mapping, so their streams support TryGetView(). Deflated entries
+    // are inflated directly from the mapping with zlib. libzip is only used to read entries which
+    // can't be located or which use other methods or encryption.
+    //
+    // Once the archive is open, OpenStream() may be called from any number of threads at once, and
+    // the resulting streams may be read concurrently. Streams that fall back to libzip serialize
+    // their libzip calls on a per-archive mutex. Open() and Close() are not thread-safe.
     class ZipArchiveReader final : public DataSource {
         friend class ZipInputStream;
 
@@ -29,36 +69,86 @@ namespace ArenaBuilder {
         ZipArchiveReader() = default;
         ZipArchiveReader(const ZipArchiveReader&) = delete;
         ZipArchiveReader(ZipArchiveReader&&) = delete;
-        explicit ZipArchiveReader(const oschar_t* path, Out<std::string> outError);
+        explicit ZipArchiveReader(const oschar_t* path, Out<IoError> outError);
         ~ZipArchiveReader();
 
-        bool Open(const oschar_t* path, Out<std::string> outError);
+        bool Open(const oschar_t* path, Out<IoError> outError) { return Open(path, {}, outError); }
+        bool Open(const oschar_t* path, const ZipOpenParams& params, Out<IoError> outError);
         void Close();
         bool IsOpen() const { return m_zip != nullptr; }
 
-        std::unique_ptr<Stream> OpenStream(std::string_view name, Out<std::string> outError) override;
+        // Entries in archive order. An entry's position in this list is its index.
+        const std::vector<ZipEntryInfo>& GetEntries() const { return m_entries; }
+
+        // Looks up an entry in the name index built when the archive was opened. Returns null if
+        // there is no such entry. If the archive contains duplicate names, the first one wins.
+        const ZipEntryInfo* FindEntry(std::string_view name) const { return FindEntry(HashedName{name}); }
+        const ZipEntryInfo* FindEntry(const HashedName& name) const;
+
+        std::unique_ptr<Stream> OpenStream(std::string_view name, Out<IoError> outError) override;
+        std::unique_ptr<Stream> OpenStream(const HashedName& name, Out<IoError> outError);
+
+        // Entry IDs are entry indices. Directory entries are skipped.
+        bool EnumerateEntries(const EntryCallback& callback, Out<IoError> outError) override;
+        std::unique_ptr<Stream> OpenEntryStream(uint64_t index, Out<IoError> outError) override;
 
     private:
         struct ::zip* m_zip = nullptr;
+        RecursiveMutex m_zipMutex; // Guards m_zip and any zip_file opened from it
+        std::shared_ptr<MappedFile> m_mapping;
+        std::vector<ZipEntryInfo> m_entries;
+
+        // Open-addressed hash table of entry indices plus one, where zero marks an empty slot. The
+        // size is always a power of two.
+        std::vector<uint32_t> m_nameTable;
+
+        bool LoadEntries(Out<IoError> outError);
+        bool LoadEntryLocations(Out<IoError> outError);
+        bool LoadIndexCache(const OsString& cachePath, const OsString& archivePath, uint64_t directoryHash);
+        void SaveIndexCache(const OsString& cachePath, const OsString& archivePath, uint64_t directoryHash) const;
+        void BuildNameTable();
+        std::unique_ptr<Stream> OpenMappedStream(const ZipEntryInfo& entry);
     };
 
+    // Reads a single zip entry. Deflated and stored entries whose data could be located are decoded
+    // straight from the archive mapping and don't share any state with other streams.
+    //
+    // All entries are seekable. Seeking within a deflated entry records inflate checkpoints as data
+    // is decompressed, so later backward seeks resume from the nearest checkpoint rather than from
+    // the start of the entry. Entries read through libzip use zip_fseek() if libzip supports it for
+    // the entry, and otherwise reopen the entry and decompress up to the target position.
     class ZipInputStream final : public Stream {
     public:
         ZipInputStream() = default;
         ZipInputStream(const ZipInputStream&) = delete;
         ZipInputStream(ZipInputStream&&) = delete;
-        explicit ZipInputStream(ZipArchiveReader& archive, const char* name, Out<std::string> outError);
+        explicit ZipInputStream(ZipArchiveReader& archive, const char* name, Out<IoError> outError);
+        explicit ZipInputStream(ZipArchiveReader& archive, uint64_t index, Out<IoError> outError);
         ~ZipInputStream();
 
-        bool Open(ZipArchiveReader& archive, const char* name, Out<std::string> outError);
+        bool Open(ZipArchiveReader& archive, const char* name, Out<IoError> outError);
+        bool Open(ZipArchiveReader& archive, uint64_t index, Out<IoError> outError);
         void Close() override;
-        bool IsOpen() const override { return m_zipFile != nullptr; }
+        bool IsOpen() const override { return m_zipFile || m_direct; }
+        bool IsSeekable() const override { return true; }
+        bool GetSize(Out<uint64_t> outSize) const override;
+        uint64_t Tell() const override;
 
     protected:
-        size_t DoRead(void* buffer, size_t size, Out<std::string> outError) override;
+        size_t DoRead(void* buffer, size_t size, Out<IoError> outError) override;
+        bool DoSeek(uint64_t position, Out<IoError> outError) override;
 
     private:
+        struct DirectState;
+
+        ZipArchiveReader* m_archive = nullptr;
+        uint64_t m_index = 0;
+        uint64_t m_size = 0;
         struct ::zip_file* m_zipFile = nullptr;
+        uint64_t m_zipFilePosition = 0;
+        std::unique_ptr<DirectState> m_direct;
+
+        bool SeekZipFile(uint64_t position, Out<IoError> outError);
     };
 
 } // namespace ArenaBuilder
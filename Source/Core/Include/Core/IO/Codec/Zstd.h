@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef ARENABUILDER_CORE_IO_CODEC_ZSTD_H_INCLUDED
+#define ARENABUILDER_CORE_IO_CODEC_ZSTD_H_INCLUDED
+
+#include "../Base.h"
+
+struct ZSTD_CCtx_s;
+struct ZSTD_DCtx_s;
+
+namespace ArenaBuilder {
+
+    // Read-only stream which decompresses zstd data from another stream as it is read. Memory use
+    // is bounded by the input buffer plus the decoder window, which is capped at MaxWindowLog.
+    // Concatenated frames are decoded as a single stream. Not seekable.
+    class ZstdInputStream final : public Stream {
+    public:
+        static constexpr int MaxWindowLog = 27; // 128 MiB
+
+        ZstdInputStream() = delete;
+        ZstdInputStream(const ZstdInputStream&) = delete;
+        ZstdInputStream(ZstdInputStream&&) = delete;
+        explicit ZstdInputStream(Stream& source);
+        explicit ZstdInputStream(std::unique_ptr<Stream> source);
+        ~ZstdInputStream();
+
+        // Closes the underlying stream.
+        void Close() override;
+        bool IsOpen() const override { return m_context && m_source->IsOpen(); }
+
+        ZstdInputStream& operator=(const ZstdInputStream&) = delete;
+        ZstdInputStream& operator=(ZstdInputStream&&) = delete;
+
+    protected:
+        size_t DoRead(void* buffer, size_t size, Out<IoError> outError) override;
+
+    private:
+        Stream* m_source;
+        std::unique_ptr<Stream> m_ownedSource;
+        struct ZSTD_DCtx_s* m_context = nullptr;
+        std::unique_ptr<uint8_t[]> m_buffer;
+        size_t m_capacity;
+        size_t m_position = 0;
+        size_t m_end = 0;
+        bool m_isFrameComplete = true;
+
+        void Init();
+    };
+
+    // Write-only stream which compresses data with zstd and writes it to another stream. Finish()
+    // must be called to write the end of the frame; closing or destroying the stream without
+    // finishing it leaves a truncated frame.
+    class ZstdOutputStream final : public Stream {
+    public:
+        static constexpr int DefaultLevel = 19;
+
+        ZstdOutputStream() = delete;
+        ZstdOutputStream(const ZstdOutputStream&) = delete;
+        ZstdOutputStream(ZstdOutputStream&&) = delete;
+        explicit ZstdOutputStream(Stream& target, int level = DefaultLevel);
+        explicit ZstdOutputStream(std::unique_ptr<Stream> target, int level = DefaultLevel);
+        ~ZstdOutputStream();
+
+        // Closes the underlying stream.
+        void Close() override;
+        bool IsOpen() const override { return m_context && m_target->IsOpen(); }
+
+        // Compresses any pending input, ends the frame and writes everything to the underlying
+        // stream. Further writes start a new frame.
+        bool Finish(Out<IoError> outError);
+
+        ZstdOutputStream& operator=(const ZstdOutputStream&) = delete;
+        ZstdOutputStream& operator=(ZstdOutputStream&&) = delete;
+
+    protected:
+        size_t DoWrite(const void* buffer, size_t size, Out<IoError> outError) override;
+
+    private:
+        Stream* m_target;
+        std::unique_ptr<Stream> m_ownedTarget;
+        struct ZSTD_CCtx_s* m_context = nullptr;
+        std::unique_ptr<uint8_t[]> m_buffer;
+        size_t m_capacity;
+
+        void Init(int level);
+    };
+
+} // namespace ArenaBuilder
+
+#endif // ARENABUILDER_CORE_IO_CODEC_ZSTD_H_INCLUDED
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef ARENABUILDER_CORE_IO_ERROR_H_INCLUDED
+#define ARENABUILDER_CORE_IO_ERROR_H_INCLUDED
+
+#include <string>
+
+#include "../Encoding.h"
+
+namespace ArenaBuilder {
+
+    enum class IoErrorCode : uint8_t {
+        None,
+        Other,
+        Closed,
+        EndOfStream, // Unexpected end of stream
+        NotFound,
+        NotSupported,
+        InvalidArgument,
+        InvalidData,
+        System, // Operating system error
+    };
+
+    // Error reported by the I/O layer. An IoError with no error is just a code and a pointer, so
+    // passing one to a call that succeeds or reaches the end of a stream never allocates.
+    //
+    // The message must have static storage duration, i.e. a string literal. Anything that isn't
+    // known statically goes in the detail string, which is only built once an error has actually
+    // occurred. Operating system error numbers are stored as is and only formatted by ToString().
+    class IoError {
+    public:
+        IoError() = default;
+
+        // Implicit so that "*outError = "Message";" works. Only pass string literals.
+        IoError(const char* message)
+            : IoError{IoErrorCode::Other, message}
+        {
+        }
+
+        IoError(IoErrorCode code, const char* message)
+            : m_code{code}, m_message{message}
+        {
+        }
+
+        IoError(const char* message, std::string detail)
+            : IoError{IoErrorCode::Other, message, std::move(detail)}
+        {
+        }
+
+        IoError(IoErrorCode code, const char* message, std::string detail)
+            : m_code{code}, m_message{message}, m_detail{std::move(detail)}
+        {
+        }
+
+        // Error from errno on Unix or GetLastError() on Windows. The message is typically the name
+        // of the function that failed.
+        static IoError FromSystemError(const char* message, int errorNumber);
+
+        IoErrorCode GetCode() const { return m_code; }
+        const char* GetMessage() const { return m_message; }
+        const std::string& GetDetail() const { return m_detail; }
+        bool HasError() const { return m_code != IoErrorCode::None; }
+        explicit operator bool() const { return HasError(); }
+
+        void Clear() { *this = {}; }
+
+        // Formats the error as "message: detail". Allocates, so this is meant for logging and error
+        // reporting, not for checking what went wrong.
+        std::string ToString() const;
+
+    private:
+        IoErrorCode m_code = IoErrorCode::None;
+        const char* m_message = "";
+        int m_systemError = 0;
+        std::string m_detail;
+    };
+
+} // namespace ArenaBuilder
+
+template<>
+struct fmt::formatter<ArenaBuilder::IoError, char> : formatter<std::string, char> {
+    format_context::iterator format(const ArenaBuilder::IoError& error, format_context& ctx) const
+    {
+        return formatter<std::string, char>::format(error.ToString(), ctx);
+    }
+};
+
+template<>
+struct fmt::formatter<ArenaBuilder::IoError, wchar_t> : formatter<std::wstring, wchar_t> {
+    wformat_context::iterator format(const ArenaBuilder::IoError& error, wformat_context& ctx) const
+    {
+        return formatter<std::wstring, wchar_t>::format(ArenaBuilder::Encoding::SystemToWide(error.ToString()), ctx);
+    }
+};
+
+#endif // ARENABUILDER_CORE_IO_ERROR_H_INCLUDED
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef ARENABUILDER_CORE_IO_FILEWATCHER_H_INCLUDED
+#define ARENABUILDER_CORE_IO_FILEWATCHER_H_INCLUDED
+
+#include <memory>
+#include <vector>
+
+#include "Error.h"
+
+namespace ArenaBuilder {
+
+    // A file under a watched directory that was written, created or removed.
+    struct FileChange {
+        std::string name; // Relative to the watched directory, named as with MappedFileSource
+        bool isRemoved;
+    };
+
+    // Reports changes to the files under a directory tree, i.e. so that assets can be reloaded
+    // while the client is running. Subdirectories created after the watcher are watched too.
+    class FileWatcher {
+    public:
+        FileWatcher() = default;
+        FileWatcher(const FileWatcher&) = delete;
+        FileWatcher(FileWatcher&&) = delete;
+        virtual ~FileWatcher() = 0;
+
+        // Appends the changes since the last call to outChanges without blocking. Each name is
+        // reported at most once per call, with the most recent kind of change. Files are reported
+        // when they're closed after writing rather than on every write. Returns false if some
+        // changes may be missing, i.e. because the system dropped events or because a directory
+        // was moved away and the files in it can't be reported as removed.
+        virtual bool Poll(Out<std::vector<FileChange>> outChanges) = 0;
+
+        FileWatcher& operator=(const FileWatcher&) = delete;
+        FileWatcher& operator=(FileWatcher&&) = delete;
+    };
+
+    // Starts watching a directory tree. Fails if the platform has no supported backend or if the
+    // directory can't be watched.
+    std::unique_ptr<FileWatcher> CreateFileWatcher(OsString rootDir, Out<IoError> outError);
+
+    namespace Internal {
+
+#ifdef __linux__
+        std::unique_ptr<FileWatcher> CreateInotifyFileWatcher(OsString rootDir, Out<IoError> outError);
+#endif
+
+    } // namespace Internal
+
+} // namespace ArenaBuilder
+
+#endif // ARENABUILDER_CORE_IO_FILEWATCHER_H_INCLUDED
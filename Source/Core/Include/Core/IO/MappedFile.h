@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef ARENABUILDER_CORE_IO_MAPPEDFILE_H_INCLUDED
+#define ARENABUILDER_CORE_IO_MAPPEDFILE_H_INCLUDED
+
+#include "Base.h"
+
+namespace ArenaBuilder {
+
+    // Read-only memory mapping of an entire file.
+    class MappedFile {
+    public:
+        MappedFile() = default;
+        MappedFile(const MappedFile&) = delete;
+        MappedFile(MappedFile&&) = delete;
+        explicit MappedFile(const oschar_t* path, Out<IoError> outError);
+        ~MappedFile();
+
+        bool Open(const oschar_t* path, Out<IoError> outError);
+        void Close();
+        bool IsOpen() const { return m_isOpen; }
+
+        // The view is empty if the file is empty. Mapping an empty file is not an error.
+        ByteView GetView() const { return {static_cast<const uint8_t*>(m_address), m_size}; }
+
+        // Last modification time of the file when it was opened. The units are platform-specific,
+        // so this is only useful for detecting changes.
+        uint64_t GetModificationTime() const { return m_modificationTime; }
+
+        MappedFile& operator=(const MappedFile&) = delete;
+        MappedFile& operator=(MappedFile&&) = delete;
+
+    private:
+        void* m_address = nullptr;
+        size_t m_size = 0;
+        uint64_t m_modificationTime = 0;
+        bool m_isOpen = false;
+    };
+
+    // Data source for loose files under a root directory. Each opened stream maps its file, so
+    // streams support TryGetView() and their contents come straight from the page cache.
+    class MappedFileSource final : public DataSource {
+    public:
+        MappedFileSource() = delete;
+        MappedFileSource(const MappedFileSource&) = delete;
+        MappedFileSource(MappedFileSource&&) = delete;
+        explicit MappedFileSource(OsString rootDir);
+        ~MappedFileSource();
+
+        const OsString& GetRootDir() const { return m_rootDir; }
+
+        // Names are relative paths separated by '/'. Names containing empty, '.' or '..'
+        // components are rejected so that streams can't escape the root directory.
+        std::unique_ptr<Stream> OpenStream(std::string_view name, Out<IoError> outError) override;
+
+        // Lists regular files under the root directory, recursively. Entry IDs aren't supported,
+        // so every entry is reported with NoEntryId.
+        bool EnumerateEntries(const EntryCallback& callback, Out<IoError> outError) override;
+
+        // Gets the file system path for a name, validated as described for OpenStream().
+        bool ResolvePath(std::string_view name, Out<OsString> outPath, Out<IoError> outError) const;
+
+        MappedFileSource& operator=(const MappedFileSource&) = delete;
+        MappedFileSource& operator=(MappedFileSource&&) = delete;
+
+    private:
+        OsString m_rootDir;
+    };
+
+} // namespace ArenaBuilder
+
+#endif // ARENABUILDER_CORE_IO_MAPPEDFILE_H_INCLUDED
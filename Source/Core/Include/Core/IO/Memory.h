@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef ARENABUILDER_CORE_IO_MEMORY_H_INCLUDED
+#define ARENABUILDER_CORE_IO_MEMORY_H_INCLUDED
+
+#include "Base.h"
+
+namespace ArenaBuilder {
+
+    // Input stream which reads from a range of memory. The stream can optionally share ownership
+    // of whatever object keeps the memory alive, i.e. a file mapping or a decompressed blob.
+    class MemoryInputStream final : public Stream {
+    public:
+        MemoryInputStream() = default;
+        MemoryInputStream(const MemoryInputStream&) = delete;
+        MemoryInputStream(MemoryInputStream&&) = delete;
+        explicit MemoryInputStream(ByteView view, std::shared_ptr<const void> owner = {});
+        ~MemoryInputStream();
+
+        void Open(ByteView view, std::shared_ptr<const void> owner = {});
+        void Close() override;
+        bool IsOpen() const override { return m_isOpen; }
+
+        bool TryGetView(Out<ByteView> outView) const override;
+        bool IsSeekable() const override { return true; }
+        bool GetSize(Out<uint64_t> outSize) const override;
+        uint64_t Tell() const override { return m_position; }
+
+        MemoryInputStream& operator=(const MemoryInputStream&) = delete;
+        MemoryInputStream& operator=(MemoryInputStream&&) = delete;
+
+    protected:
+        size_t DoRead(void* buffer, size_t size, Out<IoError> outError) override;
+        size_t DoReadV(const ByteSpan* spans, size_t count, Out<IoError> outError) override;
+        bool DoSeek(uint64_t position, Out<IoError> outError) override;
+
+    private:
+        ByteView m_view;
+        std::shared_ptr<const void> m_owner;
+        size_t m_position = 0;
+        bool m_isOpen = false;
+    };
+
+} // namespace ArenaBuilder
+
+#endif // ARENABUILDER_CORE_IO_MEMORY_H_INCLUDED
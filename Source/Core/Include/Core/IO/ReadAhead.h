@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef ARENABUILDER_CORE_IO_READAHEAD_H_INCLUDED
+#define ARENABUILDER_CORE_IO_READAHEAD_H_INCLUDED
+
+#include <atomic>
+#include <vector>
+
+#include "../Thread.h"
+#include "Base.h"
+
+namespace ArenaBuilder {
+
+    // Read-only stream adapter which reads ahead of the consumer on a worker thread, so that
+    // decompression (e.g. in a ZipInputStream) overlaps with whatever the consumer does with the
+    // data. The worker fills a ring of chunks and stalls when all of them are full. Only worthwhile
+    // for large streams that are read sequentially; for anything else, the thread costs more than
+    // it saves.
+    //
+    // The underlying stream is only accessed from the worker thread while reading, so it doesn't
+    // need to be thread-safe. Its size and seekability are read once, before the worker starts. It
+    // must not be used by anything else until this stream is closed or destroyed. Seeking is
+    // supported if the underlying stream is seekable, but discards all read-ahead data.
+    class ReadAheadStream final : public Stream {
+    public:
+        static constexpr size_t DefaultChunkSize = 262144;
+        static constexpr size_t DefaultChunkCount = 4;
+
+        ReadAheadStream() = delete;
+        ReadAheadStream(const ReadAheadStream&) = delete;
+        ReadAheadStream(ReadAheadStream&&) = delete;
+        explicit ReadAheadStream(Stream& source, size_t chunkSize = DefaultChunkSize,
+                                 size_t chunkCount = DefaultChunkCount);
+        explicit ReadAheadStream(std::unique_ptr<Stream> source, size_t chunkSize = DefaultChunkSize,
+                                 size_t chunkCount = DefaultChunkCount);
+        ~ReadAheadStream();
+
+        // Stops the worker thread and closes the underlying stream.
+        void Close() override;
+        bool IsOpen() const override { return m_isOpen; }
+
+        bool IsSeekable() const override { return m_isSeekable; }
+        bool GetSize(Out<uint64_t> outSize) const override;
+        uint64_t Tell() const override { return m_position; }
+
+        ReadAheadStream& operator=(const ReadAheadStream&) = delete;
+        ReadAheadStream& operator=(ReadAheadStream&&) = delete;
+
+    protected:
+        size_t DoRead(void* buffer, size_t size, Out<IoError> outError) override;
+        bool DoSeek(uint64_t position, Out<IoError> outError) override;
+
+    private:
+        // A chunk is owned by the worker until it is released through m_filledChunks, and by the
+        // consumer until it is released through m_freeChunks, so no other locking is needed.
+        struct Chunk {
+            std::unique_ptr<uint8_t[]> data;
+            size_t size = 0;
+            bool isLast = false;
+            IoError error; // Set if the read that ended the stream failed
+        };
+
+        Stream* m_source;
+        std::unique_ptr<Stream> m_ownedSource;
+        std::vector<Chunk> m_chunks;
+        size_t m_chunkSize;
+        bool m_isSeekable = false;
+        bool m_hasSize = false;
+        uint64_t m_size = 0;
+        Thread m_thread;
+        std::unique_ptr<Semaphore> m_freeChunks;
+        std::unique_ptr<Semaphore> m_filledChunks;
+        std::atomic<bool> m_isStopping{false};
+        bool m_isOpen = true;
+
+        // Consumer state
+        size_t m_readIndex = 0;
+        size_t m_readOffset = 0;
+        bool m_hasReadChunk = false;
+        bool m_isFinished = false;
+        IoError m_error;
+        uint64_t m_position = 0;
+
+        void Init(size_t chunkCount);
+        void StartWorker();
+        void StopWorker();
+        void RunWorker();
+    };
+
+} // namespace ArenaBuilder
+
+#endif // ARENABUILDER_CORE_IO_READAHEAD_H_INCLUDED
@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef ARENABUILDER_CORE_IO_VIRTUALFILESYSTEM_H_INCLUDED
+#define ARENABUILDER_CORE_IO_VIRTUALFILESYSTEM_H_INCLUDED
+
+#include <vector>
+
+#include "../Hash.h"
+#include "Base.h"
+
+namespace ArenaBuilder {
+
+    // DataSource which layers other data sources on top of each other, i.e. the base game, then
+    // patches, then mods. Each source is mounted at a mount point, which is prefixed to its names,
+    // and with a priority. When several layers have the same name, the highest priority wins, and
+    // between equal priorities the most recent mount wins.
+    //
+    // Mounting lists the source's entries and merges them into a single name index, so opening a
+    // stream takes one hash probe no matter how many layers there are. Because of this, files added
+    // to or removed from a mounted directory after it was mounted aren't noticed unless they're
+    // passed to RefreshEntry().
+    //
+    // Mount() and RefreshEntry() are not thread-safe. OpenStream() may be called from several
+    // threads at once if the mounted sources allow it.
+    class VirtualFileSystem final : public DataSource {
+    public:
+        VirtualFileSystem();
+        VirtualFileSystem(const VirtualFileSystem&) = delete;
+        VirtualFileSystem(VirtualFileSystem&&) = delete;
+        ~VirtualFileSystem();
+
+        // The mount point is a name prefix without a trailing '/', or empty to mount at the root.
+        // Fails if the source can't list its entries.
+        bool Mount(DataSource& source, std::string_view mountPoint, int priority, Out<IoError> outError);
+        bool Mount(std::unique_ptr<DataSource> source, std::string_view mountPoint, int priority,
+                   Out<IoError> outError);
+
+        // Updates the index after a name was added to or removed from a mounted source, i.e. by a
+        // FileWatcher. The name is relative to the source, without its mount point. A removed name
+        // falls back to the next layer that has it, if any. Returns true if the change is visible
+        // through this file system, i.e. the source is or was the layer that the name resolves to.
+        bool RefreshEntry(const DataSource& source, std::string_view name, bool exists);
+
+        size_t GetLayerCount() const { return m_layers.size(); }
+        size_t GetEntryCount() const { return m_entries.size() - m_removedEntryCount; }
+
+        std::unique_ptr<Stream> OpenStream(std::string_view name, Out<IoError> outError) override;
+        std::unique_ptr<Stream> OpenStream(const HashedName& name, Out<IoError> outError);
+
+        // Entry IDs are indices into the merged index. Removed entries are skipped, but the IDs of
+        // other entries stay the same.
+        bool EnumerateEntries(const EntryCallback& callback, Out<IoError> outError) override;
+        std::unique_ptr<Stream> OpenEntryStream(uint64_t entryId, Out<IoError> outError) override;
+
+        VirtualFileSystem& operator=(const VirtualFileSystem&) = delete;
+        VirtualFileSystem& operator=(VirtualFileSystem&&) = delete;
+
+    private:
+        struct Layer {
+            DataSource* source;
+            std::unique_ptr<DataSource> ownedSource;
+            std::string mountPoint;
+            int priority;
+        };
+
+        static constexpr uint32_t NoLayer = ~uint32_t(0);
+
+        struct Entry {
+            std::string name; // Including the mount point
+            uint64_t nameHash;
+            uint32_t layerIndex; // NoLayer if the entry was removed from every layer
+            uint64_t entryId; // Within the layer
+            uint32_t shadows = 0; // Index plus one of the first overridden layer, or zero
+        };
+
+        // Layer which also has an entry's name but is overridden by a higher one. These are only
+        // needed to fall back when the higher layer's file is removed.
+        struct Shadow {
+            uint32_t layerIndex;
+            uint64_t entryId;
+            uint32_t next; // Index plus one, or zero
+        };
+
+        std::vector<Layer> m_layers; // In mount order
+        std::vector<Entry> m_entries;
+        std::vector<Shadow> m_shadows;
+        uint32_t m_freeShadows = 0; // Index plus one of the first unused shadow, or zero
+        size_t m_removedEntryCount = 0;
+
+        // Open-addressed hash table of entry indices plus one, where zero marks an empty slot. The
+        // size is always a power of two, at least twice the number of entries.
+        std::vector<uint32_t> m_nameTable;
+
+        bool Overrides(uint32_t layerIndex, uint32_t otherLayerIndex) const;
+        Entry* FindEntry(const HashedName& name);
+        void AddEntry(std::string name, uint32_t layerIndex, uint64_t entryId);
+        void AddProvider(Entry& entry, uint32_t layerIndex, uint64_t entryId);
+        void RemoveProvider(Entry& entry, uint32_t layerIndex);
+        void AddShadow(Entry& entry, uint32_t layerIndex, uint64_t entryId);
+        void GrowNameTable();
+        std::unique_ptr<Stream> OpenEntry(const Entry& entry, Out<IoError> outError);
+    };
+
+} // namespace ArenaBuilder
+
+#endif // ARENABUILDER_CORE_IO_VIRTUALFILESYSTEM_H_INCLUDED
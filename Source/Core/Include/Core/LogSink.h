@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef ARENABUILDER_CORE_LOGSINK_H_INCLUDED
+#define ARENABUILDER_CORE_LOGSINK_H_INCLUDED
+
+#include <stdio.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Debug.h"
+#include "Mutex.h"
+#include "Thread.h"
+
+namespace ArenaBuilder {
+
+    // A log message as passed to sinks. The strings are only valid during LogSink::Write().
+    struct LogRecord {
+        int64_t timestamp = 0; // Nanoseconds since the Unix epoch
+        uint64_t threadId = 0;
+        LogLevel level = LogLevel::Info;
+        const char* sourceFileName = nullptr; // Relative to the source directory, or null
+        int sourceLine = 0;
+        OsStringView message;
+
+        static int64_t GetCurrentTimestamp();
+    };
+
+    // Destination for log messages. Sinks are only called with the logger mutex held, so they don't
+    // need any locking of their own.
+    class LogSink {
+    public:
+        LogSink() = default;
+        LogSink(const LogSink&) = delete;
+        LogSink(LogSink&&) = delete;
+        virtual ~LogSink() = default;
+
+        virtual void Write(const LogRecord& record) = 0;
+
+        // Called after each batch of records, which may be a single record. Must not block for
+        // long, since a logging thread may be waiting.
+        virtual void EndBatch() {}
+
+        // Writes out everything that's pending before returning. Called on fatal errors.
+        virtual void Flush() {}
+
+        LogSink& operator=(const LogSink&) = delete;
+        LogSink& operator=(LogSink&&) = delete;
+    };
+
+    // Writes messages to stderr as text with ANSI colors. This is the sink that InitLogger() adds.
+    class ConsoleLogSink final : public LogSink {
+    public:
+        void Write(const LogRecord& record) override;
+        void EndBatch() override;
+        void Flush() override;
+
+    private:
+        OsString m_buffer;
+    };
+
+    struct LogFileParams {
+        OsString path;
+        uint64_t maxFileSize = 0; // Rotate after a file reaches this many bytes; 0 never rotates
+        uint32_t maxFileCount = 4; // Including the current file; older files get suffixes .1, .2, ...
+    };
+
+    // Base class for sinks which encode records into a file, with size-based rotation. Records are
+    // appended to an existing file. Output is buffered until the end of each batch.
+    class LogFileSink : public LogSink {
+    public:
+        ~LogFileSink() override;
+
+        bool Open(const LogFileParams& params, Out<std::string> outError);
+
+        void Write(const LogRecord& record) final;
+        void EndBatch() final;
+        void Flush() final;
+
+    protected:
+        // Encodes a record onto the end of 'out'.
+        virtual void EncodeRecord(const LogRecord& record, std::string& out) = 0;
+
+        // Called whenever a file is opened, including after rotation, so that encoders can reset
+        // their state. 'isEmpty' is false if records are being appended to an existing file.
+        virtual void BeginFile(std::string& out, bool isEmpty);
+
+    private:
+        LogFileParams m_params;
+        FILE* m_file = nullptr;
+        uint64_t m_fileSize = 0;
+        std::string m_buffer;
+
+        bool OpenFile(Out<std::string> outError);
+        void WriteBuffer();
+        void Rotate();
+    };
+
+    // Writes one JSON object per line, e.g.:
+    //
+    //   {"time":"2023-10-16T12:34:56.789012Z","thread":1234,"level":"info",
+    //    "file":"Source/Client/Client.cpp","line":42,"message":"Mounted Assets.abpk"}
+    //
+    // "file" and "line" are omitted if the source location isn't known. Strings are UTF-8.
+    class JsonLogFileSink final : public LogFileSink {
+    protected:
+        void EncodeRecord(const LogRecord& record, std::string& out) override;
+
+    private:
+        int64_t m_cachedSecond = -1;
+        std::string m_cachedSecondText; // Formatted date and time up to the seconds
+#ifdef _WIN32
+        std::string m_text; // Message converted to UTF-8
+#endif
+    };
+
+    // Writes compact binary records. All integers are little-endian, and strings are UTF-8 with a
+    // length prefix. A new file starts with the magic "ABLG" and a uint32 version, currently 1. Then
+    // each record starts with a uint8 type:
+    //
+    //   1 = Source file name: uint16 id, uint16 length, name. Defines an ID for message records
+    //       until the next source file name record with the same ID.
+    //   2 = Message: int64 timestamp (nanoseconds since the Unix epoch), uint64 thread ID, uint8
+    //       level (0 = fatal ... 5 = trace), uint16 source file ID (0xFFFF if unknown), uint32
+    //       line, uint32 length, message.
+    //
+    // IDs are assigned from zero again at the start of each file, including when appending.
+    class BinaryLogFileSink final : public LogFileSink {
+    public:
+        static constexpr uint32_t FormatVersion = 1;
+        static constexpr uint8_t SourceFileRecordType = 1;
+        static constexpr uint8_t MessageRecordType = 2;
+        static constexpr uint16_t NoSourceFileId = 0xFFFF;
+
+    protected:
+        void EncodeRecord(const LogRecord& record, std::string& out) override;
+        void BeginFile(std::string& out, bool isEmpty) override;
+
+    private:
+        std::unordered_map<const char*, uint16_t> m_sourceFileIds; // Keyed by address, like __FILE__
+    };
+
+    // Runs another sink on its own thread. Logging threads only copy records into a batch, which
+    // the sink's thread swaps out and writes. If the thread falls too far behind, records are
+    // dropped and counted instead of using unbounded memory.
+    class ThreadedLogSink final : public LogSink {
+    public:
+        static constexpr size_t MaxPendingRecords = 65536;
+
+        ThreadedLogSink() = delete;
+        explicit ThreadedLogSink(std::unique_ptr<LogSink> sink);
+        ~ThreadedLogSink() override; // Writes any pending records
+
+        // Until the thread starts, records are written synchronously.
+        bool Start(Out<std::string> outError);
+
+        void Write(const LogRecord& record) override;
+        void Flush() override;
+
+    private:
+        struct PendingRecord {
+            LogRecord record; // Without the message
+            size_t messageOffset;
+            size_t messageSize;
+        };
+
+        struct Batch {
+            std::vector<PendingRecord> records;
+            OsString text; // Messages of all records
+        };
+
+        std::unique_ptr<LogSink> m_sink;
+        RecursiveMutex m_pendingMutex;
+        Batch m_pending; // Guarded by m_pendingMutex
+        size_t m_droppedCount = 0; // Guarded by m_pendingMutex
+        RecursiveMutex m_writeMutex; // Held while writing to m_sink
+        Batch m_writing; // Guarded by m_writeMutex
+        std::atomic<bool> m_isStopping{false};
+        Semaphore m_signal; // Released when a batch becomes non-empty
+        Thread m_thread;
+
+        void WritePending();
+        void Run();
+    };
+
+} // namespace ArenaBuilder
+
+#endif // ARENABUILDER_CORE_LOGSINK_H_INCLUDED
@@ -53,6 +53,32 @@ namespace ArenaBuilder {
         bool Initialize(Out<std::string> outError);
     };
 
+    // Holds a lock on a mutex for the lifetime of the object.
+    template<typename T>
+    class ScopedLock {
+    public:
+        ScopedLock() = delete;
+        ScopedLock(const ScopedLock<T>&) = delete;
+        ScopedLock(ScopedLock<T>&&) = delete;
+
+        explicit ScopedLock(T& mutex)
+            : m_mutex{mutex}
+        {
+            m_mutex.Lock();
+        }
+
+        ~ScopedLock()
+        {
+            m_mutex.Unlock();
+        }
+
+        ScopedLock<T>& operator=(const ScopedLock<T>&) = delete;
+        ScopedLock<T>& operator=(ScopedLock<T>&&) = delete;
+
+    private:
+        T& m_mutex;
+    };
+
 } // namespace ArenaBuilder
 
 #endif // ARENABUILDER_CORE_MUTEX_H_INCLUDED
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef ARENABUILDER_CORE_PROFILER_H_INCLUDED
+#define ARENABUILDER_CORE_PROFILER_H_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <x86intrin.h>
+#elif defined(_M_X64) || defined(_M_IX86)
+# include <intrin.h>
+#endif
+
+#include "Types.h"
+
+// Profiling zones can be compiled out entirely, in which case the macros expand to nothing.
+#ifndef ARENABUILDER_ENABLE_PROFILER
+# define ARENABUILDER_ENABLE_PROFILER 1
+#endif
+
+// Scoped profiling macros. A zone lasts until the end of the enclosing scope. Names must be string
+// literals, or otherwise outlive the profiler.
+#if ARENABUILDER_ENABLE_PROFILER
+# define ARENABUILDER_PROFILE_CONCAT_(a, b) a##b
+# define ARENABUILDER_PROFILE_CONCAT(a, b) ARENABUILDER_PROFILE_CONCAT_(a, b)
+# define PROFILE_SCOPE(name) ::ArenaBuilder::Profiler::Internal::ProfileScope ARENABUILDER_PROFILE_CONCAT(profileScope, __LINE__){"" name}
+# define PROFILE_FUNCTION() ::ArenaBuilder::Profiler::Internal::ProfileScope ARENABUILDER_PROFILE_CONCAT(profileScope, __LINE__){__func__}
+#else
+# define PROFILE_SCOPE(name) static_cast<void>(0)
+# define PROFILE_FUNCTION() static_cast<void>(0)
+#endif
+
+namespace ArenaBuilder {
+
+    namespace Profiler {
+
+        // Starts recording profiling zones on every thread. Zones which are already open aren't
+        // recorded. Each thread records into its own buffer without locking.
+        void Start();
+
+        // Stops recording. Recorded zones are kept until the process exits.
+        void Stop();
+
+        bool IsRunning();
+
+        // Writes every recorded zone in the Chrome trace event format, which chrome://tracing and
+        // Perfetto can open.
+        bool WriteChromeTrace(const oschar_t* path, Out<std::string> outError);
+
+        // Writes every recorded zone in a compact binary format. All integers are little-endian.
+        // The file starts with the magic "ABPF", a uint32 version, currently 1, and a uint32 count
+        // of zone names, each of which is a uint16 length and UTF-8 text. Then there's a uint32
+        // count of threads, each of which is a uint64 thread ID, a uint64 count of zones, and then
+        // the zones: uint32 name index, uint64 start time and uint64 duration, both in nanoseconds.
+        // Start times are relative to when the profiler was first started.
+        bool WriteBinaryTrace(const oschar_t* path, Out<std::string> outError);
+
+        namespace Internal {
+
+            extern std::atomic<bool> isRunning;
+
+            // Reads a cheap, monotonic clock whose ticks are calibrated against the steady clock
+            // when the profile is written. This is the TSC on x86, which takes a few nanoseconds.
+            inline uint64_t ReadClock()
+            {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+                return __rdtsc();
+#else
+                return uint64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+            }
+
+            void RecordZone(const char* name, uint64_t startTime, uint64_t endTime);
+
+            class ProfileScope {
+            public:
+                ProfileScope() = delete;
+                ProfileScope(const ProfileScope&) = delete;
+                ProfileScope(ProfileScope&&) = delete;
+
+                explicit ProfileScope(const char* name)
+                    : m_name{name}
+                    , m_startTime{isRunning.load(std::memory_order_relaxed) ? ReadClock() : 0}
+                {
+                }
+
+                ~ProfileScope()
+                {
+                    if (m_startTime) {
+                        RecordZone(m_name, m_startTime, ReadClock());
+                    }
+                }
+
+                ProfileScope& operator=(const ProfileScope&) = delete;
+                ProfileScope& operator=(ProfileScope&&) = delete;
+
+            private:
+                const char* m_name;
+                uint64_t m_startTime; // Zero if the profiler wasn't running
+            };
+
+        } // namespace Internal
+
+    } // namespace Profiler
+
+} // namespace ArenaBuilder
+
+#endif // ARENABUILDER_CORE_PROFILER_H_INCLUDED
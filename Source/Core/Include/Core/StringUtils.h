@@ -15,6 +15,8 @@
 #ifndef ARENABUILDER_CORE_STRINGUTILS_H_INCLUDED
 #define ARENABUILDER_CORE_STRINGUTILS_H_INCLUDED
 
+#include <limits>
+
 #include "Types.h"
 
 namespace ArenaBuilder {
@@ -53,6 +55,59 @@ namespace ArenaBuilder {
         return length;
     }
 
+    // Parses a decimal integer, i.e. a command line parameter. The whole string must be digits,
+    // with an optional '-' only if T is signed. Returns false if the string is null or malformed,
+    // or if the value doesn't fit in T.
+    template<typename T, typename CharT>
+    constexpr bool ParseInteger(const CharT* str, Out<T> outValue)
+    {
+        static_assert(std::is_integral_v<T>, "ParseInteger requires an integer type");
+
+        constexpr T minValue = std::numeric_limits<T>::min();
+        constexpr T maxValue = std::numeric_limits<T>::max();
+        bool isNegative = false;
+        T value = 0;
+
+        if (!str) {
+            return false;
+        }
+
+        if constexpr (std::is_signed_v<T>) {
+            if (*str == CharT('-')) {
+                isNegative = true;
+                ++str;
+            }
+        }
+
+        if (!*str) {
+            return false;
+        }
+
+        // Negative values are accumulated downwards so that the minimum value can be parsed.
+        for (; *str; ++str) {
+            if (*str < CharT('0') || *str > CharT('9')) {
+                return false;
+            }
+
+            T digit = T(*str - CharT('0'));
+
+            if (isNegative) {
+                if (value < (minValue + digit) / 10) {
+                    return false;
+                }
+                value = T(value * 10 - digit);
+            } else {
+                if (value > (maxValue - digit) / 10) {
+                    return false;
+                }
+                value = T(value * 10 + digit);
+            }
+        }
+
+        *outValue = value;
+        return true;
+    }
+
 } // namespace ArenaBuilder
 
 #endif // ARENABUILDER_CORE_STRINGUTILS_H_INCLUDED
@@ -15,6 +15,8 @@
 #ifndef ARENABUILDER_CORE_SYSTEM_H_INCLUDED
 #define ARENABUILDER_CORE_SYSTEM_H_INCLUDED
 
+#include <functional>
+
 #include "Types.h"
 
 namespace ArenaBuilder {
@@ -35,6 +37,28 @@ namespace ArenaBuilder {
         void InitErrorDialogHandler();
         void SetErrorDialogHandler(void (*handler)(const oschar_t*));
 
+        // Sets a function to call when the process crashes, i.e. on a segmentation fault or an
+        // unhandled exception, before the platform's default handling. The handler runs in a signal
+        // handler on Unix, so it must only do async-signal-safe things. The description is static.
+        void SetCrashHandler(void (*handler)(const char* description));
+
+        enum class FileType {
+            Regular,
+            Directory,
+            Other,
+        };
+
+        // Calls 'callback' for each entry in a directory other than '.' and '..', in no particular
+        // order. Symbolic links are reported as the type of their target. Returns false if the
+        // directory can't be read.
+        bool ListDirectory(const oschar_t* path, const std::function<void(OsStringView name, FileType type)>& callback,
+                           Out<std::string> outError);
+
+        // Gets the per-user directory for data that can be regenerated, i.e. $XDG_CACHE_HOME on
+        // Unix or %LOCALAPPDATA% on Windows, with an ArenaBuilder subdirectory. The directory may
+        // not exist yet. Returns false if there is no suitable location.
+        bool GetCacheDirectory(Out<OsString> outPath);
+
     } // namespace System
 
 #ifdef _WIN32
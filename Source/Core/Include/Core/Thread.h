@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef ARENABUILDER_CORE_THREAD_H_INCLUDED
+#define ARENABUILDER_CORE_THREAD_H_INCLUDED
+
+#ifndef _WIN32
+# include <pthread.h>
+# include <semaphore.h>
+#endif
+
+#include <functional>
+#include <string>
+
+#include "Types.h"
+
+namespace ArenaBuilder {
+
+    // Substitute for std::thread, which may be unavailable on some configurations (i.e. MinGW with
+    // Win32 threads). Unlike std::thread, destroying a joinable Thread joins it.
+    class Thread {
+    public:
+        Thread() = default;
+        Thread(const Thread&) = delete;
+        Thread(Thread&&) = delete;
+        ~Thread();
+
+        bool Start(std::function<void()> entry, Out<std::string> outError);
+        void Join();
+        bool IsJoinable() const { return m_isStarted; }
+
+        // Number of processors available to the process. Returns at least 1.
+        static size_t GetHardwareConcurrency();
+
+        // The operating system's ID for the calling thread, as shown by debuggers and tools.
+        static uint64_t GetCurrentId();
+
+        Thread& operator=(const Thread&) = delete;
+        Thread& operator=(Thread&&) = delete;
+
+    private:
+#ifdef _WIN32
+        void* m_handle = nullptr;
+#else
+        pthread_t m_thread{};
+#endif
+        bool m_isStarted = false;
+    };
+
+    // Counting semaphore, for the same reasons as Thread.
+    class Semaphore {
+    public:
+        Semaphore(); // Aborts on failure
+        Semaphore(const Semaphore&) = delete;
+        Semaphore(Semaphore&&) = delete;
+        ~Semaphore();
+
+        void Acquire();
+        bool TryAcquire(uint32_t timeoutMilliseconds); // Returns false on timeout
+        void Release(uint32_t count = 1);
+
+        Semaphore& operator=(const Semaphore&) = delete;
+        Semaphore& operator=(Semaphore&&) = delete;
+
+    private:
+#ifdef _WIN32
+        void* m_handle = nullptr;
+#else
+        sem_t m_semaphore;
+#endif
+    };
+
+} // namespace ArenaBuilder
+
+#endif // ARENABUILDER_CORE_THREAD_H_INCLUDED
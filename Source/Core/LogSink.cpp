@@ -0,0 +1,489 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <chrono>
+#include <filesystem>
+#include <iterator>
+#include <utility>
+
+#include <fmt/chrono.h>
+
+#include <Core/ByteOrder.h>
+#include <Core/LogSink.h>
+
+// ANSI escape sequences for decorating log messages. These are supported on Windows and on most
+// Unix terminal emulators.
+#define ANSI_RESET "\x1B[0m"
+#define ANSI_BOLD "\x1B[1m"
+#define ANSI_BLACK "\x1B[30m"
+#define ANSI_RED "\x1B[31m"
+#define ANSI_GREEN "\x1B[32m"
+#define ANSI_YELLOW "\x1B[33m"
+#define ANSI_BLUE "\x1B[34m"
+#define ANSI_MAGENTA "\x1B[35m"
+#define ANSI_CYAN "\x1B[36m"
+#define ANSI_WHITE "\x1B[37m"
+
+using namespace std::literals::string_literals;
+using namespace ArenaBuilder;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+    // Console buffers that grew for an unusually long message are shrunk again afterwards.
+    constexpr size_t MaxRetainedBufferSize = 65536;
+
+    const oschar_t* GetLogLevelPrefix(LogLevel level)
+    {
+        switch (level) {
+        case LogLevel::Fatal:
+            return OSSTR(ANSI_BOLD ANSI_RED "Fatal error: " ANSI_RESET ANSI_BOLD);
+        case LogLevel::Error:
+            return OSSTR(ANSI_BOLD ANSI_RED "Error: " ANSI_RESET);
+        case LogLevel::Warning:
+            return OSSTR(ANSI_BOLD ANSI_YELLOW "Warning: " ANSI_RESET);
+        case LogLevel::Info:
+            return OSSTR(ANSI_BOLD ANSI_BLUE "Info: " ANSI_RESET);
+        case LogLevel::Debug:
+            return OSSTR(ANSI_BOLD ANSI_MAGENTA "Debug: " ANSI_RESET);
+        case LogLevel::Trace:
+            return OSSTR(ANSI_BOLD ANSI_CYAN "Trace: " ANSI_BLACK);
+        default:
+            return OSSTR("");
+        }
+    }
+
+    void AppendLogMessageSuffix(OsString& buffer, const char* sourceFileName, int sourceLine)
+    {
+        if (sourceFileName) {
+            fmt::format_to(std::back_inserter(buffer), OsStringView{OSSTR(" " ANSI_BOLD ANSI_BLACK "({}:{})")},
+                           Debug::Internal::Forward(sourceFileName), sourceLine);
+        }
+
+#ifdef _WIN32
+        buffer.append(OSSTR(ANSI_RESET "\r\n"));
+#else
+        buffer.append(OSSTR(ANSI_RESET "\n"));
+#endif
+    }
+
+    template<typename T>
+    void AppendLittleEndian(std::string& buffer, T value)
+    {
+        char bytes[sizeof(T)];
+
+        StoreLittleEndian(bytes, value);
+        buffer.append(bytes, sizeof(T));
+    }
+
+    // Log files are UTF-8 on every platform.
+    void AppendUtf8(std::string& out, OsStringView text)
+    {
+#ifdef _WIN32
+        for (size_t i = 0; i < text.size(); ++i) {
+            uint32_t ch = text[i];
+
+            if (ch >= 0xD800 && ch < 0xDC00 && i + 1 < text.size() && text[i + 1] >= 0xDC00 && text[i + 1] < 0xE000) {
+                ch = 0x10000 + ((ch - 0xD800) << 10) + (text[++i] - 0xDC00);
+            } else if (ch >= 0xD800 && ch < 0xE000) {
+                ch = 0xFFFD; // Unpaired surrogate
+            }
+
+            if (ch < 0x80) {
+                out.push_back(char(ch));
+            } else if (ch < 0x800) {
+                out.push_back(char(0xC0 | (ch >> 6)));
+                out.push_back(char(0x80 | (ch & 0x3F)));
+            } else if (ch < 0x10000) {
+                out.push_back(char(0xE0 | (ch >> 12)));
+                out.push_back(char(0x80 | ((ch >> 6) & 0x3F)));
+                out.push_back(char(0x80 | (ch & 0x3F)));
+            } else {
+                out.push_back(char(0xF0 | (ch >> 18)));
+                out.push_back(char(0x80 | ((ch >> 12) & 0x3F)));
+                out.push_back(char(0x80 | ((ch >> 6) & 0x3F)));
+                out.push_back(char(0x80 | (ch & 0x3F)));
+            }
+        }
+#else
+        out.append(text);
+#endif
+    }
+
+    // Appends a quoted JSON string. 'text' must be UTF-8, which is passed through unescaped.
+    void AppendJsonString(std::string& out, std::string_view text)
+    {
+        constexpr char hexDigits[] = "0123456789abcdef";
+
+        out.push_back('"');
+
+        for (char ch : text) {
+            switch (ch) {
+            case '"': out.append("\\\""); break;
+            case '\\': out.append("\\\\"); break;
+            case '\n': out.append("\\n"); break;
+            case '\r': out.append("\\r"); break;
+            case '\t': out.append("\\t"); break;
+            default:
+                if (uint8_t(ch) < 0x20) {
+                    out.append("\\u00");
+                    out.push_back(hexDigits[uint8_t(ch) >> 4]);
+                    out.push_back(hexDigits[uint8_t(ch) & 15]);
+                } else {
+                    out.push_back(ch);
+                }
+                break;
+            }
+        }
+
+        out.push_back('"');
+    }
+
+    FILE* OpenLogFile(const OsString& path)
+    {
+#ifdef _WIN32
+        return _wfopen(path.c_str(), L"ab");
+#else
+        return fopen(path.c_str(), "ab");
+#endif
+    }
+
+} // namespace
+
+int64_t LogRecord::GetCurrentTimestamp()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+//--------------------------------------------------------------------------------------------------
+
+void ConsoleLogSink::Write(const LogRecord& record)
+{
+    m_buffer.assign(GetLogLevelPrefix(record.level));
+    m_buffer.append(record.message);
+    AppendLogMessageSuffix(m_buffer, record.sourceFileName, record.sourceLine);
+
+#ifdef _WIN32
+    fputws(m_buffer.c_str(), stderr);
+#else
+    fwrite(m_buffer.data(), 1, m_buffer.size(), stderr);
+#endif
+
+    if (m_buffer.capacity() > MaxRetainedBufferSize) {
+        m_buffer.clear();
+        m_buffer.shrink_to_fit();
+    }
+}
+
+void ConsoleLogSink::EndBatch()
+{
+    fflush(stderr);
+}
+
+void ConsoleLogSink::Flush()
+{
+    fflush(stderr);
+}
+
+//--------------------------------------------------------------------------------------------------
+
+LogFileSink::~LogFileSink()
+{
+    if (m_file) {
+        WriteBuffer();
+        fclose(m_file);
+    }
+}
+
+bool LogFileSink::Open(const LogFileParams& params, Out<std::string> outError)
+{
+    ASSERT(!m_file);
+
+    m_params = params;
+    return OpenFile(outError);
+}
+
+void LogFileSink::Write(const LogRecord& record)
+{
+    EncodeRecord(record, m_buffer);
+
+    // Rotate after the record which reaches the limit, so a record is never split across files.
+    if (m_file && m_params.maxFileSize && m_fileSize + m_buffer.size() >= m_params.maxFileSize) {
+        WriteBuffer();
+        Rotate();
+    }
+}
+
+void LogFileSink::EndBatch()
+{
+    WriteBuffer();
+    if (m_file) {
+        fflush(m_file);
+    }
+}
+
+void LogFileSink::Flush()
+{
+    EndBatch();
+}
+
+void LogFileSink::BeginFile(std::string&, bool)
+{
+}
+
+bool LogFileSink::OpenFile(Out<std::string> outError)
+{
+    std::error_code error;
+
+    m_file = OpenLogFile(m_params.path);
+    if (!m_file) {
+        *outError = "fopen: "s + strerror(errno);
+        return false;
+    }
+
+    m_fileSize = fs::file_size(m_params.path, error);
+    if (error) {
+        m_fileSize = 0;
+    }
+
+    BeginFile(m_buffer, m_fileSize == 0);
+    return true;
+}
+
+void LogFileSink::WriteBuffer()
+{
+    if (m_file) {
+        fwrite(m_buffer.data(), 1, m_buffer.size(), m_file);
+        m_fileSize += m_buffer.size();
+    }
+
+    m_buffer.clear();
+}
+
+void LogFileSink::Rotate()
+{
+    std::string openError;
+    std::error_code error;
+
+    if (m_file) {
+        fclose(m_file);
+        m_file = nullptr;
+    }
+
+    // path.2 -> path.3, path.1 -> path.2, path -> path.1
+    if (m_params.maxFileCount > 1) {
+        for (uint32_t i = m_params.maxFileCount - 1; i > 0; --i) {
+            OsString from = i > 1 ? fmt::format(OsStringView{OSSTR("{}.{}")}, m_params.path, i - 1) : m_params.path;
+            fs::rename(from, fmt::format(OsStringView{OSSTR("{}.{}")}, m_params.path, i), error);
+        }
+    } else {
+        fs::remove(m_params.path, error);
+    }
+
+    // There's nowhere to report errors from here. Records are discarded from now on if the file
+    // can't be opened.
+    m_fileSize = 0;
+    OpenFile(Out{openError});
+}
+
+//--------------------------------------------------------------------------------------------------
+
+void JsonLogFileSink::EncodeRecord(const LogRecord& record, std::string& out)
+{
+    int64_t second = record.timestamp >= 0 ? record.timestamp / 1000000000 : (record.timestamp + 1) / 1000000000 - 1;
+    int64_t microsecond = (record.timestamp - second * 1000000000) / 1000;
+
+    // Formatting the date is the slowest part, and consecutive records are usually in the same
+    // second.
+    if (second != m_cachedSecond) {
+        m_cachedSecond = second;
+        m_cachedSecondText = fmt::format("{:%Y-%m-%dT%H:%M:%S}", fmt::gmtime(std::time_t(second)));
+    }
+
+    fmt::format_to(std::back_inserter(out), R"({{"time":"{}.{:06}Z","thread":{},"level":"{}")", m_cachedSecondText,
+                   microsecond, record.threadId, Debug::GetLogLevelName(record.level));
+
+    if (record.sourceFileName) {
+        out.append(R"(,"file":)");
+        AppendJsonString(out, record.sourceFileName);
+        fmt::format_to(std::back_inserter(out), R"(,"line":{})", record.sourceLine);
+    }
+
+    out.append(R"(,"message":)");
+#ifdef _WIN32
+    m_text.clear();
+    AppendUtf8(m_text, record.message);
+    AppendJsonString(out, m_text);
+#else
+    AppendJsonString(out, record.message);
+#endif
+    out.append("}\n");
+}
+
+//--------------------------------------------------------------------------------------------------
+
+void BinaryLogFileSink::EncodeRecord(const LogRecord& record, std::string& out)
+{
+    uint16_t sourceFileId = NoSourceFileId;
+    size_t lengthOffset;
+
+    if (record.sourceFileName) {
+        auto it = m_sourceFileIds.find(record.sourceFileName);
+
+        if (it != m_sourceFileIds.end()) {
+            sourceFileId = it->second;
+        } else if (m_sourceFileIds.size() < NoSourceFileId) {
+            size_t length = std::min(strlen(record.sourceFileName), size_t{UINT16_MAX});
+
+            sourceFileId = uint16_t(m_sourceFileIds.size());
+            m_sourceFileIds.emplace(record.sourceFileName, sourceFileId);
+
+            AppendLittleEndian(out, SourceFileRecordType);
+            AppendLittleEndian(out, sourceFileId);
+            AppendLittleEndian(out, uint16_t(length));
+            out.append(record.sourceFileName, length);
+        }
+    }
+
+    AppendLittleEndian(out, MessageRecordType);
+    AppendLittleEndian(out, record.timestamp);
+    AppendLittleEndian(out, record.threadId);
+    AppendLittleEndian(out, uint8_t(record.level));
+    AppendLittleEndian(out, sourceFileId);
+    AppendLittleEndian(out, uint32_t(record.sourceLine));
+
+    // The length is only known after conversion on Windows, so patch it in afterwards.
+    lengthOffset = out.size();
+    AppendLittleEndian(out, uint32_t{0});
+    AppendUtf8(out, record.message);
+    StoreLittleEndian(&out[lengthOffset], uint32_t(out.size() - lengthOffset - sizeof(uint32_t)));
+}
+
+void BinaryLogFileSink::BeginFile(std::string& out, bool isEmpty)
+{
+    m_sourceFileIds.clear();
+
+    if (isEmpty) {
+        out.append("ABLG");
+        AppendLittleEndian(out, FormatVersion);
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+
+ThreadedLogSink::ThreadedLogSink(std::unique_ptr<LogSink> sink)
+    : m_sink{std::move(sink)}
+{
+}
+
+ThreadedLogSink::~ThreadedLogSink()
+{
+    if (m_thread.IsJoinable()) {
+        m_isStopping.store(true, std::memory_order_release);
+        m_signal.Release();
+        m_thread.Join();
+    }
+
+    Flush();
+}
+
+bool ThreadedLogSink::Start(Out<std::string> outError)
+{
+    return m_thread.Start([this] { Run(); }, outError);
+}
+
+void ThreadedLogSink::Write(const LogRecord& record)
+{
+    bool wasEmpty;
+
+    {
+        ScopedLock lock{m_pendingMutex};
+
+        if (m_pending.records.size() >= MaxPendingRecords) {
+            ++m_droppedCount;
+            return;
+        }
+
+        PendingRecord& pending = m_pending.records.emplace_back();
+        pending.record = record;
+        pending.record.message = {};
+        pending.messageOffset = m_pending.text.size();
+        pending.messageSize = record.message.size();
+        m_pending.text.append(record.message);
+        wasEmpty = m_pending.records.size() == 1;
+    }
+
+    if (!m_thread.IsJoinable()) {
+        WritePending();
+    } else if (wasEmpty) {
+        m_signal.Release();
+    }
+}
+
+void ThreadedLogSink::Flush()
+{
+    WritePending();
+
+    ScopedLock lock{m_writeMutex};
+    m_sink->Flush();
+}
+
+void ThreadedLogSink::WritePending()
+{
+    ScopedLock writeLock{m_writeMutex};
+    size_t droppedCount;
+
+    {
+        ScopedLock lock{m_pendingMutex};
+        std::swap(m_pending, m_writing);
+        droppedCount = std::exchange(m_droppedCount, 0);
+    }
+
+    for (PendingRecord& pending : m_writing.records) {
+        pending.record.message = OsStringView{m_writing.text}.substr(pending.messageOffset, pending.messageSize);
+        m_sink->Write(pending.record);
+    }
+
+    if (droppedCount) {
+        OsString notice = fmt::format(OsStringView{OSSTR("{} log messages were dropped by a log sink thread")},
+                                      droppedCount);
+        LogRecord record;
+
+        record.timestamp = LogRecord::GetCurrentTimestamp();
+        record.threadId = Thread::GetCurrentId();
+        record.level = LogLevel::Warning;
+        record.message = notice;
+        m_sink->Write(record);
+    }
+
+    if (!m_writing.records.empty() || droppedCount) {
+        m_sink->EndBatch();
+    }
+
+    m_writing.records.clear();
+    m_writing.text.clear();
+}
+
+void ThreadedLogSink::Run()
+{
+    while (!m_isStopping.load(std::memory_order_acquire)) {
+        m_signal.Acquire();
+        WritePending();
+    }
+}
@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <unordered_map>
+
+#include <Core/IO/FileWatcher.h>
+#include <Core/Debug.h>
+#include <Core/System.h>
+
+using namespace ArenaBuilder;
+
+namespace {
+
+    constexpr uint32_t WatchMask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+
+    // Same limit as MappedFileSource, which guards against symbolic link cycles.
+    constexpr int MaxDirectoryDepth = 64;
+
+    // Watches a directory tree with one inotify watch per directory. Inotify doesn't watch
+    // subdirectories on its own, so new directories are watched as they're created, and any files
+    // that were created in them before the watch was added are reported from a listing.
+    class InotifyFileWatcher final : public FileWatcher {
+    public:
+        InotifyFileWatcher() = delete;
+        InotifyFileWatcher(const InotifyFileWatcher&) = delete;
+        InotifyFileWatcher(InotifyFileWatcher&&) = delete;
+        explicit InotifyFileWatcher(OsString rootDir);
+        ~InotifyFileWatcher();
+
+        bool Initialize(Out<IoError> outError);
+
+        bool Poll(Out<std::vector<FileChange>> outChanges) override;
+
+        InotifyFileWatcher& operator=(const InotifyFileWatcher&) = delete;
+        InotifyFileWatcher& operator=(InotifyFileWatcher&&) = delete;
+
+    private:
+        // Collects the changes from one call to Poll(), keeping one change per name.
+        struct ChangeSet {
+            std::vector<FileChange>& changes;
+            std::unordered_map<std::string, size_t> indices;
+
+            void Add(std::string name, bool isRemoved);
+        };
+
+        int m_fd = -1;
+        OsString m_rootDir;
+        std::unordered_map<int, std::string> m_directories; // Watch descriptor to relative name
+
+        // Watches a directory and its subdirectories. The name is relative to the root directory,
+        // or empty for the root itself. Files that already exist are added to 'newFiles' if it
+        // isn't null.
+        bool WatchDirectory(const std::string& name, int depth, ChangeSet* newFiles, Out<IoError> outError);
+        void UnwatchDirectory(const std::string& name);
+    };
+
+    void InotifyFileWatcher::ChangeSet::Add(std::string name, bool isRemoved)
+    {
+        auto [it, isNew] = indices.emplace(name, changes.size());
+
+        if (isNew) {
+            changes.push_back({std::move(name), isRemoved});
+        } else {
+            changes[it->second].isRemoved = isRemoved;
+        }
+    }
+
+    InotifyFileWatcher::InotifyFileWatcher(OsString rootDir)
+        : m_rootDir{std::move(rootDir)}
+    {
+        if (m_rootDir.empty()) {
+            m_rootDir = ".";
+        }
+    }
+
+    InotifyFileWatcher::~InotifyFileWatcher()
+    {
+        if (m_fd >= 0) {
+            close(m_fd);
+        }
+    }
+
+    bool InotifyFileWatcher::Initialize(Out<IoError> outError)
+    {
+        m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (m_fd < 0) {
+            *outError = IoError::FromSystemError("inotify_init1", errno);
+            return false;
+        }
+
+        return WatchDirectory({}, 0, nullptr, outError);
+    }
+
+    bool InotifyFileWatcher::Poll(Out<std::vector<FileChange>> outChanges)
+    {
+        alignas(inotify_event) char buffer[16384];
+        ChangeSet changeSet{*outChanges, {}};
+        bool isComplete = true;
+
+        while (true) {
+            ssize_t readSize = read(m_fd, buffer, sizeof(buffer));
+
+            if (readSize < 0) {
+                if (errno == EINTR) {
+                    continue;
+                } else if (errno != EAGAIN) {
+                    LOG_ERROR("Can't read file change events: {}", strerror(errno));
+                    isComplete = false;
+                }
+                break;
+            } else if (readSize == 0) {
+                break;
+            }
+
+            for (ssize_t offset = 0; offset < readSize;) {
+                auto event = reinterpret_cast<const inotify_event*>(&buffer[offset]);
+                std::string name;
+
+                offset += ssize_t(sizeof(inotify_event) + event->len);
+
+                if (event->mask & IN_Q_OVERFLOW) {
+                    isComplete = false;
+                    continue;
+                }
+
+                auto it = m_directories.find(event->wd);
+                if (it == m_directories.end()) {
+                    continue;
+                } else if (event->mask & IN_IGNORED) {
+                    m_directories.erase(it);
+                    continue;
+                } else if (!event->len) {
+                    continue;
+                }
+
+                // Skip names that MappedFileSource wouldn't accept.
+                name = it->second.empty() ? std::string{event->name} : it->second + '/' + event->name;
+                if (name.find_first_of("\\:") != std::string::npos) {
+                    continue;
+                }
+
+                if (event->mask & IN_ISDIR) {
+                    if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                        int depth = int(std::count(name.begin(), name.end(), '/')) + 1;
+                        IoError error;
+
+                        if (!WatchDirectory(name, depth, &changeSet, Out{error})) {
+                            LOG_WARNING("Can't watch {}: {}", name, error);
+                            isComplete = false;
+                        }
+                    } else if (event->mask & IN_MOVED_FROM) {
+                        // The files in a directory that was moved away aren't known here, so they
+                        // can't be reported as removed.
+                        UnwatchDirectory(name);
+                        isComplete = false;
+                    }
+                } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                    changeSet.Add(std::move(name), true);
+                } else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                    changeSet.Add(std::move(name), false);
+                }
+            }
+        }
+
+        return isComplete;
+    }
+
+    bool InotifyFileWatcher::WatchDirectory(const std::string& name, int depth, ChangeSet* newFiles,
+                                            Out<IoError> outError)
+    {
+        OsString path = name.empty() ? m_rootDir : m_rootDir + '/' + name;
+        std::vector<std::string> subdirectories;
+        std::string error;
+        int wd;
+
+        if (depth > MaxDirectoryDepth) {
+            *outError = "Directories are nested too deeply";
+            return false;
+        }
+
+        // Watch before listing so that nothing created in between is missed. Files seen by both
+        // are only reported once.
+        wd = inotify_add_watch(m_fd, path.c_str(), WatchMask);
+        if (wd < 0) {
+            *outError = IoError::FromSystemError("inotify_add_watch", errno);
+            return false;
+        }
+
+        m_directories[wd] = name;
+
+        auto addChild = [&](OsStringView childName, System::FileType type) {
+            std::string fullName = name.empty() ? std::string{childName} : name + '/' + std::string{childName};
+
+            if (fullName.find_first_of("\\:") != std::string::npos) {
+                return;
+            } else if (type == System::FileType::Directory) {
+                subdirectories.push_back(std::move(fullName));
+            } else if (type == System::FileType::Regular && newFiles) {
+                newFiles->Add(std::move(fullName), false);
+            }
+        };
+
+        if (!System::ListDirectory(path.c_str(), addChild, Out{error})) {
+            *outError = IoError{"Can't list directory", std::move(error)};
+            return false;
+        }
+
+        for (const std::string& subdirectory : subdirectories) {
+            if (!WatchDirectory(subdirectory, depth + 1, newFiles, outError)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void InotifyFileWatcher::UnwatchDirectory(const std::string& name)
+    {
+        for (auto it = m_directories.begin(); it != m_directories.end();) {
+            const std::string& watchedName = it->second;
+
+            if (watchedName.compare(0, name.size(), name) == 0
+                && (watchedName.size() == name.size() || watchedName[name.size()] == '/'))
+            {
+                inotify_rm_watch(m_fd, it->first);
+                it = m_directories.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+} // namespace
+
+std::unique_ptr<FileWatcher> Internal::CreateInotifyFileWatcher(OsString rootDir, Out<IoError> outError)
+{
+    auto watcher = std::make_unique<InotifyFileWatcher>(std::move(rootDir));
+
+    if (!watcher->Initialize(outError)) {
+        return nullptr;
+    }
+
+    return watcher;
+}
@@ -0,0 +1,416 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <Core/IO/Async.h>
+#include <Core/IO/MappedFile.h>
+#include <Core/Debug.h>
+
+using namespace std::literals::string_literals;
+using namespace ArenaBuilder;
+
+namespace {
+
+    constexpr unsigned QueueDepth = 256;
+
+    // The kernel limits a single read to just under 2 GiB.
+    constexpr size_t MaxReadSize = size_t(1) << 30;
+
+    // There's no liburing dependency, so the raw system calls are used instead.
+    int IoUringSetup(unsigned entries, io_uring_params* params)
+    {
+        return int(syscall(__NR_io_uring_setup, entries, params));
+    }
+
+    int IoUringEnter(int ringFd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+    {
+        return int(syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, nullptr, 0));
+    }
+
+    int IoUringRegister(int ringFd, unsigned opcode, void* arg, unsigned argCount)
+    {
+        return int(syscall(__NR_io_uring_register, ringFd, opcode, arg, argCount));
+    }
+
+    // Reads whole loose files with io_uring. Files are opened synchronously, since that is cheap
+    // compared to reading them, and their contents are read into heap buffers. This class is not
+    // thread-safe; all calls must come from the same thread.
+    class UringFileSource final : public AsyncDataSource {
+    public:
+        UringFileSource() = delete;
+        UringFileSource(const UringFileSource&) = delete;
+        UringFileSource(UringFileSource&&) = delete;
+        explicit UringFileSource(OsString rootDir);
+        ~UringFileSource();
+
+        bool Initialize(Out<IoError> outError);
+
+        void SubmitReads(std::vector<AsyncReadRequest> requests) override;
+        size_t PollCompletions() override;
+        void WaitForAll() override;
+        size_t GetPendingCount() const override { return m_pendingCount; }
+
+        UringFileSource& operator=(const UringFileSource&) = delete;
+        UringFileSource& operator=(UringFileSource&&) = delete;
+
+    private:
+        struct Read {
+            AsyncReadCallback callback;
+            AsyncReadResult result;
+            int fd = -1;
+            std::shared_ptr<uint8_t[]> buffer;
+            size_t size = 0;
+            size_t offset = 0;
+
+            ~Read()
+            {
+                if (fd >= 0) {
+                    close(fd);
+                }
+            }
+        };
+
+        MappedFileSource m_files; // Only used to resolve paths
+        int m_ringFd = -1;
+        void* m_sqRing = nullptr;
+        size_t m_sqRingSize = 0;
+        void* m_cqRing = nullptr;
+        size_t m_cqRingSize = 0;
+        io_uring_sqe* m_sqes = nullptr;
+        size_t m_sqesSize = 0;
+
+        // Pointers into the shared rings. Heads and tails written by the other side are accessed
+        // atomically.
+        unsigned* m_sqHead = nullptr;
+        unsigned* m_sqTail = nullptr;
+        unsigned m_sqMask = 0;
+        unsigned m_sqEntries = 0;
+        unsigned* m_sqArray = nullptr;
+        unsigned* m_cqHead = nullptr;
+        unsigned* m_cqTail = nullptr;
+        unsigned m_cqMask = 0;
+        unsigned m_cqEntries = 0;
+        io_uring_cqe* m_cqes = nullptr;
+
+        std::deque<std::unique_ptr<Read>> m_waiting; // Ready to be queued when there is space
+        std::vector<std::unique_ptr<Read>> m_completed; // Waiting for callbacks
+        unsigned m_unsubmittedCount = 0; // Queued but not yet consumed by the kernel
+        unsigned m_inFlightCount = 0; // Queued but not yet completed
+        size_t m_pendingCount = 0;
+
+        bool QueueRead(Read& read);
+        void FlushSubmissions();
+        void ReapCompletions();
+        void Complete(std::unique_ptr<Read> read);
+    };
+
+    UringFileSource::UringFileSource(OsString rootDir)
+        : m_files{std::move(rootDir)}
+    {
+    }
+
+    UringFileSource::~UringFileSource()
+    {
+        // Buffers must outlive any reads the kernel is still performing.
+        while (m_inFlightCount && m_ringFd >= 0) {
+            if (IoUringEnter(m_ringFd, m_unsubmittedCount, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+                LOG_ERROR("io_uring_enter: {}", strerror(errno));
+                break;
+            }
+            m_unsubmittedCount = 0;
+            ReapCompletions();
+        }
+
+        if (m_sqes) {
+            munmap(m_sqes, m_sqesSize);
+        }
+        if (m_cqRing && m_cqRing != m_sqRing) {
+            munmap(m_cqRing, m_cqRingSize);
+        }
+        if (m_sqRing) {
+            munmap(m_sqRing, m_sqRingSize);
+        }
+        if (m_ringFd >= 0) {
+            close(m_ringFd);
+        }
+    }
+
+    bool UringFileSource::Initialize(Out<IoError> outError)
+    {
+        io_uring_params params{};
+        uint8_t probeBuffer[sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op)] = {};
+        auto probe = reinterpret_cast<io_uring_probe*>(probeBuffer);
+        uint8_t* sqRing;
+        uint8_t* cqRing;
+
+        m_ringFd = IoUringSetup(QueueDepth, &params);
+        if (m_ringFd < 0) {
+            *outError = IoError::FromSystemError("io_uring_setup", errno);
+            return false;
+        }
+
+        // IORING_OP_READ needs Linux 5.6. Older kernels don't support probing either.
+        if (IoUringRegister(m_ringFd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+            *outError = IoError::FromSystemError("io_uring_register", errno);
+            return false;
+        } else if (probe->ops_len <= IORING_OP_READ || !(probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED)) {
+            *outError = "IORING_OP_READ is not supported";
+            return false;
+        }
+
+        m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+        }
+
+        m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        m_ringFd, IORING_OFF_SQ_RING);
+        if (m_sqRing == MAP_FAILED) {
+            m_sqRing = nullptr;
+            *outError = IoError::FromSystemError("mmap", errno);
+            return false;
+        }
+
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            m_cqRing = m_sqRing;
+        } else {
+            m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            m_ringFd, IORING_OFF_CQ_RING);
+            if (m_cqRing == MAP_FAILED) {
+                m_cqRing = nullptr;
+                *outError = IoError::FromSystemError("mmap", errno);
+                return false;
+            }
+        }
+
+        m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        m_sqes = static_cast<io_uring_sqe*>(mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE,
+                                                 MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQES));
+        if (m_sqes == MAP_FAILED) {
+            m_sqes = nullptr;
+            *outError = IoError::FromSystemError("mmap", errno);
+            return false;
+        }
+
+        sqRing = static_cast<uint8_t*>(m_sqRing);
+        cqRing = static_cast<uint8_t*>(m_cqRing);
+        m_sqHead = reinterpret_cast<unsigned*>(sqRing + params.sq_off.head);
+        m_sqTail = reinterpret_cast<unsigned*>(sqRing + params.sq_off.tail);
+        m_sqMask = *reinterpret_cast<unsigned*>(sqRing + params.sq_off.ring_mask);
+        m_sqEntries = params.sq_entries;
+        m_sqArray = reinterpret_cast<unsigned*>(sqRing + params.sq_off.array);
+        m_cqHead = reinterpret_cast<unsigned*>(cqRing + params.cq_off.head);
+        m_cqTail = reinterpret_cast<unsigned*>(cqRing + params.cq_off.tail);
+        m_cqMask = *reinterpret_cast<unsigned*>(cqRing + params.cq_off.ring_mask);
+        m_cqEntries = params.cq_entries;
+        m_cqes = reinterpret_cast<io_uring_cqe*>(cqRing + params.cq_off.cqes);
+        return true;
+    }
+
+    void UringFileSource::SubmitReads(std::vector<AsyncReadRequest> requests)
+    {
+        for (AsyncReadRequest& request : requests) {
+            auto read = std::make_unique<Read>();
+            OsString path;
+            struct stat fileStat;
+
+            read->callback = std::move(request.callback);
+            read->result.name = std::move(request.name);
+            ++m_pendingCount;
+
+            if (!m_files.ResolvePath(read->result.name, Out{path}, Out{read->result.error})) {
+                Complete(std::move(read));
+                continue;
+            }
+
+            read->fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (read->fd < 0) {
+                read->result.error = IoError::FromSystemError("open", errno);
+                Complete(std::move(read));
+                continue;
+            } else if (fstat(read->fd, &fileStat)) {
+                read->result.error = IoError::FromSystemError("fstat", errno);
+                Complete(std::move(read));
+                continue;
+            } else if (!S_ISREG(fileStat.st_mode)) {
+                read->result.error = "Not a regular file";
+                Complete(std::move(read));
+                continue;
+            }
+
+            read->size = size_t(fileStat.st_size);
+            read->buffer.reset(new uint8_t[std::max<size_t>(read->size, 1)]);
+
+            if (!read->size) {
+                Complete(std::move(read));
+            } else {
+                m_waiting.push_back(std::move(read));
+            }
+        }
+
+        FlushSubmissions();
+    }
+
+    size_t UringFileSource::PollCompletions()
+    {
+        std::vector<std::unique_ptr<Read>> completed;
+
+        ReapCompletions();
+        FlushSubmissions();
+
+        // Callbacks may submit more reads, which may complete immediately and modify m_completed.
+        completed.swap(m_completed);
+
+        for (auto& read : completed) {
+            if (read->callback) {
+                read->callback(read->result);
+            }
+            --m_pendingCount;
+        }
+
+        return completed.size();
+    }
+
+    void UringFileSource::WaitForAll()
+    {
+        while (m_pendingCount) {
+            if (PollCompletions() || !m_inFlightCount) {
+                continue;
+            }
+
+            if (IoUringEnter(m_ringFd, m_unsubmittedCount, 1, IORING_ENTER_GETEVENTS) < 0) {
+                if (errno != EINTR) {
+                    FATAL("io_uring_enter: {}", strerror(errno));
+                }
+            } else {
+                m_unsubmittedCount = 0;
+            }
+        }
+    }
+
+    bool UringFileSource::QueueRead(Read& read)
+    {
+        unsigned tail = *m_sqTail;
+        unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+        unsigned index;
+
+        // Never queue more reads than the completion queue can hold.
+        if (tail - head >= m_sqEntries || m_inFlightCount >= m_cqEntries) {
+            return false;
+        }
+
+        index = tail & m_sqMask;
+        io_uring_sqe& sqe = m_sqes[index];
+        sqe = {};
+        sqe.opcode = IORING_OP_READ;
+        sqe.fd = read.fd;
+        sqe.addr = uint64_t(uintptr_t(read.buffer.get() + read.offset));
+        sqe.len = uint32_t(std::min(read.size - read.offset, MaxReadSize));
+        sqe.off = read.offset;
+        sqe.user_data = uint64_t(uintptr_t(&read));
+        m_sqArray[index] = index;
+
+        __atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+        ++m_unsubmittedCount;
+        ++m_inFlightCount;
+        return true;
+    }
+
+    void UringFileSource::FlushSubmissions()
+    {
+        int result;
+
+        // Ownership of queued reads passes to the kernel until their completions are reaped.
+        while (!m_waiting.empty() && QueueRead(*m_waiting.front())) {
+            m_waiting.front().release();
+            m_waiting.pop_front();
+        }
+
+        if (!m_unsubmittedCount) {
+            return;
+        }
+
+        result = IoUringEnter(m_ringFd, m_unsubmittedCount, 0, 0);
+        if (result >= 0) {
+            m_unsubmittedCount -= std::min(m_unsubmittedCount, unsigned(result));
+        } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            FATAL("io_uring_enter: {}", strerror(errno));
+        }
+    }
+
+    void UringFileSource::ReapCompletions()
+    {
+        unsigned head = *m_cqHead;
+        unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+
+        for (; head != tail; ++head) {
+            const io_uring_cqe& cqe = m_cqes[head & m_cqMask];
+            std::unique_ptr<Read> read{reinterpret_cast<Read*>(uintptr_t(cqe.user_data))};
+
+            --m_inFlightCount;
+
+            if (cqe.res < 0) {
+                read->result.error = IoError::FromSystemError("read", -cqe.res);
+            } else if (cqe.res == 0) {
+                read->result.error = IoError{IoErrorCode::EndOfStream, "Unexpected end of file"};
+            } else if ((read->offset += size_t(cqe.res)) < read->size) {
+                // Short read. Queue the rest ahead of new reads.
+                m_waiting.push_front(std::move(read));
+                continue;
+            }
+
+            Complete(std::move(read));
+        }
+
+        __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+    }
+
+    void UringFileSource::Complete(std::unique_ptr<Read> read)
+    {
+        if (read->fd >= 0) {
+            close(read->fd);
+            read->fd = -1;
+        }
+
+        if (!read->result.error.HasError()) {
+            read->result.data = {read->buffer.get(), read->size};
+            read->result.owner = std::move(read->buffer);
+        }
+
+        m_completed.push_back(std::move(read));
+    }
+
+} // namespace
+
+std::unique_ptr<AsyncDataSource> Internal::CreateUringFileSource(OsString rootDir, Out<IoError> outError)
+{
+    auto source = std::make_unique<UringFileSource>(std::move(rootDir));
+
+    if (!source->Initialize(outError)) {
+        return nullptr;
+    }
+
+    return source;
+}
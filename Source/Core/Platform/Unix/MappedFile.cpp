@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <Core/IO/MappedFile.h>
+
+using namespace std::literals::string_literals;
+using namespace ArenaBuilder;
+
+bool MappedFile::Open(const oschar_t* path, Out<IoError> outError)
+{
+    int fd;
+    struct stat fileStat;
+
+    Close();
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        *outError = IoError::FromSystemError("open", errno);
+        return false;
+    }
+
+    // The mapping stays valid after the descriptor is closed.
+    Finally _closeFd{[fd]() { close(fd); }};
+
+    if (fstat(fd, &fileStat)) {
+        *outError = IoError::FromSystemError("fstat", errno);
+        return false;
+    } else if (!S_ISREG(fileStat.st_mode)) {
+        *outError = "Not a regular file";
+        return false;
+    }
+
+    // mmap() rejects zero-length mappings, so empty files get an empty view instead.
+    if (fileStat.st_size > 0) {
+        m_address = mmap(nullptr, size_t(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m_address == MAP_FAILED) {
+            m_address = nullptr;
+            *outError = IoError::FromSystemError("mmap", errno);
+            return false;
+        }
+        m_size = size_t(fileStat.st_size);
+    }
+
+    m_modificationTime = uint64_t(fileStat.st_mtime);
+    m_isOpen = true;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (m_address) {
+        munmap(m_address, m_size);
+    }
+
+    m_address = nullptr;
+    m_size = 0;
+    m_modificationTime = 0;
+    m_isOpen = false;
+}
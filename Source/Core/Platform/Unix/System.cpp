@@ -12,13 +12,48 @@
  * under the License.
  */
 
+#include <dirent.h>
 #include <err.h>
+#include <errno.h>
+#include <signal.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 
 #include <Core/System.h>
 
+using namespace std::literals::string_literals;
 using namespace ArenaBuilder;
 
+namespace {
+
+    constexpr int CrashSignals[] = {SIGABRT, SIGBUS, SIGFPE, SIGILL, SIGSEGV};
+
+    void (*s_crashHandler)(const char*) = nullptr;
+
+    void HandleCrashSignal(int signalNumber)
+    {
+        const char* description;
+
+        switch (signalNumber) {
+        case SIGABRT: description = "SIGABRT"; break;
+        case SIGBUS: description = "SIGBUS"; break;
+        case SIGFPE: description = "SIGFPE"; break;
+        case SIGILL: description = "SIGILL"; break;
+        case SIGSEGV: description = "SIGSEGV"; break;
+        default: description = "Signal"; break;
+        }
+
+        if (s_crashHandler) {
+            s_crashHandler(description);
+        }
+
+        // SA_RESETHAND restored the default action, so this terminates as if we weren't here.
+        raise(signalNumber);
+    }
+
+} // namespace
+
 void System::ExitWithErrorMessage(const oschar_t* message)
 {
     errx(EXIT_FAILURE, "%s", message);
@@ -32,3 +67,100 @@ void System::ExitWithErrorDialog(const oschar_t*)
 void System::InitErrorDialogHandler()
 {
 }
+
+void System::SetCrashHandler(void (*handler)(const char* description))
+{
+    // Run on an alternate stack so that a stack overflow can still be handled. This only covers
+    // the calling thread, which is normally the main thread.
+    static char alternateStack[65536];
+    stack_t stack{};
+    struct sigaction action{};
+
+    s_crashHandler = handler;
+
+    stack.ss_sp = alternateStack;
+    stack.ss_size = sizeof(alternateStack);
+    sigaltstack(&stack, nullptr);
+
+    action.sa_handler = &HandleCrashSignal;
+    action.sa_flags = SA_ONSTACK | SA_RESETHAND;
+    sigemptyset(&action.sa_mask);
+
+    for (int signalNumber : CrashSignals) {
+        sigaction(signalNumber, &action, nullptr);
+    }
+}
+
+bool System::ListDirectory(const oschar_t* path, const std::function<void(OsStringView name, FileType type)>& callback,
+                           Out<std::string> outError)
+{
+    DIR* dir = opendir(path);
+    struct dirent* entry;
+    struct stat entryStat;
+    FileType type;
+
+    if (!dir) {
+        *outError = strerror(errno);
+        return false;
+    }
+
+    Finally _closeDir{[dir]() { closedir(dir); }};
+
+    while (true) {
+        errno = 0;
+        entry = readdir(dir);
+        if (!entry) {
+            if (errno) {
+                *outError = "readdir: "s + strerror(errno);
+                return false;
+            }
+            return true;
+        } else if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) {
+            continue;
+        }
+
+        switch (entry->d_type) {
+        case DT_REG:
+            type = FileType::Regular;
+            break;
+        case DT_DIR:
+            type = FileType::Directory;
+            break;
+        case DT_LNK:
+        case DT_UNKNOWN:
+            // Links and file systems that don't report types need a stat() call.
+            if (fstatat(dirfd(dir), entry->d_name, &entryStat, 0)) {
+                type = FileType::Other;
+            } else if (S_ISREG(entryStat.st_mode)) {
+                type = FileType::Regular;
+            } else if (S_ISDIR(entryStat.st_mode)) {
+                type = FileType::Directory;
+            } else {
+                type = FileType::Other;
+            }
+            break;
+        default:
+            type = FileType::Other;
+            break;
+        }
+
+        callback(entry->d_name, type);
+    }
+}
+
+bool System::GetCacheDirectory(Out<OsString> outPath)
+{
+    const char* cacheHome = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+
+    if (cacheHome && *cacheHome) {
+        *outPath = cacheHome;
+    } else if (home && *home) {
+        *outPath = std::string{home} + "/.cache";
+    } else {
+        return false;
+    }
+
+    *outPath += "/ArenaBuilder";
+    return true;
+}
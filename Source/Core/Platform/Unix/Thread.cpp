@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+# include <sys/syscall.h>
+#endif
+
+#include <memory>
+
+#include <Core/System.h>
+#include <Core/Thread.h>
+
+using namespace std::literals::string_literals;
+using namespace ArenaBuilder;
+
+namespace {
+
+    void* ThreadEntry(void* param)
+    {
+        std::unique_ptr<std::function<void()>> entry{static_cast<std::function<void()>*>(param)};
+
+        (*entry)();
+        return nullptr;
+    }
+
+} // namespace
+
+Thread::~Thread()
+{
+    Join();
+}
+
+bool Thread::Start(std::function<void()> entry, Out<std::string> outError)
+{
+    auto param = std::make_unique<std::function<void()>>(std::move(entry));
+
+    if (m_isStarted) {
+        *outError = "Thread is already running";
+        return false;
+    }
+
+    if (auto errorCode = pthread_create(&m_thread, nullptr, &ThreadEntry, param.get())) {
+        *outError = "pthread_create: "s + strerror(errorCode);
+        return false;
+    }
+
+    // The thread owns the entry function now.
+    param.release();
+    m_isStarted = true;
+    return true;
+}
+
+void Thread::Join()
+{
+    if (m_isStarted) {
+        pthread_join(m_thread, nullptr);
+        m_isStarted = false;
+    }
+}
+
+size_t Thread::GetHardwareConcurrency()
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? size_t(count) : 1;
+}
+
+uint64_t Thread::GetCurrentId()
+{
+#ifdef __linux__
+    return uint64_t(syscall(SYS_gettid));
+#else
+    return uint64_t(pthread_self());
+#endif
+}
+
+//--------------------------------------------------------------------------------------------------
+
+Semaphore::Semaphore()
+{
+    if (sem_init(&m_semaphore, 0, 0)) {
+        System::ExitWithErrorMessage(("sem_init: "s + strerror(errno)).c_str());
+    }
+}
+
+Semaphore::~Semaphore()
+{
+    sem_destroy(&m_semaphore);
+}
+
+void Semaphore::Acquire()
+{
+    while (sem_wait(&m_semaphore)) {
+        if (errno != EINTR) {
+            System::ExitWithErrorMessage(("sem_wait: "s + strerror(errno)).c_str());
+        }
+    }
+}
+
+bool Semaphore::TryAcquire(uint32_t timeoutMilliseconds)
+{
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += time_t(timeoutMilliseconds / 1000);
+    deadline.tv_nsec += long(timeoutMilliseconds % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    while (sem_timedwait(&m_semaphore, &deadline)) {
+        if (errno == ETIMEDOUT) {
+            return false;
+        } else if (errno != EINTR) {
+            System::ExitWithErrorMessage(("sem_timedwait: "s + strerror(errno)).c_str());
+        }
+    }
+
+    return true;
+}
+
+void Semaphore::Release(uint32_t count)
+{
+    for (uint32_t i = 0; i < count; ++i) {
+        sem_post(&m_semaphore);
+    }
+}
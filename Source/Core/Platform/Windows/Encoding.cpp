@@ -54,3 +54,39 @@ std::wstring Encoding::SystemToWide(std::string_view inStr)
     outStr.resize(size_t(result));
     return outStr;
 }
+
+std::string Encoding::WideToSystem(std::wstring_view inStr)
+{
+    std::string outStr;
+    int result;
+
+    if (inStr.empty()) {
+        return outStr;
+    }
+
+    // Pass 1: Determine the length of the converted string so we can allocate a buffer.
+    result = WideCharToMultiByte(CP_ACP, 0, inStr.data(), int(inStr.length()), nullptr, 0, nullptr, nullptr);
+
+    if (result <= 0) {
+        if (uint32_t errorCode = GetLastError()) {
+            System::ExitWithErrorMessage((L"WideCharToMultiByte: "s + Win32::GetErrorStringW(errorCode)).c_str());
+        }
+        return outStr;
+    }
+
+    outStr.resize(size_t(result));
+
+    // Pass 2: Convert the string into the allocated buffer.
+    result = WideCharToMultiByte(CP_ACP, 0, inStr.data(), int(inStr.length()), outStr.data(), int(outStr.length()),
+                                 nullptr, nullptr);
+
+    if (result <= 0) {
+        if (uint32_t errorCode = GetLastError()) {
+            System::ExitWithErrorMessage((L"WideCharToMultiByte: "s + Win32::GetErrorStringW(errorCode)).c_str());
+        }
+        result = 0;
+    }
+
+    outStr.resize(size_t(result));
+    return outStr;
+}
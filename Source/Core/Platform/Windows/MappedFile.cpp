@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <windows.h>
+
+#include <Core/IO/MappedFile.h>
+#include <Core/System.h>
+
+using namespace std::literals::string_literals;
+using namespace ArenaBuilder;
+
+bool MappedFile::Open(const oschar_t* path, Out<IoError> outError)
+{
+    HANDLE file;
+    HANDLE mapping;
+    LARGE_INTEGER fileSize;
+    FILETIME lastWriteTime;
+
+    Close();
+
+    file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                       FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        *outError = IoError::FromSystemError("CreateFileW", int(GetLastError()));
+        return false;
+    }
+
+    // The view stays valid after the file and mapping handles are closed.
+    Finally _closeFile{[file]() { CloseHandle(file); }};
+
+    if (!GetFileSizeEx(file, &fileSize)) {
+        *outError = IoError::FromSystemError("GetFileSizeEx", int(GetLastError()));
+        return false;
+    } else if (!GetFileTime(file, nullptr, nullptr, &lastWriteTime)) {
+        *outError = IoError::FromSystemError("GetFileTime", int(GetLastError()));
+        return false;
+    } else if (uint64_t(fileSize.QuadPart) > SIZE_MAX) {
+        *outError = "File is too large to map";
+        return false;
+    }
+
+    // CreateFileMappingW rejects empty files, so they get an empty view instead.
+    if (fileSize.QuadPart > 0) {
+        mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping) {
+            *outError = IoError::FromSystemError("CreateFileMappingW", int(GetLastError()));
+            return false;
+        }
+        Finally _closeMapping{[mapping]() { CloseHandle(mapping); }};
+
+        m_address = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!m_address) {
+            *outError = IoError::FromSystemError("MapViewOfFile", int(GetLastError()));
+            return false;
+        }
+        m_size = size_t(fileSize.QuadPart);
+    }
+
+    m_modificationTime = (uint64_t(lastWriteTime.dwHighDateTime) << 32) | lastWriteTime.dwLowDateTime;
+    m_isOpen = true;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (m_address) {
+        UnmapViewOfFile(m_address);
+    }
+
+    m_address = nullptr;
+    m_size = 0;
+    m_modificationTime = 0;
+    m_isOpen = false;
+}
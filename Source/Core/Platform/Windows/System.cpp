@@ -14,6 +14,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <wchar.h>
 #include <windows.h>
 
 #include <Core/System.h>
@@ -24,6 +25,26 @@ using namespace ArenaBuilder;
 namespace {
 
     void (*s_errorDialogHandler)(const oschar_t*) = nullptr;
+    void (*s_crashHandler)(const char*) = nullptr;
+
+    LONG WINAPI HandleUnhandledException(EXCEPTION_POINTERS* exception)
+    {
+        const char* description;
+
+        switch (exception->ExceptionRecord->ExceptionCode) {
+        case EXCEPTION_ACCESS_VIOLATION: description = "Access violation"; break;
+        case EXCEPTION_ILLEGAL_INSTRUCTION: description = "Illegal instruction"; break;
+        case EXCEPTION_INT_DIVIDE_BY_ZERO: description = "Integer division by zero"; break;
+        case EXCEPTION_STACK_OVERFLOW: description = "Stack overflow"; break;
+        default: description = "Unhandled exception"; break;
+        }
+
+        if (s_crashHandler) {
+            s_crashHandler(description);
+        }
+
+        return EXCEPTION_CONTINUE_SEARCH;
+    }
 
 } // namespace
 
@@ -51,6 +72,69 @@ void System::SetErrorDialogHandler(void (*handler)(const oschar_t*))
     s_errorDialogHandler = handler;
 }
 
+void System::SetCrashHandler(void (*handler)(const char* description))
+{
+    s_crashHandler = handler;
+    SetUnhandledExceptionFilter(&HandleUnhandledException);
+}
+
+bool System::ListDirectory(const oschar_t* path, const std::function<void(OsStringView name, FileType type)>& callback,
+                           Out<std::string> outError)
+{
+    std::wstring pattern = path;
+    WIN32_FIND_DATAW data;
+    HANDLE find;
+    FileType type;
+
+    if (!pattern.empty() && pattern.back() != L'/' && pattern.back() != L'\\') {
+        pattern.push_back(L'\\');
+    }
+    pattern.push_back(L'*');
+
+    find = FindFirstFileExW(pattern.c_str(), FindExInfoBasic, &data, FindExSearchNameMatch, nullptr,
+                            FIND_FIRST_EX_LARGE_FETCH);
+    if (find == INVALID_HANDLE_VALUE) {
+        *outError = Win32::GetErrorStringA(GetLastError());
+        return false;
+    }
+
+    Finally _closeFind{[find]() { FindClose(find); }};
+
+    do {
+        if (!wcscmp(data.cFileName, L".") || !wcscmp(data.cFileName, L"..")) {
+            continue;
+        } else if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            type = FileType::Directory;
+        } else if (data.dwFileAttributes & FILE_ATTRIBUTE_DEVICE) {
+            type = FileType::Other;
+        } else {
+            type = FileType::Regular;
+        }
+
+        callback(data.cFileName, type);
+    } while (FindNextFileW(find, &data));
+
+    if (GetLastError() != ERROR_NO_MORE_FILES) {
+        *outError = "FindNextFileW: "s + Win32::GetErrorStringA(GetLastError());
+        return false;
+    }
+
+    return true;
+}
+
+bool System::GetCacheDirectory(Out<OsString> outPath)
+{
+    const wchar_t* localAppData = _wgetenv(L"LOCALAPPDATA");
+
+    if (!localAppData || !*localAppData) {
+        return false;
+    }
+
+    *outPath = localAppData;
+    *outPath += L"\\ArenaBuilder\\Cache";
+    return true;
+}
+
 //--------------------------------------------------------------------------------------------------
 
 std::string Win32::GetErrorStringA(uint32_t errorCode)
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <errno.h>
+#include <process.h>
+#include <string.h>
+#include <windows.h>
+
+#include <memory>
+
+#include <Core/System.h>
+#include <Core/Thread.h>
+
+using namespace std::literals::string_literals;
+using namespace ArenaBuilder;
+
+namespace {
+
+    unsigned __stdcall ThreadEntry(void* param)
+    {
+        std::unique_ptr<std::function<void()>> entry{static_cast<std::function<void()>*>(param)};
+
+        (*entry)();
+        return 0;
+    }
+
+} // namespace
+
+Thread::~Thread()
+{
+    Join();
+}
+
+bool Thread::Start(std::function<void()> entry, Out<std::string> outError)
+{
+    auto param = std::make_unique<std::function<void()>>(std::move(entry));
+
+    if (m_isStarted) {
+        *outError = "Thread is already running";
+        return false;
+    }
+
+    // _beginthreadex is used instead of CreateThread so that the CRT is initialized for the thread.
+    m_handle = reinterpret_cast<void*>(_beginthreadex(nullptr, 0, &ThreadEntry, param.get(), 0, nullptr));
+    if (!m_handle) {
+        *outError = "_beginthreadex: "s + strerror(errno);
+        return false;
+    }
+
+    // The thread owns the entry function now.
+    param.release();
+    m_isStarted = true;
+    return true;
+}
+
+void Thread::Join()
+{
+    if (m_isStarted) {
+        WaitForSingleObject(m_handle, INFINITE);
+        CloseHandle(m_handle);
+        m_handle = nullptr;
+        m_isStarted = false;
+    }
+}
+
+size_t Thread::GetHardwareConcurrency()
+{
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? size_t(info.dwNumberOfProcessors) : 1;
+}
+
+uint64_t Thread::GetCurrentId()
+{
+    return GetCurrentThreadId();
+}
+
+//--------------------------------------------------------------------------------------------------
+
+Semaphore::Semaphore()
+{
+    m_handle = CreateSemaphoreW(nullptr, 0, LONG_MAX, nullptr);
+
+    if (!m_handle) {
+        System::ExitWithErrorMessage((L"CreateSemaphoreW: "s + Win32::GetErrorStringW(GetLastError())).c_str());
+    }
+}
+
+Semaphore::~Semaphore()
+{
+    CloseHandle(m_handle);
+}
+
+void Semaphore::Acquire()
+{
+    if (WaitForSingleObject(m_handle, INFINITE) != WAIT_OBJECT_0) {
+        System::ExitWithErrorMessage((L"WaitForSingleObject: "s + Win32::GetErrorStringW(GetLastError())).c_str());
+    }
+}
+
+bool Semaphore::TryAcquire(uint32_t timeoutMilliseconds)
+{
+    switch (WaitForSingleObject(m_handle, timeoutMilliseconds)) {
+    case WAIT_OBJECT_0:
+        return true;
+    case WAIT_TIMEOUT:
+        return false;
+    default:
+        System::ExitWithErrorMessage((L"WaitForSingleObject: "s + Win32::GetErrorStringW(GetLastError())).c_str());
+    }
+}
+
+void Semaphore::Release(uint32_t count)
+{
+    ReleaseSemaphore(m_handle, LONG(count), nullptr);
+}
@@ -0,0 +1,404 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <Core/ByteOrder.h>
+#include <Core/Debug.h>
+#include <Core/Mutex.h>
+#include <Core/Profiler.h>
+#include <Core/Thread.h>
+
+using namespace ArenaBuilder;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+    struct ProfileZone {
+        const char* name;
+        uint64_t startTime;
+        uint64_t endTime;
+    };
+
+    // One thread's recorded zones, in a linked list of fixed-size chunks so that recording never
+    // copies. Only the owning thread appends. Each chunk's count is published with release
+    // semantics, so the zones can be read while the thread is still recording.
+    class ProfileBuffer {
+    public:
+        static constexpr size_t ChunkCapacity = 4096;
+        static constexpr size_t MaxChunkCount = 256; // About 24 MiB per thread
+
+        struct Chunk {
+            ProfileZone zones[ChunkCapacity];
+            std::atomic<size_t> count{0};
+            std::atomic<Chunk*> next{nullptr};
+        };
+
+        ProfileBuffer() = delete;
+        ProfileBuffer(const ProfileBuffer&) = delete;
+        ProfileBuffer(ProfileBuffer&&) = delete;
+
+        explicit ProfileBuffer(uint64_t threadId)
+            : m_threadId{threadId}
+            , m_first{new Chunk}
+            , m_last{m_first}
+        {
+        }
+
+        ~ProfileBuffer()
+        {
+            for (Chunk* chunk = m_first; chunk;) {
+                Chunk* next = chunk->next.load(std::memory_order_relaxed);
+                delete chunk;
+                chunk = next;
+            }
+        }
+
+        uint64_t GetThreadId() const { return m_threadId; }
+        size_t GetDroppedCount() const { return m_droppedCount.load(std::memory_order_relaxed); }
+
+        void Append(const ProfileZone& zone)
+        {
+            size_t count = m_last->count.load(std::memory_order_relaxed);
+
+            if (count == ChunkCapacity) {
+                if (m_chunkCount == MaxChunkCount) {
+                    m_droppedCount.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+
+                Chunk* chunk = new Chunk;
+                m_last->next.store(chunk, std::memory_order_release);
+                m_last = chunk;
+                ++m_chunkCount;
+                count = 0;
+            }
+
+            m_last->zones[count] = zone;
+            m_last->count.store(count + 1, std::memory_order_release);
+        }
+
+        template<typename F>
+        void ForEachZone(F callback) const
+        {
+            for (const Chunk* chunk = m_first; chunk; chunk = chunk->next.load(std::memory_order_acquire)) {
+                size_t count = chunk->count.load(std::memory_order_acquire);
+
+                for (size_t i = 0; i < count; ++i) {
+                    callback(chunk->zones[i]);
+                }
+            }
+        }
+
+        size_t GetZoneCount() const
+        {
+            size_t count = 0;
+
+            for (const Chunk* chunk = m_first; chunk; chunk = chunk->next.load(std::memory_order_acquire)) {
+                count += chunk->count.load(std::memory_order_acquire);
+            }
+
+            return count;
+        }
+
+        ProfileBuffer& operator=(const ProfileBuffer&) = delete;
+        ProfileBuffer& operator=(ProfileBuffer&&) = delete;
+
+    private:
+        uint64_t m_threadId;
+        Chunk* m_first;
+        Chunk* m_last; // Owner only
+        size_t m_chunkCount = 1; // Owner only
+        std::atomic<size_t> m_droppedCount{0};
+    };
+
+    struct ProfilerState {
+        RecursiveMutex mutex; // Guards the members below
+        std::vector<std::unique_ptr<ProfileBuffer>> buffers; // Including those of exited threads
+
+        // Clock readings from when the profiler was first started, for calibrating clock ticks.
+        bool wasStarted = false;
+        uint64_t startTime = 0;
+        std::chrono::steady_clock::time_point startSteadyTime;
+    };
+
+    // Never destroyed, since other threads may still be recording zones while the process exits.
+    ProfilerState& GetProfilerState()
+    {
+        static ProfilerState* state = new ProfilerState;
+        return *state;
+    }
+
+    thread_local ProfileBuffer* t_profileBuffer = nullptr;
+
+    // Converts clock ticks to nanoseconds since the profiler was started.
+    class ClockConverter {
+    public:
+        explicit ClockConverter(const ProfilerState& state)
+            : m_startTime{state.startTime}
+        {
+            uint64_t ticks = Profiler::Internal::ReadClock() - state.startTime;
+            auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - state.startSteadyTime).count();
+
+            m_nanosecondsPerTick = ticks && nanoseconds > 0 ? double(nanoseconds) / double(ticks) : 1.0;
+        }
+
+        uint64_t ToNanoseconds(uint64_t time) const
+        {
+            return time > m_startTime ? uint64_t(double(time - m_startTime) * m_nanosecondsPerTick) : 0;
+        }
+
+    private:
+        uint64_t m_startTime;
+        double m_nanosecondsPerTick;
+    };
+
+    template<typename T>
+    void AppendLittleEndian(std::string& buffer, T value)
+    {
+        char bytes[sizeof(T)];
+
+        StoreLittleEndian(bytes, value);
+        buffer.append(bytes, sizeof(T));
+    }
+
+    // Names come from string literals in our own code, so only quotes and backslashes need care.
+    void AppendJsonString(std::string& out, std::string_view text)
+    {
+        out.push_back('"');
+
+        for (char ch : text) {
+            if (ch == '"' || ch == '\\') {
+                out.push_back('\\');
+            }
+            out.push_back(ch);
+        }
+
+        out.push_back('"');
+    }
+
+    // Writes the output in pieces, since a long profile can be hundreds of megabytes.
+    class TraceWriter {
+    public:
+        static constexpr size_t FlushThreshold = 1 << 20;
+
+        TraceWriter() = delete;
+        TraceWriter(const TraceWriter&) = delete;
+        TraceWriter(TraceWriter&&) = delete;
+
+        explicit TraceWriter(const oschar_t* path)
+            : m_output{fs::path{path}, std::ios::binary | std::ios::trunc}
+        {
+        }
+
+        std::string& GetBuffer() { return m_buffer; }
+
+        void FlushIfFull()
+        {
+            if (m_buffer.size() >= FlushThreshold) {
+                m_output.write(m_buffer.data(), std::streamsize(m_buffer.size()));
+                m_buffer.clear();
+            }
+        }
+
+        bool Finish(Out<std::string> outError)
+        {
+            m_output.write(m_buffer.data(), std::streamsize(m_buffer.size()));
+            m_buffer.clear();
+
+            if (!m_output.flush()) {
+                *outError = "Can't write profile";
+                return false;
+            }
+
+            return true;
+        }
+
+        TraceWriter& operator=(const TraceWriter&) = delete;
+        TraceWriter& operator=(TraceWriter&&) = delete;
+
+    private:
+        std::ofstream m_output;
+        std::string m_buffer;
+    };
+
+    void WarnAboutDroppedZones(const ProfilerState& state)
+    {
+        size_t droppedCount = 0;
+
+        for (const auto& buffer : state.buffers) {
+            droppedCount += buffer->GetDroppedCount();
+        }
+
+        if (droppedCount) {
+            LOG_WARNING("{} profiling zones were dropped because their threads' buffers were full", droppedCount);
+        }
+    }
+
+} // namespace
+
+std::atomic<bool> Profiler::Internal::isRunning{false};
+
+void Profiler::Start()
+{
+    ProfilerState& state = GetProfilerState();
+    ScopedLock lock{state.mutex};
+
+    if (!state.wasStarted) {
+        state.wasStarted = true;
+        state.startTime = Internal::ReadClock();
+        state.startSteadyTime = std::chrono::steady_clock::now();
+    }
+
+    Internal::isRunning.store(true, std::memory_order_relaxed);
+}
+
+void Profiler::Stop()
+{
+    Internal::isRunning.store(false, std::memory_order_relaxed);
+}
+
+bool Profiler::IsRunning()
+{
+    return Internal::isRunning.load(std::memory_order_relaxed);
+}
+
+bool Profiler::WriteChromeTrace(const oschar_t* path, Out<std::string> outError)
+{
+    ProfilerState& state = GetProfilerState();
+    ScopedLock lock{state.mutex};
+    ClockConverter converter{state};
+    TraceWriter writer{path};
+    std::string& out = writer.GetBuffer();
+    bool isFirst = true;
+
+    WarnAboutDroppedZones(state);
+
+    // Complete ("X") events, with times in microseconds.
+    out.append(R"({"displayTimeUnit":"ns","traceEvents":[)");
+
+    for (const auto& buffer : state.buffers) {
+        buffer->ForEachZone([&](const ProfileZone& zone) {
+            uint64_t startTime = converter.ToNanoseconds(zone.startTime);
+            uint64_t endTime = std::max(converter.ToNanoseconds(zone.endTime), startTime);
+
+            out.append(isFirst ? "\n" : ",\n");
+            out.append(R"({"ph":"X","pid":1,"tid":)");
+            fmt::format_to(std::back_inserter(out), "{}", buffer->GetThreadId());
+            out.append(R"(,"name":)");
+            AppendJsonString(out, zone.name);
+            fmt::format_to(std::back_inserter(out), R"(,"ts":{}.{:03},"dur":{}.{:03}}})", startTime / 1000,
+                           startTime % 1000, (endTime - startTime) / 1000, (endTime - startTime) % 1000);
+
+            isFirst = false;
+            writer.FlushIfFull();
+        });
+    }
+
+    out.append("\n]}\n");
+    return writer.Finish(outError);
+}
+
+bool Profiler::WriteBinaryTrace(const oschar_t* path, Out<std::string> outError)
+{
+    ProfilerState& state = GetProfilerState();
+    ScopedLock lock{state.mutex};
+    ClockConverter converter{state};
+    TraceWriter writer{path};
+    std::string& out = writer.GetBuffer();
+    std::unordered_map<std::string_view, uint32_t> nameIndices;
+    std::vector<std::string_view> names;
+    std::vector<size_t> zoneCounts;
+
+    WarnAboutDroppedZones(state);
+
+    // Zones can be recorded meanwhile, so take the counts first and stick to them.
+    for (const auto& buffer : state.buffers) {
+        size_t zoneCount = buffer->GetZoneCount();
+        size_t i = 0;
+
+        buffer->ForEachZone([&](const ProfileZone& zone) {
+            if (i++ < zoneCount && nameIndices.emplace(zone.name, uint32_t(names.size())).second) {
+                names.emplace_back(zone.name);
+            }
+        });
+
+        zoneCounts.push_back(zoneCount);
+    }
+
+    out.append("ABPF");
+    AppendLittleEndian(out, uint32_t{1});
+    AppendLittleEndian(out, uint32_t(names.size()));
+
+    for (std::string_view name : names) {
+        name = name.substr(0, UINT16_MAX);
+        AppendLittleEndian(out, uint16_t(name.size()));
+        out.append(name);
+    }
+
+    AppendLittleEndian(out, uint32_t(state.buffers.size()));
+
+    for (size_t i = 0; i < state.buffers.size(); ++i) {
+        const ProfileBuffer& buffer = *state.buffers[i];
+        size_t remaining = zoneCounts[i];
+
+        AppendLittleEndian(out, buffer.GetThreadId());
+        AppendLittleEndian(out, uint64_t(remaining));
+
+        buffer.ForEachZone([&](const ProfileZone& zone) {
+            if (!remaining) {
+                return;
+            }
+
+            uint64_t startTime = converter.ToNanoseconds(zone.startTime);
+            uint64_t endTime = std::max(converter.ToNanoseconds(zone.endTime), startTime);
+
+            AppendLittleEndian(out, nameIndices.at(zone.name));
+            AppendLittleEndian(out, startTime);
+            AppendLittleEndian(out, endTime - startTime);
+
+            --remaining;
+            writer.FlushIfFull();
+        });
+    }
+
+    return writer.Finish(outError);
+}
+
+void Profiler::Internal::RecordZone(const char* name, uint64_t startTime, uint64_t endTime)
+{
+    ProfileBuffer* buffer = t_profileBuffer;
+
+    if (!buffer) {
+        ProfilerState& state = GetProfilerState();
+        auto newBuffer = std::make_unique<ProfileBuffer>(Thread::GetCurrentId());
+
+        buffer = newBuffer.get();
+        t_profileBuffer = buffer;
+
+        ScopedLock lock{state.mutex};
+        state.buffers.push_back(std::move(newBuffer));
+    }
+
+    buffer->Append(ProfileZone{name, startTime, endTime});
+}
@@ -17,6 +17,7 @@
 #include <glad/gl.h>
 
 #include <Core/Debug.h>
+#include <Core/Profiler.h>
 #include <Render/GL/Loader.h>
 #include <Render/GL/Version.h>
 #include <Render/System.h>
@@ -76,6 +77,8 @@ namespace {
 
 RenderSystem::RenderSystem(ServiceProvider& serviceProvider)
 {
+    PROFILE_SCOPE("RenderSystem::RenderSystem");
+
     auto& loader = serviceProvider.RequireService<GlLoader>();
 
     CheckGlVersion(loader);
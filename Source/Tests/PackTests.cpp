@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Tests for PackInputStream, run by ctest. Each test writes a small pack file to the temporary
+// directory, reads it back through PackArchiveReader and compares the result with the data that
+// was written. Failures are logged, and the exit status is the number of failed tests.
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+#include <Core/IO/Codec/Pack.h>
+#include <Core/IO/Codec/PackFormat.h>
+#include <Core/Debug.h>
+#include <Core/Hash.h>
+
+using namespace ArenaBuilder;
+namespace fs = std::filesystem;
+
+namespace {
+
+    constexpr std::string_view EntryName = "Data.bin";
+    constexpr uint32_t ChunkSize = PackFormat::DefaultChunkSize;
+
+    // Makes every chunk different, so reading the wrong chunk can't go unnoticed.
+    std::vector<uint8_t> MakeData(size_t size)
+    {
+        std::vector<uint8_t> data(size);
+
+        for (size_t i = 0; i < size; ++i) {
+            data[i] = uint8_t(i + i / ChunkSize * 37);
+        }
+        return data;
+    }
+
+    // Writes a pack file containing a single entry named EntryName. The entry is chunked like a
+    // compressed entry, but each chunk is stored as-is, as ArenaPack does for chunks that don't
+    // shrink, so the reader takes the same path without the test depending on zstd.
+    void WritePack(const fs::path& path, const std::vector<uint8_t>& data)
+    {
+        uint32_t chunkCount = uint32_t((data.size() + ChunkSize - 1) / ChunkSize);
+        PackFormat::Header header;
+        PackFormat::Entry entry;
+        std::vector<uint8_t> file;
+
+        header.entryCount = 1;
+        header.bucketCount = 1;
+        header.chunkCount = chunkCount;
+        header.chunkSize = ChunkSize;
+        header.bucketsOffset = PackFormat::HeaderSize;
+        header.entriesOffset = header.bucketsOffset + PackFormat::BucketSize;
+        header.namesOffset = header.entriesOffset + PackFormat::EntrySize;
+        header.namesSize = EntryName.size();
+        header.payloadOffset = PackFormat::PageSize;
+        header.chunksOffset = header.payloadOffset + data.size();
+        header.fileSize = header.chunksOffset + uint64_t(chunkCount) * PackFormat::ChunkRecordSize;
+
+        entry.nameHash = HashFnv1a64(EntryName);
+        entry.nameSize = uint32_t(EntryName.size());
+        entry.dataOffset = header.payloadOffset;
+        entry.size = data.size();
+        entry.storedSize = data.size();
+        entry.method = PackFormat::Method::Zstd;
+
+        // With a single entry, every displacement leads to slot zero, so the bucket stays zero.
+        file.resize(size_t(header.fileSize));
+        PackFormat::StoreHeader(&file[0], header);
+        PackFormat::StoreEntry(&file[size_t(header.entriesOffset)], entry);
+        std::copy(EntryName.begin(), EntryName.end(), &file[size_t(header.namesOffset)]);
+        std::copy(data.begin(), data.end(), &file[size_t(header.payloadOffset)]);
+
+        for (uint32_t i = 0; i < chunkCount; ++i) {
+            PackFormat::ChunkRecord chunk;
+            chunk.offset = header.payloadOffset + uint64_t(i) * ChunkSize;
+            chunk.storedSize = uint32_t(std::min<uint64_t>(ChunkSize, data.size() - uint64_t(i) * ChunkSize));
+            PackFormat::StoreChunkRecord(&file[size_t(header.chunksOffset + uint64_t(i) * PackFormat::ChunkRecordSize)], chunk);
+        }
+
+        std::ofstream output{path, std::ios::binary | std::ios::trunc};
+        output.write(reinterpret_cast<const char*>(file.data()), std::streamsize(file.size()));
+        if (!output.good()) {
+            FATAL("Can't write {}", path.string());
+        }
+    }
+
+    // Reads 'size' bytes and checks them against the data at the stream's position.
+    bool ReadAndCompare(Stream& stream, const std::vector<uint8_t>& data, size_t size)
+    {
+        uint64_t position = stream.Tell();
+        std::vector<uint8_t> buffer(size);
+        IoError error;
+
+        if (!stream.ReadExact(buffer.data(), size, Out{error})) {
+            LOG_ERROR("Can't read {} bytes at {}: {}", size, position, error);
+            return false;
+        }
+
+        for (size_t i = 0; i < size; ++i) {
+            if (buffer[i] != data[size_t(position) + i]) {
+                LOG_ERROR("Wrong byte at {}: got {}, expected {}", position + i, buffer[i], data[size_t(position) + i]);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool Seek(Stream& stream, uint64_t position)
+    {
+        IoError error;
+
+        if (!stream.Seek(int64_t(position), SeekOrigin::Begin, Out{error})) {
+            LOG_ERROR("Can't seek to {}: {}", position, error);
+            return false;
+        }
+        return true;
+    }
+
+    //----------------------------------------------------------------------------------------------
+
+    // A read of a whole chunk is decoded straight into the caller's buffer. A seek afterwards must
+    // not be served from the chunk that was buffered before it.
+    bool TestSeekAfterWholeChunkRead(PackArchiveReader& pack, const std::vector<uint8_t>& data)
+    {
+        IoError error;
+        auto stream = pack.OpenStream(EntryName, Out{error});
+
+        if (!stream) {
+            LOG_ERROR("Can't open {}: {}", EntryName, error);
+            return false;
+        }
+
+        return ReadAndCompare(*stream, data, 100) // Buffers chunk 0
+            && ReadAndCompare(*stream, data, ChunkSize - 100) // Drains chunk 0
+            && ReadAndCompare(*stream, data, ChunkSize) // Chunk 1, unbuffered
+            && stream->Tell() == 2 * ChunkSize
+            && Seek(*stream, 70000) // In chunk 1
+            && ReadAndCompare(*stream, data, 1)
+            && Seek(*stream, 100) // Back in chunk 0
+            && ReadAndCompare(*stream, data, 1);
+    }
+
+    // Seeks within the buffered chunk are served from the buffer, in both directions.
+    bool TestSeekWithinBufferedChunk(PackArchiveReader& pack, const std::vector<uint8_t>& data)
+    {
+        IoError error;
+        auto stream = pack.OpenStream(EntryName, Out{error});
+
+        if (!stream) {
+            LOG_ERROR("Can't open {}: {}", EntryName, error);
+            return false;
+        }
+
+        return Seek(*stream, ChunkSize + 10)
+            && ReadAndCompare(*stream, data, 1000)
+            && Seek(*stream, ChunkSize)
+            && ReadAndCompare(*stream, data, 5000)
+            && Seek(*stream, 2 * ChunkSize - 1)
+            && ReadAndCompare(*stream, data, 2) // Crosses into chunk 2
+            && Seek(*stream, data.size() - 1)
+            && ReadAndCompare(*stream, data, 1);
+    }
+
+    struct Test {
+        const char* name;
+        bool (*run)(PackArchiveReader& pack, const std::vector<uint8_t>& data);
+    };
+
+    const Test s_tests[] = {
+        {"SeekAfterWholeChunkRead", &TestSeekAfterWholeChunkRead},
+        {"SeekWithinBufferedChunk", &TestSeekWithinBufferedChunk},
+    };
+
+} // namespace
+
+int main()
+{
+    Debug::InitLogger();
+
+    // Three and a bit chunks, so that the last one is short.
+    std::vector<uint8_t> data = MakeData(3 * ChunkSize + 1234);
+    fs::path path = fs::temp_directory_path() / "ArenaPackTests.abpk";
+    PackArchiveReader pack;
+    IoError error;
+    int failureCount = 0;
+
+    WritePack(path, data);
+    if (!pack.Open(path.c_str(), Out{error})) {
+        FATAL("Can't open {}: {}", path.string(), error);
+    }
+
+    for (const Test& test : s_tests) {
+        if (test.run(pack, data)) {
+            LOG_INFO("{}: passed", test.name);
+        } else {
+            LOG_ERROR("{}: failed", test.name);
+            ++failureCount;
+        }
+    }
+
+    pack.Close();
+    fs::remove(path);
+    return failureCount;
+}
@@ -0,0 +1,484 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <vector>
+
+#include <zstd.h>
+
+#include <Core/IO/Codec/Pack.h>
+#include <Core/IO/MappedFile.h>
+#include <Core/CommandLine.h>
+#include <Core/Debug.h>
+#include <Core/StringUtils.h>
+
+using namespace ArenaBuilder;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+    constexpr int DefaultCompressionLevel = 19;
+
+    // Compressed entries which don't save at least 1/8 of their size are stored instead, since
+    // stored entries can be read without copying.
+    constexpr uint64_t MinSavingsDivisor = 8;
+
+    // Gives up on the perfect hash if a bucket can't be placed after this many displacements.
+    constexpr uint32_t MaxDisplacement = uint32_t(1) << 24;
+
+    struct PackParams {
+        OsString inputDir;
+        OsString outputPath;
+        std::vector<std::string> excludedNames;
+        int compressionLevel = DefaultCompressionLevel;
+    };
+
+    struct InputFile {
+        std::string name;
+        fs::path path;
+        PackFormat::Entry entry;
+    };
+
+    class PackCommandLineHandler : public CommandLineHandler {
+    public:
+        PackParams params;
+
+        bool HandleOperand(OsStringView operand) override
+        {
+            if (!params.inputDir.empty()) {
+                FATAL("Unexpected operand: {}", operand);
+            }
+            params.inputDir = operand;
+            return true;
+        }
+
+        bool HandleShortOption(oschar_t option, CommandLineParser&) override
+        {
+            FATAL("Invalid option: -{}", option);
+        }
+
+        bool HandleLongOption(OsStringView option, CommandLineParser& parser) override
+        {
+            if (option == OSSTR("exclude")) {
+                params.excludedNames.push_back(fs::path{GetParam(option, parser)}.generic_u8string());
+                return true;
+            } else if (option == OSSTR("level")) {
+                const oschar_t* param = GetParam(option, parser);
+                if (!ParseInteger(param, Out{params.compressionLevel})
+                    || params.compressionLevel < ZSTD_minCLevel() || params.compressionLevel > ZSTD_maxCLevel())
+                {
+                    FATAL("Invalid parameter for --level: {}", param);
+                }
+                return true;
+            } else if (option == OSSTR("output")) {
+                params.outputPath = GetParam(option, parser);
+                return true;
+            } else {
+                FATAL("Invalid option: --{}", option);
+            }
+        }
+
+    private:
+        static const oschar_t* GetParam(OsStringView option, CommandLineParser& parser)
+        {
+            auto param = parser.GetParam();
+            if (!param) {
+                FATAL("Missing parameter for --{}", option);
+            }
+            return param;
+        }
+    };
+
+    uint64_t AlignUp(uint64_t value, uint64_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    // Collects regular files under the input directory, sorted by name so that the output doesn't
+    // depend on directory iteration order.
+    std::vector<InputFile> CollectInputFiles(const PackParams& params)
+    {
+        std::vector<InputFile> files;
+        std::error_code error;
+
+        for (fs::recursive_directory_iterator iter{params.inputDir, error}, end; iter != end; iter.increment(error)) {
+            if (error) {
+                break;
+            } else if (!iter->is_regular_file()) {
+                continue;
+            }
+
+            std::string name = iter->path().lexically_relative(params.inputDir).generic_u8string();
+            if (std::find(params.excludedNames.begin(), params.excludedNames.end(), name)
+                != params.excludedNames.end())
+            {
+                continue;
+            }
+
+            files.push_back({std::move(name), iter->path(), {}});
+        }
+
+        if (error) {
+            FATAL("Can't read {}: {}", params.inputDir, error.message());
+        }
+
+        std::sort(files.begin(), files.end(), [](const InputFile& a, const InputFile& b) { return a.name < b.name; });
+        return files;
+    }
+
+    // Assigns each entry a slot with hash-and-displace. Buckets are placed largest first, trying
+    // displacements until all of a bucket's entries land in distinct free slots. Returns the
+    // displacement for each bucket and fills outSlots with each entry's slot.
+    std::vector<uint32_t> BuildPerfectHash(const std::vector<InputFile>& files, uint32_t bucketCount,
+                                           Out<std::vector<uint32_t>> outSlots)
+    {
+        uint32_t entryCount = uint32_t(files.size());
+        std::vector<std::vector<uint32_t>> buckets(bucketCount);
+        std::vector<uint32_t> bucketOrder(bucketCount);
+        std::vector<uint32_t> displacements(bucketCount);
+        std::vector<bool> isSlotUsed(entryCount);
+        std::vector<uint32_t> bucketSlots;
+        std::vector<uint32_t>& slots = *outSlots;
+
+        slots.assign(entryCount, 0);
+
+        for (uint32_t i = 0; i < entryCount; ++i) {
+            buckets[PackFormat::GetBucket(files[i].entry.nameHash, bucketCount)].push_back(i);
+        }
+
+        for (uint32_t i = 0; i < bucketCount; ++i) {
+            bucketOrder[i] = i;
+        }
+
+        std::stable_sort(bucketOrder.begin(), bucketOrder.end(),
+                         [&](uint32_t a, uint32_t b) { return buckets[a].size() > buckets[b].size(); });
+
+        for (uint32_t bucket : bucketOrder) {
+            const std::vector<uint32_t>& members = buckets[bucket];
+            uint32_t displacement = 0;
+
+            if (members.empty()) {
+                break;
+            }
+
+            for (;; ++displacement) {
+                if (displacement == MaxDisplacement) {
+                    FATAL("Can't build a perfect hash for {} entries", entryCount);
+                }
+
+                bucketSlots.clear();
+
+                for (uint32_t member : members) {
+                    uint32_t slot = PackFormat::GetSlot(files[member].entry.nameHash, displacement, entryCount);
+                    if (isSlotUsed[slot] || std::find(bucketSlots.begin(), bucketSlots.end(), slot) != bucketSlots.end()) {
+                        break;
+                    }
+                    bucketSlots.push_back(slot);
+                }
+
+                if (bucketSlots.size() == members.size()) {
+                    break;
+                }
+            }
+
+            displacements[bucket] = displacement;
+
+            for (size_t i = 0; i < members.size(); ++i) {
+                isSlotUsed[bucketSlots[i]] = true;
+                slots[members[i]] = bucketSlots[i];
+            }
+        }
+
+        return displacements;
+    }
+
+    void WriteBytes(std::ofstream& output, const void* data, uint64_t size)
+    {
+        output.write(static_cast<const char*>(data), std::streamsize(size));
+    }
+
+    void WritePadding(std::ofstream& output, uint64_t position, uint64_t alignment)
+    {
+        static const char zeros[PackFormat::PageSize] = {};
+        WriteBytes(output, zeros, AlignUp(position, alignment) - position);
+    }
+
+    // Writes an entry's payload at 'position', which is updated to the end of the payload. Each
+    // chunk is compressed separately so that readers can decompress straight from the mapping.
+    void WritePayload(std::ofstream& output, InputFile& file, const PackParams& params, ZSTD_CCtx* context,
+                      Out<uint64_t> inOutPosition, Out<std::vector<PackFormat::ChunkRecord>> inOutChunks)
+    {
+        PackFormat::Entry& entry = file.entry;
+        uint64_t& position = *inOutPosition;
+        std::vector<PackFormat::ChunkRecord>& chunks = *inOutChunks;
+        std::vector<PackFormat::ChunkRecord> fileChunks;
+        std::string compressed;
+        IoError error;
+        MappedFile input;
+        ByteView data;
+
+        if (!input.Open(file.path.c_str(), Out{error})) {
+            FATAL("Can't open {}: {}", file.path.native(), error);
+        }
+
+        data = input.GetView();
+        entry.size = data.size;
+
+        if (data.size) {
+            ZSTD_CCtx_reset(context, ZSTD_reset_session_and_parameters);
+            ZSTD_CCtx_setParameter(context, ZSTD_c_compressionLevel, params.compressionLevel);
+            ZSTD_CCtx_setParameter(context, ZSTD_c_checksumFlag, 1);
+
+            for (size_t offset = 0; offset < data.size; offset += PackFormat::DefaultChunkSize) {
+                size_t chunkSize = std::min<size_t>(PackFormat::DefaultChunkSize, data.size - offset);
+                size_t chunkStart = compressed.size();
+                size_t result;
+
+                compressed.resize(chunkStart + ZSTD_compressBound(chunkSize));
+                result = ZSTD_compress2(context, &compressed[chunkStart], compressed.size() - chunkStart,
+                                        data.data + offset, chunkSize);
+                if (ZSTD_isError(result)) {
+                    FATAL("Can't compress {}: {}", file.name, ZSTD_getErrorName(result));
+                }
+
+                // Chunks that don't shrink are stored as-is.
+                if (result >= chunkSize) {
+                    compressed.resize(chunkStart);
+                    compressed.append(reinterpret_cast<const char*>(data.data + offset), chunkSize);
+                    fileChunks.push_back({chunkStart, uint32_t(chunkSize), 0});
+                } else {
+                    compressed.resize(chunkStart + result);
+                    fileChunks.push_back({chunkStart, uint32_t(result), PackFormat::ChunkFlagCompressed});
+                }
+            }
+        }
+
+        if (!data.size || compressed.size() > data.size - data.size / MinSavingsDivisor) {
+            // Stored entries that span pages start on a page boundary.
+            uint64_t alignment = data.size >= PackFormat::PageSize ? PackFormat::PageSize : PackFormat::MinAlignment;
+
+            WritePadding(output, position, alignment);
+            position = AlignUp(position, alignment);
+            WriteBytes(output, data.data, data.size);
+
+            entry.method = PackFormat::Method::Stored;
+            entry.dataOffset = position;
+            entry.storedSize = data.size;
+            position += data.size;
+            return;
+        }
+
+        WritePadding(output, position, PackFormat::MinAlignment);
+        position = AlignUp(position, PackFormat::MinAlignment);
+        WriteBytes(output, compressed.data(), compressed.size());
+
+        entry.method = PackFormat::Method::Zstd;
+        entry.dataOffset = position;
+        entry.storedSize = compressed.size();
+        entry.firstChunk = uint32_t(chunks.size());
+
+        for (PackFormat::ChunkRecord& chunk : fileChunks) {
+            chunk.offset += position;
+            chunks.push_back(chunk);
+        }
+
+        position += compressed.size();
+    }
+
+    // Reads back every entry through PackArchiveReader to catch mistakes before anything uses the
+    // pack.
+    void VerifyPack(const OsString& path, const std::vector<InputFile>& files)
+    {
+        PackArchiveReader reader;
+        IoError error;
+        std::vector<uint8_t> buffer;
+
+        if (!reader.Open(path.c_str(), Out{error})) {
+            FATAL("Can't open {} for verification: {}", path, error);
+        }
+
+        for (const InputFile& file : files) {
+            auto stream = reader.OpenStream(file.name, Out{error});
+            if (!stream) {
+                FATAL("Can't open {} for verification: {}", file.name, error);
+            }
+
+            if (!stream->ReadAll(Out{buffer}, Out{error})) {
+                FATAL("Can't verify {}: {}", file.name, error);
+            } else if (buffer.size() != file.entry.size) {
+                FATAL("Can't verify {}: Wrong size", file.name);
+            }
+
+            MappedFile input{file.path.c_str(), Out{error}};
+            ByteView data = input.GetView();
+            if (!input.IsOpen() || data.size != file.entry.size
+                || (data.size && std::memcmp(data.data, buffer.data(), data.size)))
+            {
+                FATAL("Can't verify {}: Contents differ", file.name);
+            }
+        }
+    }
+
+    int PackMain(int argc, const oschar_t* const argv[])
+    {
+        Debug::InitLogger();
+
+        PackCommandLineHandler handler;
+        CommandLineParser::Parse(argc, argv, handler);
+        const PackParams& params = handler.params;
+
+        if (params.inputDir.empty()) {
+            FATAL("Missing input directory");
+        } else if (params.outputPath.empty()) {
+            FATAL("Missing parameter: --output");
+        }
+
+        std::vector<InputFile> files = CollectInputFiles(params);
+        std::vector<uint32_t> slots;
+        std::vector<uint32_t> displacements;
+        std::vector<PackFormat::ChunkRecord> chunks;
+        std::string names;
+        PackFormat::Header header;
+        uint64_t position;
+
+        if (files.size() >= std::numeric_limits<uint32_t>::max()) {
+            FATAL("Too many input files");
+        }
+
+        for (InputFile& file : files) {
+            file.entry.nameHash = HashFnv1a64(file.name);
+            file.entry.nameOffset = uint32_t(names.size());
+            file.entry.nameSize = uint32_t(file.name.size());
+            names += file.name;
+
+            if (names.size() > std::numeric_limits<uint32_t>::max()) {
+                FATAL("Too many input files");
+            }
+        }
+
+        // Names that hash the same can never be told apart by the perfect hash.
+        std::vector<const InputFile*> byHash;
+        for (const InputFile& file : files) {
+            byHash.push_back(&file);
+        }
+        std::sort(byHash.begin(), byHash.end(),
+                  [](const InputFile* a, const InputFile* b) { return a->entry.nameHash < b->entry.nameHash; });
+        for (size_t i = 1; i < byHash.size(); ++i) {
+            if (byHash[i]->entry.nameHash == byHash[i - 1]->entry.nameHash) {
+                FATAL("Name hash collision: {} and {}", byHash[i - 1]->name, byHash[i]->name);
+            }
+        }
+
+        // Two entries per bucket on average keeps the displacement search short.
+        header.entryCount = uint32_t(files.size());
+        header.bucketCount = std::max<uint32_t>(1, (header.entryCount + 1) / 2);
+        header.chunkSize = PackFormat::DefaultChunkSize;
+        displacements = BuildPerfectHash(files, header.bucketCount, Out{slots});
+
+        header.bucketsOffset = PackFormat::HeaderSize;
+        header.entriesOffset = AlignUp(header.bucketsOffset + header.bucketCount * PackFormat::BucketSize, 8);
+        header.namesOffset = header.entriesOffset + header.entryCount * PackFormat::EntrySize;
+        header.namesSize = names.size();
+        header.payloadOffset = AlignUp(header.namesOffset + header.namesSize, PackFormat::PageSize);
+
+        // Write to a temporary file so that a failed run never leaves a pack that looks up to date.
+        OsString tempPath = params.outputPath + OSSTR(".tmp");
+        std::ofstream output{fs::path{tempPath}, std::ios::binary | std::ios::trunc};
+        if (!output) {
+            FATAL("Can't create {}", tempPath);
+        }
+
+        // The header and entry table are rewritten once the payload has been laid out.
+        std::vector<uint8_t> tables(size_t(header.payloadOffset));
+        WriteBytes(output, tables.data(), tables.size());
+        position = header.payloadOffset;
+
+        ZSTD_CCtx* context = ZSTD_createCCtx();
+        if (!context) {
+            FATAL("ZSTD_createCCtx failed");
+        }
+
+        for (InputFile& file : files) {
+            WritePayload(output, file, params, context, Out{position}, Out{chunks});
+        }
+
+        ZSTD_freeCCtx(context);
+
+        if (chunks.size() >= std::numeric_limits<uint32_t>::max()) {
+            FATAL("Too many chunks");
+        }
+
+        // The chunk table goes last since its size isn't known until everything is compressed.
+        WritePadding(output, position, 8);
+        header.chunksOffset = AlignUp(position, 8);
+        header.chunkCount = uint32_t(chunks.size());
+        header.fileSize = header.chunksOffset + header.chunkCount * PackFormat::ChunkRecordSize;
+
+        std::vector<uint8_t> chunkTable(chunks.size() * PackFormat::ChunkRecordSize);
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            PackFormat::StoreChunkRecord(&chunkTable[i * PackFormat::ChunkRecordSize], chunks[i]);
+        }
+        WriteBytes(output, chunkTable.data(), chunkTable.size());
+
+        PackFormat::StoreHeader(tables.data(), header);
+        for (uint32_t i = 0; i < header.bucketCount; ++i) {
+            StoreLittleEndian(&tables[size_t(header.bucketsOffset) + i * PackFormat::BucketSize], displacements[i]);
+        }
+        for (size_t i = 0; i < files.size(); ++i) {
+            PackFormat::StoreEntry(&tables[size_t(header.entriesOffset + slots[i] * PackFormat::EntrySize)],
+                                   files[i].entry);
+        }
+        std::memcpy(&tables[size_t(header.namesOffset)], names.data(), names.size());
+
+        output.seekp(0);
+        WriteBytes(output, tables.data(), tables.size());
+        output.close();
+        if (!output) {
+            FATAL("Can't write {}", tempPath);
+        }
+
+        VerifyPack(tempPath, files);
+
+        std::error_code error;
+        fs::rename(tempPath, params.outputPath, error);
+        if (error) {
+            FATAL("Can't rename {} to {}: {}", tempPath, params.outputPath, error.message());
+        }
+
+        LOG_INFO("Packed {} files into {} bytes", files.size(), header.fileSize);
+        return 0;
+    }
+
+} // namespace
+
+#ifdef _WIN32
+
+int wmain(int argc, wchar_t* argv[])
+{
+    return PackMain(argc, argv);
+}
+
+#else // !defined(_WIN32)
+
+int main(int argc, char* argv[])
+{
+    return PackMain(argc, argv);
+}
+
+#endif // !defined(_WIN32)
@@ -0,0 +1,524 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Benchmarks for the I/O layer, run against an archive such as the asset pack:
+//
+//   IoBench [options] <benchmark> <archive>
+//
+// Archives ending with .abpk are opened with PackArchiveReader, and anything else with
+// ZipArchiveReader. Each benchmark is run --iterations times, and the fastest run is reported,
+// since it's the one least disturbed by the rest of the system. Results go to stdout.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include <Core/IO/Buffered.h>
+#include <Core/IO/Codec/Lz4.h>
+#include <Core/IO/Codec/Pack.h>
+#include <Core/IO/Codec/Zip.h>
+#include <Core/IO/Codec/Zstd.h>
+#include <Core/IO/Memory.h>
+#include <Core/IO/ReadAhead.h>
+#include <Core/CommandLine.h>
+#include <Core/Debug.h>
+#include <Core/Hash.h>
+#include <Core/StringUtils.h>
+#include <Core/Thread.h>
+
+using namespace ArenaBuilder;
+
+namespace {
+
+    constexpr int DefaultIterations = 5;
+    constexpr size_t DefaultReadSize = 16;
+
+    struct BenchParams {
+        OsString benchmarkName;
+        OsString archivePath;
+        int iterations = DefaultIterations;
+        size_t readSize = DefaultReadSize;
+        size_t maxThreads = Thread::GetHardwareConcurrency();
+    };
+
+    class BenchCommandLineHandler : public CommandLineHandler {
+    public:
+        BenchParams params;
+
+        bool HandleOperand(OsStringView operand) override
+        {
+            if (params.benchmarkName.empty()) {
+                params.benchmarkName = operand;
+            } else if (params.archivePath.empty()) {
+                params.archivePath = operand;
+            } else {
+                FATAL("Unexpected operand: {}", operand);
+            }
+            return true;
+        }
+
+        bool HandleShortOption(oschar_t option, CommandLineParser&) override
+        {
+            FATAL("Invalid option: -{}", option);
+        }
+
+        bool HandleLongOption(OsStringView option, CommandLineParser& parser) override
+        {
+            if (option == OSSTR("iterations")) {
+                const oschar_t* param = GetParam(option, parser);
+                if (!ParseInteger(param, Out{params.iterations}) || params.iterations < 1) {
+                    FATAL("Invalid parameter for --iterations: {}", param);
+                }
+                return true;
+            } else if (option == OSSTR("read-size")) {
+                const oschar_t* param = GetParam(option, parser);
+                if (!ParseInteger(param, Out{params.readSize}) || !params.readSize) {
+                    FATAL("Invalid parameter for --read-size: {}", param);
+                }
+                return true;
+            } else if (option == OSSTR("threads")) {
+                const oschar_t* param = GetParam(option, parser);
+                if (!ParseInteger(param, Out{params.maxThreads}) || !params.maxThreads) {
+                    FATAL("Invalid parameter for --threads: {}", param);
+                }
+                return true;
+            } else {
+                FATAL("Invalid option: --{}", option);
+            }
+        }
+
+    private:
+        static const oschar_t* GetParam(OsStringView option, CommandLineParser& parser)
+        {
+            auto param = parser.GetParam();
+            if (!param) {
+                FATAL("Missing parameter for --{}", option);
+            }
+            return param;
+        }
+    };
+
+    // An open archive and the entries that the benchmarks read.
+    struct Corpus {
+        std::unique_ptr<DataSource> archive;
+        std::vector<uint64_t> entryIds;
+        uint64_t totalSize = 0; // Uncompressed
+    };
+
+    Corpus OpenCorpus(const OsString& path)
+    {
+        Corpus corpus;
+        IoError error;
+        OsStringView suffix = OSSTR(".abpk");
+
+        if (path.size() >= suffix.size() && OsStringView{path}.substr(path.size() - suffix.size()) == suffix) {
+            auto pack = std::make_unique<PackArchiveReader>();
+            if (!pack->Open(path.c_str(), Out{error})) {
+                FATAL("Can't open {}: {}", path, error);
+            }
+            corpus.archive = std::move(pack);
+        } else {
+            auto zip = std::make_unique<ZipArchiveReader>();
+            if (!zip->Open(path.c_str(), Out{error})) {
+                FATAL("Can't open {}: {}", path, error);
+            }
+            corpus.archive = std::move(zip);
+        }
+
+        auto addEntry = [&](std::string_view, uint64_t entryId) { corpus.entryIds.push_back(entryId); };
+        if (!corpus.archive->EnumerateEntries(addEntry, Out{error})) {
+            FATAL("Can't list entries: {}", error);
+        }
+
+        for (uint64_t entryId : corpus.entryIds) {
+            uint64_t size = 0;
+            auto stream = corpus.archive->OpenEntryStream(entryId, Out{error});
+            if (!stream) {
+                FATAL("Can't open entry: {}", error);
+            } else if (!stream->GetSize(Out{size})) {
+                FATAL("Entry size is unknown");
+            }
+            corpus.totalSize += size;
+        }
+
+        return corpus;
+    }
+
+    std::unique_ptr<Stream> OpenEntry(const Corpus& corpus, uint64_t entryId)
+    {
+        IoError error;
+
+        auto stream = corpus.archive->OpenEntryStream(entryId, Out{error});
+        if (!stream) {
+            FATAL("Can't open entry: {}", error);
+        }
+        return stream;
+    }
+
+    // Runs 'fn' the given number of times and returns the fastest run in seconds.
+    template<typename Fn>
+    double MeasureBest(int iterations, Fn&& fn)
+    {
+        double best = 0;
+
+        for (int i = 0; i < iterations; ++i) {
+            auto startTime = std::chrono::steady_clock::now();
+            fn();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+
+            if (!i || elapsed.count() < best) {
+                best = elapsed.count();
+            }
+        }
+
+        return best;
+    }
+
+    void PrintThroughput(const char* label, uint64_t bytes, double seconds)
+    {
+        fmt::print("{:<32} {:9.3f} ms {:9.1f} MiB/s\n", label, seconds * 1e3, double(bytes) / (1 << 20) / seconds);
+    }
+
+    //----------------------------------------------------------------------------------------------
+    // buffered: Many small reads from each entry, straight from the archive's streams and through a
+    // BufferedStream.
+
+    template<typename StreamT>
+    uint64_t ReadInPieces(StreamT& stream, size_t readSize)
+    {
+        std::vector<uint8_t> buffer(readSize);
+        uint64_t total = 0;
+        IoError error;
+
+        while (size_t count = stream.Read(buffer.data(), readSize, Out{error})) {
+            total += count;
+        }
+
+        if (error) {
+            FATAL("Read failed: {}", error);
+        }
+        return total;
+    }
+
+    void RunBufferedBenchmark(const BenchParams& params, const Corpus& corpus)
+    {
+        double rawTime = MeasureBest(params.iterations, [&]() {
+            for (uint64_t entryId : corpus.entryIds) {
+                auto stream = OpenEntry(corpus, entryId);
+                ReadInPieces(*stream, params.readSize);
+            }
+        });
+
+        double bufferedTime = MeasureBest(params.iterations, [&]() {
+            for (uint64_t entryId : corpus.entryIds) {
+                auto stream = OpenEntry(corpus, entryId);
+                BufferedStream buffered{*stream};
+                ReadInPieces(buffered, params.readSize);
+            }
+        });
+
+        fmt::print("{} entries, {} bytes, {}-byte reads\n", corpus.entryIds.size(), corpus.totalSize, params.readSize);
+        PrintThroughput("Archive stream", corpus.totalSize, rawTime);
+        PrintThroughput("BufferedStream", corpus.totalSize, bufferedTime);
+    }
+
+    //----------------------------------------------------------------------------------------------
+    // threads: Whole entries read from one archive reader on 1, 2, 4, ... threads at once, up to
+    // --threads. Each thread takes the next unread entry until all of them have been read once.
+
+    void ReadEntriesOnThreads(const Corpus& corpus, size_t threadCount)
+    {
+        std::atomic<size_t> nextIndex{0};
+        std::vector<std::unique_ptr<Thread>> threads;
+        std::string error;
+
+        auto readEntries = [&]() {
+            std::vector<uint8_t> data;
+            IoError readError;
+
+            for (size_t i; (i = nextIndex.fetch_add(1, std::memory_order_relaxed)) < corpus.entryIds.size();) {
+                auto stream = OpenEntry(corpus, corpus.entryIds[i]);
+                if (!stream->ReadAll(Out{data}, Out{readError})) {
+                    FATAL("Read failed: {}", readError);
+                }
+            }
+        };
+
+        // The calling thread reads too.
+        for (size_t i = 1; i < threadCount; ++i) {
+            threads.push_back(std::make_unique<Thread>());
+            if (!threads.back()->Start(readEntries, Out{error})) {
+                FATAL("Can't start thread: {}", error);
+            }
+        }
+
+        readEntries();
+
+        for (const auto& thread : threads) {
+            thread->Join();
+        }
+    }
+
+    void RunThreadsBenchmark(const BenchParams& params, const Corpus& corpus)
+    {
+        std::vector<size_t> threadCounts;
+        double singleThreadTime = 0;
+
+        for (size_t count = 1; count < params.maxThreads; count *= 2) {
+            threadCounts.push_back(count);
+        }
+        threadCounts.push_back(params.maxThreads);
+
+        fmt::print("{} entries, {} bytes\n", corpus.entryIds.size(), corpus.totalSize);
+
+        for (size_t threadCount : threadCounts) {
+            double time = MeasureBest(params.iterations, [&]() { ReadEntriesOnThreads(corpus, threadCount); });
+
+            if (threadCount == 1) {
+                singleThreadTime = time;
+            }
+
+            fmt::print("{:>3} threads {:9.3f} ms {:9.1f} MiB/s {:6.2f}x\n", threadCount, time * 1e3,
+                       double(corpus.totalSize) / (1 << 20) / time, singleThreadTime / time);
+        }
+    }
+
+    //----------------------------------------------------------------------------------------------
+    // codecs: Every entry decoded in full by the archive's own streams (i.e. ZipInputStream) and by
+    // ZstdInputStream and Lz4InputStream, from copies re-encoded in memory at each codec's default
+    // level. Re-encoding happens once, before anything is timed.
+
+    // Write-only stream which appends to a vector, for encoding in memory.
+    class VectorOutputStream final : public Stream {
+    public:
+        std::vector<uint8_t> data;
+
+        void Close() override {}
+        bool IsOpen() const override { return true; }
+
+    protected:
+        size_t DoWrite(const void* buffer, size_t size, Out<IoError>) override
+        {
+            data.insert(data.end(), static_cast<const uint8_t*>(buffer), static_cast<const uint8_t*>(buffer) + size);
+            return size;
+        }
+    };
+
+    template<typename EncoderT>
+    std::vector<uint8_t> Encode(const std::vector<uint8_t>& data)
+    {
+        VectorOutputStream output;
+        EncoderT encoder{output};
+        IoError error;
+
+        if (!encoder.Write(data.data(), data.size(), Out{error}) || !encoder.Finish(Out{error})) {
+            FATAL("Encoding failed: {}", error);
+        }
+        return std::move(output.data);
+    }
+
+    template<typename DecoderT>
+    void DecodeAll(const std::vector<std::vector<uint8_t>>& encodedEntries)
+    {
+        std::vector<uint8_t> data;
+        IoError error;
+
+        for (const auto& encoded : encodedEntries) {
+            MemoryInputStream input{ByteView{encoded.data(), encoded.size()}};
+            DecoderT decoder{input};
+            if (!decoder.ReadAll(Out{data}, Out{error})) {
+                FATAL("Decoding failed: {}", error);
+            }
+        }
+    }
+
+    uint64_t GetTotalSize(const std::vector<std::vector<uint8_t>>& entries)
+    {
+        uint64_t total = 0;
+
+        for (const auto& entry : entries) {
+            total += entry.size();
+        }
+        return total;
+    }
+
+    void RunCodecsBenchmark(const BenchParams& params, const Corpus& corpus)
+    {
+        std::vector<std::vector<uint8_t>> zstdEntries;
+        std::vector<std::vector<uint8_t>> lz4Entries;
+        std::vector<uint8_t> data;
+        IoError error;
+
+        for (uint64_t entryId : corpus.entryIds) {
+            if (!OpenEntry(corpus, entryId)->ReadAll(Out{data}, Out{error})) {
+                FATAL("Read failed: {}", error);
+            }
+            zstdEntries.push_back(Encode<ZstdOutputStream>(data));
+            lz4Entries.push_back(Encode<Lz4OutputStream>(data));
+        }
+
+        double archiveTime = MeasureBest(params.iterations, [&]() {
+            for (uint64_t entryId : corpus.entryIds) {
+                if (!OpenEntry(corpus, entryId)->ReadAll(Out{data}, Out{error})) {
+                    FATAL("Read failed: {}", error);
+                }
+            }
+        });
+
+        double zstdTime = MeasureBest(params.iterations, [&]() { DecodeAll<ZstdInputStream>(zstdEntries); });
+        double lz4Time = MeasureBest(params.iterations, [&]() { DecodeAll<Lz4InputStream>(lz4Entries); });
+
+        fmt::print("{} entries, {} bytes; zstd {} bytes, LZ4 {} bytes\n", corpus.entryIds.size(), corpus.totalSize,
+                   GetTotalSize(zstdEntries), GetTotalSize(lz4Entries));
+        PrintThroughput("Archive stream", corpus.totalSize, archiveTime);
+        PrintThroughput("ZstdInputStream", corpus.totalSize, zstdTime);
+        PrintThroughput("Lz4InputStream", corpus.totalSize, lz4Time);
+    }
+
+    //----------------------------------------------------------------------------------------------
+    // readahead: Every entry read sequentially in --read-size pieces (e.g. 65536), with each piece
+    // hashed as a stand-in for parsing, straight from the archive's streams and through a
+    // ReadAheadStream. Decoding and hashing are also timed on their own, since the best read-ahead
+    // can do is bring the total down to the larger of the two. Overlap needs a second core.
+
+    uint64_t HashInPieces(const uint8_t* data, size_t size, size_t pieceSize)
+    {
+        uint64_t hash = 0;
+
+        for (size_t offset = 0; offset < size; offset += pieceSize) {
+            size_t count = std::min(pieceSize, size - offset);
+            hash ^= HashFnv1a64(std::string_view{reinterpret_cast<const char*>(data + offset), count});
+        }
+        return hash;
+    }
+
+    template<typename StreamT>
+    uint64_t ReadAndHash(StreamT& stream, std::vector<uint8_t>& buffer)
+    {
+        uint64_t hash = 0;
+        IoError error;
+
+        while (size_t count = stream.Read(buffer.data(), buffer.size(), Out{error})) {
+            hash ^= HashInPieces(buffer.data(), count, count);
+        }
+
+        if (error) {
+            FATAL("Read failed: {}", error);
+        }
+        return hash;
+    }
+
+    void RunReadAheadBenchmark(const BenchParams& params, const Corpus& corpus)
+    {
+        std::vector<uint8_t> buffer(params.readSize);
+        std::vector<std::vector<uint8_t>> entries(corpus.entryIds.size());
+        volatile uint64_t hash = 0; // Keeps the hashing from being optimized out
+        IoError error;
+
+        double decodeTime = MeasureBest(params.iterations, [&]() {
+            for (size_t i = 0; i < corpus.entryIds.size(); ++i) {
+                if (!OpenEntry(corpus, corpus.entryIds[i])->ReadAll(Out{entries[i]}, Out{error})) {
+                    FATAL("Read failed: {}", error);
+                }
+            }
+        });
+
+        double hashTime = MeasureBest(params.iterations, [&]() {
+            for (const auto& entry : entries) {
+                hash = hash ^ HashInPieces(entry.data(), entry.size(), params.readSize);
+            }
+        });
+
+        double directTime = MeasureBest(params.iterations, [&]() {
+            for (uint64_t entryId : corpus.entryIds) {
+                auto stream = OpenEntry(corpus, entryId);
+                hash = hash ^ ReadAndHash(*stream, buffer);
+            }
+        });
+
+        double readAheadTime = MeasureBest(params.iterations, [&]() {
+            for (uint64_t entryId : corpus.entryIds) {
+                ReadAheadStream stream{OpenEntry(corpus, entryId)};
+                hash = hash ^ ReadAndHash(stream, buffer);
+            }
+        });
+
+        fmt::print("{} entries, {} bytes, {}-byte reads\n", corpus.entryIds.size(), corpus.totalSize, buffer.size());
+        PrintThroughput("Decode only", corpus.totalSize, decodeTime);
+        PrintThroughput("Hash only", corpus.totalSize, hashTime);
+        PrintThroughput("Archive stream", corpus.totalSize, directTime);
+        PrintThroughput("ReadAheadStream", corpus.totalSize, readAheadTime);
+    }
+
+    //----------------------------------------------------------------------------------------------
+
+    struct Benchmark {
+        const oschar_t* name;
+        void (*run)(const BenchParams& params, const Corpus& corpus);
+    };
+
+    const Benchmark s_benchmarks[] = {
+        {OSSTR("buffered"), &RunBufferedBenchmark},
+        {OSSTR("codecs"), &RunCodecsBenchmark},
+        {OSSTR("readahead"), &RunReadAheadBenchmark},
+        {OSSTR("threads"), &RunThreadsBenchmark},
+    };
+
+    int BenchMain(int argc, const oschar_t* const argv[])
+    {
+        Debug::InitLogger();
+
+        BenchCommandLineHandler handler;
+        CommandLineParser::Parse(argc, argv, handler);
+        const BenchParams& params = handler.params;
+
+        if (params.benchmarkName.empty()) {
+            FATAL("Missing benchmark name");
+        } else if (params.archivePath.empty()) {
+            FATAL("Missing archive path");
+        }
+
+        auto benchmark = std::find_if(std::begin(s_benchmarks), std::end(s_benchmarks), [&](const Benchmark& b) {
+            return params.benchmarkName == b.name;
+        });
+        if (benchmark == std::end(s_benchmarks)) {
+            FATAL("Unknown benchmark: {}", params.benchmarkName);
+        }
+
+        Corpus corpus = OpenCorpus(params.archivePath);
+        benchmark->run(params, corpus);
+        return 0;
+    }
+
+} // namespace
+
+#ifdef _WIN32
+
+int wmain(int argc, wchar_t* argv[])
+{
+    return BenchMain(argc, argv);
+}
+
+#else // !defined(_WIN32)
+
+int main(int argc, char* argv[])
+{
+    return BenchMain(argc, argv);
+}
+
+#endif // !defined(_WIN32)
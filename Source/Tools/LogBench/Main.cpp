@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2023 Martin Mills <daggerbot@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public License
+ * version 2.0 (the "License"). If a copy of the License was not distributed
+ * with this file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Microbenchmark for the logger: a number of threads log messages as fast as they can.
+//
+//   LogBench [options] 2>/dev/null
+//
+// Messages go to the console sink on stderr as usual, so redirect it to a file or /dev/null to
+// leave out the cost of the terminal. The time per message and the total throughput are printed
+// on stdout. Each run is repeated --iterations times, and the fastest one is reported.
+//
+// With --async or --deferred, the time per message only covers the logging threads, and the time
+// until the logger thread has written everything is printed separately. With --deferred, each
+// thread's buffer is made big enough for all of its messages, so none of them are dropped.
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include <Core/CommandLine.h>
+#include <Core/Debug.h>
+#include <Core/StringUtils.h>
+#include <Core/Thread.h>
+
+using namespace ArenaBuilder;
+
+namespace {
+
+    constexpr int DefaultIterations = 5;
+    constexpr size_t DefaultMessageCount = 100000;
+    constexpr size_t DeferredBytesPerMessage = 128; // More than a deferred record of our message
+
+    enum class LoggerMode {
+        Synchronous,
+        Async,
+        Deferred,
+    };
+
+    struct BenchParams {
+        int iterations = DefaultIterations;
+        size_t messageCount = DefaultMessageCount; // Per thread
+        size_t maxThreads = Thread::GetHardwareConcurrency();
+        LoggerMode mode = LoggerMode::Synchronous;
+    };
+
+    struct BenchResult {
+        double loggingTime; // Until every thread has returned from its last logging call
+        double totalTime; // Until every message has been written
+    };
+
+    class BenchCommandLineHandler : public CommandLineHandler {
+    public:
+        BenchParams params;
+
+        bool HandleOperand(OsStringView operand) override
+        {
+            FATAL("Unexpected operand: {}", operand);
+        }
+
+        bool HandleShortOption(oschar_t option, CommandLineParser&) override
+        {
+            FATAL("Invalid option: -{}", option);
+        }
+
+        bool HandleLongOption(OsStringView option, CommandLineParser& parser) override
+        {
+            if (option == OSSTR("async")) {
+                params.mode = LoggerMode::Async;
+                return true;
+            } else if (option == OSSTR("deferred")) {
+                params.mode = LoggerMode::Deferred;
+                return true;
+            } else if (option == OSSTR("iterations")) {
+                const oschar_t* param = GetParam(option, parser);
+                if (!ParseInteger(param, Out{params.iterations}) || params.iterations < 1) {
+                    FATAL("Invalid parameter for --iterations: {}", param);
+                }
+                return true;
+            } else if (option == OSSTR("messages")) {
+                const oschar_t* param = GetParam(option, parser);
+                if (!ParseInteger(param, Out{params.messageCount}) || !params.messageCount) {
+                    FATAL("Invalid parameter for --messages: {}", param);
+                }
+                return true;
+            } else if (option == OSSTR("threads")) {
+                const oschar_t* param = GetParam(option, parser);
+                if (!ParseInteger(param, Out{params.maxThreads}) || !params.maxThreads) {
+                    FATAL("Invalid parameter for --threads: {}", param);
+                }
+                return true;
+            } else {
+                FATAL("Invalid option: --{}", option);
+            }
+        }
+
+    private:
+        static const oschar_t* GetParam(OsStringView option, CommandLineParser& parser)
+        {
+            auto param = parser.GetParam();
+            if (!param) {
+                FATAL("Missing parameter for --{}", option);
+            }
+            return param;
+        }
+    };
+
+    void StartLogger(const BenchParams& params)
+    {
+        AsyncLoggerParams asyncParams;
+        DeferredLoggerParams deferredParams;
+        LoggerMode mode = params.mode;
+        std::string error;
+
+        asyncParams.overflowPolicy = LogOverflowPolicy::Block;
+        deferredParams.capacity = params.messageCount * DeferredBytesPerMessage;
+
+        if (mode == LoggerMode::Async && !Debug::StartAsyncLogger(asyncParams, Out{error})) {
+            FATAL("Can't start async logger: {}", error);
+        } else if (mode == LoggerMode::Deferred && !Debug::StartDeferredLogger(deferredParams, Out{error})) {
+            FATAL("Can't start deferred logger: {}", error);
+        }
+    }
+
+    void StopLogger(LoggerMode mode)
+    {
+        if (mode == LoggerMode::Async) {
+            Debug::StopAsyncLogger();
+        } else if (mode == LoggerMode::Deferred) {
+            Debug::StopDeferredLogger();
+        }
+    }
+
+    // Logs from the calling thread and threadCount - 1 others at once. Times are in seconds.
+    BenchResult LogOnThreads(const BenchParams& params, size_t threadCount)
+    {
+        std::vector<std::unique_ptr<Thread>> threads;
+        std::string error;
+        BenchResult result;
+
+        auto logMessages = [&](size_t threadIndex) {
+            if (params.mode == LoggerMode::Deferred) {
+                for (size_t i = 0; i < params.messageCount; ++i) {
+                    LOG_DEFERRED(Info, "Message {} from thread {}: {:.3f} ms", i, threadIndex, double(i) * 0.001);
+                }
+            } else {
+                for (size_t i = 0; i < params.messageCount; ++i) {
+                    LOG_INFO("Message {} from thread {}: {:.3f} ms", i, threadIndex, double(i) * 0.001);
+                }
+            }
+        };
+
+        auto startTime = std::chrono::steady_clock::now();
+
+        for (size_t i = 1; i < threadCount; ++i) {
+            threads.push_back(std::make_unique<Thread>());
+            if (!threads.back()->Start([&logMessages, i]() { logMessages(i); }, Out{error})) {
+                FATAL("Can't start thread: {}", error);
+            }
+        }
+
+        logMessages(0);
+
+        for (const auto& thread : threads) {
+            thread->Join();
+        }
+
+        std::chrono::duration<double> loggingTime = std::chrono::steady_clock::now() - startTime;
+
+        // The logger thread may still be writing, so wait for it to finish too.
+        StopLogger(params.mode);
+
+        std::chrono::duration<double> totalTime = std::chrono::steady_clock::now() - startTime;
+
+        result.loggingTime = loggingTime.count();
+        result.totalTime = totalTime.count();
+        return result;
+    }
+
+    const char* GetLoggerModeName(LoggerMode mode)
+    {
+        switch (mode) {
+        case LoggerMode::Async:
+            return "async";
+        case LoggerMode::Deferred:
+            return "deferred";
+        default:
+            return "synchronous";
+        }
+    }
+
+    int BenchMain(int argc, const oschar_t* const argv[])
+    {
+        Debug::InitLogger();
+        // Release builds only log warnings by default, which would time the filtered-out path.
+        Debug::SetLogLevel(LogChannel::Tools, LogLevel::Info);
+
+        BenchCommandLineHandler handler;
+        CommandLineParser::Parse(argc, argv, handler);
+        const BenchParams& params = handler.params;
+        std::vector<size_t> threadCounts;
+
+        for (size_t count = 1; count < params.maxThreads; count *= 2) {
+            threadCounts.push_back(count);
+        }
+        threadCounts.push_back(params.maxThreads);
+
+        fmt::print("{} messages per thread, {} logger, {} level\n", params.messageCount,
+                   GetLoggerModeName(params.mode),
+                   Debug::GetLogLevelName(Debug::GetLogLevel(LogChannel::Tools)));
+
+        for (size_t threadCount : threadCounts) {
+            BenchResult best{};
+
+            for (int i = 0; i < params.iterations; ++i) {
+                StartLogger(params);
+
+                BenchResult result = LogOnThreads(params, threadCount);
+                if (!i || result.loggingTime < best.loggingTime) {
+                    best = result;
+                }
+            }
+
+            double messageCount = double(params.messageCount * threadCount);
+            fmt::print("{:>3} threads {:9.3f} ms {:8.1f} ns/message {:6.2f} M messages/s {:9.3f} ms until written\n",
+                       threadCount, best.loggingTime * 1e3, best.loggingTime * 1e9 / messageCount,
+                       messageCount / best.loggingTime / 1e6, best.totalTime * 1e3);
+        }
+
+        return 0;
+    }
+
+} // namespace
+
+#ifdef _WIN32
+
+int wmain(int argc, wchar_t* argv[])
+{
+    return BenchMain(argc, argv);
+}
+
+#else // !defined(_WIN32)
+
+int main(int argc, char* argv[])
+{
+    return BenchMain(argc, argv);
+}
+
+#endif // !defined(_WIN32)